@@ -0,0 +1,141 @@
+#include "bench.h"
+#include "profiler.h"
+#include "mcmceval.h"
+#include "rand.h"
+#include "errors.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+BenchLog::BenchLog(const string json_filename, const string label_in, const int nthreads_in, const bool print_results_in)
+{
+	label = label_in;
+	nthreads = nthreads_in;
+	print_results = print_results_in;
+	if ((print_results) and (json_filename != "")) {
+		json_out.open(json_filename.c_str(), ios::out | ios::app);
+		if (!json_out.is_open()) warn("could not open benchmark output file '%s'",json_filename.c_str());
+	}
+}
+
+double BenchLog::percentile(const vector<double>& sorted_times, const double p)
+{
+	// linear interpolation between the closest ranks
+	int n = sorted_times.size();
+	if (n==0) return 0;
+	double rank = p*(n-1);
+	int i = (int) rank;
+	if (i >= n-1) return sorted_times[n-1];
+	return sorted_times[i] + (rank-i)*(sorted_times[i+1]-sorted_times[i]);
+}
+
+void BenchLog::print_header()
+{
+	if (!print_results) return;
+	cout << left << setw(40) << "# workload" << right << setw(6) << "reps" << setw(14) << "median(ms)" << setw(14) << "p10(ms)" << setw(14) << "p90(ms)" << setw(16) << "throughput" << "  unit/s" << endl;
+}
+
+void BenchLog::record(const string workload, vector<double>& times, const double items_per_rep, const string unit, const double checksum)
+{
+	vector<double> sorted_times(times);
+	sort(sorted_times.begin(),sorted_times.end());
+	double median, p10, p90, mean=0, throughput;
+	median = percentile(sorted_times,0.5);
+	p10 = percentile(sorted_times,0.1);
+	p90 = percentile(sorted_times,0.9);
+	for (int i=0; i < times.size(); i++) mean += times[i];
+	if (times.size() > 0) mean /= times.size();
+	throughput = (median > 0) ? items_per_rep/median : 0;
+
+	if (!print_results) return;
+	cout << left << setw(40) << workload << right << setw(6) << times.size() << fixed << setprecision(3) << setw(14) << 1000*median << setw(14) << 1000*p10 << setw(14) << 1000*p90 << scientific << setprecision(4) << setw(16) << throughput << "  " << unit << endl;
+	cout.unsetf(ios::floatfield);
+	if (json_out.is_open()) {
+		json_out << setprecision(6);
+		json_out << "{\"label\": \"" << label << "\", \"workload\": \"" << workload << "\", \"threads\": " << nthreads << ", \"reps\": " << times.size();
+		json_out << ", \"median\": " << median << ", \"p10\": " << p10 << ", \"p90\": " << p90 << ", \"min\": " << ((sorted_times.empty()) ? 0 : sorted_times[0]) << ", \"mean\": " << mean;
+		json_out << ", \"items_per_rep\": " << items_per_rep << ", \"unit\": \"" << unit << "\", \"throughput\": " << throughput;
+		json_out << setprecision(12) << ", \"checksum\": " << checksum << "}" << endl;
+	}
+}
+
+void bench_mkdist_histograms(BenchLog& benchlog, const string scratch_dir, const int nreps)
+{
+	// A synthetic chain of correlated Gaussian parameters (with unit multiplicities) is written in the format produced by
+	// the samplers, loaded as mkdist does, and then the 1D and 2D posterior histograms are made with mkdist's default
+	// number of bins and threshold.
+	const int nparams = 4, npoints = 20000, nbins = 60, nbins_2d = 40;
+	const double threshold = 3e-3;
+	string chain_filename = scratch_dir + "/bench_chain";
+	int i,j,k;
+	{
+		CounterRandom rng(20170101ULL);
+		ofstream chain_out(chain_filename.c_str());
+		chain_out << setprecision(10);
+		double g[nparams], u1, u2, chisq;
+		unsigned long long counter = 0;
+		for (i=0; i < npoints; i++) {
+			chisq = 0;
+			for (k=0; k < nparams; k++) {
+				// Box-Muller transform
+				u1 = rng.uniform(counter++);
+				u2 = rng.uniform(counter++);
+				g[k] = sqrt(-2*log(1-u1))*cos(2*M_PI*u2);
+				chisq += g[k]*g[k];
+			}
+			chain_out << "1";
+			for (k=0; k < nparams; k++) chain_out << " " << (1.0+k) + (0.1*(k+1))*(g[k] + 0.5*g[0]);
+			chain_out << " " << chisq << endl;
+		}
+		ofstream ranges_out((chain_filename + ".ranges").c_str());
+		for (k=0; k < nparams; k++) ranges_out << "-1e30 1e30" << endl;
+	}
+
+	// McmcEval reports what it has loaded and the confidence limits of each histogram, which would interrupt the table
+	streambuf *coutbuf = cout.rdbuf();
+	ostringstream discard;
+	cout.rdbuf(discard.rdbuf());
+	McmcEval Eval;
+	Eval.input(chain_filename.c_str(),-1,1,NULL,NULL,1,0,MULT|LIKE,true);
+
+	double minvals[nparams], maxvals[nparams], rap[20];
+	vector<double> times_1d, times_2d;
+	double checksum_1d = 0, checksum_2d = 0, t0;
+	for (int rep=-1; rep < nreps; rep++) {
+		for (k=0; k < nparams; k++) { minvals[k] = -1e30; maxvals[k] = 1e30; }
+		t0 = Profiler::wtime();
+		Eval.FindRanges(minvals,maxvals,nbins,threshold);
+		for (k=0; k < nparams; k++) {
+			stringstream hist_out;
+			hist_out << chain_filename << "_p_" << k << ".dat";
+			Eval.MkHist(minvals[k], maxvals[k], nbins, hist_out.str().c_str(), k, HIST|SMOOTH, rap);
+		}
+		if (rep >= 0) {
+			times_1d.push_back(Profiler::wtime()-t0);
+			for (k=0; k < nparams; k++) checksum_1d += minvals[k] + maxvals[k];
+		}
+
+		for (k=0; k < nparams; k++) { minvals[k] = -1e30; maxvals[k] = 1e30; }
+		t0 = Profiler::wtime();
+		Eval.FindRanges(minvals,maxvals,nbins_2d,threshold);
+		for (i=0; i < nparams; i++) {
+			for (j=i+1; j < nparams; j++) {
+				stringstream hist_out;
+				hist_out << chain_filename << "_2D_" << j << "_" << i;
+				Eval.MkHist2D(minvals[i],maxvals[i],minvals[j],maxvals[j],nbins_2d,nbins_2d,hist_out.str().c_str(),i,j,SMOOTH);
+			}
+		}
+		if (rep >= 0) {
+			times_2d.push_back(Profiler::wtime()-t0);
+			for (k=0; k < nparams; k++) checksum_2d += minvals[k] + maxvals[k];
+		}
+		discard.str("");
+	}
+	cout.rdbuf(coutbuf);
+	benchlog.record("mkdist_hist1d",times_1d,((double) npoints)*nparams,"samples",checksum_1d);
+	benchlog.record("mkdist_hist2d",times_2d,((double) npoints)*nparams*(nparams-1)/2,"samples",checksum_2d);
+}
@@ -0,0 +1,35 @@
+// BENCH.H: Timing statistics and machine-readable output for the benchmark suite (qlensbench)
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+using namespace std;
+
+// Each workload is run a fixed number of times (after one untimed warm-up run) with fixed sizes and random seeds, so
+// the results can be compared between commits on the same machine. For each workload, the median, 10th and 90th
+// percentile times per repetition are printed as a table and appended to the output file as one line of JSON, along
+// with the throughput (items per second at the median time) and a checksum of the results, which should not change
+// unless the numerical results of the workload change.
+class BenchLog
+{
+	ofstream json_out;
+	string label;
+	int nthreads;
+	bool print_results; // only one MPI process prints the table
+
+	double percentile(const vector<double>& sorted_times, const double p);
+
+	public:
+	BenchLog(const string json_filename, const string label_in, const int nthreads_in, const bool print_results_in);
+	bool is_open() { return json_out.is_open(); }
+	void print_header();
+	void record(const string workload, vector<double>& times, const double items_per_rep, const string unit, const double checksum);
+};
+
+void bench_mkdist_histograms(BenchLog& benchlog, const string scratch_dir, const int nreps);
+
+#endif // BENCH_H
@@ -3,6 +3,7 @@
 #include "sort.h"
 #include "errors.h"
 #include <cmath>
+#include <map>
 
 #ifdef USE_OPENMP
 #include <omp.h>
@@ -26,6 +27,8 @@ CG_sparse::CG_sparse(double* As_in, int* Ai_in, const double tol_in, const int i
 	preconditioner = NULL;
 	preconditioner_transpose = NULL;
 	preconditioner_transpose_index = NULL;
+	use_multigrid = false;
+	mg_nlevels = 0;
 
 	sorted_indices = new vector<int>[n];
 	sorted_indices_i = new vector<int>[n];
@@ -79,6 +82,8 @@ CG_sparse::CG_sparse(double** Amatrix, const int nn, const double tol_in, const
 	preconditioner = NULL;
 	preconditioner_transpose = NULL;
 	preconditioner_transpose_index = NULL;
+	use_multigrid = false;
+	mg_nlevels = 0;
 	set_thread_num(1);
 }
 
@@ -192,6 +197,7 @@ void CG_Solver::solve(double* b, double* x)
 			}
 			#pragma omp barrier
 			if (will_continue) continue;
+			#pragma omp barrier // every thread must read will_continue before the master thread resets it below
 			#pragma omp master
 			{
 				error_norm(x,xnrm);
@@ -246,6 +252,10 @@ void CG_sparse::solve(double* b, double* x)
 	k=0;
 	double rho[n], sigma[n], gamma[n]; // used to find determinant after solution has already converged
 	double rnrm, old_rnrm=1.0, older_rnrm, signorm, old_signorm=1.0;
+	// the determinant is found from the Lanczos coefficients of the diagonally preconditioned matrix, so it cannot be found
+	// during a multigrid-preconditioned solve; in that case, use estimate_log_determinant after the solve instead
+	bool multigrid = use_multigrid;
+	if ((find_determinant) and (multigrid)) die("determinant mode cannot be used with the multigrid preconditioner");
 
 #ifdef USE_OPENMP
 	omp_set_num_threads(nthreads);
@@ -266,20 +276,42 @@ void CG_sparse::solve(double* b, double* x)
 			rnrm = sqrt(rnrm);
 			signorm = rnrm;
 			bnrm=0; znrm=0;
-			for (j=0; j < n; j++) {
-				temp = (A_sparse[j] != 0) ? b[j]/A_sparse[j] : b[j]; // diagonal preconditioner
-				bnrm += temp*temp;
-				z[j] = (A_sparse[j] != 0) ? r[j]/A_sparse[j] : r[j]; // diagonal preconditioner
-				gamma[j] = z[j];
-				znrm += z[j]*z[j];
+			if (!multigrid) {
+				for (j=0; j < n; j++) {
+					temp = (A_sparse[j] != 0) ? b[j]/A_sparse[j] : b[j]; // diagonal preconditioner
+					bnrm += temp*temp;
+					z[j] = (A_sparse[j] != 0) ? r[j]/A_sparse[j] : r[j]; // diagonal preconditioner
+					gamma[j] = z[j];
+					znrm += z[j]*z[j];
+				}
 			}
-			bnrm = sqrt(bnrm);
-			znrm = sqrt(znrm);
 			for (j=0;j<n;j++) {
 				p[j]=0;
 				rho[j]=0;
 			}
 		}
+		if (multigrid) {
+			#pragma omp barrier
+			multigrid_preconditioner_solve(b,z);
+			#pragma omp master
+			{
+				for (j=0; j < n; j++) bnrm += z[j]*z[j];
+			}
+			#pragma omp barrier
+			multigrid_preconditioner_solve(r,z);
+			#pragma omp master
+			{
+				for (j=0; j < n; j++) {
+					gamma[j] = z[j];
+					znrm += z[j]*z[j];
+				}
+			}
+		}
+		#pragma omp master
+		{
+			bnrm = sqrt(bnrm);
+			znrm = sqrt(znrm);
+		}
 
 		#pragma omp barrier
 		while (iterations < itmax)
@@ -335,10 +367,21 @@ void CG_sparse::solve(double* b, double* x)
 						log_pre_det_last = log_predet_temp;
 					}
 
+					if (!multigrid) {
+						for (j=0; j < n; j++) {
+							z[j] = (A_sparse[j] != 0) ? r[j]/A_sparse[j] : r[j]; // diagonal preconditioner
+						}
+					}
+				}
+				if (multigrid) {
+					#pragma omp barrier
+					multigrid_preconditioner_solve(r,z);
+				}
+				#pragma omp master
+				{
 					zm1nrm=znrm;
 					znrm=0;
 					for (j=0; j < n; j++) {
-						z[j] = (A_sparse[j] != 0) ? r[j]/A_sparse[j] : r[j]; // diagonal preconditioner
 						znrm += z[j]*z[j];
 					}
 					znrm = sqrt(znrm);
@@ -480,7 +523,7 @@ double CG_sparse::calculate_log_determinant()
 	// note, the sparse version uses a diagonal preconditioner specifically
 	double ak,akden,bk,bkden=1.0,bknum,bnrm,dxnrm,xnrm,zm1nrm,znrm=0;
 	static const double EPS=1.0e-14;
-	int j,k;
+	int j;
 
 	double y[n];
 	double alpha[n];
@@ -491,7 +534,6 @@ double CG_sparse::calculate_log_determinant()
 	log_pre_det_last = 0;
 	log_pre_det = 0;
 
-	k=0;
 	double rho[n], sigma[n], gamma[n];
 	double signorm, old_signorm=1.0;
 
@@ -518,9 +560,10 @@ double CG_sparse::calculate_log_determinant()
 		}
 
 		#pragma omp barrier
-		for (k=0; k < n; k++)
+		for (int k=0; k < n; k++) // k must be private, so that every thread reaches the same barriers below
 		{
 			#pragma omp barrier
+			if (signorm < EPS) break; // Krylov space is exhausted (e.g. R = identity); further steps would divide by zero
 			#pragma omp master
 			{
 				bknum=0;
@@ -561,7 +604,7 @@ double CG_sparse::calculate_log_determinant()
 					akk[k] = 1.0/alpha[k] + beta[k-1]/alpha[k-1];
 				}
 				log_predet_temp = log_pre_det;
-				log_pre_det = log_pre_det + log(akk[k] - (bkk[k]*bkk[k])*exp(log_pre_det_last - log_pre_det));
+				log_pre_det = log_pre_det + log(fabs(akk[k] - (bkk[k]*bkk[k])*exp(log_pre_det_last - log_pre_det)));
 				log_pre_det_last = log_predet_temp;
 
 				for (j=0; j < n; j++) {
@@ -583,7 +626,7 @@ double CG_sparse::calculate_log_determinant()
 void CG_Solver::error_norm(double* sx, double& err)
 {
 	// Compute one of two norms for a vector sx[0..n-1]. Used by solve.
-	static double ans;
+	double ans;
 	ans = 0.0;
 	for (int i=0; i < n; i++) {
 		ans += SQR(sx[i]);
@@ -716,7 +759,7 @@ void CG_sparse::incomplete_Cholesky_preconditioner()
 void CG_sparse::Cholesky_preconditioner_solve(double* b, double* x)
 {
 	int i,k;
-	static double sum;
+	double sum;
 
 	for (i=0; i < n; i++) { // sum over rows
 		sum = b[i];
@@ -741,6 +784,243 @@ void CG_sparse::preconditioner_solve(double* r, double* x)
 		x[i] = (A_sparse[i] != 0) ? r[i]/A_sparse[i] : r[i];
 }
 
+bool CG_sparse::set_multigrid_aggregates(const int n_coarse_levels, int* n_aggregates, int** aggregate_index)
+{
+	// Sets up the multigrid preconditioner. For each coarse level l (l=0..n_coarse_levels-1), n_aggregates[l] gives the number of
+	// unknowns on that level, and aggregate_index[l][i] gives the coarse unknown that contains unknown i of the level above it
+	// (where the level above coarse level 0 is the original matrix). Returns false (leaving the diagonal preconditioner in place)
+	// if the coarsest matrix is not positive definite.
+	int i,j,k,l,nc;
+	double sum;
+	delete_multigrid();
+	if (n_coarse_levels < 1) return false;
+
+	mg_nlevels = n_coarse_levels+1;
+	mg_n = new int[mg_nlevels];
+	mg_aggregate = new int*[n_coarse_levels];
+	mg_n[0] = n;
+	for (l=0; l < n_coarse_levels; l++) {
+		mg_n[l+1] = n_aggregates[l];
+		mg_aggregate[l] = new int[mg_n[l]];
+		for (i=0; i < mg_n[l]; i++) mg_aggregate[l][i] = aggregate_index[l][i];
+	}
+	mg_A = new vector<double>[mg_nlevels];
+	mg_A_index = new vector<int>[mg_nlevels];
+	mg_omega = new double[mg_nlevels];
+	mg_b = new double*[mg_nlevels];
+	mg_x = new double*[mg_nlevels];
+	mg_t = new double*[mg_nlevels];
+	for (l=0; l < mg_nlevels; l++) {
+		mg_b[l] = new double[mg_n[l]];
+		mg_x[l] = new double[mg_n[l]];
+		mg_t[l] = new double[mg_n[l]];
+	}
+	mg_omega[0] = jacobi_damping_factor(A_sparse,A_index,n);
+	for (l=1; l < mg_nlevels; l++) {
+		build_coarse_matrix(l);
+		mg_omega[l] = jacobi_damping_factor(mg_A[l].data(),mg_A_index[l].data(),mg_n[l]);
+	}
+
+	// dense Cholesky decomposition of the coarsest matrix (the lower triangle is stored by rows)
+	nc = mg_n[mg_nlevels-1];
+	const double *As = mg_A[mg_nlevels-1].data();
+	const int *Ai = mg_A_index[mg_nlevels-1].data();
+	double *c = mg_coarse_cholesky = new double[nc*nc];
+	for (i=0; i < nc*nc; i++) c[i] = 0;
+	for (i=0; i < nc; i++) {
+		c[i*nc+i] = As[i];
+		for (k=Ai[i]; k < Ai[i+1]; k++) c[Ai[k]*nc+i] = As[k];
+	}
+	for (j=0; j < nc; j++) {
+		sum = c[j*nc+j];
+		for (k=0; k < j; k++) sum -= c[j*nc+k]*c[j*nc+k];
+		if (sum <= 0) {
+			delete_multigrid();
+			return false;
+		}
+		c[j*nc+j] = sqrt(sum);
+		for (i=j+1; i < nc; i++) {
+			sum = c[i*nc+j];
+			for (k=0; k < j; k++) sum -= c[i*nc+k]*c[j*nc+k];
+			c[i*nc+j] = sum / c[j*nc+j];
+		}
+	}
+	use_multigrid = true;
+	return true;
+}
+
+void CG_sparse::build_coarse_matrix(const int level)
+{
+	// Galerkin coarse matrix P^T A P for piecewise-constant prolongation: each element of the finer matrix is added to the
+	// element of the coarse matrix given by the aggregates of its row and column. Only the upper triangle is stored, so an
+	// off-diagonal element whose row and column fall in the same aggregate contributes twice to the diagonal.
+	const double *As = (level==1) ? A_sparse : mg_A[level-1].data();
+	const int *Ai = (level==1) ? A_index : mg_A_index[level-1].data();
+	const int *agg = mg_aggregate[level-1];
+	int i,k,ia,ja,nf=mg_n[level-1],nc=mg_n[level];
+	map<int,double> *rows = new map<int,double>[nc];
+	map<int,double>::iterator it;
+	vector<double>& Ac = mg_A[level];
+	vector<int>& Aci = mg_A_index[level];
+
+	Ac.assign(nc+1,0);
+	for (i=0; i < nf; i++) {
+		ia = agg[i];
+		Ac[ia] += As[i];
+		for (k=Ai[i]; k < Ai[i+1]; k++) {
+			ja = agg[Ai[k]];
+			if (ja==ia) Ac[ia] += 2*As[k];
+			else if (ia < ja) rows[ia][ja] += As[k];
+			else rows[ja][ia] += As[k];
+		}
+	}
+	Aci.assign(nc+1,0);
+	Aci[0] = nc+1;
+	k=nc;
+	for (i=0; i < nc; i++) {
+		for (it=rows[i].begin(); it != rows[i].end(); it++) {
+			Ac.push_back(it->second);
+			Aci.push_back(it->first);
+			k++;
+		}
+		Aci[i+1] = k+1;
+	}
+	delete[] rows;
+}
+
+double CG_sparse::jacobi_damping_factor(const double* As, const int* Ai, const int nn)
+{
+	// The Gershgorin bound on the largest eigenvalue of D^-1 A is used to choose a damping factor for which the Jacobi
+	// smoother always converges, which keeps the multigrid preconditioner positive definite
+	int i,k;
+	double lambda_max=1.0;
+	double *rowsum = new double[nn];
+	for (i=0; i < nn; i++) rowsum[i] = fabs(As[i]);
+	for (i=0; i < nn; i++) {
+		for (k=Ai[i]; k < Ai[i+1]; k++) {
+			rowsum[i] += fabs(As[k]);
+			rowsum[Ai[k]] += fabs(As[k]);
+		}
+	}
+	for (i=0; i < nn; i++) {
+		if ((As[i] > 0) and (rowsum[i]/As[i] > lambda_max)) lambda_max = rowsum[i]/As[i];
+	}
+	delete[] rowsum;
+	return 4.0/(3*lambda_max);
+}
+
+void CG_sparse::coarse_matrix_multiply(const int level, const double* const x, double* const r)
+{
+	const double *As = mg_A[level].data();
+	const int *Ai = mg_A_index[level].data();
+	int i,k;
+	for (i=0; i < mg_n[level]; i++) r[i] = As[i]*x[i];
+	for (i=0; i < mg_n[level]; i++) {
+		for (k=Ai[i]; k < Ai[i+1]; k++) {
+			r[i] += As[k]*x[Ai[k]];
+			r[Ai[k]] += As[k]*x[i];
+		}
+	}
+}
+
+void CG_sparse::coarse_vcycle(const int level)
+{
+	// approximately solves A x = b on the given coarse level, where b and x are stored in mg_b[level] and mg_x[level]
+	int i,k,s,nn=mg_n[level];
+	double *b = mg_b[level], *x = mg_x[level], *t = mg_t[level];
+	if (level==mg_nlevels-1) {
+		double sum, *c = mg_coarse_cholesky;
+		for (i=0; i < nn; i++) {
+			sum = b[i];
+			for (k=0; k < i; k++) sum -= c[i*nn+k]*x[k];
+			x[i] = sum / c[i*nn+i];
+		}
+		for (i=nn-1; i >= 0; i--) {
+			sum = x[i];
+			for (k=i+1; k < nn; k++) sum -= c[k*nn+i]*x[k];
+			x[i] = sum / c[i*nn+i];
+		}
+		return;
+	}
+	const double *diag = mg_A[level].data();
+	const double omega = mg_omega[level];
+	const int *agg = mg_aggregate[level];
+	double *bc = mg_b[level+1], *xc = mg_x[level+1];
+
+	for (i=0; i < nn; i++) x[i] = omega*b[i]/((diag[i] != 0) ? diag[i] : 1.0);
+	for (s=1; s < mg_nsmooth; s++) {
+		coarse_matrix_multiply(level,x,t);
+		for (i=0; i < nn; i++) x[i] += omega*(b[i]-t[i])/((diag[i] != 0) ? diag[i] : 1.0);
+	}
+	coarse_matrix_multiply(level,x,t);
+	for (i=0; i < mg_n[level+1]; i++) bc[i] = 0;
+	for (i=0; i < nn; i++) bc[agg[i]] += b[i] - t[i];
+	coarse_vcycle(level+1);
+	for (i=0; i < nn; i++) x[i] += xc[agg[i]];
+	for (s=0; s < mg_nsmooth; s++) {
+		coarse_matrix_multiply(level,x,t);
+		for (i=0; i < nn; i++) x[i] += omega*(b[i]-t[i])/((diag[i] != 0) ? diag[i] : 1.0);
+	}
+}
+
+void CG_sparse::multigrid_preconditioner_solve(const double* const r, double* const z)
+{
+	// Applies one symmetric V-cycle to find z = M^-1 r, starting from z = 0. This must be called by all threads (and all MPI
+	// processes), since the fine-level smoothing uses A_matrix_multiply; the coarse levels are done by the master thread.
+	int i,s;
+	const double omega = mg_omega[0];
+	const int *agg = mg_aggregate[0];
+	double *t = mg_t[0];
+
+	#pragma omp for schedule(static)
+	for (i=0; i < n; i++) z[i] = omega*r[i]/((A_sparse[i] != 0) ? A_sparse[i] : 1.0);
+	for (s=1; s < mg_nsmooth; s++) {
+		A_matrix_multiply(z,t);
+		#pragma omp barrier
+		#pragma omp for schedule(static)
+		for (i=0; i < n; i++) z[i] += omega*(r[i]-t[i])/((A_sparse[i] != 0) ? A_sparse[i] : 1.0);
+	}
+	A_matrix_multiply(z,t);
+	#pragma omp barrier
+	#pragma omp master
+	{
+		for (i=0; i < mg_n[1]; i++) mg_b[1][i] = 0;
+		for (i=0; i < n; i++) mg_b[1][agg[i]] += r[i] - t[i];
+		coarse_vcycle(1);
+	}
+	#pragma omp barrier
+	#pragma omp for schedule(static)
+	for (i=0; i < n; i++) z[i] += mg_x[1][agg[i]];
+	for (s=0; s < mg_nsmooth; s++) {
+		A_matrix_multiply(z,t);
+		#pragma omp barrier
+		#pragma omp for schedule(static)
+		for (i=0; i < n; i++) z[i] += omega*(r[i]-t[i])/((A_sparse[i] != 0) ? A_sparse[i] : 1.0);
+	}
+}
+
+void CG_sparse::delete_multigrid()
+{
+	if (mg_nlevels==0) return;
+	for (int l=0; l < mg_nlevels; l++) {
+		delete[] mg_b[l];
+		delete[] mg_x[l];
+		delete[] mg_t[l];
+		if (l < mg_nlevels-1) delete[] mg_aggregate[l];
+	}
+	delete[] mg_b;
+	delete[] mg_x;
+	delete[] mg_t;
+	delete[] mg_aggregate;
+	delete[] mg_n;
+	delete[] mg_A;
+	delete[] mg_A_index;
+	delete[] mg_omega;
+	delete[] mg_coarse_cholesky;
+	mg_nlevels = 0;
+	use_multigrid = false;
+}
+
 #define SWAP(a,b) temp=(a);(a)=(b);(b)=temp;
 void CG_sparse::indexx(int* arr, int* indx, int nn)
 {
@@ -812,6 +1092,212 @@ CG_sparse::~CG_sparse()
 	if (preconditioner != NULL) delete[] preconditioner;
 	if (preconditioner_transpose != NULL) delete[] preconditioner_transpose;
 	if (preconditioner_transpose_index != NULL) delete[] preconditioner_transpose_index;
+	delete_multigrid();
+}
+
+CG_matrix_free::CG_matrix_free(const int nn, const double tol_in, const int itmax_in, const int nt_in) : CG_Solver(nn,tol_in,itmax_in)
+{
+	// the operator is applied in full on each process, so there is no MPI division of the work here
+	mpi_np = 1;
+	mpi_id = 0;
+	diag = new double[n];
+	for (int i=0; i < n; i++) diag[i] = 1.0;
+	set_thread_num(nt_in);
+}
+
+void CG_matrix_free::preconditioner_solve(double* r, double* x)
+{
+	// diagonal preconditioner
+	for (int i=0; i < n; i++)
+		x[i] = (diag[i] != 0) ? r[i]/diag[i] : r[i];
+}
+
+double CG_Solver::estimate_log_determinant(const int n_probes, const int n_lanczos_steps, const unsigned int seed)
+{
+	// Stochastic Lanczos quadrature: writing A = D^(1/2) B D^(1/2) where D is the diagonal preconditioner, log(det(A)) =
+	// log(det(D)) + tr(log(B)), and tr(log(B)) is estimated as the average of z^T log(B) z over random vectors z whose entries
+	// are +/-1. Each term is found from the tridiagonal matrix T produced by Lanczos iterations started from z/|z|, as
+	// |z|^2 * sum_k tau_k^2 log(theta_k), where theta_k are the eigenvalues of T and tau_k the first components of its
+	// eigenvectors. A fixed seed gives the same probe vectors every time, so the estimate varies smoothly with the operator.
+	// Only the diagonal of A is used here, so the estimate does not depend on which preconditioner was used for the solve.
+	int m = (n_lanczos_steps < n) ? n_lanczos_steps : n;
+	if ((m < 1) or (n_probes < 1)) die("number of probe vectors and Lanczos steps must be positive");
+	double *q = new double[n];
+	double *q_old = new double[n];
+	double *qs = new double[n];
+	double *y = new double[n];
+	double *alpha = new double[m];
+	double *beta = new double[m+1];
+	double *d = new double[m];
+	double *e = new double[m];
+	double **z = new double*[m];
+	int i,j;
+	for (i=0; i < m; i++) z[i] = new double[m];
+	const double *diag = preconditioner_diagonal();
+	double *sqrt_diag = new double[n];
+	for (j=0; j < n; j++) sqrt_diag[j] = (diag[j] > 0) ? sqrt(diag[j]) : 1.0;
+
+	double trace_sum = 0;
+	int n_steps; // number of Lanczos steps actually taken (fewer than m if an invariant subspace is found)
+	bool lanczos_done;
+	unsigned long long rng_state;
+	double qnorm, wnorm;
+
+#ifdef USE_OPENMP
+	omp_set_num_threads(nthreads);
+#endif
+
+	#pragma omp parallel private(i,j)
+	{
+		int probe, k;
+		for (probe=0; probe < n_probes; probe++) {
+			#pragma omp master
+			{
+				rng_state = 0x9E3779B97F4A7C15ULL * ((unsigned long long) seed + 1) + (unsigned long long) probe;
+				qnorm = 1.0/sqrt((double) n);
+				for (j=0; j < n; j++) {
+					// xorshift64* generator; only the sign of each entry is needed
+					rng_state ^= rng_state >> 12;
+					rng_state ^= rng_state << 25;
+					rng_state ^= rng_state >> 27;
+					q[j] = ((rng_state * 0x2545F4914F6CDD1DULL) >> 63) ? qnorm : -qnorm;
+					q_old[j] = 0;
+				}
+				beta[0] = 0;
+				n_steps = 0;
+				lanczos_done = false;
+			}
+			#pragma omp barrier
+			for (k=0; k < m; k++) {
+				#pragma omp master
+				{
+					for (j=0; j < n; j++) qs[j] = q[j]/sqrt_diag[j];
+				}
+				#pragma omp barrier
+				A_matrix_multiply(qs,y);
+				#pragma omp barrier
+				#pragma omp master
+				{
+					alpha[k] = 0;
+					for (j=0; j < n; j++) {
+						y[j] = y[j]/sqrt_diag[j] - beta[k]*q_old[j];
+						alpha[k] += y[j]*q[j];
+					}
+					wnorm = 0;
+					for (j=0; j < n; j++) {
+						y[j] -= alpha[k]*q[j];
+						wnorm += y[j]*y[j];
+					}
+					beta[k+1] = sqrt(wnorm);
+					n_steps++;
+					if (beta[k+1] < 1e-12*fabs(alpha[k])) lanczos_done = true;
+					else {
+						for (j=0; j < n; j++) {
+							q_old[j] = q[j];
+							q[j] = y[j]/beta[k+1];
+						}
+					}
+				}
+				#pragma omp barrier
+				if (lanczos_done) break;
+			}
+			#pragma omp master
+			{
+				for (i=0; i < n_steps; i++) {
+					d[i] = alpha[i];
+					e[i] = (i > 0) ? beta[i] : 0;
+				}
+				if (!tridiagonal_eigensystem(d,e,z,n_steps)) warn("eigenvalues of Lanczos matrix did not converge; log-determinant may be inaccurate");
+				double quad_sum = 0;
+				for (i=0; i < n_steps; i++) {
+					if (d[i] > 0) quad_sum += SQR(z[0][i])*log(d[i]);
+				}
+				trace_sum += n*quad_sum; // |z|^2 = n
+			}
+			#pragma omp barrier
+		}
+	}
+
+#ifdef USE_OPENMP
+	omp_set_num_threads(default_nthreads);
+#endif
+	double log_preconditioner_det = 0;
+	for (j=0; j < n; j++) log_preconditioner_det += 2*log(sqrt_diag[j]);
+	log_determinant = trace_sum/n_probes + log_preconditioner_det;
+
+	for (i=0; i < m; i++) delete[] z[i];
+	delete[] z;
+	delete[] q;
+	delete[] q_old;
+	delete[] qs;
+	delete[] y;
+	delete[] alpha;
+	delete[] beta;
+	delete[] d;
+	delete[] e;
+	delete[] sqrt_diag;
+	return log_determinant;
+}
+
+bool CG_Solver::tridiagonal_eigensystem(double* d, double* e, double** z, const int nn)
+{
+	// Eigenvalues and eigenvectors of a symmetric tridiagonal matrix by the QL method with implicit shifts. On input, d holds
+	// the diagonal and e[1..nn-1] the subdiagonal elements; on output, d holds the eigenvalues and the columns of z the
+	// corresponding normalized eigenvectors. Returns false if the iterations fail to converge.
+	int m,l,iter,i,k;
+	double s,r,p,g,f,dd,c,b;
+	for (i=0; i < nn; i++) {
+		for (k=0; k < nn; k++) z[i][k] = (i==k) ? 1.0 : 0.0;
+	}
+	for (i=1; i < nn; i++) e[i-1] = e[i];
+	if (nn > 0) e[nn-1] = 0.0;
+	for (l=0; l < nn; l++) {
+		iter=0;
+		do {
+			for (m=l; m < nn-1; m++) {
+				dd = fabs(d[m]) + fabs(d[m+1]);
+				if (fabs(e[m]) <= 1e-15*dd) break;
+			}
+			if (m != l) {
+				if (iter++ == 60) return false;
+				g = (d[l+1]-d[l])/(2.0*e[l]);
+				r = sqrt(g*g+1.0);
+				g = d[m] - d[l] + e[l]/(g + ((g >= 0) ? fabs(r) : -fabs(r)));
+				s = c = 1.0;
+				p = 0.0;
+				for (i=m-1; i >= l; i--) {
+					f = s*e[i];
+					b = c*e[i];
+					e[i+1] = (r=sqrt(f*f+g*g));
+					if (r == 0.0) {
+						d[i+1] -= p;
+						e[m] = 0.0;
+						break;
+					}
+					s = f/r;
+					c = g/r;
+					g = d[i+1] - p;
+					r = (d[i]-g)*s + 2.0*c*b;
+					d[i+1] = g + (p=s*r);
+					g = c*r - b;
+					for (k=0; k < nn; k++) {
+						f = z[k][i+1];
+						z[k][i+1] = s*z[k][i] + c*f;
+						z[k][i] = c*z[k][i] - s*f;
+					}
+				}
+				if ((r == 0.0) and (i >= l)) continue;
+				d[l] -= p;
+				e[l] = g;
+				e[m] = 0.0;
+			}
+		} while (m != l);
+	}
+	return true;
 }
 
+CG_matrix_free::~CG_matrix_free()
+{
+	delete[] diag;
+}
 
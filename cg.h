@@ -43,11 +43,14 @@ class CG_Solver : public Sort
 	void get_error(int& it, double& error) { it=iterations; error=err; }
 	void set_determinant_mode(bool detmode) { find_determinant = detmode; }
 	void get_log_determinant(double& logdet) { logdet = log_determinant; }
+	double estimate_log_determinant(const int n_probes, const int n_lanczos_steps, const unsigned int seed);
 
 	protected:
 	void error_norm(double* sx, double& err);
 	virtual void preconditioner_solve(double* b, double* x) = 0;
 	virtual void A_matrix_multiply(const double* const x, double* const r) = 0;
+	virtual const double* preconditioner_diagonal() = 0; // diagonal of A (or an approximation to it), used by estimate_log_determinant
+	bool tridiagonal_eigensystem(double* d, double* e, double** z, const int nn);
 	void set_thread_num(int nt_in);
 };
 
@@ -64,6 +67,29 @@ class CG_sparse : public CG_Solver
 	double *preconditioner_transpose;
 	int *preconditioner_transpose_index;
 
+	// Multigrid preconditioner: level 0 is the matrix itself, and each coarser level l is the Galerkin product P^T A P of the
+	// level above, where P is the piecewise-constant prolongation given by mg_aggregate[l-1] (which assigns each unknown on
+	// level l-1 to an aggregate on level l). The coarse matrices are stored in the same row-indexed format as A_sparse, and the
+	// coarsest one is factored with a dense Cholesky decomposition.
+	bool use_multigrid;
+	int mg_nlevels;
+	int *mg_n;
+	int **mg_aggregate;
+	vector<double> *mg_A;
+	vector<int> *mg_A_index;
+	double *mg_omega; // damping factor for the Jacobi smoother on each level
+	double *mg_coarse_cholesky;
+	double **mg_b, **mg_x, **mg_t; // work vectors for the coarse levels (index 0 is used for the fine-level scratch vector)
+	static const int mg_nsmooth = 2; // number of smoothing sweeps before and after each coarse-grid correction
+
+	void build_coarse_matrix(const int level);
+	double jacobi_damping_factor(const double* As, const int* Ai, const int nn);
+	void coarse_matrix_multiply(const int level, const double* const x, double* const r);
+	void coarse_vcycle(const int level);
+	void multigrid_preconditioner_solve(const double* const r, double* const z);
+	void delete_multigrid();
+	const double* preconditioner_diagonal() { return A_sparse; } // the diagonal elements are stored first
+
 	public:
 	CG_sparse(double* As_in, int* Ai_in, const double tol_in, const int itmax_in, const int nt_in, const int mpi_np, const int mpi_id);
 	CG_sparse(double** Amatrix, const int nn, const double tol_in, const int itmax_in, const int mpi_np, const int mpi_id);
@@ -73,6 +99,7 @@ class CG_sparse : public CG_Solver
 	~CG_sparse();
 
 	void solve(double* b, double* x);
+	bool set_multigrid_aggregates(const int n_coarse_levels, int* n_aggregates, int** aggregate_index);
 	double calculate_log_determinant();
 	void A_matrix_multiply(const double* const x, double* const r);
 	void incomplete_Cholesky_preconditioner();
@@ -81,3 +108,21 @@ class CG_sparse : public CG_Solver
 	void indexx(int* arr, int* indx, int nn);
 };
 
+// Base class for solving with a symmetric positive-definite matrix that is only available as an operator (through
+// A_matrix_multiply), so that the matrix itself never has to be formed. A diagonal preconditioner is used, where the
+// derived class fills in the diagonal (or an approximation to it). Since the Lanczos-based determinant used by CG_sparse
+// requires n matrix multiplications, the log-determinant is instead estimated by stochastic Lanczos quadrature
+// (see estimate_log_determinant).
+class CG_matrix_free : public CG_Solver
+{
+	protected:
+	double *diag;
+
+	public:
+	CG_matrix_free(const int nn, const double tol_in, const int itmax_in, const int nt_in);
+	~CG_matrix_free();
+
+	protected:
+	void preconditioner_solve(double* b, double* x);
+	const double* preconditioner_diagonal() { return diag; }
+};
@@ -10,11 +10,13 @@
 #include <vector>
 #include <sstream>
 #include <cstdlib>
+#include <map>
+#include <sys/stat.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 using namespace std;
 
-#define Complain(errmsg) do { cerr << "Error: " << errmsg << endl; if ((read_from_file) and (quit_after_error)) die(); goto next_line; } while (false) // the while(false) is a trick to make the macro syntax behave like a function
+#define Complain(errmsg) do { cerr << "Error: " << errmsg << endl; if ((read_from_file) and (quit_after_error)) { if (batch_system) batch_system_failed = true; else die(); } goto next_line; } while (false) // the while(false) is a trick to make the macro syntax behave like a function
 #define display_switch(setting) ((setting) ? "on" : "off")
 #define set_switch(setting,setword) do { if ((setword)=="on") setting = true; else if ((setword)=="off") setting = false; else Complain("invalid argument; must specify 'on' or 'off'"); } while (false)
 #define LENS_AXIS_DIR ((LensProfile::orient_major_axis_north==true) ? "y-axis" : "x-axis")
@@ -36,6 +38,18 @@ void Lens::process_commands(bool read_file)
 	for (;;)
    {
 		next_line:
+		if (batch_system) {
+			// an error ends a batch system's script on every process in its group, even if only one process found it (e.g. in
+			// a check made only by the group leader), so that the processes do not get out of step in their collective calls
+#ifdef USE_MPI
+			if (group_np > 1) {
+				int failed = (batch_system_failed) ? 1 : 0;
+				MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, *group_comm);
+				if (failed) batch_system_failed = true;
+			}
+#endif
+			if (batch_system_failed) return;
+		}
 		if (use_scientific_notation) cout << setiosflags(ios::scientific);
 		else {
 			cout << resetiosflags(ios::scientific);
@@ -65,6 +79,7 @@ void Lens::process_commands(bool read_file)
 					cout << endl << "Available commands:   (type 'help <command>' for usage information)\n\n"
 						"read -- execute commands from input file\n"
 						"write -- save command history to text file\n"
+						"batch -- run a script template for each lens system listed in a manifest file\n"
 						"settings -- display all settings (type 'help settings' for list of settings)\n"
 						"lens -- add a lens from the list of lens models (type 'help lens' for list of models)\n"
 						"fit -- commands for lens model fitting (type 'help fit' for list of subcommands)\n"
@@ -73,6 +88,7 @@ void Lens::process_commands(bool read_file)
 						"source -- add a source from the list of surface brightness models ('help source' for list)\n"
 						"lensinfo -- display kappa, deflection, magnification, shear, and potential at a specific point\n"
 						"plotlensinfo -- plot pixel maps of kappa, deflection, magnification, shear, and potential\n"
+						"lensmaps -- write kappa, magnification, shear, and deflection maps to a binary or FITS file\n"
 						"grid -- specify coordinates of Cartesian grid on image plane\n"
 						"autogrid -- determine optimal grid size from critical curves\n"
 						"mkgrid -- create new grid for searching for point images\n"
@@ -81,6 +97,8 @@ void Lens::process_commands(bool read_file)
 						"mksrctab -- create file containing Cartesian grid of point sources to be read by 'findimgs'\n"
 						"mksrcgal -- create file containing elliptical grid of point sources to be read by 'findimgs'\n"
 						"findimgs -- find sets of images from source positions listed in a given input file\n"
+						"findimgs_batch -- find images for a large source catalog in parallel, with binary output\n"
+						"convert_imgs_batch -- convert binary output of 'findimgs_batch' to the text files made by 'findimgs'\n"
 						"plotimgs -- find and plot image positions from sources listed in a given input file\n"
 						"replotimgs -- replot image positions previously found by 'plotimgs' command\n"
 						"plotcrit -- plot critical curves and caustics to data files (or to an image)\n"
@@ -90,12 +108,14 @@ void Lens::process_commands(bool read_file)
 						"plotmass -- plot radial mass profile\n"
 						"defspline -- create a bicubic spline of the deflection field over the range of the grid\n"
 						"einstein -- find Einstein radius of a given lens model\n"
+						"profiling -- record timers and counters for each stage of the lensing/fit calculations\n"
 						"\n"
 						"FEATURES THAT REQUIRE CCSPLINE MODE:\n"
 						"cc_reset -- delete the current critical curve spline and create a new one\n"
 						"auto_defspline -- spline deflection over an optimized grid determined by critical curves\n"
 						"mkrandsrc -- create file containing randomly plotted sources to be read with 'findimgs'\n"
-						"printcs -- print total (unbiased) cross section\n\n";
+						"printcs -- print total (unbiased) cross section\n"
+						"mc_cross_section -- Monte Carlo cross sections by image multiplicity, with magnification bias\n\n";
 				} else if (words[1]=="settings") {
 					cout << "Type 'help <setting>' to display information about each setting and how to change\n"
 					"them; type 'settings' to display all current settings, or type each keyword alone\n"
@@ -110,9 +130,13 @@ void Lens::process_commands(bool read_file)
 						"show_cc -- display critical curves along with images (on/off)\n"
 						"ccspline -- set critical curve spline mode on/off\n"
 						"auto_ccspline -- spline critical curves only if elliptical symmetry is present (if on)\n"
+						"cc_marching -- trace critical curves on a uniform mesh by marching squares (on/off)\n"
+						"cc_marching_npixels -- set number of mesh cells along x and y for marching squares tracer\n"
 						"major_axis_along_y -- orient major axis of lenses along y-direction (on/off)\n"
 						"ellipticity_components -- if on, use components of ellipticity e=1-q instead of (q,theta)\n"
 						"shear_components -- if on, use components of external shear instead of (shear,theta)\n"
+						"lens_tree -- sum distant compact lenses (e.g. subhalos) using a tree of multipoles (on/off)\n"
+						"lens_tree_acc -- set the fractional accuracy of the lens tree summation\n"
 						"autogrid_from_Re -- automatically set grid size from Einstein radius of primary lens (on/off)\n"
 						"autocenter -- automatically center grid on given lens number (or 'off')\n"
 						"zlens -- redshift of lens plane\n"
@@ -123,11 +147,13 @@ void Lens::process_commands(bool read_file)
 						"omega_m -- Matter density today divided by critical density of Universe (default = 0.3)\n"
 						"central_image -- include central images when fitting to data (if on)\n"
 						"nrepeat -- number of repeat chi-square optimizations after original run\n"
+						"adaptive_fisher -- tune Fisher matrix step sizes and use Richardson extrapolation (on/off)\n"
 						"chisqmag -- use magnification in chi-square function for image positions\n"
 						"chisqflux -- include flux information in chi-square fit (if on)\n"
 						"chisq_time_delays -- include time delay information in chi-square fit (if on)\n"
 						"chisq_parity -- include parity information in flux chi-square fit (if on)\n"
 						"chisqtol -- chi-square required accuracy during fit\n"
+						"loglike_cache -- number of likelihood evaluations remembered during a fit (0 = off)\n"
 						"srcflux -- flux of point source (for producing or fitting image flux data)\n"
 						"fix_srcflux -- fix source flux to specified value during fit (if on)\n"
 						"time_delays -- calculate time delays for all images (if on)\n"
@@ -153,9 +179,17 @@ void Lens::process_commands(bool read_file)
 						"data_pixel_noise -- pixel noise in data pixel images (loaded using 'sbmap loadimg')\n"
 						"sim_pixel_noise -- simulated pixel noise added to images produced by 'sbmap plotimg'\n"
 						"psf_width -- width of point spread function (PSF) along x- and y-axes\n"
+						"source_supersampling -- number of subpixels per pixel side when fitting a parameterized source\n"
 						"regparam -- value of regularization parameter for inverting lensed pixel images\n"
+						"logdet_nprobes -- number of probe vectors for the log-determinant in CG inversions\n"
+						"logdet_lanczos_steps -- number of Lanczos steps per probe for the CG log-determinant\n"
+						"cg_multigrid -- use multigrid preconditioner (built from the source grid) in CG inversions (on/off)\n"
+						"mpi_image_decomp -- divide image pixels among MPI processes when building lensing matrices (on/off)\n"
+						"lmatrix_single_precision -- use single-precision Lmatrix values to build the lensing matrices (on/off)\n"
 						"vary_regparam -- vary the regularization parameter during a fit (on/off)\n"
 						"adaptive_grid -- use adaptive source grid that splits source pixels recursively (on/off)\n"
+						"delaunay_srcgrid -- use source pixels from ray-traced image pixels on a Delaunay triangulation (on/off)\n"
+						"delaunay_stride -- use every n'th image pixel (along each direction) as a Delaunay source point\n"
 						"vary_h0 -- specify whether to vary the Hubble parameter during a fit (on/off)\n"
 						"sb_threshold -- minimum surface brightness to include when determining image centroids\n"
 						"ptsize/ps -- set point size for plots\n"
@@ -168,6 +202,22 @@ void Lens::process_commands(bool read_file)
 				else if (words[1]=="write")
 					cout << "write <filename>\n\n"
 						"Save all commands that have been entered to a text file named <filename>.\n";
+				else if (words[1]=="batch")
+					cout << "batch <manifest_file> [output_dir]\n\n"
+						"Runs a script for each lens system listed in <manifest_file>, within this process, so that the\n"
+						"MPI processes, threads and cosmology are only set up once. Each line of the manifest has the form\n\n"
+						"<name> <template_script> [var1=value1] [var2=value2] ...\n\n"
+						"For each system, every occurrence of ${var1} in the template script is replaced by value1 and so\n"
+						"on; ${name} is the system name, and ${outdir} is the directory '<output_dir>/<name>', where the\n"
+						"fit output for the system is written. The resulting script is saved as '<output_dir>/<name>.in'\n"
+						"and run with the current settings (any settings changed by the script only apply to that\n"
+						"system), and its output is written to '<output_dir>/<name>.log'. If qlens is run with MPI groups\n"
+						"('-g' argument), the systems are divided among the groups, with the processes in each group\n"
+						"working together on each of its systems. An error in a script ends the script for that system\n"
+						"only. When all the systems are done, a table giving the status, wall time, best-fit chi-square\n"
+						"and best-fit parameters (if a fit was run) of each system is written to '<output_dir>/summary.dat'.\n"
+						"The default output directory is 'batch'. A batch can also be run non-interactively using the\n"
+						"'-b:<manifest_file>' argument.\n";
 				else if (words[1]=="grid")
 					cout << "grid <xmax> <ymax>\n"
 						"grid <xmin> <xmax> <ymin> <ymax>\n"
@@ -190,6 +240,23 @@ void Lens::process_commands(bool read_file)
 				else if (words[1]=="mkgrid")
 					cout << "autogrid\n\n"
 						"Create grid with the current grid dimensions and splitting parameters.\n";
+				else if (words[1]=="profiling")
+					cout << "profiling <on/off> [filename]\n"
+						"profiling interval <N>\n"
+						"profiling report [label]\n"
+						"profiling reset\n"
+						"profiling\n\n"
+						"If on, records the wall time and number of calls for each stage of the calculation (likelihood\n"
+						"evaluations, ray tracing, grid construction, Lmatrix/PSF/Fmatrix assembly, inversion, log-\n"
+						"determinants, image finding and the sampler itself), along with counters such as the number of\n"
+						"rays traced. Times are summed over threads; a stage nested inside another (e.g. ray tracing\n"
+						"inside a likelihood evaluation) counts toward both. The totals are reset at the start of each\n"
+						"'fit run', 'fit chisq' or 'fit scan', and a report is appended to the profile file when it\n"
+						"finishes; with MPI, the report is aggregated over all processes. Each report is a single line\n"
+						"of JSON. The file defaults to '<fit_label>.profile.jsonl' in the fit output directory.\n\n"
+						"'profiling interval <N>' additionally appends a report (from the root process only) every N\n"
+						"likelihood calls; set N to 0 to turn this off. 'profiling report' writes a report of the\n"
+						"current totals, 'profiling reset' resets them, and 'profiling' alone displays them.\n";
 				else if (words[1]=="einstein")
 					cout << "einstein\n"
 						"einstein <lens_number>\n\n"
@@ -385,9 +452,12 @@ void Lens::process_commands(bool read_file)
 						cout << "fit\n"
 							"fit lens ...\n"
 							"fit sourcept ...\n"
+							"fit source ...\n"
 							"fit source_mode <mode>\n"
 							"fit run\n"
+							"fit resume\n"
 							"fit chisq\n"
+							"fit scan ...\n"
 							"fit findimg [sourcept_num]\n"
 							"fit plotimg [sourcept_num]\n"
 							"fit method <method>\n"
@@ -443,6 +513,18 @@ void Lens::process_commands(bool read_file)
 								"to add external shear with shear=0.1 and theta=30 degrees, one can enter:\n\n"
 								"fit lens alpha 10 1 0 0.9 0 0.3 0.5 shear=0.1 30\n") <<
 							"1 0 0 1 1 1 1 1 1     # vary flags for the alpha model + external shear parameters\n";
+					else if (words[2]=="source")
+						cout << "fit source ...\n\n"
+							"Identical to the 'source' command, except that after entering the source model, flags must\n"
+							"be entered for each parameter (either 0 or 1) to specify whether it will be varied or not,\n"
+							"in the same way as for 'fit lens'. The source parameters are only varied if the source mode\n"
+							"is set to 'sbprofile' (see 'fit source_mode'). The parameters are ordered as in the 'source'\n"
+							"command (model-specific parameters, then q, theta, xc, yc). For example:\n\n"
+							"fit source gaussian 5 0.1 0.8 30 0.05 0.02\n"
+							"1 1 1 1 1 1\n\n"
+							"For nested sampling or T-Walk, upper/lower limits must then be entered for each varied\n"
+							"parameter (see 'help fit lens'). If no arguments are given, the current source objects are\n"
+							"listed along with the parameters being varied.\n";
 					else if (words[2]=="sourcept")
 						cout << "fit sourcept\n"
 							"fit sourcept <sourcept_num>\n"
@@ -469,8 +551,9 @@ void Lens::process_commands(bool read_file)
 							"            or more point sources are used as fit parameters.\n"
 							"pixel -- the data is in the form of a surface brightness map (set using the 'sbmap' command\n"
 							"         and the source galaxy is pixellated and inferred by a linear inversion.\n"
-							"sbprofile -- similar to 'pixel', except that an analytic model is used for the source galaxy\n"
-							"             rather than a pixellated source. (This option has not been implemented yet)\n";
+							"sbprofile -- similar to 'pixel', except that the source galaxy is modeled by the source objects\n"
+							"             (see 'fit source'), whose parameters can be varied. Each image pixel is split into\n"
+							"             subpixels (see 'source_supersampling') which are ray traced to the source plane.\n";
 					else if (words[2]=="findimg")
 						cout << "fit findimg [sourcept_num]\n\n"
 							"Find the images produced by the current lens model and source point(s) and output their positions,\n"
@@ -492,11 +575,35 @@ void Lens::process_commands(bool read_file)
 							"method) or a Monte Carlo sampler (e.g. MCMC or nested sampling method) depending on the\n"
 							"fit method that has been selected. For more information about the output produced,\n"
 							"type 'help fit method <method>' for whichever fit method is selected.\n";
+					else if (words[2]=="resume")
+						cout << "fit resume\n\n"
+							"Resume a nested sampling or T-Walk run from the checkpoint saved in the output directory (as\n"
+							"'<label>.checkpoint'). The sampler state is checkpointed every 'mcmc_checkpoint' iterations, and\n"
+							"whenever a run is interrupted (e.g. by Ctrl-C or a SIGTERM from a batch scheduler); points written\n"
+							"to the output files after the last checkpoint are discarded and generated again. The fit model,\n"
+							"fit method and label, number of points/chains and the number of MPI processes and groups must\n"
+							"be the same as in the original run (for T-Walk, the number of chains moved concurrently should\n"
+							"also be the same, or the resumed chains will not reproduce the uninterrupted run). The checkpoint\n"
+							"is removed once the run finishes.\n";
 					else if (words[2]=="chisq")
 						cout << "fit chisq\n\n"
 							"Output the chi-square value for the current model and data. If using more than one chi-square\n"
 							"component (e.g. fluxes and time delays), each chi-square will be printed separately in addition\n"
 							"to the total chi-square value.\n";
+					else if (words[2]=="scan")
+						cout << "fit scan [profile] <param#> <npoints> <initial> <final> [filename]\n"
+							"fit scan [profile] <param1#> <npoints1> <initial1> <final1> <param2#> <npoints2> <initial2> <final2> [filename]\n\n"
+							"Evaluate the chi-square on a grid of points along one fit parameter, or over a 2-D grid in two fit\n"
+							"parameters, with the remaining parameters held at their current values. The parameter numbers are\n"
+							"those listed by the 'fit' command; points are placed at the centers of <npoints> equal bins between\n"
+							"<initial> and <final>. If 'profile' is given, the remaining parameters are instead optimized at each\n"
+							"grid point using the downhill simplex method (zero temperature, limited by 'simplex_nmax'), which\n"
+							"gives the profile chi-square. Grid points are divided among MPI process groups, and among threads\n"
+							"when the point-source likelihood is evaluated in the source plane.\n\n"
+							"The output is written as a binary file in the fit output directory (default name '<label>.scan').\n"
+							"It begins with seven integers (ndim, number of fit parameters, param1, npoints1, param2, npoints2,\n"
+							"profile flag) and four doubles (initial1, final1, initial2, final2), followed by one record per grid\n"
+							"point (param1 varying fastest) containing all the fit parameter values and then the chi-square.\n";
 					else if (words[2]=="method") {
 						if (nwords==3)
 							cout << "fit method <fit_method>\n\n"
@@ -504,6 +611,7 @@ void Lens::process_commands(bool read_file)
 								"sampling routine. Available fit methods are:\n\n"
 								"simplex -- minimize chi-square using downhill simplex method (+ optional simulated annealing)\n"
 								"powell -- minimize chi-square using Powell's method\n"
+								"de -- global minimization of chi-square by differential evolution\n"
 								"nest -- nested sampling\n"
 								"twalk -- T-Walk MCMC algorithm\n\n"
 								"For more information on a given fitting method and the output it produces, type\n"
@@ -531,6 +639,24 @@ void Lens::process_commands(bool read_file)
 								"and returns the best-fit parameter values. If 'find_errors' is on, the Fisher matrix is then\n"
 								"calculated numerically and marginalized error estimates are displayed for each parameter. The\n"
 								"convergence criterion is set by 'chisqtol'.\n\n";
+						else if (words[3]=="de")
+							cout << "fit method de\n\n"
+								"Differential evolution searches for the global minimum of the chi-square function by evolving a\n"
+								"population of points; each generation, a trial point is made for every member by adding the scaled\n"
+								"difference of two other members to a third, and the trial replaces the member if its chi-square is\n"
+								"no worse. The initial population includes the current parameter values, with the remaining points\n"
+								"drawn uniformly within the initial parameter limits, and all points are kept within the parameter\n"
+								"limits (so limits must be entered for each parameter, as with 'nest' and 'twalk'). The trial points\n"
+								"in each generation are evaluated concurrently across MPI process groups (and across threads if the\n"
+								"likelihood allows it, i.e. for source plane chi-square with point sources). For a given population\n"
+								"size, the results do not depend on the number of threads or processes, only on the random seed\n"
+								"('random_seed'). The population size is set by 'de_popsize'; by default, it is about ten points per\n"
+								"parameter, rounded up to a multiple of the number of points evaluated at a time. The maximum\n"
+								"number of generations is set by 'de_ngen'. The algorithm converges once the chi-square values in\n"
+								"the population agree to within the fractional tolerance 'chisqtol' (or differ by less than 'chisqtol'\n"
+								"if the chi-square is close to zero). If 'de_polish' is on, the best point is then refined using the\n"
+								"downhill simplex method. If 'find_errors' is on, the Fisher matrix is calculated numerically and\n"
+								"marginalized error estimates are displayed for each parameter.\n\n";
 						else if (words[3]=="nest")
 							cout << "fit method nest\n\n"
 								"The nested sampling algorithm outputs points that sample the parameter space, which can then\n"
@@ -544,7 +670,10 @@ void Lens::process_commands(bool read_file)
 								"Metropolis-Hastings step and outputs the resulting chain(s) of points, which can then be marginalized\n"
 								"by binning in the parameter(s) of interest. Data points are output to the file '<label>', where the\n"
 								"label is set by the 'fit label' command. The algorithm uses the Gelman-Rubin R-statistic to determine\n"
-								"convergence and terminates after R reaches the value set by mcmctol.\n";
+								"convergence and terminates after R reaches the value set by mcmctol. With 'twalk_threads' set to n > 1,\n"
+								"each process moves n chains at a time and evaluates their likelihoods on separate threads (if the\n"
+								"likelihood can be evaluated concurrently, i.e. for point sources or pixellated sources, provided there is\n"
+								"only one MPI process per group and the inversion method is not MUMPS).\n";
 						else Complain("unknown fit method");
 					} else if (words[2]=="label")
 						cout << "fit label <label>\n\n"
@@ -689,8 +818,16 @@ void Lens::process_commands(bool read_file)
 							"sbmap loadimg <image_file>\n"
 							"sbmap loadpsf <psf_file>\n"        // WRITE HELP DOCS FOR THIS COMMAND
 							"sbmap loadmask <mask_file>\n"      // WRITE HELP DOCS FOR THIS COMMAND
+							"sbmap loadnoise <noise_file> [-weight]\n"
+							"sbmap clearnoise\n"
+							"sbmap addband <image_file>\n"
+							"sbmap band <n> [...]\n"
+							"sbmap bands\n"
+							"sbmap clearbands\n"
 							"sbmap plotdata\n"
 							"sbmap invert\n"
+							"sbmap check_precision\n"
+							"sbmap check_multigrid\n"
 							"sbmap set_all_pixels\n"
 							"sbmap unset_all_pixels\n"
 							"sbmap set_data_annulus [...]\n"
@@ -711,9 +848,52 @@ void Lens::process_commands(bool read_file)
 								"has been specified, than the grid dimensions specified by the 'grid' command are used to\n"
 								"set the pixel size. After loading the pixel image, the number of image pixels for plotting\n"
 								"(set by 'img_npixels') is automatically set to be identical to those of the data image.\n\n"
-								"Currently the pixel noise is specified by setting 'data_pixel_noise', and is assumed to have\n"
-								"the same dispersion for all pixels (in future versions there will be an option to load a noise\n"
-								"map for uncorrelated pixel noise, or a full covariance matrix for correlated pixel noise).\n";
+								"By default the pixel noise is specified by setting 'data_pixel_noise', and is assumed to have\n"
+								"the same dispersion for all pixels; alternatively, a noise map for uncorrelated pixel noise can\n"
+								"be loaded using 'sbmap loadnoise'.\n";
+						else if (words[2]=="loadnoise")
+							cout << "sbmap loadnoise <noise_file> [-weight]\n\n"
+								"Load a map of the noise (standard deviation) of each pixel in the image data, which is used in\n"
+								"place of the uniform 'data_pixel_noise' when inverting the image and calculating the chi-square.\n"
+								"If the '-weight' option is given, the map is taken to hold the weight (inverse variance) of each\n"
+								"pixel instead. Pixels whose noise is zero or negative (or whose weight is zero) are dropped from\n"
+								"the fit entirely, as if they were masked. If 'fits_format' is on, the file must be in FITS format;\n"
+								"otherwise it is a text file with the pixel values arranged in matrix form, like the '.dat' file\n"
+								"loaded by 'sbmap loadimg'. The map must have the same dimensions as the loaded image data, and\n"
+								"is discarded if new image data is loaded.\n";
+						else if (words[2]=="addband")
+							cout << "sbmap addband <image_file>\n\n"
+								"Load an additional band (e.g. a different filter) of image data to be fit simultaneously with\n"
+								"the main image data loaded by 'sbmap loadimg'. The file is loaded in the same way as 'sbmap loadimg',\n"
+								"and must have the same pixel dimensions as the main image. All bands share the same lens mapping\n"
+								"and fit window, so the ray tracing, source grid and Lmatrix are only constructed once per\n"
+								"likelihood evaluation; each band is then convolved with its own PSF and inverted separately to\n"
+								"find its own source surface brightness, and the chi-square values of all the bands are added.\n"
+								"The new band starts with the current values of 'psf_width' and 'data_pixel_noise', which can be\n"
+								"changed for each band with the 'sbmap band' command. The main image data is band 0, and the extra\n"
+								"bands are numbered from 1 in the order they are added. Loading new main image data removes the\n"
+								"extra bands.\n";
+						else if (words[2]=="band")
+							cout << "sbmap band <n> psf_width <width>\n"
+								"sbmap band <n> psf_width <x_width> <y_width>\n"
+								"sbmap band <n> pixel_noise <noise>\n"
+								"sbmap band <n> loadnoise <noise_file> [-weight]\n"
+								"sbmap band <n> clearnoise\n\n"
+								"Set the width of the Gaussian PSF, the uniform pixel noise, or a pixel noise map (see 'help sbmap\n"
+								"loadnoise') for extra image band <n> (where n >= 1; the settings for the main band 0 are given by\n"
+								"'psf_width', 'data_pixel_noise' and 'sbmap loadnoise'). If no arguments are given after the band\n"
+								"number, the settings of the band are shown.\n";
+						else if (words[2]=="bands")
+							cout << "sbmap bands\n\n"
+								"List the image bands being fit, with their PSF widths and pixel noise, and the chi-square of each\n"
+								"extra band from the most recent inversion.\n";
+						else if (words[2]=="clearbands")
+							cout << "sbmap clearbands\n\n"
+								"Remove all the extra image bands added by 'sbmap addband', leaving only the main image data.\n";
+						else if (words[2]=="clearnoise")
+							cout << "sbmap clearnoise\n\n"
+								"Remove the pixel noise map loaded by 'sbmap loadnoise', so that the uniform pixel noise given by\n"
+								"'data_pixel_noise' is used again.\n";
 						else if (words[2]=="loadsrc")
 							cout << "sbmap loadsrc <source_filename>\n\n"
 								"Load a source surface brightness pixel map that was previously saved in qlens (using 'sbmap\n"
@@ -783,8 +963,24 @@ void Lens::process_commands(bool read_file)
 							cout << "sbmap invert\n\n"
 								"Invert the image surface brightness map under the assumed lens model using linear inversion. The\n"
 								"method used for the linear inversion is specified in 'inversion_method', which can be set to either\n"
-								"'cg' (conjugate gradient method), 'mumps' or 'umfpack'. The latter two options require qlens to be\n"
-								"compiled with the MUMPS or UMFPACK software packages, respectively.\n";
+								"'cg' (conjugate gradient method), 'matrix_free', 'mumps' or 'umfpack'. The 'matrix_free' option also\n"
+								"uses the conjugate gradient method, but applies the lensing matrices and PSF convolution as operators\n"
+								"rather than forming the F-matrix, which saves memory for large source grids and/or wide PSFs. With\n"
+								"either CG option, the log-determinant of the F-matrix is estimated stochastically (see 'logdet_nprobes'\n"
+								"and 'logdet_lanczos_steps'). The 'mumps' and 'umfpack' options require qlens to be compiled with the\n"
+								"MUMPS or UMFPACK software packages, respectively.\n";
+						else if (words[2]=="check_precision")
+							cout << "sbmap check_precision\n\n"
+								"Invert the image surface brightness map twice, first with the Lmatrix in double precision and then in\n"
+								"single precision (see 'lmatrix_single_precision'), and print the chi-square from each along with\n"
+								"the log-determinant of the F-matrix (if the regularization parameter or pixel fraction is varied,\n"
+								"since it then enters the evidence). A warning is printed if the results differ by more than 0.1.\n";
+						else if (words[2]=="check_multigrid")
+							cout << "sbmap check_multigrid\n\n"
+								"Invert the image surface brightness map twice with the conjugate gradient method, first with the\n"
+								"diagonal preconditioner and then with the multigrid preconditioner (see 'cg_multigrid'), and print\n"
+								"the log-likelihood from each. Since the preconditioner should not change the result, a warning is\n"
+								"printed if the two differ by a fraction greater than the CG tolerance (1e-4).\n";
 						else if (words[2]=="set_all_pixels")
 							cout << "sbmap set_all_pixels\n\n"
 								"Activates all pixels in the image data so they are used in fitting and plotting. This command can only\n"
@@ -887,6 +1083,19 @@ void Lens::process_commands(bool read_file)
 						"'<file_root>.kappa', '<file_root>.mag', and so on (if no file label is specified, <file_root> defaults\n"
 						"to 'lensmap'). The number of pixels set using the 'img_npixels' command, and grid dimensions are defined\n"
 						" by the 'grid' command. All files are output to the directory set by the 'set_output_dir' command.\n";
+				else if (words[1]=="lensmaps")
+					cout << "lensmaps [file_root] [-fits] [-single] [-preview=#] [-planes=<name>,<name>,...]\n\n"
+						"Evaluates the same maps as 'plotlensinfo' (kappa, mag, invmag, shear, defx, defy) over the grid, dividing\n"
+						"the map into tiles that are evaluated in parallel (if compiled with OpenMP), and writes them all to a\n"
+						"single file, one tile at a time as they are evaluated, so the full maps are never held in memory. By\n"
+						"default this is a binary file '<file_root>.maps' (see the comments in lens.cpp for the layout); with\n"
+						"'-fits', the maps are written to '<file_root>.fits' with one image extension per quantity. To write only\n"
+						"some of the maps, list them with '-planes' (e.g. '-planes=kappa,defx,defy'); the quantities that are not\n"
+						"needed are not computed. The maps are written in double precision unless '-single' is given. With\n"
+						"'-preview=N', maps averaged over blocks of NxN pixels are also written in text format to\n"
+						"'<file_root>_preview.kappa' and so on, which can be plotted the same way as the 'plotlensinfo' output.\n"
+						"The number of pixels is set by 'img_npixels', and <file_root> defaults to 'lensmap'. All files are\n"
+						"output to the directory set by 'set_output_dir'.\n";
 				else if (words[1]=="plotcrit")
 					cout << "plotcrit\n"
 						"plotcrit <file>                      (text mode)\n"
@@ -928,6 +1137,20 @@ void Lens::process_commands(bool read_file)
 						"'sourcexy.in') and writes images to [images_file] (default = 'images.dat').\n"
 						"The image data is written as follows:\n"
 						"<x_position>  <y_position>  <magnification>  <time delay (optional)>\n";
+				else if (words[1]=="findimgs_batch")
+					cout << "findimgs_batch [source_file] [output_file]\n\n"
+						"Finds images corresponding to source positions specified in [source_file] (default = 'sourcexy.in'),\n"
+						"as in 'findimgs', but intended for large source catalogs: the sources are divided among the MPI\n"
+						"processes (if qlens is run with MPI), and among the OpenMP threads within each process. The\n"
+						"image multiplicity, positions, magnifications, time delays (if 'time_delays' is on) and parities\n"
+						"for each source are written to a single binary file (default = 'images.bin'); the text files made\n"
+						"by 'findimgs' can be produced from this file using 'convert_imgs_batch'.\n";
+				else if (words[1]=="convert_imgs_batch")
+					cout << "convert_imgs_batch <batch_file> [images_file]\n\n"
+						"Converts the binary output of 'findimgs_batch' into the text files produced by 'findimgs': the\n"
+						"images are written to [images_file] (default = 'images.dat') and the sources to 'src.dat', and the\n"
+						"images and sources are sorted by type into 'images.quads', 'sources.quads', etc., so that the\n"
+						"results can be plotted with the usual scripts.\n";
 				else if (words[1]=="plotimgs")
 					cout << "plotimgs [source_infile]\n"
 						"plotimgs <sourcepic_outfile> <imagepic_outfile>                 (postscript/PDF mode)\n"
@@ -1009,6 +1232,18 @@ void Lens::process_commands(bool read_file)
 				else if (words[1]=="printcs")
 					cout << "printcs [filename]\n\n"
 						"Prints the total (unbiased) cross section. If [filename] is specified, saves to file.\n";
+				else if (words[1]=="mc_cross_section")
+					cout << "mc_cross_section [precision] [max_samples] [count_slope] [seed]\n\n"
+						"Estimates the lensing cross section for each image multiplicity by Monte Carlo sampling of source\n"
+						"positions within the caustics (requires ccspline mode), along with the magnification-biased cross\n"
+						"section for sources with power-law number counts N(>L) ~ L^(-count_slope) (default=0, no bias), in\n"
+						"which each multiply imaged source is weighted by mu^count_slope, where mu is the total magnification\n"
+						"of its images. Samples are drawn in batches until the relative uncertainty in the multiple-image\n"
+						"and biased cross sections is below [precision] (default=0.01), or [max_samples] have been drawn\n"
+						"(default=1000000); the running estimates are printed after each batch if verbal mode is on. The\n"
+						"random numbers are drawn from a counter-based generator with the given [seed] (default=1), so the\n"
+						"result is reproducible, and the same for any number of MPI processes or threads (which divide the\n"
+						"samples).\n";
 				else if (words[1]=="clear")
 					cout << "clear <#>\n\n"
 					"Remove lens galaxy # from the list (the list of galaxies can be printed using the\n"
@@ -1025,6 +1260,23 @@ void Lens::process_commands(bool read_file)
 					cout << "major_axis_along_y <on/off>\n\n"
 						"Specify whether to orient major axis of lenses along the y-direction (if on) or x-direction\n"
 						"if off (this is on by default, in accordance with the usual convention).\n";
+				else if (words[1]=="lens_tree")
+					cout << "lens_tree <on/off>\n\n"
+						"If on, the deflection, Hessian and potential of compact lenses (point masses, pseudo-Jaffe and\n"
+						"truncated NFW models, e.g. a population of subhalos) are summed using a quadtree, in which each\n"
+						"group of distant lenses is replaced by a multipole expansion (Barnes-Hut method); the kappa of\n"
+						"distant lenses is neglected. This reduces the cost of each ray from order N to order log(N) in\n"
+						"the number of subhalos. Nearby lenses, and lenses of all other types, are still evaluated\n"
+						"exactly, as are elliptical truncated NFW lenses (whose deflections are found by numerical\n"
+						"integration). The tree is only used if there are at least 16 compact lenses. Note that a\n"
+						"pseudo-Jaffe lens only looks like a point mass well beyond its tidal radius, at roughly\n"
+						"a/(accuracy), so the tree works best if the subhalos are truncated NFW models or point masses,\n"
+						"or if the field is large compared to the tidal radii. (default=off)\n";
+				else if (words[1]=="lens_tree_acc")
+					cout << "lens_tree_acc <accuracy>\n\n"
+						"Set the fractional accuracy of the tree summation (see 'help lens_tree'), which determines both\n"
+						"the distance beyond which each compact lens is treated as a point mass and how close a group of\n"
+						"lenses can be before its multipole expansion is opened up. (default=1e-3)\n";
 				else if (words[1]=="warnings")
 					cout << "warnings <on/off>\n"
 						"warnings newton <on/off>\n\n"
@@ -1054,6 +1306,18 @@ void Lens::process_commands(bool read_file)
 						"curves are splined (i.e. ccspline is turned on) only if elliptical symmetry is present,\n"
 						"i.e. all lenses are centered at the origin. If elliptical symmetry is not present, the\n"
 						"critical curves are not splined.\n";
+				else if (words[1]=="cc_marching")
+					cout << "cc_marching <on/off>\n\n"
+						"If on, critical curves (and caustics) are found by evaluating the inverse magnification on\n"
+						"a uniform mesh spanning the grid and extracting its zero contours by marching squares, rather\n"
+						"than through the recursive grid. The mesh is evaluated in parallel (if OpenMP is enabled), and\n"
+						"each contour point is refined with Newton steps along its mesh edge. The cost is fixed by the\n"
+						"mesh size (see 'cc_marching_npixels'), so the mesh must be fine enough to resolve the smallest\n"
+						"critical curves of interest, e.g. those around subhalos. (default=off)\n";
+				else if (words[1]=="cc_marching_npixels")
+					cout << "cc_marching_npixels <nx> <ny>\n\n"
+						"Sets the number of mesh cells along x and y used to trace critical curves when 'cc_marching'\n"
+						"is on. If no arguments are given, prints the current values. (default=400 400)\n";
 				else if (words[1]=="autocenter")
 					cout << "autocenter <lens_number>\n"
 						"autocenter off\n\n"
@@ -1081,6 +1345,16 @@ void Lens::process_commands(bool read_file)
 					cout << "chisqtol <##>\n\n"
 						"Set the required accuracy for chi-square minimization (if Powell's method or the downhill\n"
 						"simplex methods are used.\n";
+				else if (words[1]=="loglike_cache")
+					cout << "loglike_cache <n>\n\n"
+						"During a fit, the likelihood values from the last n evaluations are remembered, so that if the\n"
+						"likelihood is requested again at exactly the same parameter values (e.g. when the simplex is\n"
+						"restarted, or at the central point of the Fisher matrix), it is not recalculated. For pixel image\n"
+						"fits, the model image is remembered as well (and copied at every evaluation); the oldest entries\n"
+						"are dropped once the stored images take up more than 128 MB. Since the samplers rarely request\n"
+						"exactly the same point twice, this is mainly useful with the optimizers. Set to 0 to turn off.\n"
+						"With no argument, the number of cache hits and misses during the most recent fit is also shown.\n"
+						"(default=0)\n";
 				else if (words[1]=="chisq_parity")
 					cout << "chisq_parity <on/off>\n\n"
 						"Include parity information in addition to flux in the chi-square function (if on). Note\n"
@@ -1089,6 +1363,13 @@ void Lens::process_commands(bool read_file)
 					cout << "chisq_time_delays <on/off>\n\n"
 						"Include time delays in the chi-square function (if on). Note that this is only relevant for\n"
 						"point source searches (i.e. fit source_mode = ptsource). (default=off)\n";
+				else if (words[1]=="adaptive_fisher")
+					cout << "adaptive_fisher <on/off>\n\n"
+						"If on, the finite-difference step used for each parameter when calculating the Fisher matrix is\n"
+						"adjusted until the change in chi-square along that parameter is small but well above roundoff\n"
+						"error; each Fisher matrix element is then Richardson-extrapolated from steps h and h/2. This\n"
+						"takes roughly twice as many likelihood evaluations. If off, a fixed step of 1e-4 times the\n"
+						"parameter stepsize is used. (default=off)\n";
 				else if (words[1]=="imgplane_chisq")
 					cout << "imgplane_chisq <on/off>\n\n"
 						"Use the lensed image positions in the chi-square function for fitting (if on); otherwise,\n"
@@ -1210,6 +1491,73 @@ void Lens::process_commands(bool read_file)
 						"lensed pixel images (e.g. 'sbmap plotimg' or 'sbmap invert'), the resulting image is convolved\n"
 						"with this PSF. If only one argument is given, the PSF is assumed to be symmetric and the same\n"
 						"width is given along both axes.\n";
+				else if (words[1]=="source_supersampling")
+					cout << "source_supersampling <n>\n\n"
+						"When fitting with a parameterized source (fit source_mode sbprofile), each image pixel is split\n"
+						"into n x n subpixels that are ray traced to the source plane, and the surface brightness of each\n"
+						"pixel is the average over its subpixels. The source positions of the subpixels are stored and\n"
+						"reused as long as the lens parameters do not change, so varying only the source parameters does\n"
+						"not require any further ray tracing. (default=2)\n";
+				else if (words[1]=="logdet_nprobes")
+					cout << "logdet_nprobes <n>\n\n"
+						"When using a CG inversion ('inversion_method cg' or 'matrix_free') with the regularization\n"
+						"parameter or pixel fraction varied, the log-determinant of the F-matrix is estimated by stochastic\n"
+						"Lanczos quadrature, averaging over n random probe vectors. The same probe vectors are used in each\n"
+						"likelihood evaluation, so the estimate varies smoothly with the parameters; more probes reduce its\n"
+						"scatter, roughly as 1/sqrt(n). (default=10)\n";
+				else if (words[1]=="logdet_lanczos_steps")
+					cout << "logdet_lanczos_steps <n>\n\n"
+						"Number of Lanczos iterations per probe vector used to estimate the log-determinant of the F-matrix in\n"
+						"CG inversions (see 'logdet_nprobes'). Each iteration requires one multiplication by the F-matrix.\n"
+						"(default=40)\n";
+				else if (words[1]=="mpi_image_decomp")
+					cout << "mpi_image_decomp <on/off>\n\n"
+						"If on, and a likelihood evaluation is shared by more than one MPI process (i.e. there are fewer MPI\n"
+						"groups than processes), the image is divided into horizontal strips, one for each process in the\n"
+						"group. Each process ray traces only its own strip (plus a few rows on either side, as needed for the\n"
+						"PSF convolution), and only stores the Lmatrix rows for its strip, along with the contributions of\n"
+						"those pixels to the F-matrix and data vector. The partial F-matrix rows are sent to the process that\n"
+						"assembles each row, so the communication scales with the number of nonzero F-matrix elements; the\n"
+						"source cell magnifications used to build the source grid are summed over the processes. With a\n"
+						"Delaunay source grid, the ray-traced points are still shared by all processes, since they are the\n"
+						"source pixels. This setting is ignored for matrix-free inversions, image plane curvature regulariz-\n"
+						"ation, extra image bands, and the surface brightness prior outside the fit window, which need the\n"
+						"entire Lmatrix. If off, each process constructs the entire Lmatrix, and finds its share of the\n"
+						"F-matrix rows using all the image pixels. (default=off)\n";
+				else if (words[1]=="lmatrix_single_precision")
+					cout << "lmatrix_single_precision <on/off>\n\n"
+						"If on, the Lmatrix values are converted to single precision before the F-matrix and data vector are\n"
+						"assembled (or, in matrix-free inversions, before the lensing operator is applied in each iteration),\n"
+						"which roughly halves the memory traffic in these steps. The products are still accumulated, and the\n"
+						"linear system solved, in double precision, so the only error is from rounding the Lmatrix values\n"
+						"(a relative error of ~1e-7). Use 'sbmap check_precision' to compare the chi-square and F-matrix\n"
+						"log-determinant with those found in double precision. (default=off)\n";
+				else if (words[1]=="cg_multigrid")
+					cout << "cg_multigrid <on/off>\n\n"
+						"If on, the conjugate gradient inversion ('inversion_method cg') is preconditioned with a multigrid\n"
+						"V-cycle instead of the diagonal of the F-matrix. The coarse levels are built from the source grid, by\n"
+						"merging source pixels that share a parent cell in the adaptive grid and then merging first-level\n"
+						"cells in 2x2 blocks, so the number of CG iterations should grow only slowly with the number of\n"
+						"source pixels. The log-determinant of the F-matrix (if the regularization parameter or pixel fraction\n"
+						"is varied) is estimated separately, so it does not depend on the preconditioner; use 'sbmap\n"
+						"check_multigrid' to check that the log-likelihood is the same with either preconditioner. (default=off)\n";
+				else if (words[1]=="delaunay_srcgrid")
+					cout << "delaunay_srcgrid <on/off>\n\n"
+						"If on, the source pixels used to invert a lensed pixel image are the ray-traced centers of the image\n"
+						"pixels in the fit window (every n'th pixel along each direction, set by 'delaunay_stride'), and the\n"
+						"source is interpolated linearly on the Delaunay triangulation of these points. The source resolution\n"
+						"thus follows the magnification, without any splitting of source pixels. Each image pixel is ray-traced\n"
+						"through its center only, regardless of 'raytrace_method'. The gradient and curvature regularization\n"
+						"are found from the differences between each point and its neighbors in the triangulation. Since the\n"
+						"rectangular source grid is not used for the inversion, the multigrid preconditioner ('cg_multigrid')\n"
+						"and the surface brightness prior outside the fit window are not used; however, the rectangular grid\n"
+						"is still created to display the reconstructed source (with values interpolated from the triangulation)\n"
+						"so that the source can be plotted as usual. (default=off)\n";
+				else if (words[1]=="delaunay_stride")
+					cout << "delaunay_stride <n>\n\n"
+						"If the Delaunay source grid is used ('delaunay_srcgrid on'), every n'th image pixel along each\n"
+						"direction (within the fit window) is ray-traced to make a source point, so the number of source\n"
+						"pixels is roughly 1/n^2 times the number of image pixels in the fit window. (default=2)\n";
 				else if (words[1]=="regparam")
 					cout << "regparam <R0>\n"
 						"regparam <Rmin> <R0> <Rmax>\n\n"
@@ -1253,6 +1601,7 @@ void Lens::process_commands(bool read_file)
 				else if (fitmethod==SIMPLEX) cout << "Fit method: simplex" << endl;
 				else if (fitmethod==NESTED_SAMPLING) cout << "Fit method: nest" << endl;
 				else if (fitmethod==TWALK) cout << "Fit method: twalk" << endl;
+				else if (fitmethod==DIFFERENTIAL_EVOLUTION) cout << "Fit method: de" << endl;
 				else cout << "Unknown fit method" << endl;
 				cout << "Warnings: " << display_switch(warnings) << endl;
 				cout << "Warnings for Newton's method: " << display_switch(newton_warnings) << endl;
@@ -1264,12 +1613,16 @@ void Lens::process_commands(bool read_file)
 				cout << "Show critical curves (show_cc): " << display_switch(show_cc) << endl;
 				cout << "Critical curve spline (ccspline): " << display_switch(use_cc_spline) << endl;
 				cout << "Automatic critical curve spline (auto_ccspline): " << display_switch(auto_ccspline) << endl;
+				cout << "Marching squares critical curves (cc_marching): " << display_switch(use_cc_marching_squares) << endl;
+				cout << "Marching squares mesh size (cc_marching_npixels): " << cc_marching_nx << " " << cc_marching_ny << endl;
 				cout << "Automatically determine source grid dimensions (auto_srcgrid): " << display_switch(auto_sourcegrid) << endl;
 				cout << "Automatic grid center (autocenter): ";
 				if (autocenter==false) cout << "off\n";
 				else cout << "centers on lens " << autocenter_lens_number << endl;
 				cout << "Automatically set grid size from Einstein radius before grid creation (autogrid_from_Re): " << display_switch(auto_gridsize_from_einstein_radius) << endl;
 				cout << "Subgrid around satellite galaxies (galsubgrid): " << display_switch(subgrid_around_satellites) << endl;
+				cout << "Tree summation of compact lenses (lens_tree): " << display_switch(use_lens_tree) << endl;
+				cout << "Lens tree accuracy (lens_tree_acc): " << lens_tree_accuracy << endl;
 				cout << "Include time delays (time_delays): " << display_switch(include_time_delays) << endl;
 
 				double imagepos_accuracy;
@@ -1291,6 +1644,7 @@ void Lens::process_commands(bool read_file)
 				cout << "Use image plane chi-square function (imgplane_chisq): " << display_switch(use_image_plane_chisq) << endl;
 				cout << "Find analytic best-fit source position for source plane chi-square (analytic_bestfit_src): " << display_switch(use_analytic_bestfit_src) << endl;
 				cout << "Number of repeat chi-square optimizations (nrepeat): " << n_repeats << endl;
+				cout << "Adaptive Fisher matrix step sizes (adaptive_fisher): " << display_switch(adaptive_fisher_steps) << endl;
 				cout << "Use magnification in chi-square (chisqmag): " << display_switch(use_magnification_in_chisq) << endl;
 				cout << "Include image flux in chi-square (chisqflux): " << display_switch(include_flux_chisq) << endl;
 				cout << "Include parity information in flux chi-square (chisq_parity): " << display_switch(include_parity_in_chisq) << endl;
@@ -1308,6 +1662,11 @@ void Lens::process_commands(bool read_file)
 				if (inversion_method==MUMPS) cout << "Lensing inversion method (inversion_method): LDL factorization (MUMPS)" << endl;
 				else if (inversion_method==UMFPACK) cout << "Lensing inversion method (inversion_method): LU factorization (UMFPACK)" << endl;
 				else if (inversion_method==CG_Method) cout << "Lensing inversion method (inversion_method): conjugate gradient method" << endl;
+				else if (inversion_method==Matrix_Free_CG) cout << "Lensing inversion method (inversion_method): matrix-free conjugate gradient method" << endl;
+				cout << "Stochastic log-determinant probes, Lanczos steps (logdet_nprobes, logdet_lanczos_steps): " << logdet_nprobes << ", " << logdet_lanczos_steps << endl;
+				cout << "Multigrid preconditioner for CG inversion (cg_multigrid): " << display_switch(use_multigrid_preconditioner) << endl;
+				cout << "Divide image pixels among MPI processes (mpi_image_decomp): " << display_switch(mpi_image_decomposition) << endl;
+				cout << "Single-precision Lmatrix (lmatrix_single_precision): " << display_switch(lmatrix_single_precision) << endl;
 
 				cout << "Number of image pixels (img_npixels): (" << n_image_pixels_x << "," << n_image_pixels_y << ")\n";
 				cout << "Number of source pixels (src_npixels): (" << srcgrid_npixels_x << "," << srcgrid_npixels_y << ")\n";
@@ -1317,7 +1676,9 @@ void Lens::process_commands(bool read_file)
 				if (auto_sourcegrid) cout << " (auto_srcgrid on)";
 				cout << endl;
 				cout << "Point spread function (PSF) width (psf_width): (" << psf_width_x << "," << psf_width_y << ")\n";
+				cout << "Subpixel splittings for parameterized source (source_supersampling): " << source_supersampling << endl;
 				cout << "Adaptive source pixel grid (adaptive_grid): " << display_switch(adaptive_grid) << endl;
+				cout << "Delaunay source grid, stride (delaunay_srcgrid, delaunay_stride): " << display_switch(use_delaunay_srcgrid) << ", " << delaunay_srcgrid_stride << endl;
 				cout << "Data pixel surface brightness dispersion (data_pixel_noise): " << data_pixel_noise << endl;
 				cout << "Simulated pixel surface brightness dispersion for plotting (sim_pixel_noise): " << sim_pixel_noise << endl;
 				cout << "surface brightness threshold = " << sb_threshold << endl;
@@ -1358,6 +1719,13 @@ void Lens::process_commands(bool read_file)
 				Complain("must specify filename for input file to be read");
 			} else Complain("invalid number of arguments; must specify one filename to be read");
 		}
+		else if (words[0]=="batch")
+		{
+			if (nwords < 2) Complain("must specify manifest file for batch run");
+			if (nwords > 3) Complain("invalid number of arguments; must specify manifest file, and optionally the output directory");
+			string batch_dir = (nwords==3) ? words[2] : "batch";
+			run_batch(words[1],batch_dir);
+		}
 		else if (words[0]=="write")
 		{
 			if (nwords == 2) {
@@ -2750,7 +3118,7 @@ void Lens::process_commands(bool read_file)
 				else Complain("testmodel requires 4 parameters (q, theta, xc, yc)");
 			}
 			else Complain("unrecognized lens model");
-			if ((vary_parameters) and ((fitmethod == NESTED_SAMPLING) or (fitmethod == TWALK))) {
+			if ((vary_parameters) and ((fitmethod == NESTED_SAMPLING) or (fitmethod == TWALK) or (fitmethod == DIFFERENTIAL_EVOLUTION))) {
 				int nvary=0;
 				for (int i=0; i < nparams_to_vary; i++) if (vary_flags[i]==true) nvary++;
 				if (nvary != 0) {
@@ -2794,7 +3162,7 @@ void Lens::process_commands(bool read_file)
 				add_shear_lens(shear_param_vals[0], shear_param_vals[1], 0, 0);
 				lens_list[nlens-1]->anchor_center_to_lens(lens_list,nlens-2);
 				if (vary_parameters) lens_list[nlens-1]->vary_parameters(shear_vary_flags);
-				if ((vary_parameters) and ((fitmethod == NESTED_SAMPLING) or (fitmethod == TWALK))) {
+				if ((vary_parameters) and ((fitmethod == NESTED_SAMPLING) or (fitmethod == TWALK) or (fitmethod == DIFFERENTIAL_EVOLUTION))) {
 					int nvary_shear=0;
 					for (int i=0; i < 2; i++) if (shear_vary_flags[i]==true) nvary_shear++;
 					if (nvary_shear==0) continue;
@@ -2835,10 +3203,27 @@ void Lens::process_commands(bool read_file)
 				}
 			}
 		}
-		else if (words[0]=="source")
+		else if ((words[0]=="source") or ((words[0]=="fit") and (nwords > 1) and (words[1]=="source")))
 		{
+			bool vary_parameters = false;
+			int n_sb_initial = n_sb;
+			if (words[0]=="fit") {
+				if ((nwords > 2) and (words[2]=="clear")) Complain("use 'source clear' to remove source objects");
+				vary_parameters = true;
+				// remove the "fit" word from the line so the source object is added the same way, but with
+				// vary_parameters==true so we'll prompt for an extra line to vary parameters (as with 'fit lens')
+				stringstream* new_ws = new stringstream[nwords-1];
+				for (int i=0; i < nwords-1; i++) {
+					words[i] = words[i+1];
+					new_ws[i] << words[i];
+				}
+				words.pop_back();
+				nwords--;
+				delete[] ws;
+				ws = new_ws;
+			}
 			if (nwords==1) {
-				print_source_list();
+				print_source_list(vary_parameters);
 			}
 			else if (words[1]=="clear")
 			{
@@ -2936,6 +3321,56 @@ void Lens::process_commands(bool read_file)
 				else Complain("spline requires at least 2 parameters (filename, q)");
 			}
 			else Complain("source model not recognized");
+			if ((vary_parameters) and (n_sb > n_sb_initial)) {
+				SB_Profile *new_sb = sb_list[n_sb-1];
+				int nparams = new_sb->get_n_params();
+				if (read_command(false)==false) { remove_source_object(n_sb-1); return; }
+				if (nwords != nparams) {
+					remove_source_object(n_sb-1);
+					if (nparams==7) Complain("Must specify vary flags for seven parameters in source model (model-specific parameters, then q,theta,xc,yc)");
+					else Complain("Must specify vary flags for six parameters in source model (model-specific parameters, then q,theta,xc,yc)");
+				}
+				boolvector vary_flags(nparams);
+				for (int i=0; i < nparams; i++) if (!(ws[i] >> vary_flags[i])) { remove_source_object(n_sb-1); Complain("Invalid vary flag (must specify 0 or 1)"); }
+				new_sb->vary_parameters(vary_flags);
+				int nvary = new_sb->get_n_vary_params();
+				if ((nvary != 0) and ((fitmethod == NESTED_SAMPLING) or (fitmethod == TWALK) or (fitmethod == DIFFERENTIAL_EVOLUTION))) {
+					dvector lower(nvary), upper(nvary), lower_initial(nvary), upper_initial(nvary);
+					double *param_vals = new double[nparams];
+					new_sb->get_parameters(param_vals);
+					vector<string> paramnames;
+					new_sb->get_fit_parameter_names(paramnames);
+					int i,j;
+					bool invalid_limits = false;
+					for (i=0, j=0; j < nparams; j++) {
+						if (vary_flags[j]) {
+							if ((mpi_id==0) and (verbal_mode)) cout << "limits for parameter " << paramnames[i] << ":\n";
+							if (read_command(false)==false) { invalid_limits = true; break; }
+							if ((nwords < 2) or (nwords > 4)) { invalid_limits = true; break; }
+							if (!(ws[0] >> lower[i])) { invalid_limits = true; break; }
+							if (!(ws[1] >> upper[i])) { invalid_limits = true; break; }
+							if (nwords == 2) {
+								lower_initial[i] = lower[i];
+								upper_initial[i] = upper[i];
+							} else if (nwords == 3) {
+								double width;
+								if (!(ws[2] >> width)) { invalid_limits = true; break; }
+								lower_initial[i] = param_vals[j] - width;
+								upper_initial[i] = param_vals[j] + width;
+							} else {
+								if (!(ws[2] >> lower_initial[i])) { invalid_limits = true; break; }
+								if (!(ws[3] >> upper_initial[i])) { invalid_limits = true; break; }
+							}
+							if (lower_initial[i] < lower[i]) lower_initial[i] = lower[i];
+							if (upper_initial[i] > upper[i]) upper_initial[i] = upper[i];
+							i++;
+						}
+					}
+					delete[] param_vals;
+					if (invalid_limits) { remove_source_object(n_sb-1); Complain("must specify two/four arguments: lower limit, upper limit, and (optional) initial lower limit, initial upper limit"); }
+					new_sb->set_limits(lower,upper,lower_initial,upper_initial);
+				}
+			}
 		}
 		else if (words[0]=="fit")
 		{
@@ -2950,6 +3385,7 @@ void Lens::process_commands(bool read_file)
 							else if (fitmethod==SIMPLEX) cout << "Fit method: simplex" << endl;
 							else if (fitmethod==NESTED_SAMPLING) cout << "Fit method: nest" << endl;
 							else if (fitmethod==TWALK) cout << "Fit method: twalk" << endl;
+							else if (fitmethod==DIFFERENTIAL_EVOLUTION) cout << "Fit method: de" << endl;
 							else {
 								cout << "Unknown fit method" << endl;
 							}
@@ -2960,6 +3396,7 @@ void Lens::process_commands(bool read_file)
 						else if (setword=="simplex") set_fitmethod(SIMPLEX);
 						else if (setword=="nest") set_fitmethod(NESTED_SAMPLING);
 						else if (setword=="twalk") set_fitmethod(TWALK);
+						else if (setword=="de") set_fitmethod(DIFFERENTIAL_EVOLUTION);
 						else Complain("invalid argument to 'fit method' command; must specify valid fit method");
 					} else Complain("invalid number of arguments; can only specify fit method type");
 				}
@@ -3241,17 +3678,61 @@ void Lens::process_commands(bool read_file)
 						plot_chisq_1d(p,n,ip,fp,filename);
 					} else Complain("invalid number of parameters for command 'fit plot_chisq1d' (need parameter#,npoints,initial,final)");
 				}
+				else if (words[1]=="scan")
+				{
+					bool profile = false;
+					vector<string> args;
+					for (int i=2; i < nwords; i++) {
+						if (words[i]=="profile") profile = true;
+						else args.push_back(words[i]);
+					}
+					int nargs = args.size();
+					if ((nargs < 4) or (nargs > 9) or ((nargs > 5) and (nargs < 8))) Complain("invalid number of arguments for command 'fit scan' (need parameter#,npoints,initial,final for each scanned parameter)");
+					int p1, n1, p2=-1, n2=1;
+					double i1, f1, i2=0, f2=0;
+					stringstream as[9];
+					for (int i=0; i < nargs; i++) as[i] << args[i];
+					if (!(as[0] >> p1)) Complain("invalid parameter number");
+					if (!(as[1] >> n1)) Complain("invalid number of points");
+					if (!(as[2] >> i1)) Complain("invalid initial point");
+					if (!(as[3] >> f1)) Complain("invalid final point");
+					if (nargs >= 8) {
+						if (!(as[4] >> p2)) Complain("invalid parameter number");
+						if (!(as[5] >> n2)) Complain("invalid number of points");
+						if (!(as[6] >> i2)) Complain("invalid initial point");
+						if (!(as[7] >> f2)) Complain("invalid final point");
+					}
+					string filename = fit_output_filename + ".scan";
+					if ((nargs==5) or (nargs==9)) filename = args[nargs-1];
+					if (Profiler::is_active()) Profiler::reset();
+					chisq_scan(p1,n1,i1,f1,p2,n2,i2,f2,profile,filename);
+					if (Profiler::is_active()) Profiler::write_report("fit scan");
+				}
 				else if (words[1]=="run")
 				{
+					if (Profiler::is_active()) Profiler::reset();
 					if (fitmethod==POWELL) chi_square_fit_powell();
 					else if (fitmethod==SIMPLEX) chi_square_fit_simplex();
 					else if (fitmethod==NESTED_SAMPLING) chi_square_nested_sampling();
 					else if (fitmethod==TWALK) chi_square_twalk();
+					else if (fitmethod==DIFFERENTIAL_EVOLUTION) chi_square_fit_de();
 					else Complain("unsupported fit method");
+					if (Profiler::is_active()) Profiler::write_report("fit run");
+				}
+				else if (words[1]=="resume")
+				{
+					if (nwords > 2) Complain("no arguments allowed for 'fit resume'");
+					if (Profiler::is_active()) Profiler::reset();
+					if (fitmethod==NESTED_SAMPLING) chi_square_nested_sampling(true);
+					else if (fitmethod==TWALK) chi_square_twalk(true);
+					else Complain("only nested sampling and T-Walk runs can be resumed");
+					if (Profiler::is_active()) Profiler::write_report("fit resume");
 				}
 				else if (words[1]=="chisq")
 				{
+					if (Profiler::is_active()) Profiler::reset();
 					chisq_single_evaluation();
+					if (Profiler::is_active()) Profiler::write_report("fit chisq");
 				}
 				else if (words[1]=="label")
 				{
@@ -3645,6 +4126,21 @@ void Lens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "total cross section: " << area << endl;
 			}
 		}
+		else if (words[0]=="mc_cross_section")
+		{
+			if (!islens()) Complain("must specify lens model first");
+			double precision = 0.01, slope = 0;
+			long int max_samples = 1000000;
+			unsigned long long seed = 1;
+			if (nwords > 5) Complain("too many arguments to 'mc_cross_section'");
+			if ((nwords > 1) and (!(ws[1] >> precision))) Complain("invalid target precision");
+			if ((nwords > 2) and (!(ws[2] >> max_samples))) Complain("invalid maximum number of samples");
+			if ((nwords > 3) and (!(ws[3] >> slope))) Complain("invalid number count slope");
+			if ((nwords > 4) and (!(ws[4] >> seed))) Complain("invalid random seed");
+			if (precision <= 0) Complain("target precision must be greater than zero");
+			if (max_samples < 1) Complain("maximum number of samples must be at least 1");
+			if (monte_carlo_cross_section(precision,max_samples,slope,seed,verbal_mode)==false) Complain("could not determine Monte Carlo cross section");
+		}
 		else if (words[0]=="cc_reset")
 		{
 			if (use_cc_spline) delete_ccspline();
@@ -3826,6 +4322,41 @@ void Lens::process_commands(bool read_file)
 				} else Complain("could not find critical curves");
 			} else Complain("invalid number of arguments to 'plotlogmag'");
 		}
+		else if (words[0]=="profiling")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) {
+					Profiler::print_summary();
+					if (Profiler::get_report_filename() != "") cout << "Profile report file: " << Profiler::get_report_filename() << endl;
+				}
+			} else if (words[1]=="interval") {
+				int interval;
+				if (nwords != 3) Complain("must specify number of likelihood calls between reports");
+				if (!(ws[2] >> interval)) Complain("invalid number of likelihood calls");
+				if (interval < 0) Complain("number of likelihood calls between reports cannot be negative");
+				Profiler::set_report_interval(interval);
+			} else if (words[1]=="report") {
+				if (nwords > 3) Complain("too many arguments to 'profiling report'");
+				if (Profiler::get_report_filename()=="") Complain("profiling has not been turned on");
+				string label = (nwords==3) ? words[2] : "manual";
+				Profiler::write_report(label.c_str());
+			} else if (words[1]=="reset") {
+				if (nwords != 2) Complain("no arguments are allowed for 'profiling reset'");
+				Profiler::reset();
+			} else {
+				if (nwords > 3) Complain("invalid number of arguments; can only specify 'on' or 'off' and optional filename");
+				bool activate;
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'profiling' command; must specify 'on' or 'off'");
+				set_switch(activate,setword);
+				if (activate) {
+					string filename = fit_output_dir + "/" + fit_output_filename + ".profile.jsonl";
+					if (nwords==3) filename = words[2];
+					Profiler::set_report_filename(filename);
+					if (!Profiler::is_active()) Profiler::reset();
+				}
+				Profiler::set_active(activate);
+			}
+		}
 		else if (words[0]=="einstein")
 		{
 			if (!islens()) Complain("must specify lens model first");
@@ -3927,6 +4458,25 @@ void Lens::process_commands(bool read_file)
 				plot_images(words[1].c_str(), words[2].c_str(), verbal_mode);
 			else Complain("invalid number of arguments to command 'findimgs'");
 		}
+		else if (words[0]=="findimgs_batch")
+		{
+			if (!islens()) Complain("must specify lens model first");
+			if (nwords == 1)
+				find_images_batch("sourcexy.in", "images.bin", verbal_mode);
+			else if (nwords == 2)
+				find_images_batch(words[1].c_str(), "images.bin", verbal_mode);
+			else if (nwords == 3)
+				find_images_batch(words[1].c_str(), words[2].c_str(), verbal_mode);
+			else Complain("invalid number of arguments to command 'findimgs_batch'");
+		}
+		else if (words[0]=="convert_imgs_batch")
+		{
+			if (nwords == 2)
+				convert_batch_images_to_text(words[1].c_str(), "images.dat");
+			else if (nwords == 3)
+				convert_batch_images_to_text(words[1].c_str(), words[2].c_str());
+			else Complain("must specify batch image file, and optionally the output image file");
+		}
 		else if (words[0]=="plotimgs")
 		{
 			if (!islens()) Complain("must specify lens model first");
@@ -4084,6 +4634,97 @@ void Lens::process_commands(bool read_file)
 				if (image_pixel_data == NULL) Complain("no image pixel data has been loaded");
 				image_pixel_data->load_mask_fits(filename);
 			}
+			else if (words[1]=="loadnoise")
+			{
+				string filename;
+				bool weight_map = false;
+				if ((nwords==4) and (words[3]=="-weight")) weight_map = true;
+				else if (nwords != 3) Complain("invalid arguments to 'sbmap loadnoise' (type 'help sbmap loadnoise' for usage information)");
+				if (!(ws[2] >> filename)) Complain("invalid filename for noise map");
+				if (image_pixel_data == NULL) Complain("no image pixel data has been loaded");
+				bool status;
+				if (fits_format) status = image_pixel_data->load_noise_map_fits(filename,weight_map);
+				else status = image_pixel_data->load_noise_map(filename,weight_map);
+				if ((status) and (mpi_id==0)) {
+					int i,j,n_dropped=0;
+					for (j=0; j < image_pixel_data->npixels_y; j++) {
+						for (i=0; i < image_pixel_data->npixels_x; i++) {
+							if ((image_pixel_data->require_fit[i][j]) and (!image_pixel_data->fit_pixel(i,j))) n_dropped++;
+						}
+					}
+					if (n_dropped > 0) cout << "Noise map loaded; " << n_dropped << " pixels in the fit window have zero weight and will be excluded from the fit" << endl;
+				}
+			}
+			else if (words[1]=="addband")
+			{
+				string filename;
+				if (nwords==3) {
+					if (!(ws[2] >> filename)) Complain("invalid filename for image band");
+				} else Complain("one argument required for 'sbmap addband' (filename)");
+				if (image_pixel_data == NULL) Complain("main image data must be loaded first (using 'sbmap loadimg')");
+				if (add_image_band(filename)) {
+					if (mpi_id==0) cout << "Added image band " << n_extra_bands << endl;
+				} else Complain("could not load image band");
+			}
+			else if (words[1]=="band")
+			{
+				int band;
+				if (nwords < 3) Complain("band number must be specified for 'sbmap band'");
+				if (!(ws[2] >> band)) Complain("invalid band number");
+				if ((band < 1) or (band > n_extra_bands)) Complain("band number must be between 1 and the number of extra bands (" << n_extra_bands << ")");
+				ImagePixelBand& imgband = extra_bands[band-1];
+				if (nwords==3) {
+					if (mpi_id==0) {
+						cout << "band " << band << ": psf_width=(" << imgband.psf_width_x << "," << imgband.psf_width_y << ")";
+						if (imgband.data->noise_map_loaded()) cout << ", noise map loaded";
+						else cout << ", pixel_noise=" << imgband.pixel_noise;
+						cout << endl;
+					}
+				} else if (words[3]=="psf_width") {
+					double psfx, psfy;
+					if (nwords==5) {
+						if (!(ws[4] >> psfx)) Complain("invalid PSF width");
+						psfy = psfx;
+					} else if (nwords==6) {
+						if (!(ws[4] >> psfx)) Complain("invalid PSF x-width");
+						if (!(ws[5] >> psfy)) Complain("invalid PSF y-width");
+					} else Complain("one or two arguments required for 'sbmap band <n> psf_width'");
+					imgband.psf_width_x = psfx;
+					imgband.psf_width_y = psfy;
+				} else if (words[3]=="pixel_noise") {
+					double pnoise;
+					if (nwords != 5) Complain("one argument required for 'sbmap band <n> pixel_noise'");
+					if (!(ws[4] >> pnoise)) Complain("invalid pixel noise");
+					imgband.pixel_noise = pnoise;
+				} else if (words[3]=="loadnoise") {
+					string filename;
+					bool weight_map = false;
+					if ((nwords==6) and (words[5]=="-weight")) weight_map = true;
+					else if (nwords != 5) Complain("invalid arguments to 'sbmap band <n> loadnoise'");
+					if (!(ws[4] >> filename)) Complain("invalid filename for noise map");
+					if (fits_format) imgband.data->load_noise_map_fits(filename,weight_map);
+					else imgband.data->load_noise_map(filename,weight_map);
+				} else if (words[3]=="clearnoise") {
+					if (nwords != 4) Complain("no arguments are allowed for 'sbmap band <n> clearnoise'");
+					imgband.data->clear_noise_map();
+				} else Complain("unrecognized argument to 'sbmap band' (type 'help sbmap band' for usage information)");
+			}
+			else if (words[1]=="bands")
+			{
+				if (nwords != 2) Complain("no arguments are allowed for 'sbmap bands'");
+				if (mpi_id==0) print_image_bands();
+			}
+			else if (words[1]=="clearbands")
+			{
+				if (nwords != 2) Complain("no arguments are allowed for 'sbmap clearbands'");
+				clear_image_bands();
+			}
+			else if (words[1]=="clearnoise")
+			{
+				if (nwords != 2) Complain("no arguments are allowed for 'sbmap clearnoise'");
+				if (image_pixel_data == NULL) Complain("no image pixel data has been loaded");
+				image_pixel_data->clear_noise_map();
+			}
 			else if (words[1]=="loadpsf")
 			{
 				string filename;
@@ -4301,6 +4942,16 @@ void Lens::process_commands(bool read_file)
 					}
 				} else Complain("invalid number of arguments to 'sbmap plotsrc'");
 			}
+			else if (words[1]=="check_precision")
+			{
+				if (!islens()) Complain("must specify lens model first");
+				check_lmatrix_single_precision(false);
+			}
+			else if (words[1]=="check_multigrid")
+			{
+				if (!islens()) Complain("must specify lens model first");
+				check_multigrid_preconditioner(false);
+			}
 			else if (words[1]=="invert")
 			{
 				if (!islens()) Complain("must specify lens model first");
@@ -4346,6 +4997,45 @@ void Lens::process_commands(bool read_file)
 			} else Complain("only one argument (file label) allowed for 'sbmap plotlensinfo'");
 			plot_lensinfo_maps(file_root,n_image_pixels_x,n_image_pixels_y);
 		}
+		else if (words[0]=="lensmaps")
+		{
+			if (!islens()) Complain("must specify lens model first");
+			bool fits_output = false, single_precision = false;
+			bool include_plane[6];
+			int k, preview_factor = 0;
+			for (k=0; k < n_lensmap_planes; k++) include_plane[k] = true;
+			vector<string> args;
+			if (extract_word_starts_with('-',1,nwords-1,args)==true)
+			{
+				for (int i=0; i < args.size(); i++) {
+					if (args[i]=="-fits") fits_output = true;
+					else if (args[i]=="-single") single_precision = true;
+					else if (args[i].substr(0,9)=="-preview=") {
+						stringstream pstr(args[i].substr(9));
+						if ((!(pstr >> preview_factor)) or (preview_factor < 1)) Complain("invalid preview factor");
+					}
+					else if (args[i].substr(0,8)=="-planes=") {
+						for (k=0; k < n_lensmap_planes; k++) include_plane[k] = false;
+						stringstream pstr(args[i].substr(8));
+						string plane_name;
+						while (getline(pstr,plane_name,',')) {
+							for (k=0; k < n_lensmap_planes; k++) if (plane_name==lensmap_plane_names[k]) break;
+							if (k==n_lensmap_planes) Complain("lens map plane '" << plane_name << "' not recognized (options are kappa, mag, invmag, shear, defx, defy)");
+							include_plane[k] = true;
+						}
+					}
+					else Complain("argument '" << args[i] << "' not recognized");
+				}
+			}
+			string file_root;
+			if (nwords == 1) {
+				if (fit_output_filename == "fit") file_root = "lensmap";
+				else file_root = fit_output_filename;
+			} else if (nwords == 2) {
+				file_root = words[1];
+			} else Complain("only one argument (file label) allowed for 'lensmaps', plus options");
+			generate_lens_maps(file_root,n_image_pixels_x,n_image_pixels_y,include_plane,fits_output,single_precision,preview_factor,verbal_mode);
+		}
 		else if ((words[0]=="ptsize") or (words[0]=="ps"))
 		{
 			if (mpi_id==0) {
@@ -4430,6 +5120,33 @@ void Lens::process_commands(bool read_file)
 				Shear::use_shear_component_params = use_comps;
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="lens_tree")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) {
+					cout << "Tree summation of compact lenses: " << display_switch(use_lens_tree);
+					if ((lens_tree != NULL) and (lens_tree->in_use())) cout << " (" << lens_tree->n_members() << " of " << nlens << " lenses in tree, " << lens_tree->n_nodes() << " cells)";
+					else if (use_lens_tree) cout << " (not in use; fewer than " << lens_tree_min_members << " compact lenses)";
+					cout << endl;
+				}
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'lens_tree' command; must specify 'on' or 'off'");
+				set_switch(use_lens_tree,setword);
+				reset();
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="lens_tree_acc")
+		{
+			double acc;
+			if (nwords == 2) {
+				if (!(ws[1] >> acc)) Complain("invalid lens tree accuracy");
+				if ((acc <= 0) or (acc >= 1)) Complain("lens tree accuracy must be between 0 and 1");
+				lens_tree_accuracy = acc;
+				reset();
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "lens tree accuracy = " << lens_tree_accuracy << endl;
+			} else Complain("must specify either zero or one argument (lens tree accuracy)");
+		}
 		else if (words[0]=="ellipticity_components")
 		{
 			if (nwords==1) {
@@ -4532,6 +5249,30 @@ void Lens::process_commands(bool read_file)
 				set_switch(auto_ccspline,setword);
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="cc_marching")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Marching squares critical curves: " << display_switch(use_cc_marching_squares) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'cc_marching' command; must specify 'on' or 'off'");
+				set_switch(use_cc_marching_squares,setword);
+				reset_grid();
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="cc_marching_npixels")
+		{
+			int nx, ny;
+			if (nwords==3) {
+				if (!(ws[1] >> nx)) Complain("invalid number of mesh cells along x");
+				if (!(ws[2] >> ny)) Complain("invalid number of mesh cells along y");
+				if ((nx < 2) or (ny < 2)) Complain("marching squares mesh must have at least two cells along each axis");
+				cc_marching_nx = nx;
+				cc_marching_ny = ny;
+				if (use_cc_marching_squares) reset_grid();
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Marching squares mesh: " << cc_marching_nx << " " << cc_marching_ny << endl;
+			} else Complain("must specify either zero or two arguments (nx, ny)");
+		}
 		else if (words[0]=="autocenter")
 		{
 			if (nwords==1) {
@@ -4687,6 +5428,15 @@ void Lens::process_commands(bool read_file)
 				set_switch(calculate_parameter_errors,setword);
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="adaptive_fisher")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Adaptive Fisher matrix step sizes: " << display_switch(adaptive_fisher_steps) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'adaptive_fisher' command; must specify 'on' or 'off'");
+				set_switch(adaptive_fisher_steps,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
 		else if (words[0]=="central_image")
 		{
 			if (nwords==1) {
@@ -5003,6 +5753,17 @@ void Lens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "Point spread function (PSF) width = (" << psf_width_x << "," << psf_width_y << ")\n";
 			} else Complain("can only specify up to two arguments for PSF width (x-width,y-width)");
 		}
+		else if (words[0]=="source_supersampling")
+		{
+			int nsplit;
+			if (nwords == 2) {
+				if (!(ws[1] >> nsplit)) Complain("invalid number of subpixel splittings");
+				if (nsplit < 1) Complain("number of subpixel splittings must be at least 1");
+				source_supersampling = nsplit;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Subpixel splittings for parameterized source = " << source_supersampling << endl;
+			} else Complain("only one argument allowed for source_supersampling");
+		}
 		else if (words[0]=="psf_threshold")
 		{
 			double threshold;
@@ -5132,6 +5893,40 @@ void Lens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "cooling factor for downhill simplex = " << simplex_cooling_factor << endl;
 			} else Complain("must specify either zero or one argument (cooling factor for downhill simplex)");
 		}
+		else if (words[0]=="de_popsize")
+		{
+			int np;
+			if (nwords == 2) {
+				if (!(ws[1] >> np)) Complain("invalid population size for differential evolution");
+				if ((np < 0) or ((np > 0) and (np < 4))) Complain("population size for differential evolution must be at least 4 (or 0 to set automatically)");
+				de_population_size = np;
+			} else if (nwords==1) {
+				if (mpi_id==0) {
+					if (de_population_size==0) cout << "Population size for differential evolution: automatic" << endl;
+					else cout << "Population size for differential evolution = " << de_population_size << endl;
+				}
+			} else Complain("must specify either zero or one argument (population size for differential evolution, or 0 for automatic)");
+		}
+		else if (words[0]=="de_ngen")
+		{
+			int ngen;
+			if (nwords == 2) {
+				if (!(ws[1] >> ngen)) Complain("invalid maximum number of generations for differential evolution");
+				if (ngen < 1) Complain("maximum number of generations for differential evolution must be at least one");
+				de_max_generations = ngen;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Maximum number of generations for differential evolution = " << de_max_generations << endl;
+			} else Complain("must specify either zero or one argument (maximum number of generations for differential evolution)");
+		}
+		else if (words[0]=="de_polish")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Refine differential evolution best-fit point with downhill simplex: " << display_switch(de_polish) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'de_polish' command; must specify 'on' or 'off'");
+				set_switch(de_polish,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
 		else if (words[0]=="mcmc_chains")
 		{
 			int nt;
@@ -5153,6 +5948,51 @@ void Lens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "MCMC tolerance = " << mcmc_tolerance << endl;
 			} else Complain("must specify either zero or one argument (tolerance for MCMC)");
 		}
+		else if (words[0]=="mcmc_checkpoint")
+		{
+			int interval;
+			if (nwords == 2) {
+				if (!(ws[1] >> interval)) Complain("invalid number of iterations between sampler checkpoints");
+				if (interval < 0) Complain("checkpoint interval cannot be negative");
+				mcmc_checkpoint_interval = interval;
+			} else if (nwords==1) {
+				if (mpi_id==0) {
+					if (mcmc_checkpoint_interval==0) cout << "Sampler checkpoints: off" << endl;
+					else cout << "Iterations between sampler checkpoints = " << mcmc_checkpoint_interval << endl;
+				}
+			} else Complain("must specify either zero or one argument (number of iterations between checkpoints, or 0 for none)");
+		}
+		else if (words[0]=="twalk_threads")
+		{
+			int nt;
+			if (nwords == 2) {
+				if (!(ws[1] >> nt)) Complain("invalid number of concurrent T-Walk chains");
+				if (nt < 1) Complain("number of concurrent T-Walk chains must be at least one");
+				twalk_threads = nt;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "number of T-Walk chains moved concurrently per process = " << twalk_threads << endl;
+			} else Complain("must specify either zero or one argument (number of concurrent T-Walk chains)");
+		}
+		else if (words[0]=="loglike_cache")
+		{
+			int n;
+			if (nwords == 2) {
+				if (!(ws[1] >> n)) Complain("invalid number of cached likelihood evaluations");
+				if (n < 0) Complain("number of cached likelihood evaluations cannot be negative");
+				loglike_cache_size = n;
+			} else if (nwords==1) {
+				if (mpi_id==0) {
+					if (loglike_cache_size==0) cout << "Likelihood cache: off" << endl;
+					else cout << "Likelihood cache size = " << loglike_cache_size << " evaluations" << endl;
+					if (loglike_cache != NULL) {
+						long int lookups = loglike_cache->hits() + loglike_cache->misses();
+						cout << "Most recent fit: " << loglike_cache->hits() << " hits, " << loglike_cache->misses() << " misses";
+						if (lookups > 0) cout << " (hit rate " << (100.0*loglike_cache->hits())/lookups << "%)";
+						cout << endl;
+					}
+				}
+			} else Complain("must specify either zero or one argument (number of cached likelihood evaluations, or 0 for none)");
+		}
 		else if (words[0]=="mcmclog")
 		{
 			if (nwords==1) {
@@ -5398,6 +6238,75 @@ void Lens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "inversion # of threads = " << nt << endl;
 			} else Complain("must specify either zero or one argument (number of threads for inversion)");
 		}
+		else if (words[0]=="logdet_nprobes")
+		{
+			int np;
+			if (nwords == 2) {
+				if (!(ws[1] >> np)) Complain("invalid number of probe vectors");
+				if (np < 1) Complain("number of probe vectors must be at least 1");
+				logdet_nprobes = np;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "number of probe vectors for stochastic log-determinant = " << logdet_nprobes << endl;
+			} else Complain("must specify either zero or one argument (number of probe vectors)");
+		}
+		else if (words[0]=="logdet_lanczos_steps")
+		{
+			int nsteps;
+			if (nwords == 2) {
+				if (!(ws[1] >> nsteps)) Complain("invalid number of Lanczos steps");
+				if (nsteps < 1) Complain("number of Lanczos steps must be at least 1");
+				logdet_lanczos_steps = nsteps;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "number of Lanczos steps for stochastic log-determinant = " << logdet_lanczos_steps << endl;
+			} else Complain("must specify either zero or one argument (number of Lanczos steps)");
+		}
+		else if (words[0]=="mpi_image_decomp")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Divide image pixels among MPI processes when building lensing matrices: " << display_switch(mpi_image_decomposition) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'mpi_image_decomp' command; must specify 'on' or 'off'");
+				set_switch(mpi_image_decomposition,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="lmatrix_single_precision")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Single-precision Lmatrix: " << display_switch(lmatrix_single_precision) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'lmatrix_single_precision' command; must specify 'on' or 'off'");
+				set_switch(lmatrix_single_precision,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="cg_multigrid")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Multigrid preconditioner for CG inversion: " << display_switch(use_multigrid_preconditioner) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'cg_multigrid' command; must specify 'on' or 'off'");
+				set_switch(use_multigrid_preconditioner,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="delaunay_srcgrid")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Delaunay source grid: " << display_switch(use_delaunay_srcgrid) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'delaunay_srcgrid' command; must specify 'on' or 'off'");
+				set_switch(use_delaunay_srcgrid,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="delaunay_stride")
+		{
+			int stride;
+			if (nwords == 2) {
+				if (!(ws[1] >> stride)) Complain("invalid Delaunay source grid stride");
+				if (stride < 1) Complain("Delaunay source grid stride must be at least 1");
+				delaunay_srcgrid_stride = stride;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Delaunay source grid stride = " << delaunay_srcgrid_stride << endl;
+			} else Complain("must specify either zero or one argument (stride)");
+		}
 		else if (words[0]=="raytrace_method") {
 			if (nwords==1) {
 				if (mpi_id==0) {
@@ -5420,6 +6329,7 @@ void Lens::process_commands(bool read_file)
 					if (inversion_method==MUMPS) cout << "Lensing inversion method: LDL factorization (MUMPS)" << endl;
 					else if (inversion_method==UMFPACK) cout << "Lensing inversion method: LU factorization (UMFPACK)" << endl;
 					else if (inversion_method==CG_Method) cout << "Lensing inversion method: conjugate gradient method" << endl;
+					else if (inversion_method==Matrix_Free_CG) cout << "Lensing inversion method: matrix-free conjugate gradient method" << endl;
 					else cout << "Unknown inversion method" << endl;
 				}
 			} else if (nwords==2) {
@@ -5427,6 +6337,7 @@ void Lens::process_commands(bool read_file)
 				if (setword=="mumps") inversion_method = MUMPS;
 				else if (setword=="umfpack") inversion_method = UMFPACK;
 				else if (setword=="cg") inversion_method = CG_Method;
+				else if (setword=="matrix_free") inversion_method = Matrix_Free_CG;
 				else Complain("invalid argument to 'inversion_method' command; must specify valid inversion method");
 			} else Complain("invalid number of arguments; can only inversion method");
 		}
@@ -5571,6 +6482,207 @@ bool Lens::open_command_file(char *filename)
 	return (infile.is_open()) ? true : false;
 }
 
+bool Lens::expand_batch_template(const string template_filename, map<string,string>& vars, const string script_filename, string& errmsg)
+{
+	// copies the template to the script file, replacing each ${var} by its value
+	ifstream template_file(template_filename.c_str());
+	if (!template_file.is_open()) { errmsg = "could not open template file '" + template_filename + "'"; return false; }
+	ofstream script_file(script_filename.c_str());
+	if (!script_file.is_open()) { errmsg = "could not create script file '" + script_filename + "'"; return false; }
+	string templine, varname;
+	size_t pos, end;
+	map<string,string>::iterator it;
+	while (getline(template_file,templine)) {
+		pos = 0;
+		while ((pos = templine.find("${",pos)) != string::npos) {
+			if ((end = templine.find('}',pos)) == string::npos) { errmsg = "unterminated variable in line '" + templine + "'"; return false; }
+			varname = templine.substr(pos+2,end-pos-2);
+			if ((it = vars.find(varname)) == vars.end()) { errmsg = "variable '" + varname + "' is not defined"; return false; }
+			templine.replace(pos,end-pos+1,it->second);
+			pos += it->second.size();
+		}
+		script_file << templine << endl;
+	}
+	return true;
+}
+
+bool Lens::run_batch(const string manifest_filename, const string batch_dir)
+{
+	// Each line of the manifest has the form '<name> <template_script> [var=value ...]'. For each system, the template is
+	// copied to '<batch_dir>/<name>.in' with every ${var} replaced by its value (${name} and ${outdir} are also defined,
+	// the latter being the directory '<batch_dir>/<name>' where the fit output goes), and the script is then run on a new
+	// Lens object that inherits the current settings, with its output written to '<batch_dir>/<name>.log'. Since all the
+	// systems are run by the same process, the MPI communicators, threads and cosmology are only set up once. The systems
+	// are divided among the MPI groups (if qlens is run with '-g'), and all the processes in a group work together on each
+	// of its systems, as they would on a single system. An error in a script ends that system (rather than the program),
+	// and its status is recorded as 'failed' in the summary table '<batch_dir>/summary.dat'.
+	ifstream manifest(manifest_filename.c_str());
+	if (!manifest.is_open()) { warn("could not open manifest file '%s'",manifest_filename.c_str()); return false; }
+	vector<string> names, templates;
+	vector< map<string,string> > system_vars;
+	string manifest_line, word;
+	size_t pos;
+	int line_number = 0;
+	while (getline(manifest,manifest_line)) {
+		line_number++;
+		remove_comments(manifest_line);
+		istringstream linestream(manifest_line);
+		vector<string> linewords;
+		while (linestream >> word) linewords.push_back(word);
+		if (linewords.size()==0) continue;
+		if (linewords.size()==1) { warn("line %i of manifest must give both the system name and its template script",line_number); return false; }
+		map<string,string> vars;
+		vars["name"] = linewords[0];
+		vars["outdir"] = batch_dir + "/" + linewords[0];
+		for (int j=2; j < linewords.size(); j++) {
+			if (((pos = linewords[j].find('=')) == string::npos) or (pos==0)) { warn("invalid variable assignment '%s' in line %i of manifest (must be var=value)",linewords[j].c_str(),line_number); return false; }
+			vars[linewords[j].substr(0,pos)] = linewords[j].substr(pos+1);
+		}
+		names.push_back(linewords[0]);
+		templates.push_back(linewords[1]);
+		system_vars.push_back(vars);
+	}
+	int i, n_systems = names.size();
+	if (n_systems==0) { warn("no lens systems found in manifest file '%s'",manifest_filename.c_str()); return false; }
+
+	if (mpi_id==0) {
+		struct stat sb;
+		if ((stat(batch_dir.c_str(),&sb) != 0) or (S_ISDIR(sb.st_mode)==false)) mkdir(batch_dir.c_str(),S_IRWXU | S_IRWXG);
+		cout << "Running batch of " << n_systems << " lens systems";
+		if (mpi_ngroups > 1) cout << " over " << mpi_ngroups << " MPI groups";
+		cout << "..." << endl;
+	}
+#ifdef USE_MPI
+	MPI_Barrier(mpi_comm);
+#endif
+
+	string summary_rows, errmsg;
+	int n_failed = 0;
+	for (i=0; i < n_systems; i++) {
+		if (i % mpi_ngroups != group_num) continue;
+		string script_filename = batch_dir + "/" + names[i] + ".in";
+		string log_filename = batch_dir + "/" + names[i] + ".log";
+		int template_ok = 1;
+		if (group_id==0) {
+			if (!expand_batch_template(templates[i],system_vars[i],script_filename,errmsg)) template_ok = 0;
+		}
+#ifdef USE_MPI
+		MPI_Bcast(&template_ok,1,MPI_INT,0,*group_comm);
+#endif
+		double wtime;
+#ifdef USE_OPENMP
+		double wtime0 = omp_get_wtime();
+#else
+		clock_t clocktime0 = clock();
+#endif
+		Lens *system_lens = NULL;
+		if (template_ok) {
+			system_lens = new Lens(this);
+#ifdef USE_MPI
+			// the processes in this group act as if they were the only ones running
+			system_lens->mpi_id = group_id;
+			system_lens->mpi_np = group_np;
+			system_lens->mpi_ngroups = 1;
+			system_lens->group_num = 0;
+			system_lens->Set_MCMC_MPI_Comm(*group_comm);
+			if (group_np==1) system_lens->Set_MCMC_MPI(1,0);
+			else {
+				int group_leader = 0;
+				system_lens->Set_MCMC_MPI(group_np,group_id,1,0,&group_leader);
+			}
+#endif
+			system_lens->fit_output_dir = system_vars[i]["outdir"];
+			system_lens->auto_fit_output_dir = false;
+			system_lens->chisq_bestfit = 1e30;
+			system_lens->batch_system = true;
+			system_lens->batch_system_failed = false;
+			system_lens->quit_after_error = true;
+			system_lens->quit_after_reading_file = true;
+			system_lens->create_output_directory();
+
+			// the output of each system goes to its own log file (which only the group leader writes to)
+			ofstream logfile;
+			if (group_id==0) logfile.open(log_filename.c_str());
+			streambuf *coutbuf = cout.rdbuf(), *cerrbuf = cerr.rdbuf();
+			cout.rdbuf(logfile.rdbuf());
+			cerr.rdbuf(logfile.rdbuf());
+			system_lens->infile.open(script_filename.c_str());
+			if (system_lens->infile.is_open()) system_lens->process_commands(true);
+			else {
+				cerr << "Error: could not open script file '" << script_filename << "'" << endl;
+				system_lens->batch_system_failed = true;
+			}
+			cout.rdbuf(coutbuf);
+			cerr.rdbuf(cerrbuf);
+			cout.clear();
+			cerr.clear();
+		}
+#ifdef USE_OPENMP
+		wtime = omp_get_wtime() - wtime0;
+#else
+		wtime = ((double) (clock() - clocktime0)) / CLOCKS_PER_SEC;
+#endif
+		if (group_id==0) {
+			ostringstream row;
+			row << setprecision(10) << i << " " << names[i] << " ";
+			if (!template_ok) row << "template_error " << wtime << " -";
+			else {
+				row << ((system_lens->batch_system_failed) ? "failed " : "ok ") << wtime << " ";
+				if (system_lens->chisq_bestfit < 1e30) {
+					row << system_lens->chisq_bestfit;
+					for (int j=0; j < system_lens->bestfitparams.size(); j++) {
+						if (j < system_lens->fit_parameter_names.size()) row << " " << system_lens->fit_parameter_names[j] << "=" << system_lens->bestfitparams[j];
+						else row << " " << system_lens->bestfitparams[j];
+					}
+				} else row << "-";
+			}
+			if ((!template_ok) or (system_lens->batch_system_failed)) n_failed++;
+			summary_rows += row.str() + "\n";
+			if (!template_ok) warn("system '%s': %s",names[i].c_str(),errmsg.c_str());
+		}
+		if (system_lens != NULL) delete system_lens;
+	}
+
+	// the group leaders send their rows of the summary table to the root process, which writes them in manifest order
+#ifdef USE_MPI
+	int n_chars = summary_rows.size();
+	int *counts = new int[mpi_np];
+	int *displs = new int[mpi_np];
+	MPI_Gather(&n_chars, 1, MPI_INT, counts, 1, MPI_INT, 0, mpi_comm);
+	MPI_Allreduce(MPI_IN_PLACE, &n_failed, 1, MPI_INT, MPI_SUM, mpi_comm);
+	char *all_rows = NULL;
+	if (mpi_id==0) {
+		int total = 0;
+		for (i=0; i < mpi_np; i++) { displs[i] = total; total += counts[i]; }
+		all_rows = new char[total+1];
+		all_rows[total] = 0;
+	}
+	MPI_Gatherv((char*) summary_rows.c_str(), n_chars, MPI_CHAR, all_rows, counts, displs, MPI_CHAR, 0, mpi_comm);
+	if (mpi_id==0) {
+		summary_rows.assign(all_rows);
+		delete[] all_rows;
+	}
+	delete[] counts;
+	delete[] displs;
+#endif
+	if (mpi_id==0) {
+		vector<string> rows(n_systems);
+		istringstream rowstream(summary_rows);
+		string row;
+		int indx;
+		while (getline(rowstream,row)) {
+			istringstream(row) >> indx;
+			rows[indx] = row.substr(row.find(' ')+1);
+		}
+		string summary_filename = batch_dir + "/summary.dat";
+		ofstream summary(summary_filename.c_str());
+		summary << "# name status wtime chisq_bestfit [best-fit parameters]" << endl;
+		for (i=0; i < n_systems; i++) summary << rows[i] << endl;
+		cout << "Batch finished: " << n_systems-n_failed << " of " << n_systems << " systems ran successfully; summary written to '" << summary_filename << "'" << endl;
+	}
+	return (n_failed==0);
+}
+
 void Lens::remove_equal_sign(void)
 {
 	int pos;
@@ -0,0 +1,326 @@
+#include "delaunay.h"
+#include "errors.h"
+#include <cmath>
+using namespace std;
+
+Delaunay::Delaunay(const double *xvals, const double *yvals, const int n)
+{
+	// The points are inserted one at a time (Bowyer-Watson): the triangles whose circumcircles contain the new point are
+	// removed, and the resulting cavity is re-triangulated by connecting its boundary edges to the new point. Each point
+	// is located by walking from the most recently created triangle, which is fast if consecutive points are close together
+	// (e.g. if they come from neighboring image pixels).
+	n_pts = n;
+	x = new double[n+3];
+	y = new double[n+3];
+	included = new bool[n];
+	int i;
+	xmin = 1e30; xmax = -1e30; ymin = 1e30; ymax = -1e30;
+	for (i=0; i < n; i++) {
+		x[i] = xvals[i];
+		y[i] = yvals[i];
+		included[i] = true;
+		if (x[i] < xmin) xmin = x[i];
+		if (x[i] > xmax) xmax = x[i];
+		if (y[i] < ymin) ymin = y[i];
+		if (y[i] > ymax) ymax = y[i];
+	}
+	if (n < 3) die("need at least three points to construct a Delaunay triangulation");
+	double xc, yc, d;
+	xc = 0.5*(xmin+xmax);
+	yc = 0.5*(ymin+ymax);
+	d = (xmax-xmin > ymax-ymin) ? xmax-xmin : ymax-ymin;
+	if (d==0) d = 1;
+	// the super-triangle is made large so that it does not cut off triangles along the convex hull of the points
+	x[n] = xc - 20*d; y[n] = yc - 10*d;
+	x[n+1] = xc + 20*d; y[n+1] = yc - 10*d;
+	x[n+2] = xc; y[n+2] = yc + 20*d;
+
+	Triangle super;
+	for (i=0; i < 3; i++) {
+		super.vertex[i] = n+i;
+		super.neighbor[i] = -1;
+	}
+	triangles.reserve(2*n+10);
+	triangles.push_back(super);
+	alive.push_back(true);
+	cavity_stamp.push_back(0);
+	stamp = 0;
+
+	int last_triangle = 0;
+	for (i=0; i < n; i++) insert_point(i,last_triangle);
+	remove_super_triangle();
+	fill_hull_concavities();
+}
+
+inline double Delaunay::orientation(const int a, const int b, const double xp, const double yp)
+{
+	// positive if the point is to the left of the line going from point a to point b
+	return ((x[b]-x[a])*(yp-y[a]) - (y[b]-y[a])*(xp-x[a]));
+}
+
+inline bool Delaunay::in_circumcircle(const Triangle& tri, const double xp, const double yp)
+{
+	double ax, ay, bx, by, cx, cy;
+	ax = x[tri.vertex[0]] - xp; ay = y[tri.vertex[0]] - yp;
+	bx = x[tri.vertex[1]] - xp; by = y[tri.vertex[1]] - yp;
+	cx = x[tri.vertex[2]] - xp; cy = y[tri.vertex[2]] - yp;
+	double det = (ax*ax+ay*ay)*(bx*cy-cx*by) - (bx*bx+by*by)*(ax*cy-cx*ay) + (cx*cx+cy*cy)*(ax*by-bx*ay);
+	return (det > 0);
+}
+
+int Delaunay::walk_to_triangle(const double xp, const double yp, int tri)
+{
+	// Returns the triangle containing the point, -1 if the walk leaves the triangulation, or -2 if it does not terminate
+	// (which can only happen in degenerate cases)
+	int k, next, steps, max_steps = triangles.size();
+	for (steps=0; steps < max_steps; steps++) {
+		const Triangle& t = triangles[tri];
+		next = tri;
+		for (k=0; k < 3; k++) {
+			if (orientation(t.vertex[(k+1)%3],t.vertex[(k+2)%3],xp,yp) < 0) { next = t.neighbor[k]; break; }
+		}
+		if (next==tri) return tri;
+		if (next==-1) return -1;
+		tri = next;
+	}
+	return -2;
+}
+
+int Delaunay::search_all_triangles(const double xp, const double yp)
+{
+	int i,k;
+	for (i=0; i < triangles.size(); i++) {
+		if (!alive[i]) continue;
+		for (k=0; k < 3; k++) {
+			if (orientation(triangles[i].vertex[(k+1)%3],triangles[i].vertex[(k+2)%3],xp,yp) < 0) break;
+		}
+		if (k==3) return i;
+	}
+	return -1;
+}
+
+void Delaunay::insert_point(const int p, int& last_triangle)
+{
+	double xp = x[p], yp = y[p];
+	int tri = walk_to_triangle(xp,yp,last_triangle);
+	if (tri < 0) tri = search_all_triangles(xp,yp);
+	if (tri < 0) die("could not locate point %i in Delaunay triangulation",p);
+	int i,k,l;
+	for (k=0; k < 3; k++) {
+		if ((x[triangles[tri].vertex[k]]==xp) and (y[triangles[tri].vertex[k]]==yp)) {
+			included[p] = false;
+			return;
+		}
+	}
+
+	// find the cavity: all the triangles (connected to the one containing the point) whose circumcircles contain the point
+	int nb;
+	stamp++;
+	cavity.clear();
+	cavity.push_back(tri);
+	cavity_stamp[tri] = stamp;
+	for (i=0; i < cavity.size(); i++) {
+		for (k=0; k < 3; k++) {
+			nb = triangles[cavity[i]].neighbor[k];
+			if ((nb >= 0) and (cavity_stamp[nb] != stamp) and (in_circumcircle(triangles[nb],xp,yp))) {
+				cavity_stamp[nb] = stamp;
+				cavity.push_back(nb);
+			}
+		}
+	}
+
+	// connect each boundary edge of the cavity to the new point
+	Triangle t, newtri;
+	int c, indx;
+	new_triangles.clear();
+	for (i=0; i < cavity.size(); i++) {
+		c = cavity[i];
+		t = triangles[c]; // copied, since adding triangles may reallocate the vector
+		alive[c] = false;
+		for (k=0; k < 3; k++) {
+			nb = t.neighbor[k];
+			if ((nb >= 0) and (cavity_stamp[nb]==stamp)) continue;
+			newtri.vertex[0] = t.vertex[(k+1)%3];
+			newtri.vertex[1] = t.vertex[(k+2)%3];
+			newtri.vertex[2] = p;
+			newtri.neighbor[0] = newtri.neighbor[1] = -1;
+			newtri.neighbor[2] = nb;
+			indx = triangles.size();
+			triangles.push_back(newtri);
+			alive.push_back(true);
+			cavity_stamp.push_back(0);
+			if (nb >= 0) {
+				for (l=0; l < 3; l++) if (triangles[nb].neighbor[l]==c) triangles[nb].neighbor[l] = indx;
+			}
+			new_triangles.push_back(indx);
+		}
+	}
+	// the new triangles form a fan around the point; triangle (a,b,p) borders the one starting at b and the one ending at a
+	int j;
+	for (i=0; i < new_triangles.size(); i++) {
+		Triangle& ti = triangles[new_triangles[i]];
+		for (j=0; j < new_triangles.size(); j++) {
+			if (j==i) continue;
+			const Triangle& tj = triangles[new_triangles[j]];
+			if (tj.vertex[0]==ti.vertex[1]) ti.neighbor[0] = new_triangles[j];
+			if (tj.vertex[1]==ti.vertex[0]) ti.neighbor[1] = new_triangles[j];
+		}
+	}
+	last_triangle = new_triangles[0];
+}
+
+void Delaunay::remove_super_triangle()
+{
+	int i,k,n_alive=0;
+	int *new_index = new int[triangles.size()];
+	for (i=0; i < triangles.size(); i++) {
+		if ((alive[i]) and ((triangles[i].vertex[0] >= n_pts) or (triangles[i].vertex[1] >= n_pts) or (triangles[i].vertex[2] >= n_pts))) alive[i] = false;
+		new_index[i] = (alive[i]) ? n_alive++ : -1;
+	}
+	vector<Triangle> final_triangles;
+	final_triangles.reserve(n_alive);
+	Triangle t;
+	for (i=0; i < triangles.size(); i++) {
+		if (!alive[i]) continue;
+		t = triangles[i];
+		for (k=0; k < 3; k++) {
+			if (t.neighbor[k] >= 0) t.neighbor[k] = new_index[t.neighbor[k]];
+		}
+		final_triangles.push_back(t);
+	}
+	delete[] new_index;
+	triangles.swap(final_triangles);
+	alive.assign(n_alive,true);
+	cavity_stamp.clear();
+	cavity.clear();
+	new_triangles.clear();
+	if (n_alive==0) warn("Delaunay triangulation has no triangles (points may be collinear)");
+}
+
+void Delaunay::fill_hull_concavities()
+{
+	// Removing the triangles attached to the super-triangle can leave small concavities along the edge of the triangulation.
+	// These are filled in with extra triangles until the boundary is the convex hull of the points, so that point location
+	// never has to fall back to searching all the triangles: a walk that crosses the boundary shows the point is outside.
+	// The boundary edges (those with no neighbor) go counterclockwise around the triangulation, so a boundary vertex where
+	// the boundary turns clockwise is filled by connecting its two neighbors along the boundary, provided no other boundary
+	// vertex lies inside the new triangle.
+	convex = false;
+	if (triangles.size()==0) return;
+	int i,k,a,b,c,d;
+	vector<int> next(n_pts,-1), prev(n_pts,-1), edge_triangle(n_pts,-1), edge_k(n_pts,-1);
+	vector<int> boundary;
+	for (i=0; i < triangles.size(); i++) {
+		for (k=0; k < 3; k++) {
+			if (triangles[i].neighbor[k] != -1) continue;
+			a = triangles[i].vertex[(k+1)%3];
+			b = triangles[i].vertex[(k+2)%3];
+			if ((next[a] != -1) or (prev[b] != -1)) return; // the boundary touches itself at a vertex, so it is left as it is
+			next[a] = b;
+			prev[b] = a;
+			edge_triangle[a] = i; // the boundary edge starting at a
+			edge_k[a] = k;
+			boundary.push_back(a);
+		}
+	}
+
+	bool filled, concave_vertex_left;
+	Triangle newtri;
+	int indx, n_boundary = boundary.size();
+	do {
+		filled = false;
+		concave_vertex_left = false;
+		for (i=0; i < boundary.size(); i++) {
+			b = boundary[i];
+			if ((next[b]==-1) or (n_boundary <= 3)) continue; // already filled in
+			a = prev[b];
+			c = next[b];
+			if (orientation(a,b,x[c],y[c]) >= 0) continue;
+			for (k=0; k < boundary.size(); k++) {
+				d = boundary[k];
+				if ((next[d]==-1) or (d==a) or (d==b) or (d==c)) continue;
+				if ((orientation(a,c,x[d],y[d]) > 0) and (orientation(c,b,x[d],y[d]) > 0) and (orientation(b,a,x[d],y[d]) > 0)) break;
+			}
+			if (k < boundary.size()) { concave_vertex_left = true; continue; }
+			newtri.vertex[0] = a;
+			newtri.vertex[1] = c;
+			newtri.vertex[2] = b;
+			newtri.neighbor[0] = edge_triangle[b];
+			newtri.neighbor[1] = edge_triangle[a];
+			newtri.neighbor[2] = -1;
+			indx = triangles.size();
+			triangles.push_back(newtri);
+			triangles[edge_triangle[b]].neighbor[edge_k[b]] = indx;
+			triangles[edge_triangle[a]].neighbor[edge_k[a]] = indx;
+			next[a] = c;
+			prev[c] = a;
+			next[b] = prev[b] = -1;
+			edge_triangle[a] = indx; // the new boundary edge from a to c
+			edge_k[a] = 2;
+			n_boundary--;
+			filled = true;
+		}
+	} while (filled);
+	convex = !concave_vertex_left;
+	alive.assign(triangles.size(),true);
+}
+
+double Delaunay::triangle_area(const int i)
+{
+	const Triangle& t = triangles[i];
+	return 0.5*orientation(t.vertex[0],t.vertex[1],x[t.vertex[2]],y[t.vertex[2]]);
+}
+
+bool Delaunay::find_triangle(const double xp, const double yp, int& tri, double *weights)
+{
+	// On input, tri is the triangle to start the search from (e.g. the one found for a nearby point); on output, it is the
+	// triangle containing the point, and weights gives the linear interpolation weights of its three vertices. Returns
+	// false if the point is outside the triangulation. Since this does not modify the triangulation, it is thread-safe.
+	if (triangles.size()==0) return false;
+	if ((xp < xmin) or (xp > xmax) or (yp < ymin) or (yp > ymax)) return false;
+	if ((tri < 0) or (tri >= triangles.size())) tri = 0;
+	int found = walk_to_triangle(xp,yp,tri);
+	// Since the boundary is convex, a walk that leaves the triangulation shows the point is outside. All the triangles only
+	// need to be searched if the walk does not terminate, or if the boundary could not be made convex; both are rare.
+	if ((found==-2) or ((found==-1) and (!convex))) found = search_all_triangles(xp,yp);
+	if (found < 0) return false;
+	tri = found;
+	const Triangle& t = triangles[tri];
+	double area = orientation(t.vertex[0],t.vertex[1],x[t.vertex[2]],y[t.vertex[2]]);
+	weights[0] = orientation(t.vertex[1],t.vertex[2],xp,yp)/area;
+	weights[1] = orientation(t.vertex[2],t.vertex[0],xp,yp)/area;
+	weights[2] = 1 - weights[0] - weights[1];
+	return true;
+}
+
+void Delaunay::find_vertex_neighbors(vector<int>* neighbors, bool* boundary_pt)
+{
+	// neighbors and boundary_pt should have room for all the input points; points on the edge of the triangulation are
+	// flagged as boundary points
+	int i,j,k,a,b;
+	bool found;
+	for (i=0; i < n_pts; i++) {
+		neighbors[i].clear();
+		boundary_pt[i] = false;
+	}
+	for (i=0; i < triangles.size(); i++) {
+		for (k=0; k < 3; k++) {
+			a = triangles[i].vertex[(k+1)%3];
+			b = triangles[i].vertex[(k+2)%3];
+			found = false;
+			for (j=0; j < neighbors[a].size(); j++) if (neighbors[a][j]==b) { found = true; break; }
+			if (!found) {
+				neighbors[a].push_back(b);
+				neighbors[b].push_back(a);
+			}
+			if (triangles[i].neighbor[k]==-1) boundary_pt[a] = boundary_pt[b] = true;
+		}
+	}
+}
+
+Delaunay::~Delaunay()
+{
+	delete[] x;
+	delete[] y;
+	delete[] included;
+}
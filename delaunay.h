@@ -0,0 +1,46 @@
+// DELAUNAY.H: Delaunay triangulation of a set of points in the plane (Bowyer-Watson algorithm), with point location
+
+#ifndef DELAUNAY_H
+#define DELAUNAY_H
+
+#include <vector>
+using namespace std;
+
+struct Triangle
+{
+	int vertex[3]; // in counterclockwise order
+	int neighbor[3]; // neighbor[k] is the triangle across the edge opposite vertex[k] (or -1 if this is a boundary edge)
+};
+
+class Delaunay
+{
+	int n_pts;
+	double *x, *y; // includes the three vertices of the enclosing "super-triangle" at the end
+	bool *included; // false for points that were dropped because they coincide with a point already in the triangulation
+	vector<Triangle> triangles;
+	vector<bool> alive;
+	vector<int> cavity, cavity_stamp, new_triangles;
+	int stamp;
+	double xmin, xmax, ymin, ymax; // bounding box of the points
+	bool convex; // if true, a point location walk that leaves the triangulation shows the point is outside
+
+	inline double orientation(const int a, const int b, const double xp, const double yp);
+	inline bool in_circumcircle(const Triangle& tri, const double xp, const double yp);
+	int walk_to_triangle(const double xp, const double yp, int tri);
+	int search_all_triangles(const double xp, const double yp);
+	void insert_point(const int p, int& last_triangle);
+	void remove_super_triangle();
+	void fill_hull_concavities();
+
+	public:
+	Delaunay(const double *xvals, const double *yvals, const int n);
+	~Delaunay();
+	int n_triangles() { return triangles.size(); }
+	const Triangle& triangle(const int i) { return triangles[i]; }
+	bool point_included(const int i) { return included[i]; }
+	double triangle_area(const int i);
+	bool find_triangle(const double xp, const double yp, int& tri, double *weights);
+	void find_vertex_neighbors(vector<int>* neighbors, bool* boundary_pt);
+};
+
+#endif // DELAUNAY_H
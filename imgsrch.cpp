@@ -3,6 +3,7 @@
 #include "mathexpr.h"
 #include "errors.h"
 #include <unistd.h>
+#include <cstring>
 #include <cmath>
 #include <iostream>
 #include <fstream>
@@ -11,26 +12,15 @@ using namespace std;
 
 int Grid::nthreads;
 double Grid::image_pos_accuracy = 1e-6; // default
-double Grid::redundancy_separation_threshold;
+double Grid::redundancy_separation_threshold = 1e-5;
 double Grid::warning_magnification_threshold = 10; // if redundant images are found with magnification higher than this, no warning is printed
 const int Grid::max_images = 10;
 const int Grid::max_level = 10;
 double Grid::theta_offset = 0; // slight offset in the initial angle for creating the grid; obsolete, but keeping it here just in case
-double Grid::ccroot_t;
-lensvector Grid::ccroot;
-double Grid::cclength1, Grid::cclength2, Grid::long_diagonal_length;
-bool Grid::enforce_min_area;
-bool Grid::cc_neighbor_splittings;
-double Grid::zfactor;
 
 // parameters for creating the recursive grid
 const int Grid::u_split = 2;
 const int Grid::w_split = 2;
-bool Grid::radial_grid;
-double Grid::rmin, Grid::rmax, Grid::xcenter, Grid::ycenter, Grid::grid_q;
-int Grid::u_split_initial, Grid::w_split_initial;
-int Grid::levels, Grid::splitlevels, Grid::cc_splitlevels;
-double Grid::min_cell_area;
 
 // multithreaded variables
 lensvector *Grid::d1, *Grid::d2, *Grid::d3, *Grid::d4;
@@ -40,23 +30,15 @@ lensvector *Grid::fvec;
 int *Grid::maxlevs;
 lensvector ***Grid::xvals_threads;
 
-int Grid::nfound, Grid::nfound_max, Grid::nfound_pos, Grid::nfound_neg;
-bool Grid::finished_search;
-
-int Grid::corner_positive_mag[4], Grid::corner_negative_mag[4];
-lensvector Grid::ccsearch_initial_pt, Grid::ccsearch_interval;
-
-image Grid::images[Grid::max_images];
-Lens* Grid::lens = NULL;
-
-void Grid::set_splitting(int rs0, int ts0, int sl, int ccsl, double min_cs, bool neighbor_split)
+void Grid::set_splitting_from_lens()
 {
-	u_split_initial = rs0;
-	w_split_initial = ts0;
-	splitlevels = sl;
-	cc_splitlevels = ccsl;
-	min_cell_area = min_cs;
-	cc_neighbor_splittings = neighbor_split;
+	grid_data->u_split_initial = lens->rsplit_initial;
+	grid_data->w_split_initial = lens->thetasplit_initial;
+	grid_data->splitlevels = lens->splitlevels;
+	grid_data->cc_splitlevels = lens->cc_splitlevels;
+	grid_data->min_cell_area = lens->min_cell_area;
+	grid_data->cc_neighbor_splittings = lens->cc_neighbor_splittings;
+	grid_data->enforce_min_area = lens->enforce_min_cell_area;
 }
 
 void Grid::allocate_multithreaded_variables(const int& threads)
@@ -100,23 +82,26 @@ void Grid::deallocate_multithreaded_variables()
 	delete[] xvals_threads;
 }
 
-Grid::Grid(double xcenter_in, double ycenter_in, double xlength, double ylength, double zfactor_in)	// use for top-level cell only; subcells use constructor below
+Grid::Grid(Lens* lens_in, double xcenter_in, double ycenter_in, double xlength, double ylength, double zfactor_in)	// use for top-level cell only; subcells use constructor below
 {
 	// this constructor is used for a Cartesian grid
-	radial_grid = false;
+	lens = lens_in;
+	grid_data = new GridData;
+	grid_data->images = new image[max_images];
+	set_splitting_from_lens();
+	grid_data->radial_grid = false;
 	center_imgplane[0] = 0; // these should not be used for the top-level grid
 	center_imgplane[1] = 0; // these should not be used for the top-level grid
 	// For the Cartesian grid, u = x, w = y
-	u_N = u_split_initial;
-	w_N = w_split_initial;
+	u_N = grid_data->u_split_initial;
+	w_N = grid_data->w_split_initial;
 	level = 0;
-	levels = 0;
+	grid_data->levels = 0;
 	cell = NULL;
 	parent_cell = NULL;
-	redundancy_separation_threshold = 1e-5;
 	singular_pt_inside = false;
 	cell_in_central_image_region = false;
-	zfactor = zfactor_in;
+	grid_data->zfactor = zfactor_in;
 
 	for (int i=0; i < 4; i++) {
 		corner_pt[i][0]=0;
@@ -129,12 +114,12 @@ Grid::Grid(double xcenter_in, double ycenter_in, double xlength, double ylength,
 		allocated_corner[i]=false;
 	}
 
-	xcenter = xcenter_in; ycenter = ycenter_in;
+	grid_data->xcenter = xcenter_in; grid_data->ycenter = ycenter_in;
 	double x_min, x_max, y_min, y_max;
-	x_min = xcenter - 0.5*xlength;
-	x_max = xcenter + 0.5*xlength;
-	y_min = ycenter - 0.5*ylength;
-	y_max = ycenter + 0.5*ylength;
+	x_min = grid_data->xcenter - 0.5*xlength;
+	x_max = grid_data->xcenter + 0.5*xlength;
+	y_min = grid_data->ycenter - 0.5*ylength;
+	y_max = grid_data->ycenter + 0.5*ylength;
 
 	double x, y, xstep, ystep;
 	xstep = (x_max-x_min)/u_N;
@@ -162,7 +147,7 @@ Grid::Grid(double xcenter_in, double ycenter_in, double xlength, double ylength,
 
 	for (i=0; i < u_N; i++) {
 		for (j=0; j < w_N; j++) {
-			cell[i][j]->assign_lensing_properties(0);
+			cell[i][j]->assign_lensing_properties(lens->lens_thread);
 		}
 	}
 
@@ -170,40 +155,43 @@ Grid::Grid(double xcenter_in, double ycenter_in, double xlength, double ylength,
 		delete[] xvals[i];
 	delete[] xvals;
 
-	levels++;
+	grid_data->levels++;
 	assign_firstlevel_neighbors();
 
 	assign_subcell_lensing_properties_firstlevel();
 
-	for (i=0; i < splitlevels + cc_splitlevels - 1; i++) {
+	for (i=0; i < grid_data->splitlevels + grid_data->cc_splitlevels - 1; i++) {
 		// the second argument here, set to 'true', says to subgrid around neighbors of critical curves (this allows us to catch
 		// cells that might have a curve piercing in and out of one side only; we can only detect this by breaking into smaller cells)
-		split_subcells_firstlevel(i,cc_neighbor_splittings);
+		split_subcells_firstlevel(i,grid_data->cc_neighbor_splittings);
 	}
 	// don't subgrid around neighbors of critical curves for last iteration, since it's not necessary and the extra cells add overhead
-	if (splitlevels + cc_splitlevels > 0) {
-		if (splitlevels + cc_splitlevels==1) split_subcells_firstlevel(splitlevels + cc_splitlevels-1,cc_neighbor_splittings);
-		else split_subcells_firstlevel(splitlevels + cc_splitlevels-1,false); // if more than one level of splitting, then don't split neighbors on last level (it's wasteful)
+	if (grid_data->splitlevels + grid_data->cc_splitlevels > 0) {
+		if (grid_data->splitlevels + grid_data->cc_splitlevels==1) split_subcells_firstlevel(grid_data->splitlevels + grid_data->cc_splitlevels-1,grid_data->cc_neighbor_splittings);
+		else split_subcells_firstlevel(grid_data->splitlevels + grid_data->cc_splitlevels-1,false); // if more than one level of splitting, then don't split neighbors on last level (it's wasteful)
 	}
 }
 
-Grid::Grid(double r_min, double r_max, double xcenter_in, double ycenter_in, double grid_q_in, double zfactor_in) // use for top-level cell only; subcells use constructor below
+Grid::Grid(Lens* lens_in, double r_min, double r_max, double xcenter_in, double ycenter_in, double grid_q_in, double zfactor_in) // use for top-level cell only; subcells use constructor below
 {
 	// this constructor is used for a radial grid
-	radial_grid = true;
+	lens = lens_in;
+	grid_data = new GridData;
+	grid_data->images = new image[max_images];
+	set_splitting_from_lens();
+	grid_data->radial_grid = true;
 	center_imgplane[0] = 0; // these should not be used for the top-level grid
 	center_imgplane[1] = 0;
 	// For the radial grid, u = r, w = theta
-	u_N = u_split_initial;
-	w_N = w_split_initial;
+	u_N = grid_data->u_split_initial;
+	w_N = grid_data->w_split_initial;
 	level = 0;
-	levels = 0;
+	grid_data->levels = 0;
 	cell = NULL;
 	parent_cell = NULL;
-	redundancy_separation_threshold = 1e-5;
 	singular_pt_inside = false;
 	cell_in_central_image_region = false;
-	zfactor = zfactor_in;
+	grid_data->zfactor = zfactor_in;
 
 	int i,j;
 	for (i=0; i < 4; i++) {
@@ -217,23 +205,23 @@ Grid::Grid(double r_min, double r_max, double xcenter_in, double ycenter_in, dou
 		allocated_corner[i]=false;
 	}
 
-	rmin = r_min; rmax = r_max;
-	xcenter = xcenter_in;
-	ycenter = ycenter_in;
-	grid_q = grid_q_in;
+	grid_data->rmin = r_min; grid_data->rmax = r_max;
+	grid_data->xcenter = xcenter_in;
+	grid_data->ycenter = ycenter_in;
+	grid_data->grid_q = grid_q_in;
 
 	double r, theta, rstep, thetastep;
-	rstep = (rmax-rmin)/u_N;
+	rstep = (grid_data->rmax-grid_data->rmin)/u_N;
 	thetastep = 2*M_PI/w_N;
 
 	lensvector** xvals = new lensvector*[u_N+1];
-	r = rmin;
+	r = grid_data->rmin;
 	for (i=0; i <= u_N; i++, r += rstep) {
 		xvals[i] = new lensvector[w_N+1];
 		theta = theta_offset;
 		for (j=0; j <= w_N; j++, theta += thetastep) {
-			xvals[i][j][0] = xcenter + r*cos(theta);
-			xvals[i][j][1] = ycenter + grid_q*r*sin(theta);
+			xvals[i][j][0] = grid_data->xcenter + r*cos(theta);
+			xvals[i][j][1] = grid_data->ycenter + grid_data->grid_q*r*sin(theta);
 		}
 	}
 
@@ -249,7 +237,7 @@ Grid::Grid(double r_min, double r_max, double xcenter_in, double ycenter_in, dou
 
 	for (i=0; i < u_N; i++) {
 		for (j=0; j < w_N; j++) {
-			cell[i][j]->assign_lensing_properties(0);
+			cell[i][j]->assign_lensing_properties(lens->lens_thread);
 		}
 	}
 
@@ -257,19 +245,19 @@ Grid::Grid(double r_min, double r_max, double xcenter_in, double ycenter_in, dou
 		delete[] xvals[i];
 	delete[] xvals;
 
-	levels++;
+	grid_data->levels++;
 	assign_firstlevel_neighbors();
 	assign_subcell_lensing_properties_firstlevel();
 
-	for (i=0; i < splitlevels + cc_splitlevels - 1; i++) {
+	for (i=0; i < grid_data->splitlevels + grid_data->cc_splitlevels - 1; i++) {
 		// the second argument here, set to 'true', says to subgrid around neighbors of critical curves (this allows us to catch
 		// cells that might have a curve piercing in and out of one side only; we can only detect this by breaking into smaller cells)
-		split_subcells_firstlevel(i,cc_neighbor_splittings);
+		split_subcells_firstlevel(i,grid_data->cc_neighbor_splittings);
 	}
 	// don't subgrid around neighbors of critical curves for last iteration, since it's not necessary and the extra cells add overhead
-	if (splitlevels + cc_splitlevels > 0) {
-		if (splitlevels + cc_splitlevels==1) split_subcells_firstlevel(splitlevels + cc_splitlevels-1,cc_neighbor_splittings);
-		else split_subcells_firstlevel(splitlevels + cc_splitlevels-1,false); // if more than one level of splitting, then don't split neighbors on last level (it's wasteful)
+	if (grid_data->splitlevels + grid_data->cc_splitlevels > 0) {
+		if (grid_data->splitlevels + grid_data->cc_splitlevels==1) split_subcells_firstlevel(grid_data->splitlevels + grid_data->cc_splitlevels-1,grid_data->cc_neighbor_splittings);
+		else split_subcells_firstlevel(grid_data->splitlevels + grid_data->cc_splitlevels-1,false); // if more than one level of splitting, then don't split neighbors on last level (it's wasteful)
 	}
 }
 
@@ -284,6 +272,8 @@ Grid::Grid(lensvector** xij, const int& i, const int& j, const int& level_in, Gr
 	cell_in_central_image_region = false;
 	galsubgrid_cc_splitlevels = 0;
 	parent_cell = parent_ptr;
+	lens = parent_ptr->lens;
+	grid_data = parent_ptr->grid_data;
 
 	for (int k=0; k < 2; k++) {
 		corner_pt[0][k] = xij[i][j][k];
@@ -313,39 +303,40 @@ Grid::Grid(lensvector** xij, const int& i, const int& j, const int& level_in, Gr
 
 void Grid::redraw_grid(double r_min, double r_max, double xcenter_in, double ycenter_in, double grid_q_in, double zfactor_in)  // for radial grid
 {
-	if (radial_grid==false) radial_grid = true;
-	rmin = r_min; rmax = r_max;
-	xcenter = xcenter_in;
-	ycenter = ycenter_in;
-	grid_q = grid_q_in;
-	zfactor = zfactor_in;
+	if (grid_data->radial_grid==false) grid_data->radial_grid = true;
+	set_splitting_from_lens();
+	grid_data->rmin = r_min; grid_data->rmax = r_max;
+	grid_data->xcenter = xcenter_in;
+	grid_data->ycenter = ycenter_in;
+	grid_data->grid_q = grid_q_in;
+	grid_data->zfactor = zfactor_in;
 
 	double r, theta, rstep, thetastep;
-	rstep = (rmax-rmin)/u_N;
+	rstep = (grid_data->rmax-grid_data->rmin)/u_N;
 	thetastep = 2*M_PI/w_N;
 
 	lensvector** xvals = new lensvector*[u_N+1];
-	r = rmin;
+	r = grid_data->rmin;
 	int i, j;
 	for (i=0; i <= u_N; i++, r += rstep) {
 		xvals[i] = new lensvector[w_N+1];
 		theta = theta_offset;
 		for (j=0; j <= w_N; j++, theta += thetastep) {
-			xvals[i][j][0] = xcenter + r*cos(theta);
-			xvals[i][j][1] = ycenter + grid_q*r*sin(theta);
+			xvals[i][j][0] = grid_data->xcenter + r*cos(theta);
+			xvals[i][j][1] = grid_data->ycenter + grid_data->grid_q*r*sin(theta);
 		}
 	}
 
-	clear_subcells(splitlevels);
-	levels = splitlevels+1;
+	clear_subcells(grid_data->splitlevels);
+	grid_data->levels = grid_data->splitlevels+1;
 
 	#pragma omp parallel
 	{
 		int thread;
 #ifdef USE_OPENMP
-		thread = omp_get_thread_num();
+		thread = lens->lens_thread + omp_get_thread_num();
 #else
-		thread = 0;
+		thread = lens->lens_thread;
 #endif
 
 		#pragma omp for private(i,j) schedule(static)
@@ -366,30 +357,31 @@ void Grid::redraw_grid(double r_min, double r_max, double xcenter_in, double yce
 #ifdef USE_OPENMP
 	double wtime, wtime0;
 #endif
-	for (i=0; i < splitlevels + cc_splitlevels - 1; i++) {
+	for (i=0; i < grid_data->splitlevels + grid_data->cc_splitlevels - 1; i++) {
 		// the second argument here, set to 'true', says to subgrid around neighbors of critical curves (this allows us to catch
 		// cells that might have a curve piercing in and out of one side only; we can only detect this by breaking into smaller cells)
-		split_subcells_firstlevel(i,cc_neighbor_splittings);
+		split_subcells_firstlevel(i,grid_data->cc_neighbor_splittings);
 	}
 	// don't subgrid around neighbors of critical curves for last iteration, since it's not necessary and the extra cells add overhead
-	if (splitlevels + cc_splitlevels > 0) {
-		if (splitlevels + cc_splitlevels==1) split_subcells_firstlevel(splitlevels + cc_splitlevels-1,cc_neighbor_splittings);
-		else split_subcells_firstlevel(splitlevels + cc_splitlevels-1,false); // if more than one level of splitting, then don't split neighbors on last level (it's wasteful)
+	if (grid_data->splitlevels + grid_data->cc_splitlevels > 0) {
+		if (grid_data->splitlevels + grid_data->cc_splitlevels==1) split_subcells_firstlevel(grid_data->splitlevels + grid_data->cc_splitlevels-1,grid_data->cc_neighbor_splittings);
+		else split_subcells_firstlevel(grid_data->splitlevels + grid_data->cc_splitlevels-1,false); // if more than one level of splitting, then don't split neighbors on last level (it's wasteful)
 	}
 }
 
 void Grid::redraw_grid(double xcenter_in, double ycenter_in, double xlength, double ylength, double zfactor_in)  // for Cartesian grid
 {
-	if (radial_grid==true) radial_grid = false;
-	xcenter = xcenter_in;
-	ycenter = ycenter_in;
-	zfactor = zfactor_in;
+	if (grid_data->radial_grid==true) grid_data->radial_grid = false;
+	set_splitting_from_lens();
+	grid_data->xcenter = xcenter_in;
+	grid_data->ycenter = ycenter_in;
+	grid_data->zfactor = zfactor_in;
 
 	double x_min, x_max, y_min, y_max;
-	x_min = xcenter - 0.5*xlength;
-	x_max = xcenter + 0.5*xlength;
-	y_min = ycenter - 0.5*ylength;
-	y_max = ycenter + 0.5*ylength;
+	x_min = grid_data->xcenter - 0.5*xlength;
+	x_max = grid_data->xcenter + 0.5*xlength;
+	y_min = grid_data->ycenter - 0.5*ylength;
+	y_max = grid_data->ycenter + 0.5*ylength;
 
 	double x, y, xstep, ystep;
 	xstep = (x_max-x_min)/u_N;
@@ -405,16 +397,16 @@ void Grid::redraw_grid(double xcenter_in, double ycenter_in, double xlength, dou
 		}
 	}
 
-	clear_subcells(splitlevels);
-	levels = splitlevels+1;
+	clear_subcells(grid_data->splitlevels);
+	grid_data->levels = grid_data->splitlevels+1;
 
 	#pragma omp parallel
 	{
 		int thread;
 #ifdef USE_OPENMP
-		thread = omp_get_thread_num();
+		thread = lens->lens_thread + omp_get_thread_num();
 #else
-		thread = 0;
+		thread = lens->lens_thread;
 #endif
 
 		#pragma omp for private(i,j) schedule(static)
@@ -435,15 +427,15 @@ void Grid::redraw_grid(double xcenter_in, double ycenter_in, double xlength, dou
 #ifdef USE_OPENMP
 	double wtime, wtime0;
 #endif
-	for (i=0; i < splitlevels + cc_splitlevels - 1; i++) {
+	for (i=0; i < grid_data->splitlevels + grid_data->cc_splitlevels - 1; i++) {
 		// the second argument here, set to 'true', says to subgrid around neighbors of critical curves (this allows us to catch
 		// cells that might have a curve piercing in and out of one side only; we can only detect this by breaking into smaller cells)
-		split_subcells_firstlevel(i,cc_neighbor_splittings);
+		split_subcells_firstlevel(i,grid_data->cc_neighbor_splittings);
 	}
 	// don't subgrid around neighbors of critical curves for last iteration, since it's not necessary and the extra cells add overhead
-	if (splitlevels + cc_splitlevels > 0) {
-		if (splitlevels + cc_splitlevels==1) split_subcells_firstlevel(splitlevels + cc_splitlevels-1,cc_neighbor_splittings);
-		else split_subcells_firstlevel(splitlevels + cc_splitlevels-1,false); // if more than one level of splitting, then don't split neighbors on last level (it's wasteful)
+	if (grid_data->splitlevels + grid_data->cc_splitlevels > 0) {
+		if (grid_data->splitlevels + grid_data->cc_splitlevels==1) split_subcells_firstlevel(grid_data->splitlevels + grid_data->cc_splitlevels-1,grid_data->cc_neighbor_splittings);
+		else split_subcells_firstlevel(grid_data->splitlevels + grid_data->cc_splitlevels-1,false); // if more than one level of splitting, then don't split neighbors on last level (it's wasteful)
 	}
 }
 
@@ -471,13 +463,13 @@ void Grid::reassign_coordinates(lensvector** xij, const int& i, const int& j, co
 
 void Grid::assign_lensing_properties(const int& thread)
 {
-	if (enforce_min_area) find_cell_area(thread);
+	if (grid_data->enforce_min_area) find_cell_area(thread);
 	else cell_area=0;
 
-	(*corner_invmag[0]) = lens->inverse_magnification(corner_pt[0],thread,zfactor);
+	(*corner_invmag[0]) = lens->inverse_magnification(corner_pt[0],thread,grid_data->zfactor);
 	(*corner_parity[0]) = sign_bool(*corner_invmag[0]);
-	lens->find_sourcept(corner_pt[0],(*corner_sourcept[0]),thread,zfactor);
-	(*corner_kappa[0]) = lens->kappa(corner_pt[0],zfactor);
+	lens->find_sourcept(corner_pt[0],(*corner_sourcept[0]),thread,grid_data->zfactor);
+	(*corner_kappa[0]) = lens->kappa(corner_pt[0],grid_data->zfactor);
 }
 
 inline void Grid::set_grid_xvals(lensvector** xv, const int& i, const int& j)
@@ -506,7 +498,7 @@ void Grid::assign_firstlevel_neighbors()
 			if (j < w_N-1)
 				cell[i][j]->neighbor[2] = cell[i][j+1];
 			else {
-				if (radial_grid)
+				if (grid_data->radial_grid)
 					cell[i][j]->neighbor[2] = cell[i][0];
 				else
 					cell[i][j]->neighbor[2] = NULL;
@@ -515,7 +507,7 @@ void Grid::assign_firstlevel_neighbors()
 			if (j > 0) 
 				cell[i][j]->neighbor[3] = cell[i][j-1];
 			else {
-				if (radial_grid)
+				if (grid_data->radial_grid)
 					cell[i][j]->neighbor[3] = cell[i][w_N-1];
 				else
 					cell[i][j]->neighbor[3] = NULL;
@@ -543,7 +535,7 @@ void Grid::assign_neighborhood()
 	assign_level_neighbors(level);
 	for (l=0; l < 4; l++)
 		if ((neighbor[l] != NULL) and (neighbor[l]->cell != NULL)) {
-		for (k=level; k <= levels; k++) {
+		for (k=level; k <= grid_data->levels; k++) {
 			neighbor[l]->assign_level_neighbors(k);
 		}
 	}
@@ -554,7 +546,7 @@ void Grid::assign_all_neighbors()
 	if (level!=0) die("assign_all_neighbors should only be run from level 0");
 
 	int i,j,k;
-	for (k=1; k < levels; k++) {
+	for (k=1; k < grid_data->levels; k++) {
 		for (i=0; i < u_N; i++) {
 			for (j=0; j < w_N; j++) {
 				cell[i][j]->assign_level_neighbors(k); // we've just created our grid, so we only need to go to level+1
@@ -687,15 +679,18 @@ bool Grid::split_cells(const int& thread)
 void Grid::split_subcells_firstlevel(int cc_splitlevel, bool cc_neighbor_splitting)
 {
 	int i,j;
+	int nthreads_used = 1; // only the maxlevs entries of the threads used here are checked, since thread clones may be using the others
 	#pragma omp parallel
 	{
 		int thread;
 #ifdef USE_OPENMP
-		thread = omp_get_thread_num();
+		thread = lens->lens_thread + omp_get_thread_num();
+		#pragma omp master
+		nthreads_used = omp_get_num_threads();
 #else
-		thread = 0;
+		thread = lens->lens_thread;
 #endif
-		maxlevs[thread] = levels;
+		maxlevs[thread] = grid_data->levels;
 
 		if (cc_splitlevel > level) {
 			int i,j;
@@ -707,16 +702,16 @@ void Grid::split_subcells_firstlevel(int cc_splitlevel, bool cc_neighbor_splitti
 			}
 		} else {
 			int i,j;
-			if (level >= splitlevels)
+			if (level >= grid_data->splitlevels)
 			{
-				if (level < splitlevels + cc_splitlevels) {
+				if (level < grid_data->splitlevels + grid_data->cc_splitlevels) {
 					// check for critical curves in each grid cell, and subgrid each cell that contains a critical curve
 					// (provided the subgridded cells won't be smaller than the specified min_cell_area limit)
 					bool recurse = false;
 					#pragma omp for private(i,j) schedule(dynamic)
 					for (i=0; i < u_N; i++) {
 						for (j=0; j < w_N; j++) {
-							if ((!enforce_min_area) or (cell[i][j]->cell_area > min_cell_area)) {
+							if ((!grid_data->enforce_min_area) or (cell[i][j]->cell_area > grid_data->min_cell_area)) {
 								if (recurse) recurse = false;
 								// check to see if critical curve goes through the grid cell (or its neighbors if cc_neighbor_splitting is turned on); if so, subgrid...
 								if ((cell[i][j]->cc_inside) or (cell[i][j]->singular_pt_inside)) recurse = true;
@@ -753,8 +748,8 @@ void Grid::split_subcells_firstlevel(int cc_splitlevel, bool cc_neighbor_splitti
 			}
 		}
 	}
-	assign_neighbors_lensing_subcells(cc_splitlevel,0);
-	for (i=0; i < nthreads; i++) if (maxlevs[i] > levels) levels = maxlevs[i];
+	assign_neighbors_lensing_subcells(cc_splitlevel,lens->lens_thread);
+	for (i=lens->lens_thread; i < lens->lens_thread + nthreads_used; i++) if (maxlevs[i] > grid_data->levels) grid_data->levels = maxlevs[i];
 }
 
 void Grid::split_subcells(int cc_splitlevel, bool cc_neighbor_splitting, const int& thread)
@@ -771,15 +766,15 @@ void Grid::split_subcells(int cc_splitlevel, bool cc_neighbor_splitting, const i
 		}
 	} else {
 		int i,j;
-		if (level >= splitlevels)
+		if (level >= grid_data->splitlevels)
 		{
-			if (level < splitlevels + cc_splitlevels) {
+			if (level < grid_data->splitlevels + grid_data->cc_splitlevels) {
 				// check for critical curves in each grid cell, and subgrid each cell that contains a critical curve
 				// (provided the subgridded cells won't be smaller than the specified min_cell_area limit)
 				bool recurse = false;
 				for (i=0; i < u_N; i++) {
 					for (j=0; j < w_N; j++) {
-						if ((!enforce_min_area) or (cell[i][j]->cell_area > min_cell_area)) {
+						if ((!grid_data->enforce_min_area) or (cell[i][j]->cell_area > grid_data->min_cell_area)) {
 							if (recurse) recurse = false;
 							// check to see if critical curve goes through the grid cell (or its neighbors if cc_neighbor_splitting is turned on); if so, subgrid...
 							if ((cell[i][j]->cc_inside) or (cell[i][j]->singular_pt_inside)) recurse = true;
@@ -880,13 +875,13 @@ void Grid::galsubgrid()
 		}
 		for (i=0; i < u_N; i++) {
 			for (j=0; j < w_N; j++) {
-				cell[i][j]->assign_lensing_properties(0);
+				cell[i][j]->assign_lensing_properties(lens->lens_thread);
 			}
 		}
 		assign_neighborhood();
-		assign_subcell_lensing_properties(0);
-		if (level == levels-1) {
-			levels++; // our subcells are at the max level, so splitting them increases the number of levels by 1
+		assign_subcell_lensing_properties(lens->lens_thread);
+		if (level == grid_data->levels-1) {
+			grid_data->levels++; // our subcells are at the max level, so splitting them increases the number of levels by 1
 		}
 		for (i=0; i < u_N+1; i++)
 			delete[] xvals[i];
@@ -914,10 +909,10 @@ void Grid::assign_subcell_lensing_properties_firstlevel()
 				cell[i][j]->corner_parity[1] = new bool;
 				cell[i][j]->corner_sourcept[1] = new lensvector;
 				cell[i][j]->corner_kappa[1] = new double;
-				*(cell[i][j]->corner_invmag[1]) = lens->inverse_magnification(cell[i][j]->corner_pt[1],0,zfactor);
+				*(cell[i][j]->corner_invmag[1]) = lens->inverse_magnification(cell[i][j]->corner_pt[1],lens->lens_thread,grid_data->zfactor);
 				*(cell[i][j]->corner_parity[1]) = sign_bool(*cell[i][j]->corner_invmag[1]);
-				lens->find_sourcept(cell[i][j]->corner_pt[1],*(cell[i][j]->corner_sourcept[1]),0,zfactor);
-				*(cell[i][j]->corner_kappa[1]) = lens->kappa(cell[i][j]->corner_pt[1],zfactor);
+				lens->find_sourcept(cell[i][j]->corner_pt[1],*(cell[i][j]->corner_sourcept[1]),lens->lens_thread,grid_data->zfactor);
+				*(cell[i][j]->corner_kappa[1]) = lens->kappa(cell[i][j]->corner_pt[1],grid_data->zfactor);
 				cell[i][j]->allocated_corner[1] = true;
 			}
 
@@ -936,10 +931,10 @@ void Grid::assign_subcell_lensing_properties_firstlevel()
 					cell[i][j]->corner_parity[3] = new bool;
 					cell[i][j]->corner_sourcept[3] = new lensvector;
 					cell[i][j]->corner_kappa[3] = new double;
-					*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],0,zfactor);
+					*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],lens->lens_thread,grid_data->zfactor);
 					*(cell[i][j]->corner_parity[3]) = sign_bool(*cell[i][j]->corner_invmag[3]);
-					lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),0,zfactor);
-					*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],zfactor);
+					lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),lens->lens_thread,grid_data->zfactor);
+					*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],grid_data->zfactor);
 					cell[i][j]->allocated_corner[3] = true;
 				}
 			} else {
@@ -947,24 +942,24 @@ void Grid::assign_subcell_lensing_properties_firstlevel()
 				cell[i][j]->corner_parity[2] = new bool;
 				cell[i][j]->corner_sourcept[2] = new lensvector;
 				cell[i][j]->corner_kappa[2] = new double;
-				*(cell[i][j]->corner_invmag[2]) = lens->inverse_magnification(cell[i][j]->corner_pt[2],0,zfactor);
+				*(cell[i][j]->corner_invmag[2]) = lens->inverse_magnification(cell[i][j]->corner_pt[2],lens->lens_thread,grid_data->zfactor);
 				*(cell[i][j]->corner_parity[2]) = sign_bool(*cell[i][j]->corner_invmag[2]);
-				lens->find_sourcept(cell[i][j]->corner_pt[2],*(cell[i][j]->corner_sourcept[2]),0,zfactor);
-				*(cell[i][j]->corner_kappa[2]) = lens->kappa(cell[i][j]->corner_pt[2],zfactor);
+				lens->find_sourcept(cell[i][j]->corner_pt[2],*(cell[i][j]->corner_sourcept[2]),lens->lens_thread,grid_data->zfactor);
+				*(cell[i][j]->corner_kappa[2]) = lens->kappa(cell[i][j]->corner_pt[2],grid_data->zfactor);
 				cell[i][j]->allocated_corner[2] = true;
 
 				cell[i][j]->corner_invmag[3] = new double;
 				cell[i][j]->corner_parity[3] = new bool;
 				cell[i][j]->corner_sourcept[3] = new lensvector;
 				cell[i][j]->corner_kappa[3] = new double;
-				*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],0,zfactor);
+				*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],lens->lens_thread,grid_data->zfactor);
 				*(cell[i][j]->corner_parity[3]) = sign_bool(*cell[i][j]->corner_invmag[3]);
-				lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),0,zfactor);
-				*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],zfactor);
+				lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),lens->lens_thread,grid_data->zfactor);
+				*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],grid_data->zfactor);
 				cell[i][j]->allocated_corner[3] = true;
 			}
 			cell[i][j]->check_if_cc_inside();
-			cell[i][j]->check_if_singular_point_inside(0);
+			cell[i][j]->check_if_singular_point_inside(lens->lens_thread);
 			cell[i][j]->check_if_central_image_region();
 			// Just in case we missed the critical curve when searching the larger cell...
 			if (cc_inside==false)
@@ -987,10 +982,10 @@ void Grid::reassign_subcell_lensing_properties_firstlevel()
 				cell[i][j]->corner_sourcept[1] = cell[i][j]->neighbor[2]->corner_sourcept[0];
 				cell[i][j]->corner_kappa[1] = cell[i][j]->neighbor[2]->corner_kappa[0];
 			} else {
-				*(cell[i][j]->corner_invmag[1]) = lens->inverse_magnification(cell[i][j]->corner_pt[1],0,zfactor);
+				*(cell[i][j]->corner_invmag[1]) = lens->inverse_magnification(cell[i][j]->corner_pt[1],lens->lens_thread,grid_data->zfactor);
 				*(cell[i][j]->corner_parity[1]) = sign_bool(*cell[i][j]->corner_invmag[1]);
-				lens->find_sourcept(cell[i][j]->corner_pt[1],*(cell[i][j]->corner_sourcept[1]),0,zfactor);
-				*(cell[i][j]->corner_kappa[1]) = lens->kappa(cell[i][j]->corner_pt[1],zfactor);
+				lens->find_sourcept(cell[i][j]->corner_pt[1],*(cell[i][j]->corner_sourcept[1]),lens->lens_thread,grid_data->zfactor);
+				*(cell[i][j]->corner_kappa[1]) = lens->kappa(cell[i][j]->corner_pt[1],grid_data->zfactor);
 				cell[i][j]->allocated_corner[1] = true;
 			}
 
@@ -1005,27 +1000,27 @@ void Grid::reassign_subcell_lensing_properties_firstlevel()
 					cell[i][j]->corner_sourcept[3] = cell[i][j]->neighbor[0]->neighbor[2]->corner_sourcept[0];
 					cell[i][j]->corner_kappa[3] = cell[i][j]->neighbor[0]->neighbor[2]->corner_kappa[0];
 				} else {
-					*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],0,zfactor);
+					*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],lens->lens_thread,grid_data->zfactor);
 					*(cell[i][j]->corner_parity[3]) = sign_bool(*cell[i][j]->corner_invmag[3]);
-					lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),0,zfactor);
-					*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],zfactor);
+					lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),lens->lens_thread,grid_data->zfactor);
+					*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],grid_data->zfactor);
 					cell[i][j]->allocated_corner[3] = true;
 				}
 			} else {
-				*(cell[i][j]->corner_invmag[2]) = lens->inverse_magnification(cell[i][j]->corner_pt[2],0,zfactor);
+				*(cell[i][j]->corner_invmag[2]) = lens->inverse_magnification(cell[i][j]->corner_pt[2],lens->lens_thread,grid_data->zfactor);
 				*(cell[i][j]->corner_parity[2]) = sign_bool(*cell[i][j]->corner_invmag[2]);
-				lens->find_sourcept(cell[i][j]->corner_pt[2],*(cell[i][j]->corner_sourcept[2]),0,zfactor);
-				*(cell[i][j]->corner_kappa[2]) = lens->kappa(cell[i][j]->corner_pt[2],zfactor);
+				lens->find_sourcept(cell[i][j]->corner_pt[2],*(cell[i][j]->corner_sourcept[2]),lens->lens_thread,grid_data->zfactor);
+				*(cell[i][j]->corner_kappa[2]) = lens->kappa(cell[i][j]->corner_pt[2],grid_data->zfactor);
 				cell[i][j]->allocated_corner[2] = true;
 
-				*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],0,zfactor);
+				*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],lens->lens_thread,grid_data->zfactor);
 				*(cell[i][j]->corner_parity[3]) = sign_bool(*cell[i][j]->corner_invmag[3]);
-				lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),0,zfactor);
-				*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],zfactor);
+				lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),lens->lens_thread,grid_data->zfactor);
+				*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],grid_data->zfactor);
 				cell[i][j]->allocated_corner[3] = true;
 			}
 			cell[i][j]->check_if_cc_inside();
-			cell[i][j]->check_if_singular_point_inside(0);
+			cell[i][j]->check_if_singular_point_inside(lens->lens_thread);
 			cell[i][j]->check_if_central_image_region();
 			// Just in case we missed the critical curve when searching the larger cell...
 			if (cc_inside==false)
@@ -1069,10 +1064,10 @@ void Grid::assign_subcell_lensing_properties(const int& thread)
 					cell[i][j]->corner_parity[1] = new bool;
 					cell[i][j]->corner_sourcept[1] = new lensvector;
 					cell[i][j]->corner_kappa[1] = new double;
-					*(cell[i][j]->corner_invmag[1]) = lens->inverse_magnification(cell[i][j]->corner_pt[1],thread,zfactor);
+					*(cell[i][j]->corner_invmag[1]) = lens->inverse_magnification(cell[i][j]->corner_pt[1],thread,grid_data->zfactor);
 					*(cell[i][j]->corner_parity[1]) = sign_bool(*cell[i][j]->corner_invmag[1]);
-					lens->find_sourcept(cell[i][j]->corner_pt[1],*(cell[i][j]->corner_sourcept[1]),thread,zfactor);
-					*(cell[i][j]->corner_kappa[1]) = lens->kappa(cell[i][j]->corner_pt[1],zfactor);
+					lens->find_sourcept(cell[i][j]->corner_pt[1],*(cell[i][j]->corner_sourcept[1]),thread,grid_data->zfactor);
+					*(cell[i][j]->corner_kappa[1]) = lens->kappa(cell[i][j]->corner_pt[1],grid_data->zfactor);
 					cell[i][j]->allocated_corner[1] = true;
 				}
 			}
@@ -1097,10 +1092,10 @@ void Grid::assign_subcell_lensing_properties(const int& thread)
 						cell[i][j]->corner_parity[3] = new bool;
 						cell[i][j]->corner_sourcept[3] = new lensvector;
 						cell[i][j]->corner_kappa[3] = new double;
-						*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],thread,zfactor);
+						*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],thread,grid_data->zfactor);
 						*(cell[i][j]->corner_parity[3]) = sign_bool(*cell[i][j]->corner_invmag[3]);
-						lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),thread,zfactor);
-						*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],zfactor);
+						lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),thread,grid_data->zfactor);
+						*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],grid_data->zfactor);
 						cell[i][j]->allocated_corner[3] = true;
 					}
 				}
@@ -1110,10 +1105,10 @@ void Grid::assign_subcell_lensing_properties(const int& thread)
 					cell[i][j]->corner_parity[2] = new bool;
 					cell[i][j]->corner_sourcept[2] = new lensvector;
 					cell[i][j]->corner_kappa[2] = new double;
-					*(cell[i][j]->corner_invmag[2]) = lens->inverse_magnification(cell[i][j]->corner_pt[2],thread,zfactor);
+					*(cell[i][j]->corner_invmag[2]) = lens->inverse_magnification(cell[i][j]->corner_pt[2],thread,grid_data->zfactor);
 					*(cell[i][j]->corner_parity[2]) = sign_bool(*cell[i][j]->corner_invmag[2]);
-					lens->find_sourcept(cell[i][j]->corner_pt[2],*(cell[i][j]->corner_sourcept[2]),thread,zfactor);
-					*(cell[i][j]->corner_kappa[2]) = lens->kappa(cell[i][j]->corner_pt[2],zfactor);
+					lens->find_sourcept(cell[i][j]->corner_pt[2],*(cell[i][j]->corner_sourcept[2]),thread,grid_data->zfactor);
+					*(cell[i][j]->corner_kappa[2]) = lens->kappa(cell[i][j]->corner_pt[2],grid_data->zfactor);
 					cell[i][j]->allocated_corner[2] = true;
 				}
 					if (cell[i][j]->corner_invmag[3]==NULL) {
@@ -1121,10 +1116,10 @@ void Grid::assign_subcell_lensing_properties(const int& thread)
 					cell[i][j]->corner_parity[3] = new bool;
 					cell[i][j]->corner_sourcept[3] = new lensvector;
 					cell[i][j]->corner_kappa[3] = new double;
-					*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],thread,zfactor);
+					*(cell[i][j]->corner_invmag[3]) = lens->inverse_magnification(cell[i][j]->corner_pt[3],thread,grid_data->zfactor);
 					*(cell[i][j]->corner_parity[3]) = sign_bool(*cell[i][j]->corner_invmag[3]);
-					lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),thread,zfactor);
-					*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],zfactor);
+					lens->find_sourcept(cell[i][j]->corner_pt[3],*(cell[i][j]->corner_sourcept[3]),thread,grid_data->zfactor);
+					*(cell[i][j]->corner_kappa[3]) = lens->kappa(cell[i][j]->corner_pt[3],grid_data->zfactor);
 					cell[i][j]->allocated_corner[3] = true;
 				}
 			}
@@ -1176,6 +1171,10 @@ void Grid::plot_corner_coordinates()
 void Grid::store_critical_curve_pts()
 {
 	lensvector new_srcpt;
+	int corner_positive_mag[4], corner_negative_mag[4];
+	double ccroot_t;
+	lensvector ccroot;
+	double cclength1, cclength2, long_diagonal_length;
 	if (lens->sorted_critical_curves==true) lens->sorted_critical_curves = false;
 	if (cell != NULL) {
 		int i,j;
@@ -1203,15 +1202,15 @@ void Grid::store_critical_curve_pts()
 			else die("positive vs. negative magnitude corners don't match up right");
 		}
 		if (corner03) {
-			ccsearch_initial_pt[0] = corner_pt[0][0];
-			ccsearch_initial_pt[1] = corner_pt[0][1];
-			ccsearch_interval[0] = corner_pt[3][0] - corner_pt[0][0];
-			ccsearch_interval[1] = corner_pt[3][1] - corner_pt[0][1];
+			grid_data->ccsearch_initial_pt[0] = corner_pt[0][0];
+			grid_data->ccsearch_initial_pt[1] = corner_pt[0][1];
+			grid_data->ccsearch_interval[0] = corner_pt[3][0] - corner_pt[0][0];
+			grid_data->ccsearch_interval[1] = corner_pt[3][1] - corner_pt[0][1];
 		} else {
-			ccsearch_initial_pt[0] = corner_pt[1][0];
-			ccsearch_initial_pt[1] = corner_pt[1][1];
-			ccsearch_interval[0] = corner_pt[2][0] - corner_pt[1][0];
-			ccsearch_interval[1] = corner_pt[2][1] - corner_pt[1][1];
+			grid_data->ccsearch_initial_pt[0] = corner_pt[1][0];
+			grid_data->ccsearch_initial_pt[1] = corner_pt[1][1];
+			grid_data->ccsearch_interval[0] = corner_pt[2][0] - corner_pt[1][0];
+			grid_data->ccsearch_interval[1] = corner_pt[2][1] - corner_pt[1][1];
 		}
 		double (Brent::*invmag)(const double);
 		invmag = static_cast<double (Brent::*)(const double)> (&Grid::invmag_along_diagonal);
@@ -1220,12 +1219,12 @@ void Grid::store_critical_curve_pts()
 			return;
 		}
 		ccroot_t = BrentsMethod(invmag,0,1,1e-6);
-		ccroot[0] = ccsearch_initial_pt[0] + ccroot_t*ccsearch_interval[0];
-		ccroot[1] = ccsearch_initial_pt[1] + ccroot_t*ccsearch_interval[1];
-		ccroot[0] = ccsearch_initial_pt[0] + ccroot_t*ccsearch_interval[0];
-		ccroot[1] = ccsearch_initial_pt[1] + ccroot_t*ccsearch_interval[1];
+		ccroot[0] = grid_data->ccsearch_initial_pt[0] + ccroot_t*grid_data->ccsearch_interval[0];
+		ccroot[1] = grid_data->ccsearch_initial_pt[1] + ccroot_t*grid_data->ccsearch_interval[1];
+		ccroot[0] = grid_data->ccsearch_initial_pt[0] + ccroot_t*grid_data->ccsearch_interval[0];
+		ccroot[1] = grid_data->ccsearch_initial_pt[1] + ccroot_t*grid_data->ccsearch_interval[1];
 		lens->critical_curve_pts.push_back(ccroot);
-		lens->find_sourcept(ccroot,new_srcpt,0,zfactor);
+		lens->find_sourcept(ccroot,new_srcpt,lens->lens_thread,grid_data->zfactor);
 		lens->caustic_pts.push_back(new_srcpt);
 		lensvector diagonal1, diagonal2;
 		diagonal1[0] = corner_pt[3][0] - corner_pt[0][0];
@@ -1242,7 +1241,7 @@ void Grid::store_critical_curve_pts()
 
 double Grid::invmag_along_diagonal(const double t)
 {
-	return lens->inverse_magnification(ccsearch_initial_pt + t*ccsearch_interval,0,zfactor);
+	return lens->inverse_magnification(grid_data->ccsearch_initial_pt + t*grid_data->ccsearch_interval,lens->lens_thread,grid_data->zfactor);
 }
 
 inline bool Grid::image_test(const int& thread)
@@ -1454,18 +1453,18 @@ inline bool Grid::test_if_galaxy_nearby(const lensvector& point, const double& d
 	disp[1] = 0;
 	nearby_pt[0] = point[0] + disp[0];
 	nearby_pt[1] = point[1] + disp[1];
-	if (test_if_inside_cell(nearby_pt,0)==true) return true;
+	if (test_if_inside_cell(nearby_pt,lens->lens_thread)==true) return true;
 	nearby_pt[0] = point[0] - disp[0];
 	nearby_pt[1] = point[1] - disp[1];
-	if (test_if_inside_cell(nearby_pt,0)==true) return true;
+	if (test_if_inside_cell(nearby_pt,lens->lens_thread)==true) return true;
 	disp[0] = 0;
 	disp[1] = sqrt(distsq);
 	nearby_pt[0] = point[0] + disp[0];
 	nearby_pt[1] = point[1] + disp[1];
-	if (test_if_inside_cell(nearby_pt,0)==true) return true;
+	if (test_if_inside_cell(nearby_pt,lens->lens_thread)==true) return true;
 	nearby_pt[0] = point[0] - disp[0];
 	nearby_pt[1] = point[1] - disp[1];
-	if (test_if_inside_cell(nearby_pt,0)==true) return true;
+	if (test_if_inside_cell(nearby_pt,lens->lens_thread)==true) return true;
 
 	return false;
 }
@@ -1615,7 +1614,7 @@ void Grid::grid_search_firstlevel(const int& searchlevel)
 //#ifdef USE_OPENMP
 		//thread = omp_get_thread_num();
 //#else
-		thread = 0;
+		thread = lens->lens_thread;
 //#endif
 
 		int ntot = u_N*w_N;
@@ -1631,7 +1630,7 @@ void Grid::grid_search_firstlevel(const int& searchlevel)
 
 void Grid::grid_search(const int& searchlevel, const int& thread)
 {
-	if (finished_search) return;
+	if (grid_data->finished_search) return;
 	if ((lens->include_central_image==false) and (cell_in_central_image_region==true)) return;
 	// 'searchlevel' specifies level at which we should start hunting for images.
 	// If the level is at or above the searchlevel, start searching for images;
@@ -1642,7 +1641,7 @@ void Grid::grid_search(const int& searchlevel, const int& thread)
 		int i,j;
 		for (j=0; j < w_N; j++) {
 			for (i=0; i < u_N; i++) {
-				if (finished_search) break;
+				if (grid_data->finished_search) break;
 				cell[i][j]->grid_search(searchlevel,thread);
 			}
 		}
@@ -1657,7 +1656,7 @@ void Grid::grid_search(const int& searchlevel, const int& thread)
 					edge_sourcept_status status = check_subgrid_neighbor_boundaries(i, neighbor[i], center_of_triangle, thread);
 					if (status==SourceInGap) {
 						if (run_newton(center_of_triangle,thread)==true)
-							if (nfound >= max_images) finished_search = true;
+							if (grid_data->nfound >= max_images) grid_data->finished_search = true;
 					} else if (status==SourceInOverlap) {
 						cell_maps_around_sourcept = false; // even if this cell maps around the source, don't search if it overlaps with neighboring subcells
 					}
@@ -1666,7 +1665,7 @@ void Grid::grid_search(const int& searchlevel, const int& thread)
 		}
 		if (cell_maps_around_sourcept) {
 			if (run_newton(center_imgplane,thread)==true) {
-				if (nfound >= max_images) finished_search = true;
+				if (grid_data->nfound >= max_images) grid_data->finished_search = true;
 			}
 		}
 	}
@@ -1682,7 +1681,7 @@ void Grid::subgrid_around_galaxies(lensvector* galaxy_centers, const int& ngal,
 void Grid::subgrid_around_galaxies_iteration(lensvector* galaxy_centers, const int& ngal, double* subgrid_radius, double* min_galsubgrid_cellsize, const int& n_cc_splittings, bool cc_neighbor_splitting)
 {
 	bool galaxy_nearby;
-	if (level < splitlevels+1)
+	if (level < grid_data->splitlevels+1)
 	{
 		int i,j;
 		for (i=0; i < u_N; i++) {
@@ -1691,19 +1690,19 @@ void Grid::subgrid_around_galaxies_iteration(lensvector* galaxy_centers, const i
 			}
 		}
 	}
-	else if ((!enforce_min_area) or (cell_area > min_cell_area))
+	else if ((!grid_data->enforce_min_area) or (cell_area > grid_data->min_cell_area))
 	{
-		if ((!enforce_min_area) and (cell_area==0)) find_cell_area(0);
+		if ((!grid_data->enforce_min_area) and (cell_area==0)) find_cell_area(lens->lens_thread);
 		int i,j,k;
 		for (k=0; k < ngal; k++) {
 			galaxy_nearby = false;
 			if ((cell_area > min_galsubgrid_cellsize[k]) or ((n_cc_splittings > 0) and (cc_inside))) {
-				if (test_if_inside_cell(galaxy_centers[k],0)==true) galaxy_nearby = true;
+				if (test_if_inside_cell(galaxy_centers[k],lens->lens_thread)==true) galaxy_nearby = true;
 				else galaxy_nearby = test_if_galaxy_nearby(galaxy_centers[k],SQR(subgrid_radius[k]));
 				if (galaxy_nearby==true) {
 					if (cell != NULL) {
 						// We're going to assume that the cells all have nearly the same area, so we can just check the first cell area
-						if (cell[0][0]->cell_area > min_cell_area) {
+						if (cell[0][0]->cell_area > grid_data->min_cell_area) {
 							if (cell[0][0]->cell_area > min_galsubgrid_cellsize[k]) {
 								for (i=0; i < u_N; i++)
 									for (j=0; j < w_N; j++)
@@ -1734,7 +1733,7 @@ void Grid::subgrid_around_galaxies_iteration(lensvector* galaxy_centers, const i
 						}
 					} else {
 						galsubgrid();
-						if (cell[0][0]->cell_area > dmax(min_cell_area,min_galsubgrid_cellsize[k])) {
+						if (cell[0][0]->cell_area > dmax(grid_data->min_cell_area,min_galsubgrid_cellsize[k])) {
 							for (i=0; i < u_N; i++) {
 								for (j=0; j < w_N; j++) {
 									cell[i][j]->subgrid_around_galaxies_iteration(galaxy_centers, ngal, subgrid_radius, min_galsubgrid_cellsize, n_cc_splittings, cc_neighbor_splitting);
@@ -1751,28 +1750,28 @@ void Grid::subgrid_around_galaxies_iteration(lensvector* galaxy_centers, const i
 
 image* Grid::tree_search()
 {
-   finished_search = false;
+   grid_data->finished_search = false;
 	if (lens->use_cc_spline) {
 		// With the critical curve/caustic spline (this assumes elliptical symmetry), we know how many images to
 		// expect based on the region the source is located in. We can use this to speed up the image search: if
 		// all the expected images are found, we stop before all the remaining cells are searched unnecessarily.
 		// Also, we can check to see if we actually found all the expected images.
-		grid_search_firstlevel(levels);
-		if (!finished_search)
+		grid_search_firstlevel(grid_data->levels);
+		if (!grid_data->finished_search)
 			warn(lens->warnings, "could not find all images for source (%g,%g), system type %i", lens->source[0], lens->source[1], lens->system_type);
 	} else {
-		grid_search_firstlevel(levels);
+		grid_search_firstlevel(grid_data->levels);
 	}
 
-   return images;
+   return grid_data->images;
 }
 
 inline bool Grid::redundancy(const lensvector& xroot)
 {
 	bool redundancy = false;
-	for (int k = 0; k < nfound; k++)
+	for (int k = 0; k < grid_data->nfound; k++)
 	{
-		if ((abs(xroot[0]-images[k].pos[0]) < redundancy_separation_threshold) and (abs(xroot[1]-images[k].pos[1]) < redundancy_separation_threshold))
+		if ((abs(xroot[0]-grid_data->images[k].pos[0]) < redundancy_separation_threshold) and (abs(xroot[1]-grid_data->images[k].pos[1]) < redundancy_separation_threshold))
 		{
 			redundancy = true;
 			break;
@@ -1784,6 +1783,7 @@ inline bool Grid::redundancy(const lensvector& xroot)
 void Lens::find_images()
 {
 	// called by plot_images(...)
+	ProfileTimer profile_timer(PROF_IMAGE_FINDING);
 	if (use_cc_spline) {
 		double r_source, theta_source;
 		r_source = norm(source[0]-grid_xcenter, source[1]-grid_ycenter);
@@ -1795,16 +1795,17 @@ void Lens::find_images()
 		else system_type = Single;
 	}
 
-	Grid::reset_search_parameters();
+	grid->reset_search_parameters();
 	images_found = grid->tree_search();
+	Profiler::add_count(PROF_IMAGES_FOUND,grid->get_nfound());
 
 	if (include_time_delays) {
 		double td_factor = time_delay_factor_arcsec(lens_redshift,reference_source_redshift);
 		double min_td=1e30;
 		int i;
-		for (i = 0; i < Grid::nfound; i++)
+		for (i = 0; i < grid->get_nfound(); i++)
 			if (images_found[i].td < min_td) min_td = images_found[i].td;
-		for (i = 0; i < Grid::nfound; i++) {
+		for (i = 0; i < grid->get_nfound(); i++) {
 			images_found[i].td -= min_td;
 			if (images_found[i].td != 0.0) images_found[i].td *= td_factor;
 		}
@@ -1832,13 +1833,13 @@ void Lens::output_images_single_source(const double &x_source, const double &y_s
 		cout << "#src_x (arcsec)\tsrc_y (arcsec)\tn_images";
 		if (flux != -1) cout << "\tsrc_flux";
 		cout << endl;
-		cout << source[0] << "\t" << source[1] << "\t" << Grid::nfound << "\t";
+		cout << source[0] << "\t" << source[1] << "\t" << grid->get_nfound() << "\t";
 		if (flux != -1) cout << "\t" << flux;
 		cout << endl << endl;
 	}
 
 	if (mpi_id==0) {
-		//cout << "# " << Grid::nfound << " images" << endl;
+		//cout << "# " << grid->get_nfound() << " images" << endl;
 		if (show_labels) {
 			cout << "#pos_x (arcsec)\tpos_y (arcsec)\tmagnification";
 			if (flux != -1.0) cout << "\tflux\t";
@@ -1846,12 +1847,12 @@ void Lens::output_images_single_source(const double &x_source, const double &y_s
 			cout << endl;
 		}
 		if (include_time_delays) {
-			for (int i = 0; i < Grid::nfound; i++) {
+			for (int i = 0; i < grid->get_nfound(); i++) {
 				if (flux == -1.0) cout << images_found[i].pos[0] << "\t" << images_found[i].pos[1] << "\t" << images_found[i].mag << "\t" << images_found[i].td << endl;
 				else cout << images_found[i].pos[0] << "\t" << images_found[i].pos[1] << "\t" << images_found[i].mag << "\t" << images_found[i].mag*flux << "\t" << images_found[i].td << endl;
 			}
 		} else {
-			for (int i = 0; i < Grid::nfound; i++) {
+			for (int i = 0; i < grid->get_nfound(); i++) {
 				if (flux == -1.0) cout << images_found[i].pos[0] << "\t" << images_found[i].pos[1] << "\t" << images_found[i].mag << endl;
 				else cout << images_found[i].pos[0] << "\t" << images_found[i].pos[1] << "\t" << images_found[i].mag << "\t" << images_found[i].mag*flux << endl;
 			}
@@ -1883,7 +1884,7 @@ bool Lens::plot_images_single_source(const double &x_source, const double &y_sou
 		cout << "#src_x (arcsec)\tsrc_y (arcsec)\tn_images";
 		if (flux != -1) cout << "\tsrc_flux";
 		cout << endl;
-		cout << source[0] << "\t" << source[1] << "\t" << Grid::nfound << "\t";
+		cout << source[0] << "\t" << source[1] << "\t" << grid->get_nfound() << "\t";
 		if (flux != -1) cout << "\t" << flux;
 		cout << endl << endl;
 	}
@@ -1892,7 +1893,7 @@ bool Lens::plot_images_single_source(const double &x_source, const double &y_sou
 		ofstream srcfile(srcfilename.c_str());
 		srcfile << x_source << " " << y_source << endl;
 		srcfile.close();
-		//cout << "# " << Grid::nfound << " images" << endl;
+		//cout << "# " << grid->get_nfound() << " images" << endl;
 		if (show_labels) {
 			cout << "#pos_x (arcsec)\tpos_y (arcsec)\tmagnification";
 			if (flux != -1.0) cout << "\tflux\t";
@@ -1901,13 +1902,13 @@ bool Lens::plot_images_single_source(const double &x_source, const double &y_sou
 		}
 		ofstream imgfile(imgfilename.c_str());
 		if (include_time_delays) {
-			for (int i = 0; i < Grid::nfound; i++) {
+			for (int i = 0; i < grid->get_nfound(); i++) {
 				if (flux == -1.0) cout << images_found[i].pos[0] << "\t" << images_found[i].pos[1] << "\t" << images_found[i].mag << "\t" << images_found[i].td << endl;
 				else cout << images_found[i].pos[0] << "\t" << images_found[i].pos[1] << "\t" << images_found[i].mag << "\t" << images_found[i].mag*flux << "\t" << images_found[i].td << endl;
 				imgfile << images_found[i].pos[0] << " " << images_found[i].pos[1] << endl;
 			}
 		} else {
-			for (int i = 0; i < Grid::nfound; i++) {
+			for (int i = 0; i < grid->get_nfound(); i++) {
 				if (flux == -1.0) cout << images_found[i].pos[0] << "\t" << images_found[i].pos[1] << "\t" << images_found[i].mag << endl;
 				else cout << images_found[i].pos[0] << "\t" << images_found[i].pos[1] << "\t" << images_found[i].mag << "\t" << images_found[i].mag*flux << endl;
 				imgfile << images_found[i].pos[0] << " " << images_found[i].pos[1] << endl;
@@ -1933,7 +1934,7 @@ image* Lens::get_images(const lensvector &source_in, int &n_images, bool verbal)
 	}
 
 	find_images();
-	n_images = Grid::nfound;
+	n_images = grid->get_nfound();
 	return images_found;
 }
 
@@ -1998,10 +1999,10 @@ bool Lens::plot_images(const char *sourcefile, const char *imagefile, bool verba
 		find_images();
 
 		if (mpi_id==0) {
-			imagedat << "# " << Grid::nfound << " images" << endl;
+			imagedat << "# " << grid->get_nfound() << " images" << endl;
 
 			if (use_cc_spline) {
-				for (int i = 0; i < Grid::nfound; i++)
+				for (int i = 0; i < grid->get_nfound(); i++)
 				{
 					if (include_time_delays)
 						imagedat << images_found[i].pos[0] << " " << images_found[i].pos[1] << " " << images_found[i].mag << " " << images_found[i].td << " " << images_found[i].parity << endl;
@@ -2034,32 +2035,32 @@ bool Lens::plot_images(const char *sourcefile, const char *imagefile, bool verba
 				}
 
 			} else {
-				for (int i = 0; i < Grid::nfound; i++)
+				for (int i = 0; i < grid->get_nfound(); i++)
 				{
 					if (include_time_delays)
 						imagedat << images_found[i].pos[0] << " " << images_found[i].pos[1] << " " << images_found[i].mag << " " << images_found[i].td << " " << images_found[i].parity << endl;
 					else
 						imagedat << images_found[i].pos[0] << " " << images_found[i].pos[1] << " " << images_found[i].mag << " " << images_found[i].parity << endl;
-					if (Grid::nfound==5) {
+					if (grid->get_nfound()==5) {
 						quads << images_found[i].pos[0] << " " << images_found[i].pos[1] << " " << images_found[i].mag << " " << images_found[i].parity << endl;
 					}
-					else if (Grid::nfound==3) {
+					else if (grid->get_nfound()==3) {
 						// this will count doubles and cusps
 						doubles << images_found[i].pos[0] << " " << images_found[i].pos[1] << " " << images_found[i].mag << " " << images_found[i].parity << endl;
 					}
-					else if (Grid::nfound==1) {
+					else if (grid->get_nfound()==1) {
 						singles << images_found[i].pos[0] << " " << images_found[i].pos[1] << " " << images_found[i].mag << " " << images_found[i].parity << endl;
 					} else {
 						weird << images_found[i].pos[0] << " " << images_found[i].pos[1] << " " << images_found[i].mag << " " << images_found[i].parity << endl;
 					}
 				}
-				if (Grid::nfound==5) {
+				if (grid->get_nfound()==5) {
 					srcquads << source[0] << " " << source[1] << endl;
 				}
-				else if (Grid::nfound==3) {
+				else if (grid->get_nfound()==3) {
 					srcdoubles << source[0] << " " << source[1] << endl;
 				}
-				else if (Grid::nfound==1) {
+				else if (grid->get_nfound()==1) {
 					srcsingles << source[0] << " " << source[1] << endl;
 				} else {
 					srcweird << source[0] << " " << source[1] << endl;
@@ -2073,6 +2074,203 @@ bool Lens::plot_images(const char *sourcefile, const char *imagefile, bool verba
 	return true;
 }
 
+// The batch image file written by find_images_batch(...) is binary, in the native byte order, with the layout:
+//   header:     char[8] "QLBATCH1", int nsources, int include_time_delays (0 or 1)
+//   per source: double x_source, double y_source, int n_images, int system_type (an ImageSystemType; with the critical
+//               curves splined this is found from the caustics, otherwise it is found from the number of images, with
+//               NoImages used for systems that are not singles, doubles or quads), followed by n_images records of
+//               double x, double y, double magnification, double time_delay, int parity
+// Sources appear in the same order as in the source file.
+const char batch_image_file_tag[8] = { 'Q','L','B','A','T','C','H','1' };
+
+bool Lens::find_images_batch(const char *sourcefile, const char *outfile, bool verbal)
+{
+	// Finds the images for every source in the source file. The sources are divided among the MPI processes, and within
+	// each process among threads, each of which searches with its own clone of this object (and hence its own grid). Each
+	// process packs its results into a buffer of doubles, and the buffers are gathered by process 0 and written to a single
+	// binary file (see above).
+	if ((use_cc_spline) and (!cc_splined) and (spline_critical_curves()==false)) return false;
+	if ((grid==NULL) and (create_grid(verbal,reference_zfactor)==false)) return false;
+
+	ifstream sources(sourcefile);
+	if (!sources.is_open()) { warn("could not open source file '%s'",sourcefile); return false; }
+	vector<double> srcx, srcy;
+	double x, y;
+	while (sources >> x >> y) {
+		srcx.push_back(x);
+		srcy.push_back(y);
+	}
+	int nsources = srcx.size();
+
+	int chunk, src_start, src_end;
+	chunk = nsources / mpi_np;
+	src_start = mpi_id*chunk;
+	if (mpi_id == mpi_np-1) chunk += (nsources % mpi_np); // assign the remainder elements to the last mpi process
+	src_end = src_start + chunk;
+
+	// Each thread searches with its own clone of this object (see create_image_search_clones()), so the sources are divided
+	// among threads as well; the results for each source are stored separately, then packed in order
+	vector< vector<double> > src_results(chunk); // for each source: n_images, system_type, then x, y, mag, td, parity for each image
+	Lens **clones = (chunk > 1) ? create_image_search_clones() : NULL;
+	int i, k, n_images_tot = 0;
+	#pragma omp parallel if (clones != NULL)
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = omp_get_thread_num();
+#else
+		thread = 0;
+#endif
+		Lens *lensptr = this;
+		if (clones != NULL) {
+			lensptr = clones[thread];
+			lensptr->create_grid(false,reference_zfactor);
+		}
+		ImageSystemType systype;
+		int j, n_images;
+		vector<double> *res;
+		#pragma omp for private(k) schedule(dynamic)
+		for (k=src_start; k < src_end; k++) {
+			lensptr->source[0] = srcx[k];
+			lensptr->source[1] = srcy[k];
+			lensptr->find_images();
+			n_images = lensptr->grid->get_nfound();
+			if (use_cc_spline) systype = lensptr->system_type;
+			else if (n_images==5) systype = Quad;
+			else if (n_images==3) systype = Double;
+			else if (n_images==1) systype = Single;
+			else systype = NoImages;
+			res = &src_results[k-src_start];
+			res->push_back(n_images);
+			res->push_back(systype);
+			for (j=0; j < n_images; j++) {
+				res->push_back(lensptr->images_found[j].pos[0]);
+				res->push_back(lensptr->images_found[j].pos[1]);
+				res->push_back(lensptr->images_found[j].mag);
+				res->push_back((include_time_delays) ? lensptr->images_found[j].td : 0.0);
+				res->push_back(lensptr->images_found[j].parity);
+			}
+		}
+	}
+	if (clones != NULL) {
+		for (i=0; i < nthreads; i++) delete clones[i];
+		delete[] clones;
+	}
+
+	vector<double> results;
+	for (k=0; k < chunk; k++) {
+		results.insert(results.end(),src_results[k].begin(),src_results[k].end());
+		n_images_tot += (int) src_results[k][0];
+	}
+
+	double *all_results;
+	int n_results = results.size();
+#ifdef USE_MPI
+	int id, *counts, *displs;
+	counts = new int[mpi_np];
+	displs = new int[mpi_np];
+	MPI_Gather(&n_results, 1, MPI_INT, counts, 1, MPI_INT, 0, mpi_comm);
+	MPI_Reduce((mpi_id==0) ? MPI_IN_PLACE : &n_images_tot, &n_images_tot, 1, MPI_INT, MPI_SUM, 0, mpi_comm);
+	if (mpi_id==0) {
+		displs[0] = 0;
+		for (id=1; id < mpi_np; id++) displs[id] = displs[id-1] + counts[id-1];
+		n_results = displs[mpi_np-1] + counts[mpi_np-1];
+	}
+	all_results = new double[(mpi_id==0) ? n_results+1 : 1];
+	MPI_Gatherv((results.size() > 0) ? &results[0] : NULL, results.size(), MPI_DOUBLE, all_results, counts, displs, MPI_DOUBLE, 0, mpi_comm);
+	delete[] counts;
+	delete[] displs;
+#else
+	all_results = (n_results > 0) ? &results[0] : NULL;
+#endif
+
+	if (mpi_id==0) {
+		ofstream out(outfile, ios::out | ios::binary);
+		if (!out.is_open()) warn("could not open batch image file '%s' for writing",outfile);
+		else {
+			int include_td = (include_time_delays) ? 1 : 0;
+			int n_images, systype_int, parity;
+			out.write(batch_image_file_tag,8);
+			out.write((char*) &nsources, sizeof(int));
+			out.write((char*) &include_td, sizeof(int));
+			int indx = 0;
+			for (k=0; k < nsources; k++) {
+				n_images = (int) all_results[indx++];
+				systype_int = (int) all_results[indx++];
+				out.write((char*) &srcx[k], sizeof(double));
+				out.write((char*) &srcy[k], sizeof(double));
+				out.write((char*) &n_images, sizeof(int));
+				out.write((char*) &systype_int, sizeof(int));
+				for (i=0; i < n_images; i++) {
+					out.write((char*) (all_results+indx), 4*sizeof(double));
+					parity = (int) all_results[indx+4];
+					out.write((char*) &parity, sizeof(int));
+					indx += 5;
+				}
+			}
+			if (verbal) cout << "Found " << n_images_tot << " images from " << nsources << " sources; results written to '" << outfile << "'" << endl;
+		}
+	}
+#ifdef USE_MPI
+	delete[] all_results;
+#endif
+	return true;
+}
+
+bool Lens::convert_batch_images_to_text(const char *batchfile, const char *imagefile)
+{
+	// Writes the results from a batch image file in the same text files that are produced by plot_images(...), so that the
+	// usual plotting scripts can be used
+	if (mpi_id != 0) return true;
+	ifstream in(batchfile, ios::in | ios::binary);
+	if (!in.is_open()) { warn("could not open batch image file '%s'",batchfile); return false; }
+	char tag[8];
+	int nsources, include_td;
+	in.read(tag,8);
+	in.read((char*) &nsources, sizeof(int));
+	in.read((char*) &include_td, sizeof(int));
+	if ((!in) or (strncmp(tag,batch_image_file_tag,8) != 0)) { warn("file '%s' is not a batch image file",batchfile); return false; }
+
+	ofstream imagedat(imagefile);
+	ofstream srcdat("src.dat");
+	// the classified images and sources are written to images.<type> and sources.<type>, indexed by ImageSystemType
+	const char *type_suffix[5] = { "weird", "singles", "doubles", "cusps", "quads" };
+	ofstream typed_images[5], typed_sources[5];
+	int i, k;
+	for (i=0; i < 5; i++) {
+		typed_images[i].open((string("images.") + type_suffix[i]).c_str());
+		typed_sources[i].open((string("sources.") + type_suffix[i]).c_str());
+		typed_images[i] << setiosflags(ios::scientific);
+		typed_sources[i] << setiosflags(ios::scientific);
+	}
+	imagedat << setiosflags(ios::scientific);
+	srcdat << setiosflags(ios::scientific);
+
+	double src[2], imgvals[4];
+	int n_images, systype, parity;
+	for (k=0; k < nsources; k++) {
+		in.read((char*) src, 2*sizeof(double));
+		in.read((char*) &n_images, sizeof(int));
+		in.read((char*) &systype, sizeof(int));
+		if (!in) { warn("batch image file '%s' ended after %i of %i sources",batchfile,k,nsources); return false; }
+		if ((systype < 0) or (systype > 4)) systype = NoImages;
+		srcdat << src[0] << " " << src[1] << endl;
+		typed_sources[systype] << src[0] << " " << src[1] << endl;
+		imagedat << "# " << n_images << " images" << endl;
+		for (i=0; i < n_images; i++) {
+			in.read((char*) imgvals, 4*sizeof(double));
+			in.read((char*) &parity, sizeof(int));
+			if (include_td)
+				imagedat << imgvals[0] << " " << imgvals[1] << " " << imgvals[2] << " " << imgvals[3] << " " << parity << endl;
+			else
+				imagedat << imgvals[0] << " " << imgvals[1] << " " << imgvals[2] << " " << parity << endl;
+			typed_images[systype] << imgvals[0] << " " << imgvals[1] << " " << imgvals[2] << " " << parity << endl;
+		}
+		imagedat << endl;
+	}
+	return true;
+}
+
 // 2-d Newton's Method w/ backtracking routines
 
 const int Grid::max_iterations = 200;
@@ -2099,7 +2297,7 @@ inline double Grid::max_component(const lensvector& x) { return dmax(fabs(x[0]),
 bool Grid::run_newton(const lensvector& xroot_initial, const int& thread)
 {
 	lensvector xroot = xroot_initial;
-	if ((enforce_min_area) and (image_pos_accuracy > 0.2*sqrt(cell_area))) warn(lens->newton_warnings,"image position accuracy comparable to or larger than cell size");
+	if ((grid_data->enforce_min_area) and (image_pos_accuracy > 0.2*sqrt(cell_area))) warn(lens->newton_warnings,"image position accuracy comparable to or larger than cell size");
 	if ((xroot[0]==0) and (xroot[1]==0)) { xroot[0] = xroot[1] = 5e-1*lens->cc_rmin; }	// Avoiding singularity at center
 	if (NewtonsMethod(xroot, newton_check[thread], thread)==false) {
 		warn(lens->newton_warnings,"Newton's method failed for source (%g,%g), level %i, cell center (%g,%g)",lens->source[0],lens->source[1],level,center_imgplane[0],center_imgplane[1],xroot[0],xroot[1]);
@@ -2121,9 +2319,9 @@ bool Grid::run_newton(const lensvector& xroot_initial, const int& thread)
 	}
 	if (((xroot[0]==center_imgplane[0]) and (center_imgplane[0] != 0)) and ((xroot[1]==center_imgplane[1]) and (center_imgplane[1] != 0)))
 		warn(lens->newton_warnings, "Newton's method returned center of grid cell");
-	double mag = lens->magnification(xroot,thread,zfactor);
+	double mag = lens->magnification(xroot,thread,grid_data->zfactor);
 	lensvector lens_eq_f;
-	lens->lens_equation(xroot,lens_eq_f,thread,zfactor);
+	lens->lens_equation(xroot,lens_eq_f,thread,grid_data->zfactor);
 	if ((abs(lens_eq_f[0]) > 1000*image_pos_accuracy) and (abs(lens_eq_f[1]) > 1000*image_pos_accuracy)) {
 		if ((lens->newton_warnings==true) and (abs(mag) < warning_magnification_threshold)) {
 			warn(lens->newton_warnings,"Newton's method found false root (%g,%g) (within 1000*accuracy) for source (%g,%g), level %i, cell center (%g,%g), mag %g",xroot[0],xroot[1],lens->source[0],lens->source[1],level,center_imgplane[0],center_imgplane[1],xroot[0],xroot[1],mag);
@@ -2134,7 +2332,7 @@ bool Grid::run_newton(const lensvector& xroot_initial, const int& thread)
 		warn(lens->newton_warnings,"Newton's method found image that exceeded magnification threshold for source (%g,%g), level %i, cell center (%g,%g)",lens->source[0],lens->source[1],level,center_imgplane[0],center_imgplane[1],xroot[0],xroot[1]);
 		return false;
 	}
-	if ((lens->include_central_image==false) and (mag > 0) and (lens->kappa(xroot,zfactor) > 1)) return false; // discard central image if not desired
+	if ((lens->include_central_image==false) and (mag > 0) and (lens->kappa(xroot,grid_data->zfactor) > 1)) return false; // discard central image if not desired
 	bool status = true;
 	#pragma omp critical
 	{
@@ -2148,18 +2346,18 @@ bool Grid::run_newton(const lensvector& xroot_initial, const int& thread)
 			}
 			status = false;
 		}
-		else if (nfound >= max_images) status = false;
+		else if (grid_data->nfound >= max_images) status = false;
 		else {
-			images[nfound].pos[0] = xroot[0];
-			images[nfound].pos[1] = xroot[1];
-			images[nfound].mag = lens->magnification(xroot,0,zfactor);
+			grid_data->images[grid_data->nfound].pos[0] = xroot[0];
+			grid_data->images[grid_data->nfound].pos[1] = xroot[1];
+			grid_data->images[grid_data->nfound].mag = lens->magnification(xroot,lens->lens_thread,grid_data->zfactor);
 			if (lens->include_time_delays) {
-				double potential = lens->potential(xroot,zfactor);
-				images[nfound].td = 0.5*(SQR(xroot[0]-lens->source[0])+SQR(xroot[1]-lens->source[1])) - potential; // the dimensionless version; it will be converted to days by the Lens class
+				double potential = lens->potential(xroot,grid_data->zfactor);
+				grid_data->images[grid_data->nfound].td = 0.5*(SQR(xroot[0]-lens->source[0])+SQR(xroot[1]-lens->source[1])) - potential; // the dimensionless version; it will be converted to days by the Lens class
 			} else {
-				images[nfound].td = 0;
+				grid_data->images[grid_data->nfound].td = 0;
 			}
-			images[nfound].parity = sign(images[nfound].mag);
+			grid_data->images[grid_data->nfound].parity = sign(grid_data->images[grid_data->nfound].mag);
 
 			if (lens->use_cc_spline) {
 				bool found_pos=false, found_neg=false;
@@ -2171,30 +2369,30 @@ bool Grid::run_newton(const lensvector& xroot_initial, const int& thread)
 
 				int expected_parity;
 				if (rroot < cr0) {
-					nfound_max++; expected_parity = 1;
+					grid_data->nfound_max++; expected_parity = 1;
 				} else if (rroot > cr1) {
-					nfound_pos++; expected_parity = 1;
+					grid_data->nfound_pos++; expected_parity = 1;
 				} else {
-					nfound_neg++; expected_parity = -1;
+					grid_data->nfound_neg++; expected_parity = -1;
 				}
 
-				if (images[nfound].parity != expected_parity)
+				if (grid_data->images[grid_data->nfound].parity != expected_parity)
 					warn(lens->warnings, "wrong parity found for image from source (%g, %g)", lens->source[0], lens->source[1]);
 				
-				if ((lens->system_type==Single) and (nfound_pos >= 1)) finished_search = true;
+				if ((lens->system_type==Single) and (grid_data->nfound_pos >= 1)) grid_data->finished_search = true;
 				else
 				{
-					if ((lens->system_type==Double) and (nfound_pos >= 1)) found_pos = true;
-					else if (((lens->system_type==Quad) or (lens->system_type==Cusp)) and (nfound_pos >= 2)) found_pos = true;
+					if ((lens->system_type==Double) and (grid_data->nfound_pos >= 1)) found_pos = true;
+					else if (((lens->system_type==Quad) or (lens->system_type==Cusp)) and (grid_data->nfound_pos >= 2)) found_pos = true;
 
-					if (((lens->system_type==Double) or (lens->system_type==Cusp)) and (nfound_neg >= 1)) found_neg = true;
-					else if ((lens->system_type==Quad) and (nfound_neg >= 2)) found_neg = true;
+					if (((lens->system_type==Double) or (lens->system_type==Cusp)) and (grid_data->nfound_neg >= 1)) found_neg = true;
+					else if ((lens->system_type==Quad) and (grid_data->nfound_neg >= 2)) found_neg = true;
 
-					if ((found_pos) and (found_neg)) finished_search = true;
+					if ((found_pos) and (found_neg)) grid_data->finished_search = true;
 				}
 			}
 
-			nfound++;
+			grid_data->nfound++;
 		}
 	}
 	return status;
@@ -2206,7 +2404,7 @@ bool Grid::NewtonsMethod(lensvector& x, bool &check, const int& thread)
 	lensvector g, p, xold;
 	lensmatrix fjac;
 
-	lens->lens_equation(x, fvec[thread], thread, zfactor);
+	lens->lens_equation(x, fvec[thread], thread, grid_data->zfactor);
 	double f = 0.5*fvec[thread].sqrnorm();
 	if (max_component(fvec[thread]) < 0.01*image_pos_accuracy)
 		return true; 
@@ -2214,7 +2412,7 @@ bool Grid::NewtonsMethod(lensvector& x, bool &check, const int& thread)
 	double fold, stpmax, temp, test;
 	stpmax = max_step_length * dmax(x.norm(), 2.0); 
 	for (int its=0; its < max_iterations; its++) {
-		lens->hessian(x[0],x[1],fjac,thread,zfactor);
+		lens->hessian(x[0],x[1],fjac,thread,grid_data->zfactor);
 		fjac[0][0] = -1 + fjac[0][0];
 		fjac[1][1] = -1 + fjac[1][1];
 		g[0] = fjac[0][0] * fvec[thread][0] + fjac[0][1]*fvec[thread][1];
@@ -2281,7 +2479,7 @@ bool Grid::LineSearch(lensvector& xold, double fold, lensvector& g, lensvector&
 			warn(lens->newton_warnings, "Newton blew up!");
 			return false;
 		}
-		lens->lens_equation(x, fvec[thread], thread, zfactor);
+		lens->lens_equation(x, fvec[thread], thread, grid_data->zfactor);
 		f = 0.5 * fvec[thread].sqrnorm();
 		if (alam < alamin) {
 			x[0] = xold[0];
@@ -2320,8 +2518,8 @@ bool Grid::LineSearch(lensvector& xold, double fold, lensvector& g, lensvector&
 
 void Grid::reset_search_parameters()
 {
-	nfound = 0;
-	nfound_max = 0; nfound_pos = 0; nfound_neg = 0;
+	grid_data->nfound = 0;
+	grid_data->nfound_max = 0; grid_data->nfound_pos = 0; grid_data->nfound_neg = 0;
 }
 
 void Grid::clear_subcells(int clear_level)
@@ -2375,6 +2573,9 @@ Grid::~Grid()
 				delete corner_kappa[k];
 			}
 		}
+	} else {
+		delete[] grid_data->images;
+		delete grid_data;
 	}
 }
 
@@ -11,6 +11,9 @@
 #include "mcmchdr.h"
 #include "hyp_2F1.h"
 #include "cosmo.h"
+#ifdef USE_FITS
+#include "fitsio.h"
+#endif
 #include <cmath>
 #include <complex>
 #include <iostream>
@@ -21,6 +24,9 @@
 #include <cstdlib>
 #include <csignal>
 #include <sys/stat.h>
+#include <map>
+#include <vector>
+#include <cstring>
 using namespace std;
 
 const double Lens::default_autogrid_initial_step = 1.0e-3;
@@ -28,6 +34,7 @@ const double Lens::default_autogrid_rmin = 1.0e-5;
 const double Lens::default_autogrid_rmax = 1.0e6;
 const double Lens::default_autogrid_frac = 1.95; // ****** NOTE: it might be better to make this depend on the axis ratio, since for q=1 you may need larger rfrac
 const int Lens::max_cc_search_iterations = 8;
+const int Lens::cc_marching_newton_steps = 6;
 double Lens::galsubgrid_radius_fraction; // radius of satellite subgridding in terms of fraction of Einstein radius
 double Lens::galsubgrid_min_cellsize_fraction; // minimum cell size for satellite subgridding in terms of fraction of Einstein radius
 int Lens::galsubgrid_cc_splittings;
@@ -124,6 +131,8 @@ void Lens::set_mpi_params(const int& mpi_id_in, const int& mpi_np_in)
 
 Lens::Lens() : UCMC()
 {
+	lens_thread = 0;
+	thread_clone = false;
 	mpi_id = 0;
 	mpi_np = 1;
 	group_np = 1;
@@ -156,6 +165,8 @@ Lens::Lens() : UCMC()
 	verbal_mode = true;
 	quit_after_reading_file = false;
 	quit_after_error = false;
+	batch_system = false;
+	batch_system_failed = false;
 	fitmethod = SIMPLEX;
 	fit_output_dir = ".";
 	auto_fit_output_dir = true; // name the output directory "chains_<label>" unless manually specified otherwise
@@ -165,10 +176,16 @@ Lens::Lens() : UCMC()
 	simplex_temp_final = 1;
 	simplex_cooling_factor = 0.9; // temperature decrement (multiplicative) for annealing schedule
 	simplex_minchisq = -1e30;
+	de_population_size = 0;
+	de_max_generations = 1000;
+	de_polish = true;
 	n_mcpoints = 1000; // for nested sampling
 	mcmc_threads = 1;
 	mcmc_tolerance = 1.01; // Gelman-Rubin statistic for T-Walk sampler
 	mcmc_logfile = false;
+	mcmc_checkpoint_interval = 100;
+	twalk_threads = 1;
+	loglike_cache_size = 0;
 	open_chisq_logfile = false;
 	psf_convolution_mpi = false;
 	use_input_psf_matrix = false;
@@ -179,6 +196,9 @@ Lens::Lens() : UCMC()
 	max_sb_frac_unselected_pixels = 0.3; // ********ALSO SHOULD BE SPECIFIED BY THE USER, AND ONLY GETS USED IF max_sb_prior_unselected_pixels IS SET TO 'TRUE'
 	subhalo_prior = false; // if on, this prior constrains any subhalos (with Pseudo-Jaffe profiles) to be positioned within the designated fit area (selected fit pixels only)
 	nlens = 0;
+	use_lens_tree = false;
+	lens_tree_accuracy = 1e-3;
+	lens_tree = NULL;
 	n_sb = 0;
 	radial_grid = true;
 	grid_xlength = 20; // default gridsize
@@ -192,6 +212,7 @@ Lens::Lens() : UCMC()
 	fit_output_filename = "fit";
 	auto_save_bestfit = false;
 	fitmodel = NULL;
+	loglike_cache = NULL;
 #ifdef USE_FITS
 	fits_format = true;
 #else
@@ -213,6 +234,7 @@ Lens::Lens() : UCMC()
 	chisq_tolerance = 1e-3;
 	n_repeats = 1;
 	calculate_parameter_errors = true;
+	adaptive_fisher_steps = false;
 	use_image_plane_chisq2 = false;
 	use_image_plane_chisq = false;
 	use_magnification_in_chisq = false;
@@ -231,6 +253,8 @@ Lens::Lens() : UCMC()
 	sim_err_td = 0.1;
 
 	image_pixel_data = NULL;
+	n_extra_bands = 0;
+	extra_bands = NULL;
 	image_pixel_grid = NULL;
 	source_pixel_grid = NULL;
 	sourcegrid_xmin = -1;
@@ -263,6 +287,7 @@ Lens::Lens() : UCMC()
 	psf_width_y = 0;
 	data_pixel_noise = 0;
 	sim_pixel_noise = 0;
+	source_supersampling = 2;
 	sb_threshold = 0;
 	noise_threshold = 1.3;
 	n_image_pixels_x = 200;
@@ -285,12 +310,22 @@ Lens::Lens() : UCMC()
 	source_pixel_n_images = NULL;
 	active_image_pixel_i = NULL;
 	active_image_pixel_j = NULL;
+	active_image_row_start = NULL;
 	image_pixel_location_Lmatrix = NULL;
 	source_pixel_location_Lmatrix = NULL;
 	Lmatrix = NULL;
 	Lmatrix_index = NULL;
 	psf_matrix = NULL;
+	fit_uses_psf = false;
 	inversion_nthreads = 1;
+	logdet_nprobes = 10;
+	logdet_lanczos_steps = 40;
+	use_multigrid_preconditioner = false;
+	mpi_image_decomposition = false;
+	lmatrix_single_precision = false;
+	use_delaunay_srcgrid = false;
+	delaunay_srcgrid_stride = 2;
+	delaunay_srcgrid = NULL;
 	adaptive_grid = false;
 	pixel_magnification_threshold = 6;
 	pixel_magnification_threshold_lower_limit = 1e30; // These must be specified by user
@@ -326,6 +361,9 @@ Lens::Lens() : UCMC()
 	galsubgrid_min_cellsize_fraction = 0.1;
 	galsubgrid_cc_splittings = 1;
 	sorted_critical_curves = false;
+	use_cc_marching_squares = false;
+	cc_marching_nx = 400;
+	cc_marching_ny = 400;
 	n_singular_points = 0;
 	auto_store_cc_points = true;
 	newton_magnification_threshold = 1000;
@@ -351,7 +389,11 @@ Lens::Lens() : UCMC()
 
 Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as input lens; does NOT import the lens/source model configurations, however
 {
+	lens_thread = lens_in->lens_thread;
+	thread_clone = false;
 	verbal_mode = lens_in->verbal_mode;
+	batch_system = false;
+	batch_system_failed = false;
 	chisq_it=0;
 	chisq_bestfit = lens_in->chisq_bestfit;
 	bestfit_flux = lens_in->bestfit_flux;
@@ -364,6 +406,7 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	group_num = lens_in->group_num;
 	group_np = lens_in->group_np;
 #ifdef USE_MPI
+	mpi_comm = lens_in->mpi_comm;
 	group_comm = lens_in->group_comm;
 	mpi_group = lens_in->mpi_group;
 	my_comm = lens_in->my_comm;
@@ -397,9 +440,15 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	simplex_temp_final = lens_in->simplex_temp_final;
 	simplex_cooling_factor = lens_in->simplex_cooling_factor; // temperature decrement (multiplicative) for annealing schedule
 	simplex_minchisq = lens_in->simplex_minchisq;
+	de_population_size = lens_in->de_population_size;
+	de_max_generations = lens_in->de_max_generations;
+	de_polish = lens_in->de_polish;
 	n_mcpoints = lens_in->n_mcpoints; // for nested sampling
 	mcmc_tolerance = lens_in->mcmc_tolerance; // for T-Walk sampler
 	mcmc_logfile = lens_in->mcmc_logfile;
+	mcmc_checkpoint_interval = lens_in->mcmc_checkpoint_interval;
+	twalk_threads = lens_in->twalk_threads;
+	loglike_cache_size = lens_in->loglike_cache_size;
 	open_chisq_logfile = lens_in->open_chisq_logfile;
 	psf_convolution_mpi = lens_in->psf_convolution_mpi;
 	use_input_psf_matrix = lens_in->use_input_psf_matrix;
@@ -414,6 +463,9 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	plot_pttype = lens_in->plot_pttype;
 
 	nlens = 0;
+	use_lens_tree = lens_in->use_lens_tree;
+	lens_tree_accuracy = lens_in->lens_tree_accuracy;
+	lens_tree = NULL;
 	n_sb = 0;
 	radial_grid = lens_in->radial_grid;
 	grid_xlength = lens_in->grid_xlength; // default gridsize
@@ -426,8 +478,9 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	chisq_tolerance = lens_in->chisq_tolerance;
 	n_repeats = lens_in->n_repeats;
 	calculate_parameter_errors = lens_in->calculate_parameter_errors;
-	use_image_plane_chisq2 = lens_in->use_image_plane_chisq;
-	use_image_plane_chisq = lens_in->use_image_plane_chisq2;
+	adaptive_fisher_steps = lens_in->adaptive_fisher_steps;
+	use_image_plane_chisq = lens_in->use_image_plane_chisq;
+	use_image_plane_chisq2 = lens_in->use_image_plane_chisq2;
 	use_magnification_in_chisq = lens_in->use_magnification_in_chisq;
 	use_magnification_in_chisq_during_repeats = lens_in->use_magnification_in_chisq_during_repeats;
 	include_central_image = lens_in->include_central_image;
@@ -444,6 +497,7 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	sim_err_td = lens_in->sim_err_td;
 
 	fitmodel = NULL;
+	loglike_cache = NULL;
 	fits_format = lens_in->fits_format;
 	data_pixel_size = lens_in->data_pixel_size;
 	n_fit_parameters = 0;
@@ -458,6 +512,8 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	defspline = NULL;
 
 	image_pixel_data = NULL;
+	n_extra_bands = 0;
+	extra_bands = NULL;
 	image_pixel_grid = NULL;
 	source_pixel_grid = NULL;
 	sourcegrid_xmin = lens_in->sourcegrid_xmin;
@@ -483,6 +539,7 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	psf_width_y = lens_in->psf_width_y;
 	data_pixel_noise = lens_in->data_pixel_noise;
 	sim_pixel_noise = lens_in->sim_pixel_noise;
+	source_supersampling = lens_in->source_supersampling;
 	sb_threshold = lens_in->sb_threshold;
 	noise_threshold = lens_in->noise_threshold;
 	n_image_pixels_x = lens_in->n_image_pixels_x;
@@ -506,7 +563,9 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	source_pixel_n_images = NULL;
 	active_image_pixel_i = NULL;
 	active_image_pixel_j = NULL;
+	active_image_row_start = NULL;
 	Lmatrix_index = NULL;
+	fit_uses_psf = false;
 	if (lens_in->psf_matrix==NULL) psf_matrix = NULL;
 	else {
 		psf_npixels_x = lens_in->psf_npixels_x;
@@ -522,6 +581,14 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	source_pixel_location_Lmatrix = NULL;
 	Lmatrix = NULL;
 	inversion_nthreads = lens_in->inversion_nthreads;
+	logdet_nprobes = lens_in->logdet_nprobes;
+	logdet_lanczos_steps = lens_in->logdet_lanczos_steps;
+	use_multigrid_preconditioner = lens_in->use_multigrid_preconditioner;
+	mpi_image_decomposition = lens_in->mpi_image_decomposition;
+	lmatrix_single_precision = lens_in->lmatrix_single_precision;
+	use_delaunay_srcgrid = lens_in->use_delaunay_srcgrid;
+	delaunay_srcgrid_stride = lens_in->delaunay_srcgrid_stride;
+	delaunay_srcgrid = NULL;
 	adaptive_grid = lens_in->adaptive_grid;
 	pixel_magnification_threshold = lens_in->pixel_magnification_threshold;
 	vary_magnification_threshold = lens_in->vary_magnification_threshold;
@@ -555,6 +622,9 @@ Lens::Lens(Lens *lens_in) : UCMC() // creates lens object with same settings as
 	galsubgrid_min_cellsize_fraction = lens_in->galsubgrid_min_cellsize_fraction;
 	galsubgrid_cc_splittings = lens_in->galsubgrid_cc_splittings;
 	sorted_critical_curves = false;
+	use_cc_marching_squares = lens_in->use_cc_marching_squares;
+	cc_marching_nx = lens_in->cc_marching_nx;
+	cc_marching_ny = lens_in->cc_marching_ny;
 	auto_store_cc_points = lens_in->auto_store_cc_points;
 	n_singular_points = lens_in->n_singular_points;
 	newton_magnification_threshold = lens_in->newton_magnification_threshold;
@@ -863,7 +933,7 @@ void Lens::clear_source_objects()
 	}
 }
 
-void Lens::print_source_list()
+void Lens::print_source_list(bool show_vary_params)
 {
 	if (mpi_id==0) {
 		cout << resetiosflags(ios::scientific);
@@ -871,6 +941,8 @@ void Lens::print_source_list()
 			for (int i=0; i < n_sb; i++) {
 				cout << i << ". ";
 				sb_list[i]->print_parameters();
+				if (show_vary_params)
+					sb_list[i]->print_vary_parameters();
 			}
 		}
 		else cout << "No source objects have been specified" << endl;
@@ -944,6 +1016,7 @@ void Lens::autogrid() {
 bool Lens::create_grid(bool verbal, const double zfac)
 {
 	if (nlens==0) { warn(warnings, "no lens model is specified"); return false; }
+	ProfileTimer profile_timer(PROF_GRID_CONSTRUCTION);
 	double mytime0, mytime;
 #ifdef USE_OPENMP
 	if (show_wtime) {
@@ -969,10 +1042,6 @@ bool Lens::create_grid(bool verbal, const double zfac)
 	double rmax = 0.5*dmax(grid_xlength,grid_ylength);
 	record_singular_points(); // grid cells will split around singular points (e.g. center of point mass, etc.)
 
-	Grid::set_splitting(rsplit_initial, thetasplit_initial, splitlevels, cc_splitlevels, min_cell_area, cc_neighbor_splittings);
-	Grid::set_enforce_min_area(enforce_min_cell_area);
-	Grid::set_lens(this);
-
 	if (autogrid_before_grid_creation) autogrid();
 	else {
 		if (autocenter==true) {
@@ -998,12 +1067,15 @@ bool Lens::create_grid(bool verbal, const double zfac)
 			grid->redraw_grid(grid_xcenter, grid_ycenter, grid_xlength, grid_ylength, zfac);
 	} else {
 		if (radial_grid)
-			grid = new Grid(rmin_frac*rmax, rmax, grid_xcenter, grid_ycenter, 1, zfac); // setting grid_q to 1 for the moment...I will play with that later
+			grid = new Grid(this,rmin_frac*rmax, rmax, grid_xcenter, grid_ycenter, 1, zfac); // setting grid_q to 1 for the moment...I will play with that later
 		else
-			grid = new Grid(grid_xcenter, grid_ycenter, grid_xlength, grid_ylength, zfac);
+			grid = new Grid(this,grid_xcenter, grid_ycenter, grid_xlength, grid_ylength, zfac);
 	}
 	if (subgrid_around_satellites) subgrid_around_satellite_galaxies(zfac);
-	if ((auto_store_cc_points==true) and (use_cc_spline==false)) grid->store_critical_curve_pts();
+	if ((auto_store_cc_points==true) and (use_cc_spline==false)) {
+		if (use_cc_marching_squares) find_critical_curves_marching_squares(false,zfac);
+		else grid->store_critical_curve_pts();
+	}
 	if ((verbal) and (mpi_id==0)) {
 		cout << "done" << endl;
 #ifdef USE_OPENMP
@@ -1404,7 +1476,7 @@ bool Lens::get_einstein_radius(int lens_number, double& re_major_axis, double& r
 double Lens::inverse_magnification_r(const double r)
 {
 	lensmatrix jac;
-	hessian(grid_xcenter + r*cos(theta_crit), grid_ycenter + r*sin(theta_crit), jac, 0, reference_zfactor);
+	hessian(grid_xcenter + r*cos(theta_crit), grid_ycenter + r*sin(theta_crit), jac, lens_thread, reference_zfactor);
 	jac[0][0] = 1 - jac[0][0];
 	jac[1][1] = 1 - jac[1][1];
 	jac[0][1] = -jac[0][1];
@@ -1417,7 +1489,7 @@ double Lens::source_plane_r(const double r)
 	lensvector x,def;
 	x[0] = grid_xcenter + r*cos(theta_crit);
 	x[1] = grid_ycenter + r*sin(theta_crit);
-	find_sourcept(x,def,0,reference_zfactor);
+	find_sourcept(x,def,lens_thread,reference_zfactor);
 	def[0] -= grid_xcenter; // this assumes the deflection is approximately zero at the center of the grid (roughly true if any satellite gal's are small)
 	def[1] -= grid_ycenter;
 	return def.norm();
@@ -1675,13 +1747,13 @@ bool Lens::spline_critical_curves(bool verbal)
 		xp = cos(theta_table[i]); yp = sin(theta_table[i]);
 		x[0] = grid_xcenter + rcrit[0][i]*xp;
 		x[1] = grid_ycenter + rcrit[0][i]*yp;
-		find_sourcept(x,caust0,0,reference_zfactor);
+		find_sourcept(x,caust0,lens_thread,reference_zfactor);
 		rcaust[0][i] = norm(caust0[0]-grid_xcenter,caust0[1]-grid_ycenter);
 		caust0_theta_table[i] = angle(caust0[0]-grid_xcenter,caust0[1]-grid_ycenter);
 		if (!(isspherical())) {
 			x[0] = grid_xcenter + rcrit[1][i]*xp;
 			x[1] = grid_ycenter + rcrit[1][i]*yp;
-			find_sourcept(x,caust1,0,reference_zfactor);
+			find_sourcept(x,caust1,lens_thread,reference_zfactor);
 			rcaust[1][i] = norm(caust1[0]-grid_xcenter,caust1[1]-grid_ycenter);
 			caust1_theta_table[i] = angle(caust1[0]-grid_xcenter,caust1[1]-grid_ycenter);
 			if ((i==0) and (rcaust[1][i] < 1e-3))
@@ -1904,6 +1976,240 @@ void Lens::sort_critical_curves()
 	sorted_critical_curves = true;
 }
 
+bool Lens::find_critical_curves_marching_squares(const bool verbal, const double zfac)
+{
+	// The inverse magnification is evaluated on a uniform mesh spanning the grid, and its zero contours are extracted
+	// by marching squares. Each contour crossing is polished along its mesh edge with safeguarded Newton steps, then the
+	// segments are linked into ordered polylines that are stored directly as sorted critical curves (and caustics).
+	if (nlens==0) { warn(warnings, "no lens model is specified"); return false; }
+	if ((cc_marching_nx < 2) or (cc_marching_ny < 2)) { warn("marching squares mesh must have at least two cells along each axis"); return false; }
+#ifdef USE_OPENMP
+	double wtime0, wtime;
+	if (show_wtime) {
+		wtime0 = omp_get_wtime();
+	}
+#endif
+	int nx = cc_marching_nx, ny = cc_marching_ny;
+	int nodes_x = nx+1, nodes_y = ny+1;
+	int n_nodes = nodes_x*nodes_y;
+	int n_hedges = nx*nodes_y; // horizontal edges are indexed first, followed by the vertical edges
+	int n_edges = n_hedges + nodes_x*ny;
+	double xmin, ymin, xstep, ystep;
+	xmin = grid_xcenter - 0.5*grid_xlength;
+	ymin = grid_ycenter - 0.5*grid_ylength;
+	xstep = grid_xlength/nx;
+	ystep = grid_ylength/ny;
+
+	double *invmag = new double[n_nodes];
+	int n;
+	#pragma omp parallel
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = lens_thread + omp_get_thread_num();
+#else
+		thread = lens_thread;
+#endif
+		lensvector x;
+		#pragma omp for private(n) schedule(static)
+		for (n=0; n < n_nodes; n++) {
+			x[0] = xmin + (n % nodes_x)*xstep;
+			x[1] = ymin + (n / nodes_x)*ystep;
+			invmag[n] = inverse_magnification(x,thread,zfac);
+		}
+	}
+
+	// find the mesh edges crossed by a zero contour; nodes where the inverse magnification is not finite (e.g. at the
+	// center of a point mass) are skipped, which leaves an open end in the contour rather than a spurious crossing
+	int i, j, k, node0, node1;
+	int *edge_crossing = new int[n_edges];
+	vector<int> crossing_edge;
+	for (k=0; k < n_edges; k++) {
+		edge_crossing[k] = -1;
+		if (k < n_hedges) {
+			node0 = (k / nx)*nodes_x + (k % nx);
+			node1 = node0 + 1;
+		} else {
+			node0 = k - n_hedges;
+			node1 = node0 + nodes_x;
+		}
+		if ((invmag[node0]*0.0 != 0.0) or (invmag[node1]*0.0 != 0.0)) continue;
+		if ((invmag[node0] > 0) != (invmag[node1] > 0)) {
+			edge_crossing[k] = crossing_edge.size();
+			crossing_edge.push_back(k);
+		}
+	}
+	int n_crossings = crossing_edge.size();
+	if (n_crossings==0) {
+		delete[] invmag;
+		delete[] edge_crossing;
+		critical_curve_pts.clear();
+		caustic_pts.clear();
+		length_of_cc_cell.clear();
+		sorted_critical_curve.clear();
+		sorted_critical_curves = true;
+		if ((verbal) and (mpi_id==0)) cout << "No critical curves found within the grid" << endl;
+		return false;
+	}
+
+	// polish each crossing along its edge; the sign-change bracket is retained so that a Newton step that leaves
+	// the bracket is replaced by a bisection step
+	lensvector *ccpts = new lensvector[n_crossings];
+	lensvector *caustpts = new lensvector[n_crossings];
+	#pragma omp parallel
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = lens_thread + omp_get_thread_num();
+#else
+		thread = lens_thread;
+#endif
+		int m, edge, nd0, iter;
+		double t, ta, tb, fa, fb, f, fplus, fminus, dfdt, tnew;
+		const double dt = 1e-4;
+		lensvector x0, dx, x;
+		#pragma omp for private(m) schedule(dynamic)
+		for (m=0; m < n_crossings; m++) {
+			edge = crossing_edge[m];
+			if (edge < n_hedges) {
+				nd0 = (edge / nx)*nodes_x + (edge % nx);
+				dx[0] = xstep; dx[1] = 0;
+				fb = invmag[nd0+1];
+			} else {
+				nd0 = edge - n_hedges;
+				dx[0] = 0; dx[1] = ystep;
+				fb = invmag[nd0+nodes_x];
+			}
+			x0[0] = xmin + (nd0 % nodes_x)*xstep;
+			x0[1] = ymin + (nd0 / nodes_x)*ystep;
+			fa = invmag[nd0];
+			t = fa/(fa-fb); // linear interpolation gives the starting point
+			ta = 0; tb = 1;
+			for (iter=0; iter < cc_marching_newton_steps; iter++) {
+				x = x0 + t*dx;
+				f = inverse_magnification(x,thread,zfac);
+				if (f==0) break;
+				if ((f > 0) == (fa > 0)) ta = t;
+				else tb = t;
+				x = x0 + (t+dt)*dx;
+				fplus = inverse_magnification(x,thread,zfac);
+				x = x0 + (t-dt)*dx;
+				fminus = inverse_magnification(x,thread,zfac);
+				dfdt = (fplus-fminus)/(2*dt);
+				tnew = (dfdt != 0) ? t - f/dfdt : 0.5*(ta+tb);
+				if ((tnew <= ta) or (tnew >= tb)) tnew = 0.5*(ta+tb);
+				if (abs(tnew-t) < 1e-8) { t = tnew; break; }
+				t = tnew;
+			}
+			ccpts[m] = x0 + t*dx;
+			find_sourcept(ccpts[m],caustpts[m],thread,zfac);
+		}
+	}
+
+	// link the segments within each mesh cell. Each edge is shared by at most two cells, so every crossing has at most
+	// two neighbors; saddle cells (four crossings) are resolved using the inverse magnification at the cell center.
+	int *neighbor = new int[2*n_crossings];
+	for (k=0; k < 2*n_crossings; k++) neighbor[k] = -1;
+	int cell_edges[4], crossed[4], n_crossed, a, b, s;
+	double center_invmag;
+	lensvector xc;
+	for (j=0; j < ny; j++) {
+		for (i=0; i < nx; i++) {
+			cell_edges[0] = j*nx + i; // bottom
+			cell_edges[1] = n_hedges + j*nodes_x + i + 1; // right
+			cell_edges[2] = (j+1)*nx + i; // top
+			cell_edges[3] = n_hedges + j*nodes_x + i; // left
+			n_crossed = 0;
+			for (k=0; k < 4; k++) {
+				crossed[k] = edge_crossing[cell_edges[k]];
+				if (crossed[k] >= 0) n_crossed++;
+			}
+			if (n_crossed < 2) continue;
+			int pairs[4], n_pairs;
+			if (n_crossed==4) {
+				xc[0] = xmin + (i+0.5)*xstep;
+				xc[1] = ymin + (j+0.5)*ystep;
+				center_invmag = inverse_magnification(xc,lens_thread,zfac);
+				if ((center_invmag > 0) == (invmag[j*nodes_x+i] > 0)) {
+					// lower-left and upper-right corners are connected through the center
+					pairs[0] = crossed[0]; pairs[1] = crossed[1];
+					pairs[2] = crossed[2]; pairs[3] = crossed[3];
+				} else {
+					pairs[0] = crossed[3]; pairs[1] = crossed[0];
+					pairs[2] = crossed[1]; pairs[3] = crossed[2];
+				}
+				n_pairs = 2;
+			} else if (n_crossed==2) {
+				for (k=0, s=0; k < 4; k++) if (crossed[k] >= 0) pairs[s++] = crossed[k];
+				n_pairs = 1;
+			} else continue; // three crossings can only occur next to a non-finite node; leave those ends open
+			for (k=0; k < n_pairs; k++) {
+				a = pairs[2*k];
+				b = pairs[2*k+1];
+				if (neighbor[2*a]==-1) neighbor[2*a] = b;
+				else if (neighbor[2*a+1]==-1) neighbor[2*a+1] = b;
+				if (neighbor[2*b]==-1) neighbor[2*b] = a;
+				else if (neighbor[2*b+1]==-1) neighbor[2*b+1] = a;
+			}
+		}
+	}
+
+	// walk the linked crossings into polylines, starting with the open curves (which end at the edge of the grid)
+	// and then picking up the closed curves
+	critical_curve_pts.clear();
+	caustic_pts.clear();
+	length_of_cc_cell.clear();
+	sorted_critical_curve.clear();
+	double cell_length = sqrt(xstep*xstep + ystep*ystep);
+	bool *visited = new bool[n_crossings];
+	for (k=0; k < n_crossings; k++) visited[k] = false;
+	int pass, start, cur, next;
+	critical_curve new_critical_curve;
+	for (pass=0; pass < 2; pass++) {
+		for (start=0; start < n_crossings; start++) {
+			if (visited[start]) continue;
+			if (neighbor[2*start]==-1) continue; // isolated crossing
+			if ((pass==0) and (neighbor[2*start+1] != -1)) continue;
+			new_critical_curve.cc_pts.clear();
+			new_critical_curve.caustic_pts.clear();
+			new_critical_curve.length_of_cell.clear();
+			cur = start;
+			while (cur != -1) {
+				visited[cur] = true;
+				new_critical_curve.cc_pts.push_back(ccpts[cur]);
+				new_critical_curve.caustic_pts.push_back(caustpts[cur]);
+				new_critical_curve.length_of_cell.push_back(cell_length);
+				critical_curve_pts.push_back(ccpts[cur]);
+				caustic_pts.push_back(caustpts[cur]);
+				length_of_cc_cell.push_back(cell_length);
+				next = -1;
+				for (k=0; k < 2; k++) {
+					if ((neighbor[2*cur+k] != -1) and (!visited[neighbor[2*cur+k]])) { next = neighbor[2*cur+k]; break; }
+				}
+				cur = next;
+			}
+			sorted_critical_curve.push_back(new_critical_curve);
+		}
+	}
+	sorted_critical_curves = true;
+
+#ifdef USE_OPENMP
+	if (show_wtime) {
+		wtime = omp_get_wtime() - wtime0;
+		if (mpi_id==0) cout << "Wall time for tracing critical curves by marching squares: " << wtime << endl;
+	}
+#endif
+	if ((verbal) and (mpi_id==0)) cout << "Found " << sorted_critical_curve.size() << " critical curves (" << critical_curve_pts.size() << " points)" << endl;
+
+	delete[] invmag;
+	delete[] edge_crossing;
+	delete[] ccpts;
+	delete[] caustpts;
+	delete[] neighbor;
+	delete[] visited;
+	return true;
+}
+
 bool Lens::plot_sorted_critical_curves(const char *critfile)
 {
 	if (grid==NULL) {
@@ -2124,6 +2430,153 @@ double Lens::total_cross_section_integrand(const double theta)
 	return (0.5 * SQR(dmax(caust0_interpolate(theta), caust1_interpolate(theta))));
 }
 
+bool Lens::monte_carlo_cross_section(const double target_precision, const long int max_samples, const double lf_slope, const unsigned long long seed, bool verbal)
+{
+	// Monte Carlo estimate of the lensing cross section for each image multiplicity, and of the magnification-biased cross
+	// section for sources with power-law number counts N(>L) ~ L^(-lf_slope); since the number of sources per unit area in
+	// the source plane that appear brighter than a given flux is then boosted by mu^lf_slope (where mu is the total
+	// magnification of all the images), the biased cross section is the integral of mu^lf_slope over the multiple-imaging
+	// region. Sources are drawn uniformly within the circle enclosing the outer caustic, and the images are only searched
+	// for if the source is inside the caustics (otherwise it is counted as singly imaged). Sample k uses counters 2k and
+	// 2k+1 of a counter-based generator, so the samples (and results) do not depend on how they are divided up: the
+	// samples in each batch are divided among the MPI processes, and within each process among threads (each of which
+	// searches with its own clone of this object; see create_image_search_clones()). Each process sums the results of its
+	// samples in order, and the batch totals are then summed over processes so all of them apply the same stopping rule.
+	// Sampling stops once the relative uncertainty in both the multiple-imaging and biased cross sections is below
+	// target_precision, or max_samples have been drawn.
+	if (!use_cc_spline) { warn(warnings,"Monte Carlo cross section is only supported in critical curve spline mode (ccspline)"); return false; }
+	if (!cc_splined)
+		if (spline_critical_curves()==false) return false;	// in case critical curves could not be found
+	if ((grid==NULL) and (create_grid(verbal,reference_zfactor)==false)) return false;
+
+	double theta, r, theta_step, rmax;
+	int theta_n, theta_count = 400;
+	theta_step = 2*M_PI/(theta_count-1);
+	rmax = dmax(caust0_interpolate(0), caust1_interpolate(0));
+	for (theta_n=0, theta=0; theta_n < theta_count; theta_n++, theta += theta_step) {
+		r = dmax(caust0_interpolate(theta), caust1_interpolate(theta));
+		if (r > rmax) rmax = r;
+	}
+	rmax *= 1.02; // leave some margin, since the maximum of the caustic radius is only found on a grid in theta
+	double sample_area = M_PI*rmax*rmax;
+
+	const int max_multiplicity = 10; // multiplicities above this are counted in the last bin
+	const int n_sums = max_multiplicity + 5;
+	// sums[n] for n=0..max_multiplicity counts the samples with n images; these are followed by the sum of the bias weights,
+	// the sum of their squares, the number of samples, and the number of samples inside the caustics
+	double sums[n_sums], batch_sums[n_sums];
+	int i, n_images;
+	for (i=0; i < n_sums; i++) sums[i] = 0;
+
+	CounterRandom rng(seed);
+	long int m, n_local, n_samples=0, batch_size = 1000;
+	double weight;
+	double mult_cs, mult_cs_err, bias_cs, bias_cs_err, p, mean_w, mean_wsq;
+	bool converged = false;
+	vector<int> sample_n_images; // number of images found for each sample (or -1 if the source is outside the caustics)
+	vector<double> sample_weight;
+	Lens **clones = create_image_search_clones();
+	while ((!converged) and (n_samples < max_samples))
+	{
+		if (n_samples + batch_size > max_samples) batch_size = max_samples - n_samples;
+		for (i=0; i < n_sums; i++) batch_sums[i] = 0;
+		n_local = (batch_size > mpi_id) ? (batch_size - mpi_id + mpi_np - 1)/mpi_np : 0; // this process does samples n_samples + mpi_id + m*mpi_np
+		sample_n_images.assign(n_local,0);
+		sample_weight.assign(n_local,0.0);
+		#pragma omp parallel if (clones != NULL)
+		{
+			int thread;
+#ifdef USE_OPENMP
+			thread = omp_get_thread_num();
+#else
+			thread = 0;
+#endif
+			Lens *lensptr = this;
+			if (clones != NULL) {
+				lensptr = clones[thread];
+				if (lensptr->grid==NULL) lensptr->create_grid(false,reference_zfactor);
+			}
+			long int k;
+			int j, nfound;
+			double theta_k, r_k, mu_tot;
+			#pragma omp for private(m) schedule(dynamic)
+			for (m=0; m < n_local; m++) {
+				k = n_samples + mpi_id + m*mpi_np;
+				theta_k = rng.uniform(2*k) * 2*M_PI;
+				r_k = sqrt(rng.uniform(2*k+1)) * rmax;
+				if (r_k >= dmax(lensptr->caust0_interpolate(theta_k), lensptr->caust1_interpolate(theta_k))) {
+					sample_n_images[m] = -1; // outside the caustics
+					continue;
+				}
+				lensptr->source[0] = grid_xcenter + r_k*cos(theta_k);
+				lensptr->source[1] = grid_ycenter + r_k*sin(theta_k);
+				lensptr->find_images();
+				nfound = lensptr->grid->get_nfound();
+				sample_n_images[m] = nfound;
+				if (nfound > 1) {
+					mu_tot = 0;
+					for (j=0; j < nfound; j++) mu_tot += abs(lensptr->images_found[j].mag);
+					sample_weight[m] = pow(mu_tot,lf_slope);
+				}
+			}
+		}
+		for (m=0; m < n_local; m++) {
+			batch_sums[max_multiplicity+3] += 1;
+			if (sample_n_images[m] < 0) {
+				batch_sums[1] += 1; // outside the caustics
+				continue;
+			}
+			batch_sums[max_multiplicity+4] += 1;
+			n_images = (sample_n_images[m] > max_multiplicity) ? max_multiplicity : sample_n_images[m];
+			batch_sums[n_images] += 1;
+			if (n_images > 1) {
+				weight = sample_weight[m];
+				batch_sums[max_multiplicity+1] += weight;
+				batch_sums[max_multiplicity+2] += weight*weight;
+			}
+		}
+#ifdef USE_MPI
+		MPI_Allreduce(MPI_IN_PLACE, batch_sums, n_sums, MPI_DOUBLE, MPI_SUM, mpi_comm);
+#endif
+		for (i=0; i < n_sums; i++) sums[i] += batch_sums[i];
+		n_samples += batch_size;
+
+		p = 0;
+		for (i=2; i <= max_multiplicity; i++) p += sums[i];
+		p /= sums[max_multiplicity+3];
+		mult_cs = p*sample_area;
+		mult_cs_err = sqrt(p*(1-p)/sums[max_multiplicity+3])*sample_area;
+		mean_w = sums[max_multiplicity+1]/sums[max_multiplicity+3];
+		mean_wsq = sums[max_multiplicity+2]/sums[max_multiplicity+3];
+		bias_cs = mean_w*sample_area;
+		bias_cs_err = sqrt(dmax(mean_wsq - mean_w*mean_w,0)/sums[max_multiplicity+3])*sample_area;
+		if ((mpi_id==0) and (verbal)) cout << "samples=" << n_samples << ": multiple-image cross section = " << mult_cs << " +/- " << mult_cs_err << ", biased = " << bias_cs << " +/- " << bias_cs_err << endl;
+		if ((mult_cs > 0) and (mult_cs_err < target_precision*mult_cs) and (bias_cs_err < target_precision*bias_cs)) converged = true;
+		batch_size *= 2; // the stopping rule is checked less often as the number of samples grows
+	}
+	if (clones != NULL) {
+		for (i=0; i < nthreads; i++) delete clones[i];
+		delete[] clones;
+	}
+
+	if (mpi_id==0) {
+		cout << "Monte Carlo cross sections from " << n_samples << " samples (sampling area " << sample_area << "):" << endl;
+		for (i=1; i <= max_multiplicity; i++) {
+			if (sums[i]==0) continue;
+			p = sums[i]/sums[max_multiplicity+3];
+			cout << "   " << i << ((i==max_multiplicity) ? "+" : "") << " images: " << p*sample_area << " +/- " << sqrt(p*(1-p)/sums[max_multiplicity+3])*sample_area << endl;
+		}
+		if (sums[0] > 0) cout << "   (no images found for " << sums[0] << " samples inside the caustics)" << endl;
+		p = sums[max_multiplicity+4]/sums[max_multiplicity+3];
+		cout << "area enclosed by caustics: " << p*sample_area << " +/- " << sqrt(p*(1-p)/sums[max_multiplicity+3])*sample_area << endl;
+		cout << "multiple-image cross section: " << mult_cs << " +/- " << mult_cs_err << endl;
+		cout << "magnification-biased cross section (number count slope " << lf_slope << "): " << bias_cs << " +/- " << bias_cs_err << endl;
+		if (mult_cs > 0) cout << "magnification bias factor: " << bias_cs/mult_cs << endl;
+		if (!converged) warn(warnings,"target precision was not reached within the maximum number of samples");
+	}
+	return true;
+}
+
 bool Lens::plot_lens_equation(double x_source, double y_source, const char *lxfile, const char *lyfile)
 {
 	source[0] = x_source; source[1] = y_source;
@@ -2299,7 +2752,7 @@ void Lens::add_simulated_image_data(const lensvector &sourcept)
 		}
 	}
 	new_redshifts[n_sourcepts_fit] = source_redshift;
-	if (n_sourcepts_fit > 0) new_zfactors[n_sourcepts_fit] = kappa_ratio(lens_redshift,source_redshift,reference_source_redshift);
+	new_zfactors[n_sourcepts_fit] = kappa_ratio(lens_redshift,source_redshift,reference_source_redshift);
 	delete[] image_data;
 	delete[] sourcepts_fit;
 	delete[] vary_sourcepts_x;
@@ -2656,6 +3109,8 @@ void Lens::clear_image_data()
 		delete[] vary_sourcepts_x;
 		delete[] vary_sourcepts_y;
 		sourcepts_fit = NULL;
+		vary_sourcepts_x = NULL;
+		vary_sourcepts_y = NULL;
 	}
 	if (sourcepts_lower_limit != NULL) {
 		delete[] sourcepts_lower_limit;
@@ -2860,12 +3315,14 @@ void Lens::initialize_fitmodel()
 {
 	if (source_fit_mode == Point_Source) {
 		if ((sourcepts_fit==NULL) or (image_data==NULL)) { warn("cannot do fit; image data points have not been defined"); return; }
-	} else if (source_fit_mode == Pixellated_Source) {
+	} else if ((source_fit_mode == Pixellated_Source) or (source_fit_mode == Parameterized_Source)) {
 		if (image_pixel_data==NULL) { warn("cannot do fit; image data pixels have not been loaded"); return; }
 	}
 	if (fitmodel != NULL) delete fitmodel;
 	fitmodel = new Lens(this);
 	fitmodel->auto_ccspline = false;
+	if (loglike_cache != NULL) delete loglike_cache;
+	loglike_cache = (loglike_cache_size > 0) ? new LogLikeCache(n_fit_parameters,loglike_cache_size) : NULL;
 	//fitmodel->set_gridcenter(grid_xcenter,grid_ycenter);
 
 	fitmodel->borrowed_image_data = true;
@@ -2886,77 +3343,201 @@ void Lens::initialize_fitmodel()
 			fitmodel->zfactors[i] = zfactors[i];
 		}
 	} else if (source_fit_mode == Pixellated_Source) {
+		fitmodel->image_pixel_data = image_pixel_data;
+		fitmodel->n_extra_bands = n_extra_bands;
+		fitmodel->extra_bands = extra_bands;
+		fitmodel->load_pixel_grid_from_data();
+	} else if (source_fit_mode == Parameterized_Source) {
 		fitmodel->image_pixel_data = image_pixel_data;
 		fitmodel->load_pixel_grid_from_data();
-		delete source_pixel_grid; source_pixel_grid = NULL; // we do this because some of the static source grid parameters will be changed during fit (really should reorganize so this is not an issue)
+		fitmodel->clone_source_models(this);
+		fitmodel->fit_uses_psf = fitmodel->generate_psf_matrix(); // the PSF and pixel size do not change during the fit
+	}
+
+	fitmodel->clone_lens_models(this);
+	if (open_chisq_logfile) {
+		string logfile_str = fit_output_dir + "/" + fit_output_filename + ".log";
+		if (group_id==0) {
+			if (group_num > 0) {
+				// if there is more than one MPI group evaluating the likelihood, output a separate file for each group
+				stringstream groupstream;
+				string groupstr;
+				groupstream << group_num;
+				groupstream >> groupstr;
+				logfile_str += "." + groupstr;
+			}
+			fitmodel->logfile.open(logfile_str.c_str());
+			fitmodel->logfile << setprecision(10);
+		}
 	}
+}
 
-	fitmodel->nlens = nlens;
-	fitmodel->lens_list = new LensProfile*[nlens];
+void Lens::clone_lens_models(Lens *lens_in)
+{
+	// deep-copies the lens models of lens_in, so that their parameters can be varied independently of the originals
+	if (nlens > 0) {
+		for (int i=0; i < nlens; i++) delete lens_list[i];
+		delete[] lens_list;
+	}
+	nlens = lens_in->nlens;
+	lens_list = new LensProfile*[nlens];
 	for (int i=0; i < nlens; i++) {
-		switch (lens_list[i]->get_lenstype()) {
+		switch (lens_in->lens_list[i]->get_lenstype()) {
 			case KSPLINE:
-				fitmodel->lens_list[i] = new LensProfile(lens_list[i]); break;
+				lens_list[i] = new LensProfile(lens_in->lens_list[i]); break;
 			case ALPHA:
-				fitmodel->lens_list[i] = new Alpha((Alpha*) lens_list[i]); break;
+				lens_list[i] = new Alpha((Alpha*) lens_in->lens_list[i]); break;
 			case PJAFFE:
-				fitmodel->lens_list[i] = new PseudoJaffe((PseudoJaffe*) lens_list[i]); break;
+				lens_list[i] = new PseudoJaffe((PseudoJaffe*) lens_in->lens_list[i]); break;
 			case nfw:
-				fitmodel->lens_list[i] = new NFW((NFW*) lens_list[i]); break;
+				lens_list[i] = new NFW((NFW*) lens_in->lens_list[i]); break;
 			case TRUNCATED_nfw:
-				fitmodel->lens_list[i] = new Truncated_NFW((Truncated_NFW*) lens_list[i]); break;
+				lens_list[i] = new Truncated_NFW((Truncated_NFW*) lens_in->lens_list[i]); break;
 			case HERNQUIST:
-				fitmodel->lens_list[i] = new Hernquist((Hernquist*) lens_list[i]); break;
+				lens_list[i] = new Hernquist((Hernquist*) lens_in->lens_list[i]); break;
 			case EXPDISK:
-				fitmodel->lens_list[i] = new ExpDisk((ExpDisk*) lens_list[i]); break;
+				lens_list[i] = new ExpDisk((ExpDisk*) lens_in->lens_list[i]); break;
 			case SHEAR:
-				fitmodel->lens_list[i] = new Shear((Shear*) lens_list[i]); break;
+				lens_list[i] = new Shear((Shear*) lens_in->lens_list[i]); break;
 			case MULTIPOLE:
-				fitmodel->lens_list[i] = new Multipole((Multipole*) lens_list[i]); break;
+				lens_list[i] = new Multipole((Multipole*) lens_in->lens_list[i]); break;
 			case CORECUSP:
-				fitmodel->lens_list[i] = new CoreCusp((CoreCusp*) lens_list[i]); break;
+				lens_list[i] = new CoreCusp((CoreCusp*) lens_in->lens_list[i]); break;
 			case SERSIC_LENS:
-				fitmodel->lens_list[i] = new SersicLens((SersicLens*) lens_list[i]); break;
+				lens_list[i] = new SersicLens((SersicLens*) lens_in->lens_list[i]); break;
 			case PTMASS:
-				fitmodel->lens_list[i] = new PointMass((PointMass*) lens_list[i]); break;
+				lens_list[i] = new PointMass((PointMass*) lens_in->lens_list[i]); break;
 			case SHEET:
-				fitmodel->lens_list[i] = new MassSheet((MassSheet*) lens_list[i]); break;
+				lens_list[i] = new MassSheet((MassSheet*) lens_in->lens_list[i]); break;
 			default:
 				die("lens type not supported for fitting");
 		}
 	}
 	for (int i=0; i < nlens; i++) {
 		// if the lens is anchored to another lens, re-anchor so that it points to the corresponding
-		// lens in fitmodel (the lens whose parameters will be varied)
-		if (fitmodel->lens_list[i]->center_anchored==true) fitmodel->lens_list[i]->anchor_center_to_lens(fitmodel->lens_list, lens_list[i]->get_center_anchor_number());
-		if (fitmodel->lens_list[i]->anchor_special_parameter==true) {
-			LensProfile *parameter_anchor_lens = fitmodel->lens_list[lens_list[i]->get_special_parameter_anchor_number()];
-			fitmodel->lens_list[i]->assign_special_anchored_parameters(parameter_anchor_lens);
-		}
-		for (int j=0; j < fitmodel->lens_list[i]->get_n_params(); j++) {
-			if (fitmodel->lens_list[i]->anchor_parameter[j]==true) {
-				LensProfile *parameter_anchor_lens = fitmodel->lens_list[lens_list[i]->parameter_anchor_lens[j]->lens_number];
-				int paramnum = fitmodel->lens_list[i]->parameter_anchor_paramnum[j];
-				double param_ratio = fitmodel->lens_list[i]->parameter_anchor_ratio[j];
-				fitmodel->lens_list[i]->assign_anchored_parameter(j,paramnum,param_ratio,parameter_anchor_lens);
+		// lens in this object (the lens whose parameters will be varied)
+		if (lens_list[i]->center_anchored==true) lens_list[i]->anchor_center_to_lens(lens_list, lens_in->lens_list[i]->get_center_anchor_number());
+		if (lens_list[i]->anchor_special_parameter==true) {
+			LensProfile *parameter_anchor_lens = lens_list[lens_in->lens_list[i]->get_special_parameter_anchor_number()];
+			lens_list[i]->assign_special_anchored_parameters(parameter_anchor_lens);
+		}
+		for (int j=0; j < lens_list[i]->get_n_params(); j++) {
+			if (lens_list[i]->anchor_parameter[j]==true) {
+				LensProfile *parameter_anchor_lens = lens_list[lens_in->lens_list[i]->parameter_anchor_lens[j]->lens_number];
+				int paramnum = lens_list[i]->parameter_anchor_paramnum[j];
+				double param_ratio = lens_list[i]->parameter_anchor_ratio[j];
+				lens_list[i]->assign_anchored_parameter(j,paramnum,param_ratio,parameter_anchor_lens);
 			}
 		}
 	}
-	if (open_chisq_logfile) {
-		string logfile_str = fit_output_dir + "/" + fit_output_filename + ".log";
-		if (group_id==0) {
-			if (group_num > 0) {
-				// if there is more than one MPI group evaluating the likelihood, output a separate file for each group
-				stringstream groupstream;
-				string groupstr;
-				groupstream << group_num;
-				groupstream >> groupstr;
-				logfile_str += "." + groupstr;
-			}
-			fitmodel->logfile.open(logfile_str.c_str());
-			fitmodel->logfile << setprecision(10);
+	update_lens_tree();
+}
+
+void Lens::clone_source_models(Lens *lens_in)
+{
+	// deep-copies the source objects of lens_in, so that their parameters can be varied independently of the originals
+	clear_source_objects();
+	n_sb = lens_in->n_sb;
+	sb_list = new SB_Profile*[n_sb];
+	for (int i=0; i < n_sb; i++) {
+		switch (lens_in->sb_list[i]->get_sbtype()) {
+			case SB_SPLINE:
+				sb_list[i] = new SB_Profile(lens_in->sb_list[i]); break;
+			case GAUSSIAN:
+				sb_list[i] = new Gaussian((Gaussian*) lens_in->sb_list[i]); break;
+			case SERSIC:
+				sb_list[i] = new Sersic((Sersic*) lens_in->sb_list[i]); break;
+			case TOPHAT:
+				sb_list[i] = new TopHat((TopHat*) lens_in->sb_list[i]); break;
+			default:
+				die("surface brightness profile type not supported for fitting");
+		}
+	}
+}
+
+Lens* Lens::create_thread_clone(const int thread)
+{
+	// Creates an independent copy of this object (with its own fitmodel) that can evaluate the fit likelihood on the given
+	// thread while other clones do the same. The lens models and fit settings are deep-copied, whereas the data are shared
+	// read-only. This must be called after the fit parameters have been set up; see thread_safe_likelihood() for which
+	// likelihoods can actually be evaluated concurrently.
+	if ((thread < 0) or (thread >= nthreads)) die("thread clone number (%i) exceeds the number of allocated threads (%i)",thread,nthreads);
+	Lens *clone = new Lens(this);
+	clone->lens_thread = thread;
+	clone->thread_clone = true;
+	clone->display_chisq_status = false;
+	clone->open_chisq_logfile = false;
+	clone->clone_lens_models(this);
+	clone->n_fit_parameters = n_fit_parameters;
+
+	clone->borrowed_image_data = true;
+	if (source_fit_mode == Point_Source) {
+		clone->image_data = image_data;
+		clone->n_sourcepts_fit = n_sourcepts_fit;
+		clone->sourcepts_fit = new lensvector[n_sourcepts_fit];
+		clone->vary_sourcepts_x = new bool[n_sourcepts_fit];
+		clone->vary_sourcepts_y = new bool[n_sourcepts_fit];
+		clone->source_redshifts = new double[n_sourcepts_fit];
+		clone->zfactors = new double[n_sourcepts_fit];
+		for (int i=0; i < n_sourcepts_fit; i++) {
+			clone->sourcepts_fit[i][0] = sourcepts_fit[i][0];
+			clone->sourcepts_fit[i][1] = sourcepts_fit[i][1];
+			clone->vary_sourcepts_x[i] = vary_sourcepts_x[i];
+			clone->vary_sourcepts_y[i] = vary_sourcepts_y[i];
+			clone->source_redshifts[i] = source_redshifts[i];
+			clone->zfactors[i] = zfactors[i];
+		}
+	} else if (source_fit_mode == Pixellated_Source) {
+		clone->image_pixel_data = image_pixel_data;
+		clone->n_extra_bands = n_extra_bands;
+		if (n_extra_bands > 0) {
+			// the band data are shared, but each clone records the chi-square of each band in its own array
+			clone->extra_bands = new ImagePixelBand[n_extra_bands];
+			for (int i=0; i < n_extra_bands; i++) clone->extra_bands[i] = extra_bands[i];
 		}
 	}
+	clone->initialize_fitmodel();
+	return clone;
+}
+
+Lens** Lens::create_image_search_clones()
+{
+	// Creates a copy of this object for each thread, with its own lens models (and critical curve splines, if used), so that
+	// images can be found for several sources concurrently; used by find_images_batch(...) and monte_carlo_cross_section(...).
+	// The clones' grids are not created here: each clone should call create_grid from within the parallel region, so that the
+	// grid's own parallel regions are inactive and only use the clone's thread. The clones use the grid dimensions already
+	// found for this object, so they do not re-center or resize their grids. Returns NULL if there is only one thread, if the
+	// deflection is splined (the clones do not copy the spline), or if the critical curves cannot be splined.
+	if ((nthreads==1) or (defspline != NULL)) return NULL;
+	Lens **clones = new Lens*[nthreads];
+	int i,j;
+	for (i=0; i < nthreads; i++) {
+		clones[i] = new Lens(this);
+		clones[i]->lens_thread = i;
+		clones[i]->clone_lens_models(this);
+		clones[i]->autogrid_before_grid_creation = false;
+		clones[i]->autocenter = false;
+		clones[i]->auto_gridsize_from_einstein_radius = false;
+		if ((use_cc_spline) and (clones[i]->spline_critical_curves(false)==false)) {
+			for (j=0; j <= i; j++) delete clones[j];
+			delete[] clones;
+			return NULL;
+		}
+	}
+	return clones;
+}
+
+bool Lens::thread_safe_likelihood()
+{
+	// Each thread clone has its own lens models, image-searching grid and source/image pixel grids, and uses its own set of
+	// dummy variables (indexed by lens_thread), so thread clones can evaluate the point image chi-square (in either the source
+	// or image plane) and the pixellated source likelihood concurrently. The exceptions are inversions that use MPI
+	// collectives within each group, and MUMPS, whose solver instance is shared by all Lens objects.
+	if (source_fit_mode == Point_Source) return true;
+	if (source_fit_mode != Pixellated_Source) return false;
+	if (group_np > 1) return false;
+	if (inversion_method==MUMPS) return false;
+	return true;
 }
 
 void Lens::update_anchored_parameters()
@@ -2966,6 +3547,22 @@ void Lens::update_anchored_parameters()
 		if (lens_list[i]->anchor_special_parameter) lens_list[i]->update_special_anchored_params();
 		lens_list[i]->update_anchored_parameters();
 	}
+	update_lens_tree();
+}
+
+void Lens::update_lens_tree()
+{
+	// Builds (or updates) the tree of compact lenses used to sum their deflections hierarchically; this must be called
+	// whenever lenses are added or removed, or their parameters are changed
+	if (!use_lens_tree) {
+		if (lens_tree != NULL) {
+			delete lens_tree;
+			lens_tree = NULL;
+		}
+		return;
+	}
+	if (lens_tree==NULL) lens_tree = new LensTree(lens_tree_accuracy);
+	lens_tree->update(lens_list,nlens,lens_tree_accuracy);
 }
 
 bool Lens::update_fitmodel(const double* params)
@@ -2987,6 +3584,8 @@ bool Lens::update_fitmodel(const double* params)
 		if ((vary_regularization_parameter) and (regularization_method != None)) fitmodel->regularization_parameter = params[index++];
 		if (vary_pixel_fraction) fitmodel->pixel_fraction = params[index++];
 		if (vary_magnification_threshold) fitmodel->pixel_magnification_threshold = params[index++];
+	} else if (source_fit_mode == Parameterized_Source) {
+		for (i=0; i < n_sb; i++) fitmodel->sb_list[i]->update_fit_parameters(params,index,status);
 	}
 	if (vary_hubble_parameter) {
 		fitmodel->hubble = params[index++];
@@ -3025,7 +3624,7 @@ double Lens::chisq_pos_source_plane()
 		src_bf[0] = src_bf[1] = 0;
 		src_norm=0;
 		for (j=0; j < image_data[i].n_images; j++) {
-			find_sourcept(image_data[i].pos[j],beta_ji[j],0,zfactors[i]);
+			find_sourcept(image_data[i].pos[j],beta_ji[j],lens_thread,zfactors[i]);
 			if (use_magnification_in_chisq) {
 				hessian(image_data[i].pos[j],jac,zfactors[i]);
 				jac[0][0] = 1 - jac[0][0];
@@ -3107,7 +3706,7 @@ void Lens::output_analytic_srcpos(lensvector *beta_i)
 		beta_i[i][0] = beta_i[i][1] = 0;
 		src_norm=0;
 		for (j=0; j < image_data[i].n_images; j++) {
-			find_sourcept(image_data[i].pos[j],beta_ji,0,zfactors[i]);
+			find_sourcept(image_data[i].pos[j],beta_ji,lens_thread,zfactors[i]);
 			if (use_magnification_in_chisq) {
 				hessian(image_data[i].pos[j],jac,zfactors[i]);
 				jac[0][0] = 1 - jac[0][0];
@@ -3383,7 +3982,7 @@ double Lens::chisq_time_delays()
 		min_td_mod=1e30;
 		for (j=0; j < image_data[i].n_images; j++) {
 			if (image_data[i].sigma_t[j]==0) continue;
-			find_sourcept(image_data[i].pos[j],beta_ij,0,zfactors[i]);
+			find_sourcept(image_data[i].pos[j],beta_ij,lens_thread,zfactors[i]);
 			pot = potential(image_data[i].pos[j],zfactors[i]);
 			time_delays_mod[j] = 0.5*(SQR(image_data[i].pos[j][0] - beta_ij[0]) + SQR(image_data[i].pos[j][1] - beta_ij[1])) - pot;
 			if (time_delays_mod[j] < min_td_mod) min_td_mod = time_delays_mod[j];
@@ -3427,6 +4026,9 @@ void Lens::get_automatic_initial_stepsizes(dvector& stepsizes)
 	else if ((vary_regularization_parameter) and (source_fit_mode==Pixellated_Source) and (regularization_method != None)) {
 		stepsizes[index++] = 0.33*regularization_parameter;
 	}
+	else if (source_fit_mode==Parameterized_Source) {
+		for (i=0; i < n_sb; i++) sb_list[i]->get_auto_stepsizes(stepsizes,index);
+	}
 	if (vary_pixel_fraction) stepsizes[index++] = 0.3;
 	if (vary_magnification_threshold) stepsizes[index++] = 0.3;
 	if (vary_hubble_parameter) stepsizes[index++] = 0.3;
@@ -3453,6 +4055,9 @@ void Lens::set_default_plimits()
 	else if ((vary_regularization_parameter) and (source_fit_mode==Pixellated_Source) and (regularization_method != None)) {
 		index++;
 	}
+	else if (source_fit_mode==Parameterized_Source) {
+		for (i=0; i < n_sb; i++) sb_list[i]->get_auto_ranges(use_penalty_limits,lower,upper,index);
+	}
 	if (vary_pixel_fraction) index++;
 	if (vary_magnification_threshold) index++;
 	if (vary_hubble_parameter) index++;
@@ -3466,6 +4071,12 @@ void Lens::get_n_fit_parameters(int &nparams)
 	for (int i=0; i < nlens; i++)
 		lensmodel_fit_parameters += lens_list[i]->get_n_vary_params();
 	nparams = lensmodel_fit_parameters;
+	srcmodel_fit_parameters=0;
+	if (source_fit_mode==Parameterized_Source) {
+		for (int i=0; i < n_sb; i++)
+			srcmodel_fit_parameters += sb_list[i]->get_n_vary_params();
+		nparams += srcmodel_fit_parameters;
+	}
 	if (source_fit_mode==Point_Source) {
 		if ((!use_analytic_bestfit_src) or (use_image_plane_chisq) or (use_image_plane_chisq2)) {
 			for (int i=0; i < n_sourcepts_fit; i++) {
@@ -3487,6 +4098,9 @@ bool Lens::setup_fit_parameters(bool include_limits)
 		if (sourcepts_fit==NULL) { warn("cannot do fit; initial source parameters have not been defined"); return false; }
 	} else if (source_fit_mode==Pixellated_Source) {
 		if (image_pixel_data==NULL) { warn("cannot do fit; image pixel data has not been loaded"); return false; }
+	} else if (source_fit_mode==Parameterized_Source) {
+		if (image_pixel_data==NULL) { warn("cannot do fit; image pixel data has not been loaded"); return false; }
+		if (n_sb==0) { warn("cannot do fit; no source objects have been defined"); return false; }
 	}
 	if (nlens==0) { warn("cannot do fit; no lens models have been defined"); return false; }
 	get_n_fit_parameters(n_fit_parameters);
@@ -3503,6 +4117,9 @@ bool Lens::setup_fit_parameters(bool include_limits)
 			}
 		}
 	} else if ((vary_regularization_parameter) and (source_fit_mode==Pixellated_Source) and (regularization_method != None)) fitparams[index++] = regularization_parameter;
+	else if (source_fit_mode==Parameterized_Source) {
+		for (int i=0; i < n_sb; i++) sb_list[i]->get_fit_parameters(fitparams,index);
+	}
 	if (vary_pixel_fraction) fitparams[index++] = pixel_fraction;
 	if (vary_magnification_threshold) fitparams[index++] = pixel_magnification_threshold;
 	if (vary_hubble_parameter) fitparams[index++] = hubble;
@@ -3573,6 +4190,10 @@ bool Lens::setup_fit_parameters(bool include_limits)
 				upper_limits_initial[index] = upper_limits[index];
 				index++;
 			}
+		} else if (source_fit_mode == Parameterized_Source) {
+			for (int i=0; i < n_sb; i++) {
+				if ((sb_list[i]->get_n_vary_params() > 0) and (sb_list[i]->get_limits(lower_limits,upper_limits,lower_limits_initial,upper_limits_initial,index)==false)) { warn("cannot do fit; limits have not been defined for source object %i",i); return false; }
+			}
 		}
 		if (vary_hubble_parameter) {
 			lower_limits[index] = hubble_lower_limit;
@@ -3606,6 +4227,11 @@ void Lens::get_parameter_names()
 	for (i=0; i < nlens; i++) {
 		lens_list[i]->get_fit_parameter_names(fit_parameter_names,&latex_parameter_names,&latex_parameter_subscripts);
 	}
+	if (source_fit_mode==Parameterized_Source) {
+		for (i=0; i < n_sb; i++) {
+			sb_list[i]->get_fit_parameter_names(fit_parameter_names,&latex_parameter_names,&latex_parameter_subscripts);
+		}
+	}
 	// find any parameters with matching names and number them so they can be distinguished
 	int count, n_names;
 	n_names = fit_parameter_names.size();
@@ -3721,7 +4347,6 @@ void Lens::fit_restore_defaults()
 	auto_store_cc_points = temp_auto_store_cc_points;
 	enforce_min_cell_area = temp_enforce_min_cell_area;
 	include_time_delays = temp_include_time_delays;
-	Grid::set_lens(this); // annoying that the grids can only point to one lens object--it would be better for the pointer to be non-static (implement this later)
 }
 
 void Lens::chisq_single_evaluation()
@@ -3736,6 +4361,8 @@ void Lens::chisq_single_evaluation()
 		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_point_source);
 	} else if (source_fit_mode==Pixellated_Source) {
 		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
 	}
 
 	double chisq_initial = (this->*loglikeptr)(fitparams.array());
@@ -3767,6 +4394,8 @@ void Lens::plot_chisq_2d(const int param1, const int param2, const int n1, const
 		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_point_source);
 	} else if (source_fit_mode==Pixellated_Source) {
 		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
 	}
 
 	double step1 = (f1-i1)/n1;
@@ -3838,6 +4467,8 @@ void Lens::plot_chisq_1d(const int param, const int n, const double ip, const do
 		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_point_source);
 	} else if (source_fit_mode==Pixellated_Source) {
 		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
 	}
 
 	double step = (fp-ip)/n;
@@ -3863,8 +4494,190 @@ void Lens::plot_chisq_1d(const int param, const int n, const double ip, const do
 	fit_restore_defaults();
 }
 
+void Lens::chisq_scan(const int param1, const int n1, const double i1, const double f1, const int param2, const int n2, const double i2, const double f2, const bool profile, string filename)
+{
+	// Evaluates the chi-square on a 1-D grid in param1 (if param2 < 0) or a 2-D grid in (param1,param2), using the same
+	// cell-centered points as plot_chisq_1d/plot_chisq_2d. If profile is on, the remaining parameters are optimized at each
+	// grid point with a (zero-temperature) downhill simplex. Grid points are divided among the MPI groups, and among threads
+	// whenever the likelihood can be evaluated concurrently on thread clones (see thread_safe_likelihood()).
+	if (setup_fit_parameters(false)==false) return;
+	fit_set_optimizations();
+	if (fit_output_dir != ".") create_output_directory();
+	initialize_fitmodel();
+
+	int ndim = (param2 >= 0) ? 2 : 1;
+	if ((param1 < 0) or (param1 >= n_fit_parameters)) { warn("Parameter %i does not exist (%i parameters total)",param1,n_fit_parameters); fit_restore_defaults(); return; }
+	if ((ndim==2) and (param2 >= n_fit_parameters)) { warn("Parameter %i does not exist (%i parameters total)",param2,n_fit_parameters); fit_restore_defaults(); return; }
+	if ((ndim==2) and (param1==param2)) { warn("cannot scan the same parameter along both axes"); fit_restore_defaults(); return; }
+	if ((n1 < 1) or ((ndim==2) and (n2 < 1))) { warn("number of grid points must be positive"); fit_restore_defaults(); return; }
+	bool profile_params = profile;
+	if ((profile_params) and (n_fit_parameters==ndim)) {
+		warn(warnings,"no other parameters are varied, so the scan will not be profiled");
+		profile_params = false;
+	}
+
+	double (Lens::*loglikeptr)(double*);
+	if (source_fit_mode==Point_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_point_source);
+	} else if (source_fit_mode==Pixellated_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
+	}
+
+	int nx = n1, ny = (ndim==2) ? n2 : 1;
+	int npts = nx*ny;
+	double step1 = (f1-i1)/n1;
+	double step2 = (ndim==2) ? (f2-i2)/n2 : 0;
+	double *chisqvals = new double[npts];
+	double *pointvals = new double[npts*n_fit_parameters];
+	int k;
+	for (k=0; k < npts; k++) chisqvals[k] = 0;
+	for (k=0; k < npts*n_fit_parameters; k++) pointvals[k] = 0;
+
+	int nclones = 0;
+	Lens **clones = NULL;
+	if ((nthreads > 1) and (thread_safe_likelihood())) {
+		nclones = nthreads;
+		clones = new Lens*[nclones];
+		for (int i=0; i < nclones; i++) clones[i] = create_thread_clone(i);
+	}
+
+#ifdef USE_OPENMP
+	double wtime0, wtime;
+	if (show_wtime) {
+		wtime0 = omp_get_wtime();
+	}
+#endif
+	if (mpi_id==0) cout << "Scanning chi-square over " << npts << " grid points" << ((profile_params) ? " (profiling remaining parameters)" : "") << "..." << endl;
+
+	#pragma omp parallel if (nclones > 0)
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = omp_get_thread_num();
+#else
+		thread = 0;
+#endif
+		Lens *lensptr = (nclones > 0) ? clones[thread] : this;
+		double *point = new double[n_fit_parameters];
+		int i, j, l;
+		#pragma omp for private(k) schedule(dynamic)
+		for (k=group_num; k < npts; k += mpi_ngroups) {
+			i = k % nx;
+			j = k / nx;
+			for (l=0; l < n_fit_parameters; l++) point[l] = fitparams[l];
+			point[param1] = i1 + (i+0.5)*step1;
+			if (ndim==2) point[param2] = i2 + (j+0.5)*step2;
+			if (profile_params) chisqvals[k] = 2.0 * lensptr->profile_scan_point(point,loglikeptr,param1,param2);
+			else chisqvals[k] = 2.0 * (lensptr->*loglikeptr)(point);
+			for (l=0; l < n_fit_parameters; l++) pointvals[k*n_fit_parameters+l] = point[l];
+			if (group_id != 0) {
+				// only the group leaders contribute to the sum over MPI processes below
+				chisqvals[k] = 0;
+				for (l=0; l < n_fit_parameters; l++) pointvals[k*n_fit_parameters+l] = 0;
+			}
+		}
+		delete[] point;
+	}
+
+#ifdef USE_MPI
+	MPI_Allreduce(MPI_IN_PLACE, chisqvals, npts, MPI_DOUBLE, MPI_SUM, mpi_comm);
+	MPI_Allreduce(MPI_IN_PLACE, pointvals, npts*n_fit_parameters, MPI_DOUBLE, MPI_SUM, mpi_comm);
+#endif
+
+#ifdef USE_OPENMP
+	if (show_wtime) {
+		wtime = omp_get_wtime() - wtime0;
+		if (mpi_id==0) cout << "Wall time for chi-square scan: " << wtime << endl;
+	}
+#endif
+
+	if (mpi_id==0) {
+		// binary output: header of ints (ndim, nparams, param1, n1, param2, n2, profile) and doubles (i1, f1, i2, f2), followed by
+		// one record per grid point (with param1 varying fastest) containing all the parameter values and then the chi-square
+		string scanfile_str = fit_output_dir + "/" + filename;
+		ofstream scanout(scanfile_str.c_str(), ios::out | ios::binary);
+		int header[7];
+		header[0] = ndim;
+		header[1] = n_fit_parameters;
+		header[2] = param1;
+		header[3] = nx;
+		header[4] = (ndim==2) ? param2 : -1;
+		header[5] = ny;
+		header[6] = (profile_params) ? 1 : 0;
+		double limits[4];
+		limits[0] = i1; limits[1] = f1;
+		limits[2] = (ndim==2) ? i2 : 0; limits[3] = (ndim==2) ? f2 : 0;
+		scanout.write((char*) header, 7*sizeof(int));
+		scanout.write((char*) limits, 4*sizeof(double));
+		for (k=0; k < npts; k++) {
+			scanout.write((char*) (pointvals + k*n_fit_parameters), n_fit_parameters*sizeof(double));
+			scanout.write((char*) (chisqvals + k), sizeof(double));
+		}
+		scanout.close();
+
+		int kmin = 0;
+		for (k=1; k < npts; k++) if (chisqvals[k] < chisqvals[kmin]) kmin = k;
+		cout << "min chisq=" << chisqvals[kmin] << ", occurs at " << transformed_parameter_names[param1] << "=" << pointvals[kmin*n_fit_parameters+param1];
+		if (ndim==2) cout << ", " << transformed_parameter_names[param2] << "=" << pointvals[kmin*n_fit_parameters+param2];
+		cout << endl;
+		cout << "Chi-square scan written to '" << scanfile_str << "'" << endl;
+	}
+
+	if (nclones > 0) {
+		for (int i=0; i < nclones; i++) delete clones[i];
+		delete[] clones;
+	}
+	delete[] chisqvals;
+	delete[] pointvals;
+	fit_restore_defaults();
+}
+
+double Lens::profile_scan_point(double *point, double (Lens::*loglikeptr)(double*), const int param1, const int param2)
+{
+	// minimizes the loglike over all parameters except param1 and param2 (which are held at their values in point); on return,
+	// point contains the profiled parameter values
+	scan_loglikeptr = loglikeptr;
+	scan_point = point;
+	scan_param1 = param1;
+	scan_param2 = param2;
+	int i, k, nsub = 0;
+	for (i=0; i < n_fit_parameters; i++) if ((i != param1) and (i != param2)) nsub++;
+	double subparams[nsub], substeps[nsub];
+	for (i=0, k=0; i < n_fit_parameters; i++) {
+		if ((i==param1) or (i==param2)) continue;
+		subparams[k] = point[i];
+		substeps[k] = param_settings->stepsizes[i];
+		k++;
+	}
+	initialize_simplex(subparams,nsub,substeps,chisq_tolerance);
+	simplex_set_function(static_cast<double (Simplex::*)(double*)> (&Lens::scan_profile_loglike));
+	simplex_set_fmin(simplex_minchisq);
+	set_annealing_schedule_parameters(0,simplex_temp_final,simplex_cooling_factor,simplex_nmax_anneal,simplex_nmax);
+	downhill_simplex_anneal(false);
+	double loglike;
+	simplex_minval(subparams,loglike);
+	for (i=0, k=0; i < n_fit_parameters; i++) {
+		if ((i==param1) or (i==param2)) continue;
+		point[i] = subparams[k++];
+	}
+	return loglike;
+}
+
+double Lens::scan_profile_loglike(double *subparams)
+{
+	double params[n_fit_parameters];
+	for (int i=0, k=0; i < n_fit_parameters; i++) {
+		if ((i==scan_param1) or (i==scan_param2)) params[i] = scan_point[i];
+		else params[i] = subparams[k++];
+	}
+	return (this->*scan_loglikeptr)(params);
+}
+
 double Lens::chi_square_fit_simplex()
 {
+	ProfileTimer profile_timer(PROF_SAMPLER);
 	if (setup_fit_parameters(false)==false) return 0.0;
 	fit_set_optimizations();
 	if (fit_output_dir != ".") create_output_directory();
@@ -3877,6 +4690,8 @@ double Lens::chi_square_fit_simplex()
 		loglikeptr = static_cast<double (Simplex::*)(double*)> (&Lens::fitmodel_loglike_point_source);
 	} else if (source_fit_mode==Pixellated_Source) {
 		loglikeptr = static_cast<double (Simplex::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Simplex::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
 	}
 
 	dvector stepsizes(param_settings->stepsizes,n_fit_parameters);
@@ -3917,6 +4732,7 @@ double Lens::chi_square_fit_simplex()
 			turned_on_chisqmag = true;
 			use_magnification_in_chisq = true;
 			fitmodel->use_magnification_in_chisq = true;
+			if (loglike_cache != NULL) loglike_cache->new_epoch(); // the cached chi-square values no longer apply
 			simplex_evaluate_bestfit_point(); // need to re-evaluate and record the chi-square at the best-fit point since we are changing the chi-square function
 			cout << "Now using magnification in position chi-square function during repeats...\n";
 		}
@@ -3948,9 +4764,18 @@ double Lens::chi_square_fit_simplex()
 	}
 
 	if (source_fit_mode==Pixellated_Source) {
+		if (loglike_cache != NULL) {
+			// the reconstructed source is not cached, so make sure it corresponds to the best-fit point
+			loglike_cache->new_epoch();
+			(this->*loglikeptr)(fitparams.array());
+		}
+		fitmodel->build_delaunay_display_grid();
 		fitmodel->source_pixel_grid->plot_surface_brightness("src_calc");
 		fitmodel->image_pixel_grid->plot_surface_brightness("img_calc");
 	}
+	else if (source_fit_mode==Parameterized_Source) {
+		fitmodel->image_pixel_grid->plot_surface_brightness("img_calc");
+	}
 
 	bool fisher_matrix_is_nonsingular;
 	if (calculate_parameter_errors) {
@@ -3970,6 +4795,7 @@ double Lens::chi_square_fit_simplex()
 		//cout << "Number of iterations: " << iterations << endl;
 		for (int i=0; i < nlens; i++) fitmodel->lens_list[i]->reset_angle_modulo_2pi();
 		fitmodel->print_lens_list(false);
+		if (source_fit_mode == Parameterized_Source) fitmodel->print_source_list(false);
 
 		if (source_fit_mode == Point_Source) {
 			lensvector *bestfit_src = new lensvector[n_sourcepts_fit];
@@ -4034,6 +4860,7 @@ double Lens::chi_square_fit_simplex()
 
 double Lens::chi_square_fit_powell()
 {
+	ProfileTimer profile_timer(PROF_SAMPLER);
 	if (setup_fit_parameters(false)==false) return 0.0;
 	fit_set_optimizations();
 	if (fit_output_dir != ".") create_output_directory();
@@ -4044,6 +4871,8 @@ double Lens::chi_square_fit_powell()
 		loglikeptr = static_cast<double (Powell::*)(double*)> (&Lens::fitmodel_loglike_point_source);
 	} else if (source_fit_mode==Pixellated_Source) {
 		loglikeptr = static_cast<double (Powell::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Powell::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
 	}
 
 	initialize_powell(loglikeptr,chisq_tolerance);
@@ -4076,6 +4905,7 @@ double Lens::chi_square_fit_powell()
 			turned_on_chisqmag = true;
 			use_magnification_in_chisq = true;
 			fitmodel->use_magnification_in_chisq = true;
+			if (loglike_cache != NULL) loglike_cache->new_epoch(); // the cached chi-square values no longer apply
 			cout << "Now using magnification in position chi-square function during repeats...\n";
 		}
 		for (int i=0; i < n_repeats; i++) {
@@ -4098,9 +4928,18 @@ double Lens::chi_square_fit_powell()
 	if (group_id==0) fitmodel->logfile << "Optimization finished: min chisq = " << chisq_bestfit << endl;
 
 	if (source_fit_mode==Pixellated_Source) {
+		if (loglike_cache != NULL) {
+			// the reconstructed source is not cached, so make sure it corresponds to the best-fit point
+			loglike_cache->new_epoch();
+			(this->*loglikeptr)(fitparams.array());
+		}
+		fitmodel->build_delaunay_display_grid();
 		if (mpi_id==0) fitmodel->source_pixel_grid->plot_surface_brightness("src_calc");
 		if (mpi_id==0) fitmodel->image_pixel_grid->plot_surface_brightness("img_calc");
 	}
+	else if (source_fit_mode==Parameterized_Source) {
+		if (mpi_id==0) fitmodel->image_pixel_grid->plot_surface_brightness("img_calc");
+	}
 	bool fisher_matrix_is_nonsingular;
 	if (calculate_parameter_errors) {
 		if (mpi_id==0) cout << "Calculating parameter errors..." << flush;
@@ -4120,6 +4959,7 @@ double Lens::chi_square_fit_powell()
 		update_fitmodel(fitparams.array());
 		for (int i=0; i < nlens; i++) fitmodel->lens_list[i]->reset_angle_modulo_2pi();
 		fitmodel->print_lens_list(false);
+		if (source_fit_mode == Parameterized_Source) fitmodel->print_source_list(false);
 
 		if (source_fit_mode == Point_Source) {
 			lensvector *bestfit_src = new lensvector[n_sourcepts_fit];
@@ -4175,11 +5015,12 @@ double Lens::chi_square_fit_powell()
 	return chisq_bestfit;
 }
 
-void Lens::chi_square_nested_sampling()
+void Lens::chi_square_nested_sampling(const bool resume)
 {
+	ProfileTimer profile_timer(PROF_SAMPLER);
 	if (setup_fit_parameters(true)==false) return;
 	fit_set_optimizations();
-	if ((mpi_id==0) and (fit_output_dir != ".")) {
+	if ((mpi_id==0) and (fit_output_dir != ".") and (!resume)) {
 		string rmstring = "if [ -e " + fit_output_dir + " ]; then rm -r " + fit_output_dir + "; fi";
 		system(rmstring.c_str()); // delete the old output directory and remake it, just in case there is old data that might get mixed up when running mkdist
 		// I should probably give the nested sampling output a unique extension like ".nest" or something, so that mkdist can't ever confuse it with twalk output in the same dir
@@ -4194,6 +5035,8 @@ void Lens::chi_square_nested_sampling()
 		LogLikePtr = static_cast<double (UCMC::*)(double*)> (&Lens::fitmodel_loglike_point_source);
 	} else if (source_fit_mode==Pixellated_Source) {
 		LogLikePtr = static_cast<double (UCMC::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		LogLikePtr = static_cast<double (UCMC::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
 	}
 
 	if (mpi_id==0) {
@@ -4224,7 +5067,15 @@ void Lens::chi_square_nested_sampling()
 	string filename = fit_output_dir + "/" + fit_output_filename;
 	//if (use_image_plane_chisq2) display_chisq_status = true;
 
-	MonoSample(filename.c_str(),n_mcpoints,fitparams.array(),param_errors,mcmc_logfile);
+	SetCheckpointInterval(mcmc_checkpoint_interval);
+	SetResume(resume);
+	if (MonoSample(filename.c_str(),n_mcpoints,fitparams.array(),param_errors,mcmc_logfile)==false) {
+		delete[] param_errors;
+		fit_restore_defaults();
+		delete fitmodel;
+		fitmodel = NULL;
+		return;
+	}
 	bestfitparams.input(fitparams);
 
 	//if (display_chisq_status) {
@@ -4294,11 +5145,12 @@ void Lens::test_fitmodel_invert()
 	fitmodel = NULL;
 }
 
-void Lens::chi_square_twalk()
+void Lens::chi_square_twalk(const bool resume)
 {
+	ProfileTimer profile_timer(PROF_SAMPLER);
 	if (setup_fit_parameters(true)==false) return;
 	fit_set_optimizations();
-	if ((mpi_id==0) and (fit_output_dir != ".")) {
+	if ((mpi_id==0) and (fit_output_dir != ".") and (!resume)) {
 		string rmstring = "if [ -e " + fit_output_dir + " ]; then rm -r " + fit_output_dir + "; fi";
 		system(rmstring.c_str()); // delete the old output directory and remake it, just in case there is old data that might get mixed up when running mkdist
 		create_output_directory();
@@ -4310,6 +5162,8 @@ void Lens::chi_square_twalk()
 		LogLikePtr = static_cast<double (UCMC::*)(double*)> (&Lens::fitmodel_loglike_point_source);
 	} else if (source_fit_mode==Pixellated_Source) {
 		LogLikePtr = static_cast<double (UCMC::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		LogLikePtr = static_cast<double (UCMC::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
 	}
 
 	if (mpi_id==0) {
@@ -4339,7 +5193,43 @@ void Lens::chi_square_twalk()
 	string filename = fit_output_dir + "/" + fit_output_filename;
 	//if (use_image_plane_chisq2) display_chisq_status = true;
 
-	TWalk(filename.c_str(),0.9836,4,2.4,2.5,6.0,mcmc_tolerance,mcmc_threads,fitparams.array(),mcmc_logfile);
+	// if more than one chain is moved at a time, each one is evaluated on its own thread clone (this requires that each MPI
+	// group has only one process, since otherwise the processes in a group share each likelihood evaluation)
+	int nclones = 0;
+	Lens **clones = NULL;
+	UCMC **evaluators = NULL;
+	if (twalk_threads > 1) {
+		if (!thread_safe_likelihood()) warn(warnings,"likelihood cannot be evaluated concurrently for this fit; moving one T-Walk chain at a time");
+		else if (group_np > 1) warn(warnings,"more than one MPI process per group; moving one T-Walk chain at a time");
+		else {
+			nclones = (twalk_threads < nthreads) ? twalk_threads : nthreads;
+			if (nclones > 1) {
+				clones = new Lens*[nclones];
+				evaluators = new UCMC*[nclones];
+				for (int i=0; i < nclones; i++) {
+					clones[i] = create_thread_clone(i);
+					evaluators[i] = clones[i];
+				}
+			} else nclones = 0;
+		}
+	}
+	SetLogLikeEvaluators(nclones,evaluators);
+
+	SetCheckpointInterval(mcmc_checkpoint_interval);
+	SetResume(resume);
+	bool finished = TWalk(filename.c_str(),0.9836,4,2.4,2.5,6.0,mcmc_tolerance,mcmc_threads,fitparams.array(),mcmc_logfile);
+	SetLogLikeEvaluators(0,NULL);
+	if (nclones > 0) {
+		for (int i=0; i < nclones; i++) delete clones[i];
+		delete[] clones;
+		delete[] evaluators;
+	}
+	if (!finished) {
+		fit_restore_defaults();
+		delete fitmodel;
+		fitmodel = NULL;
+		return;
+	}
 	bestfitparams.input(fitparams);
 
 	//if (display_chisq_status) {
@@ -4393,6 +5283,8 @@ void Lens::use_bestfit_model()
 			pixel_fraction = transformed_params[index++];
 		if (vary_magnification_threshold)
 			pixel_magnification_threshold = transformed_params[index++];
+	} else if (source_fit_mode == Parameterized_Source) {
+		for (i=0; i < n_sb; i++) sb_list[i]->update_fit_parameters(transformed_params,index,status);
 	}
 	if (vary_hubble_parameter) {
 		hubble = transformed_params[index++];
@@ -4415,58 +5307,214 @@ void fisher_quitproc(int sig)
 	exit(0);
 }
 
+struct FisherStencilPoint
+{
+	// a point in the Fisher stencil, given as integer offsets (in units of the finite-difference step) along at most two parameters
+	int p1, a1, p2, a2;
+	bool operator< (const FisherStencilPoint& pt) const
+	{
+		if (p1 != pt.p1) return (p1 < pt.p1);
+		if (a1 != pt.a1) return (a1 < pt.a1);
+		if (p2 != pt.p2) return (p2 < pt.p2);
+		return (a2 < pt.a2);
+	}
+};
+
+static int fisher_stencil_index(map<FisherStencilPoint,int>& index, vector<FisherStencilPoint>& stencil, int p1, int a1, int p2, int a2)
+{
+	// returns the index of the given stencil point, adding it to the list if it is not already there; the point is put in
+	// a canonical form first so that coinciding points (e.g. the central point, which is needed for every diagonal element)
+	// are evaluated only once
+	if (a2==0) { p2 = -1; }
+	if (a1==0) { p1 = p2; a1 = a2; p2 = -1; a2 = 0; }
+	if (p1 < 0) { a1 = 0; }
+	if ((p2 >= 0) and (p2 < p1)) { int p = p1, a = a1; p1 = p2; a1 = a2; p2 = p; a2 = a; }
+	FisherStencilPoint pt;
+	pt.p1 = p1; pt.a1 = a1; pt.p2 = p2; pt.a2 = a2;
+	map<FisherStencilPoint,int>::iterator it = index.find(pt);
+	if (it != index.end()) return it->second;
+	int k = stencil.size();
+	index[pt] = k;
+	stencil.push_back(pt);
+	return k;
+}
+
 bool Lens::calculate_fisher_matrix(const dvector &params, const dvector &stepsizes)
 {
 	// this function calculates the marginalized error using the Gaussian approximation
 	// (only accurate if we are near maximum likelihood point and it is close to Gaussian around this point)
+	// All the points required by the finite-difference stencil are enumerated first (with duplicates removed), then evaluated
+	// together using evaluate_loglike_points(), so they can be divided among MPI groups and threads. If adaptive_fisher_steps
+	// is on, the step size for each parameter is tuned beforehand, and each element is Richardson-extrapolated from steps h and h/2.
 	static const double increment2 = 1e-4;
 	if ((mpi_id==0) and (source_fit_mode==Point_Source) and (!use_image_plane_chisq2) and (!use_image_plane_chisq) and (!use_magnification_in_chisq)) warn("Fisher matrix errors may not be accurate if source plane chi-square is used without magnification");
 
-	dmatrix fisher(n_fit_parameters,n_fit_parameters);
+	int n = n_fit_parameters;
+	dmatrix fisher(n,n);
 	fisher_inverse.erase();
-	fisher_inverse.input(n_fit_parameters,n_fit_parameters);
-	dvector xhi(params);
-	dvector xlo(params);
-	double x0, curvature;
-	int i,j;
-	double step, derivlo, derivhi;
-	for (i=0; i < n_fit_parameters; i++) {
-		x0 = params[i];
-		xhi[i] += increment2*stepsizes[i];
-		if ((param_settings->use_penalty_limits[i]==true) and (xhi[i] > param_settings->penalty_limits_hi[i])) xhi[i] = x0;
-		xlo[i] -= increment2*stepsizes[i];
-		if ((param_settings->use_penalty_limits[i]==true) and (xlo[i] < param_settings->penalty_limits_lo[i])) xlo[i] = x0;
-		step = xhi[i] - xlo[i];
-		for (j=0; j < n_fit_parameters; j++) {
-			derivlo = loglike_deriv(xlo,j,stepsizes[j]);
-			derivhi = loglike_deriv(xhi,j,stepsizes[j]);
-			fisher[i][j] = (derivhi - derivlo) / step;
-			if (fisher[i][j]*0.0) warn(warnings,"Fisher matrix element (%i,%i) calculated as 'nan'",i,j);
-			//if (i==j) cout << abs(derivlo+derivhi) << " " << sqrt(abs(fisher[i][j])) << endl;
-			if ((i==j) and (abs(derivlo+derivhi) > sqrt(abs(fisher[i][j])))) warn(warnings,"Derivatives along parameter %i indicate best-fit point may not be at a local minimum of chi-square",i);
-			signal(SIGABRT, &fisher_sighandler);
-			signal(SIGTERM, &fisher_sighandler);
-			signal(SIGINT, &fisher_sighandler);
-			signal(SIGUSR1, &fisher_sighandler);
-			signal(SIGQUIT, &fisher_quitproc);
-			if (!FISHER_KEEP_RUNNING) {
-				fisher_inverse.erase();
-				return false;
-			}
-		}
-		xhi[i]=xlo[i]=x0;
+	fisher_inverse.input(n,n);
+	int i,j,k,l;
+
+	signal(SIGABRT, &fisher_sighandler);
+	signal(SIGTERM, &fisher_sighandler);
+	signal(SIGINT, &fisher_sighandler);
+	signal(SIGUSR1, &fisher_sighandler);
+	signal(SIGQUIT, &fisher_quitproc);
+
+#ifdef USE_OPENMP
+	double wtime0, wtime;
+	if (show_wtime) {
+		wtime0 = omp_get_wtime();
 	}
+#endif
 
-	double offdiag_avg;
-	// average the off-diagonal elements to enforce symmetry
-	for (i=1; i < n_fit_parameters; i++) {
-		for (j=0; j < i; j++) {
-			offdiag_avg = 0.5*(fisher[i][j]+ fisher[j][i]);
-			//cout << i << " " << j << " " << fisher[i][j] << " " << fisher[j][i] << " " << abs((fisher[i][j]-fisher[j][i])/offdiag_avg) << endl;
-			//if (abs((fisher[i][j]-fisher[j][i])/offdiag_avg) > 0.01) die("Fisher off-diags differ by more than 1%!");
-			fisher[i][j] = fisher[j][i] = offdiag_avg;
-		}
+	double *h = new double[n];
+	for (i=0; i < n; i++) h[i] = increment2*stepsizes[i];
+	if (adaptive_fisher_steps) find_adaptive_fisher_steps(params,h);
+
+	// offsets are in units of h/2 when extrapolating (so both step sizes lie on the same lattice), and in units of h otherwise
+	int nlevels = (adaptive_fisher_steps) ? 2 : 1;
+	int scale = nlevels;
+	double *unit = new double[n];
+	for (i=0; i < n; i++) unit[i] = h[i]/scale;
+
+	// for each step size, find the upper and lower offsets for each parameter; if a step would cross a penalty limit,
+	// the offset on that side is set to zero so that a one-sided difference is used instead
+	int **up = new int*[nlevels];
+	int **dn = new int*[nlevels];
+	int lev, m;
+	bool lopsided = false;
+	for (lev=0; lev < nlevels; lev++) {
+		up[lev] = new int[n];
+		dn[lev] = new int[n];
+		m = (lev==0) ? scale : 1;
+		for (i=0; i < n; i++) {
+			up[lev][i] = m;
+			dn[lev][i] = -m;
+			if ((param_settings->use_penalty_limits[i]==true) and (params[i] + m*unit[i] > param_settings->penalty_limits_hi[i])) up[lev][i] = 0;
+			if ((param_settings->use_penalty_limits[i]==true) and (params[i] - m*unit[i] < param_settings->penalty_limits_lo[i])) dn[lev][i] = 0;
+			if ((up[lev][i]==0) and (dn[lev][i]==0)) lopsided = true;
+		}
+	}
+	if (lopsided) {
+		warn(warnings,"Fisher matrix step is wider than the penalty limits for at least one parameter; cannot calculate Fisher matrix");
+		for (lev=0; lev < nlevels; lev++) { delete[] up[lev]; delete[] dn[lev]; }
+		delete[] up; delete[] dn; delete[] unit; delete[] h;
+		fisher_inverse.erase();
+		return false;
 	}
+
+	// enumerate the stencil. Diagonal elements use the three-point second difference (one-sided if a penalty limit is in the way),
+	// while off-diagonal elements use the four corner points; element (i,j) at level lev uses the stencil points listed in
+	// stencil_pts[lev][i][j] (the diagonal ones are listed in the order up, center, down)
+	map<FisherStencilPoint,int> point_index;
+	vector<FisherStencilPoint> stencil;
+	int ****stencil_pts = new int***[nlevels];
+	int ui, di, uj, dj;
+	for (lev=0; lev < nlevels; lev++) {
+		stencil_pts[lev] = new int**[n];
+		for (i=0; i < n; i++) {
+			stencil_pts[lev][i] = new int*[n];
+			for (j=0; j < n; j++) stencil_pts[lev][i][j] = NULL;
+			ui = up[lev][i]; di = dn[lev][i];
+			stencil_pts[lev][i][i] = new int[3];
+			if (ui==0) { ui = di; di = 2*di; } // one-sided: use the points at 0, -d, -2d (listed as center, middle, far)
+			else if (di==0) { di = ui; ui = 2*ui; } // one-sided: use the points at 2d, d, 0
+			stencil_pts[lev][i][i][0] = fisher_stencil_index(point_index,stencil,i,(up[lev][i]==0) ? 0 : ui,-1,0);
+			stencil_pts[lev][i][i][1] = fisher_stencil_index(point_index,stencil,i,(up[lev][i]==0) ? ui : (dn[lev][i]==0) ? di : 0,-1,0);
+			stencil_pts[lev][i][i][2] = fisher_stencil_index(point_index,stencil,i,(dn[lev][i]==0) ? 0 : di,-1,0);
+			for (j=i+1; j < n; j++) {
+				uj = up[lev][j]; dj = dn[lev][j];
+				stencil_pts[lev][i][j] = new int[4];
+				stencil_pts[lev][i][j][0] = fisher_stencil_index(point_index,stencil,i,up[lev][i],j,uj);
+				stencil_pts[lev][i][j][1] = fisher_stencil_index(point_index,stencil,i,up[lev][i],j,dj);
+				stencil_pts[lev][i][j][2] = fisher_stencil_index(point_index,stencil,i,dn[lev][i],j,uj);
+				stencil_pts[lev][i][j][3] = fisher_stencil_index(point_index,stencil,i,dn[lev][i],j,dj);
+			}
+		}
+	}
+
+	int npts = stencil.size();
+	double **points = new double*[npts];
+	double *loglikes = new double[npts];
+	for (k=0; k < npts; k++) {
+		points[k] = new double[n];
+		for (l=0; l < n; l++) points[k][l] = params[l];
+		if (stencil[k].p1 >= 0) points[k][stencil[k].p1] += stencil[k].a1*unit[stencil[k].p1];
+		if (stencil[k].p2 >= 0) points[k][stencil[k].p2] += stencil[k].a2*unit[stencil[k].p2];
+	}
+	evaluate_loglike_points(npts,points,loglikes);
+
+	// assemble the Fisher matrix at each step size; for adaptive steps, the two are combined by Richardson extrapolation
+	// (the central differences have error of order h^2, the one-sided differences of order h)
+	dmatrix *fisher_lev = new dmatrix[nlevels];
+	bool *two_sided = new bool[n];
+	double d1, d2, curvature;
+	int *pts;
+	for (lev=0; lev < nlevels; lev++) {
+		fisher_lev[lev].input(n,n);
+		for (i=0; i < n; i++) {
+			two_sided[i] = ((up[lev][i] != 0) and (dn[lev][i] != 0));
+			pts = stencil_pts[lev][i][i];
+			d1 = ((lev==0) ? scale : 1)*unit[i];
+			curvature = (loglikes[pts[0]] - 2*loglikes[pts[1]] + loglikes[pts[2]]) / (d1*d1);
+			fisher_lev[lev][i][i] = curvature;
+			if ((lev==0) and (two_sided[i])) {
+				// compare the gradient to the curvature, as a check that the best-fit point is at a minimum
+				if (abs(loglikes[pts[0]]-loglikes[pts[2]])/d1 > sqrt(abs(curvature))) warn(warnings,"Derivatives along parameter %i indicate best-fit point may not be at a local minimum of chi-square",i);
+			}
+			for (j=i+1; j < n; j++) {
+				pts = stencil_pts[lev][i][j];
+				d1 = (up[lev][i]-dn[lev][i])*unit[i];
+				d2 = (up[lev][j]-dn[lev][j])*unit[j];
+				fisher_lev[lev][i][j] = fisher_lev[lev][j][i] = (loglikes[pts[0]] - loglikes[pts[1]] - loglikes[pts[2]] + loglikes[pts[3]]) / (d1*d2);
+			}
+		}
+	}
+	double rfac;
+	for (i=0; i < n; i++) {
+		for (j=0; j < n; j++) {
+			if (nlevels==1) fisher[i][j] = fisher_lev[0][i][j];
+			else {
+				rfac = ((two_sided[i]) and (two_sided[j])) ? 4.0 : 2.0;
+				fisher[i][j] = (rfac*fisher_lev[1][i][j] - fisher_lev[0][i][j]) / (rfac - 1);
+			}
+			if (fisher[i][j]*0.0) warn(warnings,"Fisher matrix element (%i,%i) calculated as 'nan'",i,j);
+		}
+	}
+
+#ifdef USE_OPENMP
+	if (show_wtime) {
+		wtime = omp_get_wtime() - wtime0;
+		if (mpi_id==0) cout << "Wall time for calculating Fisher matrix: " << wtime << endl;
+	}
+#endif
+
+	for (lev=0; lev < nlevels; lev++) {
+		for (i=0; i < n; i++) {
+			for (j=0; j < n; j++) if (stencil_pts[lev][i][j] != NULL) delete[] stencil_pts[lev][i][j];
+			delete[] stencil_pts[lev][i];
+		}
+		delete[] stencil_pts[lev];
+		delete[] up[lev];
+		delete[] dn[lev];
+	}
+	delete[] stencil_pts;
+	delete[] up;
+	delete[] dn;
+	for (k=0; k < npts; k++) delete[] points[k];
+	delete[] points;
+	delete[] loglikes;
+	delete[] fisher_lev;
+	delete[] two_sided;
+	delete[] unit;
+	delete[] h;
+
+	if (!FISHER_KEEP_RUNNING) {
+		fisher_inverse.erase();
+		return false;
+	}
+
 	bool nonsingular;
 	fisher.inverse(fisher_inverse,nonsingular);
 	if (!nonsingular) {
@@ -4477,24 +5525,422 @@ bool Lens::calculate_fisher_matrix(const dvector &params, const dvector &stepsiz
 	return true;
 }
 
-double Lens::loglike_deriv(const dvector &params, const int index, const double step)
+void Lens::find_adaptive_fisher_steps(const dvector &params, double *h)
+{
+	// Adjusts the finite-difference step for each parameter until the second difference of the loglike along that parameter
+	// is close to fisher_target_dloglike: large enough to stay well above roundoff error, yet small enough that the loglike
+	// is still close to quadratic. The parameters are divided among MPI groups and threads (if the likelihood allows it).
+	static const double fisher_target_dloglike = 1e-2;
+	static const int max_iterations = 12;
+	int n = n_fit_parameters;
+	double (Lens::*loglikeptr)(double*);
+	if (source_fit_mode==Point_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_point_source);
+	} else if (source_fit_mode==Pixellated_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
+	}
+	double *x0 = new double[n];
+	int i;
+	for (i=0; i < n; i++) x0[i] = params[i];
+	double loglike0 = (this->*loglikeptr)(x0);
+
+	int nclones = 0;
+	Lens **clones = NULL;
+	if ((nthreads > 1) and (thread_safe_likelihood())) {
+		nclones = nthreads;
+		clones = new Lens*[nclones];
+		for (i=0; i < nclones; i++) clones[i] = create_thread_clone(i);
+	}
+	double *hvals = new double[n];
+	for (i=0; i < n; i++) hvals[i] = 0;
+
+	#pragma omp parallel if (nclones > 0)
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = omp_get_thread_num();
+#else
+		thread = 0;
+#endif
+		Lens *lensptr = (nclones > 0) ? clones[thread] : this;
+		double *x = new double[n];
+		double hstep, delta, factor;
+		int j, iter;
+		for (j=0; j < n; j++) x[j] = x0[j];
+		#pragma omp for private(i) schedule(dynamic)
+		for (i=group_num; i < n; i += mpi_ngroups) {
+			hstep = h[i];
+			for (iter=0; iter < max_iterations; iter++) {
+				x[i] = x0[i] + hstep;
+				delta = (lensptr->*loglikeptr)(x);
+				x[i] = x0[i] - hstep;
+				delta += (lensptr->*loglikeptr)(x) - 2*loglike0;
+				x[i] = x0[i];
+				if ((delta > fisher_target_dloglike/3) and (delta < 3*fisher_target_dloglike)) break;
+				if ((delta <= 0) or (delta*0.0 != 0.0)) factor = 10; // curvature lost in roundoff (or not at a minimum), so widen the step
+				else {
+					factor = sqrt(fisher_target_dloglike/delta);
+					if (factor > 10) factor = 10;
+					else if (factor < 0.1) factor = 0.1;
+				}
+				hstep *= factor;
+			}
+			if (group_id==0) hvals[i] = hstep;
+		}
+		delete[] x;
+	}
+
+#ifdef USE_MPI
+	MPI_Allreduce(MPI_IN_PLACE, hvals, n, MPI_DOUBLE, MPI_SUM, mpi_comm);
+#endif
+	for (i=0; i < n; i++) h[i] = hvals[i];
+
+	if (nclones > 0) {
+		for (i=0; i < nclones; i++) delete clones[i];
+		delete[] clones;
+	}
+	delete[] hvals;
+	delete[] x0;
+}
+
+void Lens::evaluate_loglike_points(const int npoints, double **points, double *loglikes, Lens **thread_clones)
 {
-	static const double increment = 1e-5;
-	dvector xhi(params);
-	dvector xlo(params);
-	double dif, x0 = xhi[index];
-	xhi[index] += increment*step;
-	if ((param_settings->use_penalty_limits[index]==true) and (xhi[index] > param_settings->penalty_limits_hi[index])) xhi[index] = x0;
-	xlo[index] -= increment*step;
-	if ((param_settings->use_penalty_limits[index]==true) and (xlo[index] < param_settings->penalty_limits_lo[index])) xlo[index] = x0;
-	dif = xhi[index] - xlo[index];
+	// Evaluates the fit loglike at each of the given points. The points are divided among the MPI groups, and among threads
+	// whenever the likelihood can be evaluated concurrently on thread clones (see thread_safe_likelihood()); on return, every
+	// MPI process has all the loglike values. Points not yet evaluated when a Fisher interrupt signal is caught are skipped.
+	// If this is called repeatedly, the caller can create the thread clones once and pass them in (one for each thread).
 	double (Lens::*loglikeptr)(double*);
 	if (source_fit_mode==Point_Source) {
 		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_point_source);
 	} else if (source_fit_mode==Pixellated_Source) {
 		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
+	}
+	int k, nclones = 0;
+	Lens **clones = NULL;
+	if (thread_clones != NULL) {
+		nclones = nthreads;
+		clones = thread_clones;
+	} else if ((nthreads > 1) and (npoints > 1) and (thread_safe_likelihood())) {
+		nclones = nthreads;
+		clones = new Lens*[nclones];
+		for (k=0; k < nclones; k++) clones[k] = create_thread_clone(k);
+	}
+	for (k=0; k < npoints; k++) loglikes[k] = 0;
+
+	#pragma omp parallel if (nclones > 0)
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = omp_get_thread_num();
+#else
+		thread = 0;
+#endif
+		Lens *lensptr = (nclones > 0) ? clones[thread] : this;
+		#pragma omp for private(k) schedule(dynamic)
+		for (k=group_num; k < npoints; k += mpi_ngroups) {
+			if (!FISHER_KEEP_RUNNING) continue;
+			loglikes[k] = (lensptr->*loglikeptr)(points[k]);
+			if (group_id != 0) loglikes[k] = 0; // only the group leaders contribute to the sum over MPI processes below
+		}
+	}
+
+#ifdef USE_MPI
+	MPI_Allreduce(MPI_IN_PLACE, loglikes, npoints, MPI_DOUBLE, MPI_SUM, mpi_comm);
+#endif
+
+	if ((nclones > 0) and (thread_clones == NULL)) {
+		for (k=0; k < nclones; k++) delete clones[k];
+		delete[] clones;
 	}
-	return (((this->*loglikeptr)(xhi.array()) - (this->*loglikeptr)(xlo.array())) / dif);
+}
+
+double Lens::chi_square_fit_de()
+{
+	// Global optimization by differential evolution (the "rand/1/bin" scheme of Storn & Price). Each generation, a trial point
+	// is made for every member of the population by adding a scaled difference of two other members to a third, and crossing
+	// the result with the member; the trial replaces the member if it has an equal or better chi-square. All the trials in
+	// a generation are evaluated together with evaluate_loglike_points(), so they are divided among MPI groups and threads.
+	// Random numbers come from a counter-based generator (keyed by the random seed) and selection is done in order afterward,
+	// so the result does not depend on the number of threads or MPI processes. The population is drawn within the initial
+	// parameter limits and kept within the parameter limits; priors and transformations are handled by the loglike function.
+	ProfileTimer profile_timer(PROF_SAMPLER);
+	if (setup_fit_parameters(true)==false) return 0.0;
+	fit_set_optimizations();
+	if (fit_output_dir != ".") create_output_directory();
+	initialize_fitmodel();
+
+	double (Lens::*loglikeptr)(double*);
+	if (source_fit_mode==Point_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_point_source);
+	} else if (source_fit_mode==Pixellated_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_pixellated_source);
+	} else if (source_fit_mode==Parameterized_Source) {
+		loglikeptr = static_cast<double (Lens::*)(double*)> (&Lens::fitmodel_loglike_parameterized_source);
+	}
+
+	int i,j,k,n = n_fit_parameters;
+	double chisq_initial = (this->*loglikeptr)(fitparams.array());
+	if (chisq_initial==1e30) warn(warnings,"Your initial parameter values are returning a large \"penalty\" chi-square--this likely means\none or more parameters have unphysical values or are out of the bounds specified by 'fit plimits'");
+	display_chisq_status = false;
+
+	Lens **clones = NULL;
+	if ((nthreads > 1) and (thread_safe_likelihood())) {
+		clones = new Lens*[nthreads];
+		for (k=0; k < nthreads; k++) clones[k] = create_thread_clone(k);
+	}
+	// unless specified, the population size is ~10 per parameter, rounded up so each generation divides evenly among the evaluators
+	int n_evaluators = (clones != NULL) ? nthreads*mpi_ngroups : mpi_ngroups;
+	int popsize = (de_population_size > 0) ? de_population_size : 10*n;
+	if (de_population_size==0) popsize = n_evaluators*((popsize + n_evaluators - 1)/n_evaluators);
+	if (popsize < 4) popsize = 4; // each trial point requires three other members
+
+	double **pop = new double*[popsize];
+	double **trial = new double*[popsize];
+	double *loglike = new double[popsize];
+	double *trial_loglike = new double[popsize];
+	for (i=0; i < popsize; i++) {
+		pop[i] = new double[n];
+		trial[i] = new double[n];
+	}
+
+	CounterRandom rng((unsigned long long) ((long long) get_random_seed()));
+	unsigned long long counter = 0;
+	const double crossover_prob = 0.9;
+	for (j=0; j < n; j++) pop[0][j] = fitparams[j];
+	for (i=1; i < popsize; i++) {
+		for (j=0; j < n; j++) pop[i][j] = lower_limits_initial[j] + rng.uniform(counter++)*(upper_limits_initial[j]-lower_limits_initial[j]);
+	}
+
+	FISHER_KEEP_RUNNING = 1;
+	signal(SIGABRT, &fisher_sighandler);
+	signal(SIGTERM, &fisher_sighandler);
+	signal(SIGINT, &fisher_sighandler);
+	signal(SIGUSR1, &fisher_sighandler);
+	signal(SIGQUIT, &fisher_quitproc);
+
+#ifdef USE_OPENMP
+	double wt0, wt;
+	if (show_wtime) {
+		wt0 = omp_get_wtime();
+	}
+#endif
+	if (mpi_id==0) {
+		cout << "Differential evolution: population size " << popsize;
+		if (n_evaluators > 1) cout << " (" << n_evaluators << " points evaluated at a time)";
+		cout << endl << endl;
+	}
+
+	evaluate_loglike_points(popsize,pop,loglike,clones);
+	const double tiny = 1e-10;
+	int generation, best, worst, r1, r2, r3, jrand;
+	double scale, rtol;
+	bool converged = false, interrupted = false;
+	for (generation=1; generation <= de_max_generations; generation++) {
+		best = worst = 0;
+		for (i=1; i < popsize; i++) {
+			if (loglike[i] < loglike[best]) best = i;
+			if (loglike[i] > loglike[worst]) worst = i;
+		}
+		if (mpi_id==0) cout << "\033[1A" << "generation " << generation << ": best chisq=" << 2*loglike[best] << ", worst chisq=" << 2*loglike[worst] << "       " << endl;
+		rtol = 2.0*abs(loglike[worst]-loglike[best])/(abs(loglike[worst])+abs(loglike[best])+tiny);
+		if ((rtol < chisq_tolerance) or (2*(loglike[worst]-loglike[best]) < chisq_tolerance)) { converged = true; break; } // second condition is for chi-square near zero
+
+		scale = 0.5 + 0.5*rng.uniform(counter++); // dithering the scale factor each generation helps avoid stagnation
+		for (i=0; i < popsize; i++) {
+			do r1 = (int) (rng.uniform(counter++)*popsize); while (r1==i);
+			do r2 = (int) (rng.uniform(counter++)*popsize); while ((r2==i) or (r2==r1));
+			do r3 = (int) (rng.uniform(counter++)*popsize); while ((r3==i) or (r3==r1) or (r3==r2));
+			jrand = (int) (rng.uniform(counter++)*n); // at least one parameter is always taken from the mutant
+			for (j=0; j < n; j++) {
+				if ((j==jrand) or (rng.uniform(counter++) < crossover_prob)) {
+					trial[i][j] = pop[r1][j] + scale*(pop[r2][j] - pop[r3][j]);
+					// a parameter that leaves the allowed range is put somewhere between the member's value and the limit it crossed
+					if (trial[i][j] < lower_limits[j]) trial[i][j] = lower_limits[j] + rng.uniform(counter++)*(pop[i][j]-lower_limits[j]);
+					else if (trial[i][j] > upper_limits[j]) trial[i][j] = upper_limits[j] - rng.uniform(counter++)*(upper_limits[j]-pop[i][j]);
+				} else {
+					trial[i][j] = pop[i][j];
+				}
+			}
+		}
+		evaluate_loglike_points(popsize,trial,trial_loglike,clones);
+		int keep_running = FISHER_KEEP_RUNNING;
+#ifdef USE_MPI
+		MPI_Allreduce(MPI_IN_PLACE, &keep_running, 1, MPI_INT, MPI_MIN, mpi_comm);
+#endif
+		if (!keep_running) { interrupted = true; break; } // the generation is incomplete, so it is discarded
+		for (i=0; i < popsize; i++) {
+			if (trial_loglike[i] <= loglike[i]) {
+				for (j=0; j < n; j++) pop[i][j] = trial[i][j];
+				loglike[i] = trial_loglike[i];
+			}
+		}
+	}
+	if (generation > de_max_generations) generation = de_max_generations;
+	FISHER_KEEP_RUNNING = 1;
+	best = 0;
+	for (i=1; i < popsize; i++) if (loglike[i] < loglike[best]) best = i;
+	for (j=0; j < n; j++) fitparams[j] = pop[best][j];
+	chisq_bestfit = 2*loglike[best];
+#ifdef USE_OPENMP
+	if (show_wtime) {
+		wt = omp_get_wtime() - wt0;
+		if (mpi_id==0) cout << "Time for differential evolution: " << wt << endl;
+	}
+#endif
+	if (mpi_id==0) {
+		if (converged) cout << "Differential evolution converged after " << generation << " generations\n\n";
+		else if (interrupted) cout << "Differential evolution interrupted after " << generation << " generations\n\n";
+		else cout << "Differential evolution stopped after maximum number of generations (" << de_max_generations << ") without converging\n\n";
+	}
+
+	dvector stepsizes(param_settings->stepsizes,n_fit_parameters);
+	if ((de_polish) and (!interrupted)) {
+		// the initial simplex is scaled by the spread of the final population, which roughly reflects the size of the basin
+		double *disps = new double[n];
+		double mean, var;
+		for (j=0; j < n; j++) {
+			mean = var = 0;
+			for (i=0; i < popsize; i++) mean += pop[i][j];
+			mean /= popsize;
+			for (i=0; i < popsize; i++) var += SQR(pop[i][j]-mean);
+			disps[j] = sqrt(var/popsize);
+			if (disps[j]==0) disps[j] = stepsizes[j];
+		}
+		if (mpi_id==0) cout << "Polishing best-fit point with downhill simplex..." << endl;
+		initialize_simplex(fitparams.array(),n,disps,chisq_tolerance);
+		simplex_set_function(static_cast<double (Simplex::*)(double*)> (loglikeptr));
+		simplex_set_fmin(simplex_minchisq);
+		set_annealing_schedule_parameters(0,simplex_temp_final,simplex_cooling_factor,simplex_nmax_anneal,simplex_nmax);
+		int n_iterations = downhill_simplex_anneal(false);
+		simplex_minval(fitparams.array(),chisq_bestfit);
+		chisq_bestfit *= 2; // since the loglike function actually returns 0.5*chisq
+		if (mpi_id==0) {
+			if (simplex_exit_status==true) cout << "Downhill simplex converged after " << n_iterations << " iterations\n\n";
+			else cout << "Downhill simplex interrupted after " << n_iterations << " iterations\n\n";
+		}
+		delete[] disps;
+	}
+
+	if (clones != NULL) {
+		for (k=0; k < nthreads; k++) delete clones[k];
+		delete[] clones;
+	}
+	for (i=0; i < popsize; i++) {
+		delete[] pop[i];
+		delete[] trial[i];
+	}
+	delete[] pop;
+	delete[] trial;
+	delete[] loglike;
+	delete[] trial_loglike;
+
+	if (source_fit_mode==Point_Source) {
+		display_chisq_status = true;
+		fitmodel->chisq_it = 0; // To ensure it displays the chi-square status
+		(this->*loglikeptr)(fitparams.array());
+		if (mpi_id==0) cout << endl;
+		display_chisq_status = false;
+	} else {
+		(this->*loglikeptr)(fitparams.array()); // so the fit model is set to the best-fit point
+	}
+	bestfitparams.input(fitparams);
+
+	if (group_id==0) fitmodel->logfile << "Optimization finished: min chisq = " << chisq_bestfit << endl;
+
+	if (source_fit_mode==Pixellated_Source) {
+		if (loglike_cache != NULL) {
+			// the reconstructed source is not cached, so make sure it corresponds to the best-fit point
+			loglike_cache->new_epoch();
+			(this->*loglikeptr)(fitparams.array());
+		}
+		fitmodel->build_delaunay_display_grid();
+		if (mpi_id==0) fitmodel->source_pixel_grid->plot_surface_brightness("src_calc");
+		if (mpi_id==0) fitmodel->image_pixel_grid->plot_surface_brightness("img_calc");
+	}
+	else if (source_fit_mode==Parameterized_Source) {
+		if (mpi_id==0) fitmodel->image_pixel_grid->plot_surface_brightness("img_calc");
+	}
+	bool fisher_matrix_is_nonsingular;
+	if (calculate_parameter_errors) {
+		if (mpi_id==0) cout << "Calculating parameter errors..." << flush;
+		fisher_matrix_is_nonsingular = calculate_fisher_matrix(fitparams,stepsizes);
+		if (fisher_matrix_is_nonsingular) bestfit_fisher_inverse.input(fisher_inverse);
+		else bestfit_fisher_inverse.erase(); // just in case it was defined before
+		if (mpi_id==0) cout << "done\n\n";
+	}
+	if (mpi_id==0) {
+		if (use_scientific_notation) cout << setiosflags(ios::scientific);
+		else {
+			cout << resetiosflags(ios::scientific);
+			cout.unsetf(ios_base::floatfield);
+		}
+		cout << "Best-fit model: chi-square = " << chisq_bestfit << endl;
+		for (int i=0; i < nlens; i++) fitmodel->lens_list[i]->reset_angle_modulo_2pi();
+		fitmodel->print_lens_list(false);
+		if (source_fit_mode == Parameterized_Source) fitmodel->print_source_list(false);
+
+		if (source_fit_mode == Point_Source) {
+			lensvector *bestfit_src = new lensvector[n_sourcepts_fit];
+			double *bestfit_flux;
+			bool found_bestfit_flux = true;
+			if (include_flux_chisq) {
+				bestfit_flux = new double[n_sourcepts_fit];
+				fitmodel->output_model_source_flux(bestfit_flux);
+				for (int i=0; i < n_sourcepts_fit; i++) if (bestfit_flux[i] == -1) found_bestfit_flux = false;
+			};
+			if (!found_bestfit_flux) warn("Not all best-fit source fluxes could be calculated. If there are no measured fluxes in your\ndata, turn 'chisqflux' off.");
+
+			if ((use_analytic_bestfit_src) and (!use_image_plane_chisq) and (!use_image_plane_chisq2)) {
+				fitmodel->output_analytic_srcpos(bestfit_src);
+			} else {
+				for (int i=0; i < n_sourcepts_fit; i++) bestfit_src[i] = fitmodel->sourcepts_fit[i];
+			}
+			for (int i=0; i < n_sourcepts_fit; i++) {
+				cout << "src" << i << "_x=" << bestfit_src[i][0] << " src" << i << "_y=" << bestfit_src[i][1];
+				if ((include_flux_chisq) and (found_bestfit_flux)) {
+					cout << " src" << i << "_flux=" << bestfit_flux[i];
+				}
+				cout << endl;
+			}
+			delete[] bestfit_src;
+			if (include_flux_chisq) delete[] bestfit_flux;
+		}
+
+		if ((vary_regularization_parameter) and (source_fit_mode == Pixellated_Source) and (regularization_method != None)) {
+			cout << "regularization parameter lambda=" << fitmodel->regularization_parameter << endl;
+		}
+		if (vary_pixel_fraction) cout << "pixel fraction = " << fitmodel->pixel_fraction << endl;
+		if (vary_magnification_threshold) cout << "magnification threshold = " << fitmodel->pixel_magnification_threshold << endl;
+		if (vary_hubble_parameter) cout << "h0 = " << fitmodel->hubble << endl;
+
+		cout << endl;
+		if (calculate_parameter_errors) {
+			if (fisher_matrix_is_nonsingular) {
+				cout << "Marginalized 1-sigma errors from Fisher matrix:\n";
+				for (int i=0; i < n_fit_parameters; i++) {
+					cout << transformed_parameter_names[i] << ": " << fitparams[i] << " +/- " << sqrt(abs(fisher_inverse[i][i])) << endl;
+				}
+			} else {
+				cout << "Error: Fisher matrix is singular, marginalized errors cannot be calculated\n";
+				for (int i=0; i < n_fit_parameters; i++)
+					cout << transformed_parameter_names[i] << ": " << fitparams[i] << endl;
+			}
+		} else {
+			for (int i=0; i < n_fit_parameters; i++)
+				cout << transformed_parameter_names[i] << ": " << fitparams[i] << endl;
+		}
+		cout << endl;
+		if (auto_save_bestfit) output_bestfit_model();
+	}
+
+	fit_restore_defaults();
+	delete fitmodel;
+	fitmodel = NULL;
+	return chisq_bestfit;
 }
 
 void Lens::output_bestfit_model()
@@ -4560,8 +6006,48 @@ void Lens::output_bestfit_model()
 	prangefile.close();
 }
 
+bool Lens::loglike_cache_lookup(const double* params, double& loglike)
+{
+	// If the fit likelihood has already been evaluated at these parameters, returns the stored value. Since the fit model
+	// has been updated to the given parameters already, the only by-product that needs restoring is the model image for
+	// pixel image fits; the reconstructed pixellated source is not kept. When chisq_it has been reset to zero to force the
+	// chi-square status to be displayed, the likelihood is always evaluated, since the status line needs each of its terms.
+	if ((loglike_cache==NULL) or ((display_chisq_status) and (fitmodel->chisq_it==0))) return false;
+	bool found;
+	ImagePixelGrid *image_grid = (source_fit_mode==Point_Source) ? NULL : fitmodel->image_pixel_grid;
+	if (image_grid==NULL) found = loglike_cache->lookup(params,loglike);
+	else {
+		vector<double> model_sb;
+		found = loglike_cache->lookup(params,loglike,&model_sb);
+		if ((found) and (model_sb.size()==image_grid->x_N*image_grid->y_N)) {
+			int i,j,k=0;
+			for (i=0; i < image_grid->x_N; i++) {
+				for (j=0; j < image_grid->y_N; j++) image_grid->surface_brightness[i][j] = model_sb[k++];
+			}
+		}
+	}
+	if (found) Profiler::add_count(PROF_LOGLIKE_CACHE_HITS,1);
+	return found;
+}
+
+void Lens::loglike_cache_store(const double* params, const double loglike)
+{
+	if (loglike_cache==NULL) return;
+	ImagePixelGrid *image_grid = (source_fit_mode==Point_Source) ? NULL : fitmodel->image_pixel_grid;
+	if (image_grid==NULL) loglike_cache->store(params,loglike);
+	else {
+		vector<double> model_sb(image_grid->x_N*image_grid->y_N);
+		int i,j,k=0;
+		for (i=0; i < image_grid->x_N; i++) {
+			for (j=0; j < image_grid->y_N; j++) model_sb[k++] = image_grid->surface_brightness[i][j];
+		}
+		loglike_cache->store(params,loglike,&model_sb);
+	}
+}
+
 double Lens::fitmodel_loglike_point_source(double* params)
 {
+	ProfileTimer profile_timer(PROF_LIKELIHOOD);
 	for (int i=0; i < n_fit_parameters; i++) {
 		if (fitmodel->param_settings->use_penalty_limits[i]==true) {
 			if ((params[i] < fitmodel->param_settings->penalty_limits_lo[i]) or (params[i] > fitmodel->param_settings->penalty_limits_hi[i])) return 1e30;
@@ -4570,6 +6056,8 @@ double Lens::fitmodel_loglike_point_source(double* params)
 	double transformed_params[n_fit_parameters];
 	fitmodel->param_settings->inverse_transform_parameters(params,transformed_params);
 	if (update_fitmodel(transformed_params)==false) return 1e30;
+	double loglike, chisq_total=0, chisq;
+	if (loglike_cache_lookup(params,loglike)) return loglike;
 	if (group_id==0) {
 		if (fitmodel->logfile.is_open()) {
 			for (int i=0; i < n_fit_parameters; i++) fitmodel->logfile << params[i] << " ";
@@ -4577,7 +6065,6 @@ double Lens::fitmodel_loglike_point_source(double* params)
 		fitmodel->logfile << flush;
 	}
 
-	double loglike, chisq_total=0, chisq;
 	if (use_image_plane_chisq) {
 		chisq = fitmodel->chisq_pos_image_plane();
 		if ((display_chisq_status) and (mpi_id==0)) {
@@ -4626,6 +6113,7 @@ double Lens::fitmodel_loglike_point_source(double* params)
 	fitmodel->param_settings->add_prior_terms_to_loglike(params,loglike);
 	fitmodel->param_settings->add_jacobian_terms_to_loglike(transformed_params,loglike);
 	fitmodel->chisq_it++;
+	loglike_cache_store(params,loglike);
 	return loglike;
 }
 
@@ -4701,6 +6189,7 @@ double Lens::loglike_point_source(double* params)
 
 double Lens::fitmodel_loglike_pixellated_source(double* params)
 {
+	ProfileTimer profile_timer(PROF_LIKELIHOOD);
 	for (int i=0; i < n_fit_parameters; i++) {
 		if (fitmodel->param_settings->use_penalty_limits[i]==true) {
 			if ((params[i] < fitmodel->param_settings->penalty_limits_lo[i]) or (params[i] > fitmodel->param_settings->penalty_limits_hi[i])) return 1e30;
@@ -4709,13 +6198,14 @@ double Lens::fitmodel_loglike_pixellated_source(double* params)
 	double transformed_params[n_fit_parameters];
 	fitmodel->param_settings->inverse_transform_parameters(params,transformed_params);
 	if (update_fitmodel(transformed_params)==false) return 1e30;
+	double loglike, chisq=0;
+	if (loglike_cache_lookup(params,loglike)) return loglike;
 	if (group_id==0) {
 		if (fitmodel->logfile.is_open()) {
 			for (int i=0; i < n_fit_parameters; i++) fitmodel->logfile << params[i] << " ";
 			fitmodel->logfile << flush;
 		}
 	}
-	double loglike, chisq=0;
 	for (int i=0; i < nlens; i++) {
 		if ((lens_list[i]->get_lenstype()==PJAFFE) or (lens_list[i]->get_lenstype()==CORECUSP)) {
 			double subparams[10];
@@ -4732,6 +6222,66 @@ double Lens::fitmodel_loglike_pixellated_source(double* params)
 	loglike = chisq/2.0;
 	fitmodel->param_settings->add_prior_terms_to_loglike(params,loglike);
 	fitmodel->param_settings->add_jacobian_terms_to_loglike(transformed_params,loglike);
+	loglike_cache_store(params,loglike);
+	return loglike;
+}
+
+double Lens::fitmodel_loglike_parameterized_source(double* params)
+{
+	ProfileTimer profile_timer(PROF_LIKELIHOOD);
+	int i;
+	for (i=0; i < n_fit_parameters; i++) {
+		if (fitmodel->param_settings->use_penalty_limits[i]==true) {
+			if ((params[i] < fitmodel->param_settings->penalty_limits_lo[i]) or (params[i] > fitmodel->param_settings->penalty_limits_hi[i])) return 1e30;
+		}
+	}
+	double transformed_params[n_fit_parameters];
+	fitmodel->param_settings->inverse_transform_parameters(params,transformed_params);
+	if (update_fitmodel(transformed_params)==false) return 1e30;
+	double loglike, chisq=0;
+	if (loglike_cache_lookup(params,loglike)) return loglike;
+	if (group_id==0) {
+		if (fitmodel->logfile.is_open()) {
+			for (i=0; i < n_fit_parameters; i++) fitmodel->logfile << params[i] << " ";
+			fitmodel->logfile << flush;
+		}
+	}
+
+	// The source parameters come right after the lens parameters. If none of the other parameters have changed since the
+	// image pixels were last ray traced, the stored source points are reused and only the surface brightness is recalculated.
+	bool redo_ray_tracing = false;
+	if (fitmodel->traced_lens_params.size() != n_fit_parameters) {
+		fitmodel->traced_lens_params.input(n_fit_parameters);
+		redo_ray_tracing = true;
+	}
+	for (i=0; i < n_fit_parameters; i++) {
+		if ((i >= lensmodel_fit_parameters) and (i < lensmodel_fit_parameters + srcmodel_fit_parameters)) continue;
+		if (transformed_params[i] != fitmodel->traced_lens_params[i]) {
+			fitmodel->traced_lens_params[i] = transformed_params[i];
+			redo_ray_tracing = true;
+		}
+	}
+
+	for (i=0; i < nlens; i++) {
+		if ((lens_list[i]->get_lenstype()==PJAFFE) or (lens_list[i]->get_lenstype()==CORECUSP)) {
+			double subparams[10];
+			lens_list[i]->get_parameters(subparams);
+			if (subparams[2] > subparams[1]) chisq=2e30; // don't allow s to be larger than a
+		}
+	}
+	if (chisq != 2e30) chisq = fitmodel->calculate_parameterized_source_chisq(redo_ray_tracing,false);
+	if ((group_id==0) and (fitmodel->logfile.is_open())) fitmodel->logfile << "it=" << fitmodel->chisq_it << " chisq=" << chisq << endl;
+	if ((display_chisq_status) and (mpi_id==0)) {
+		if (fitmodel->chisq_it % chisq_display_frequency == 0) cout << "chisq=" << chisq << "               ";
+		cout << endl;
+		cout << "\033[1A";
+	}
+	fitmodel->chisq_it++;
+
+	loglike = chisq/2.0;
+	fitmodel->param_settings->add_prior_terms_to_loglike(params,loglike);
+	fitmodel->param_settings->add_jacobian_terms_to_loglike(transformed_params,loglike);
+	loglike_cache_store(params,loglike);
 	return loglike;
 }
 
@@ -4845,6 +6395,10 @@ void Lens::print_fit_model()
 			}
 		}
 	}
+	else if (source_fit_mode == Parameterized_Source) {
+		cout << "Source objects:\n";
+		print_source_list(true);
+	}
 	if (vary_hubble_parameter) {
 		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX)) {
 			cout << "Hubble parameter: " << hubble << endl;
@@ -4895,53 +6449,112 @@ void Lens::plot_ray_tracing_grid(double xmin, double xmax, double ymin, double y
 	delete[] corner_sourcepts;
 }
 
-void Lens::plot_logkappa_map(const int x_N, const int y_N)
+// The lens maps are evaluated at pixel centers over the grid set by the 'grid' command. The planes are stored in the order
+// below (each as a row-major x_N*y_N array with x varying fastest, i.e. one row per line of the text maps); a NULL plane is
+// skipped, and if none of the planes needing the hessian (or deflection) are requested, it is never computed.
+const int Lens::n_lensmap_planes = 6;
+const char *Lens::lensmap_plane_names[6] = { "kappa", "mag", "invmag", "shear", "defx", "defy" };
+const int Lens::lensmap_tile_size = 32;
+
+void Lens::evaluate_lens_maps(const int x_N, const int y_N, double **planes)
 {
-	double x,xmin,xmax,xstep,y,ymin,ymax,ystep;
-	xmin = grid_xcenter-0.5*grid_xlength; xmax = grid_xcenter+0.5*grid_xlength;
-	ymin = grid_ycenter-0.5*grid_ylength; ymax = grid_ycenter+0.5*grid_ylength;
-	xstep = (xmax-xmin)/x_N;
-	ystep = (ymax-ymin)/y_N;
-	string x_filename = "lensmap.x";
-	string y_filename = "lensmap.y";
-	ofstream pixel_xvals(x_filename.c_str());
-	ofstream pixel_yvals(y_filename.c_str());
-	int i,j;
-	for (i=0, x=xmin; i <= x_N; i++, x += xstep) {
-		pixel_xvals << x << endl;
-	}
-	for (j=0, y=ymin; j <= y_N; j++, y += ystep) {
-		pixel_yvals << y << endl;
+	// The map is divided into square tiles which are shared among the threads
+	int tiles_x = (x_N + lensmap_tile_size - 1) / lensmap_tile_size;
+	int tiles_y = (y_N + lensmap_tile_size - 1) / lensmap_tile_size;
+	int n_tiles = tiles_x*tiles_y;
+	int tile;
+	#pragma omp parallel
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = omp_get_thread_num();
+#else
+		thread = 0;
+#endif
+		int imin, jmin, imax, jmax;
+		#pragma omp for private(tile) schedule(dynamic)
+		for (tile=0; tile < n_tiles; tile++) {
+			find_lens_map_tile_limits(tile,tiles_x,x_N,y_N,imin,imax,jmin,jmax);
+			evaluate_lens_map_tile(imin,imax,jmin,jmax,x_N,y_N,planes,0,0,x_N,thread);
+		}
 	}
-	pixel_xvals.close();
-	pixel_yvals.close();
+}
 
-	string logkapname = "lensmap.kappalog";
-	ofstream logkapout(logkapname.c_str());
+void Lens::find_lens_map_tile_limits(const int tile, const int tiles_x, const int x_N, const int y_N, int& imin, int& imax, int& jmin, int& jmax)
+{
+	imin = (tile % tiles_x)*lensmap_tile_size;
+	jmin = (tile / tiles_x)*lensmap_tile_size;
+	imax = imin + lensmap_tile_size;
+	jmax = jmin + lensmap_tile_size;
+	if (imax > x_N) imax = x_N;
+	if (jmax > y_N) jmax = y_N;
+}
 
-	double kap, mag, invmag, shearval, pot;
-	lensvector alpha;
-	lensvector pos;
-	for (j=0, y=ymin+0.5*ystep; j < y_N; j++, y += ystep) {
-		pos[1] = y;
-		for (i=0, x=xmin+0.5*xstep; i < x_N; i++, x += xstep) {
-			pos[0] = x;
-			kap = kappa(pos,reference_zfactor);
-			logkapout << log(kap)/log(10) << " ";
+void Lens::evaluate_lens_map_tile(const int imin, const int imax, const int jmin, const int jmax, const int x_N, const int y_N, double **planes, const int i0, const int j0, const int row_length, const int thread)
+{
+	// Evaluates pixels imin <= i < imax, jmin <= j < jmax of the map; pixel (i,j) is stored in element (j-j0)*row_length + (i-i0)
+	// of each plane, so the planes can either span the whole map (i0=j0=0, row_length=x_N) or just the tile. Each pixel needs
+	// one hessian and one deflection evaluation (plus kappa, which is found from the lens profiles directly).
+	double xmin, ymin, xstep, ystep;
+	xmin = grid_xcenter-0.5*grid_xlength;
+	ymin = grid_ycenter-0.5*grid_ylength;
+	xstep = grid_xlength/x_N;
+	ystep = grid_ylength/y_N;
+	bool find_hessian = ((planes[1] != NULL) or (planes[2] != NULL) or (planes[3] != NULL));
+	bool find_deflection = ((planes[4] != NULL) or (planes[5] != NULL));
+	int i, j, k;
+	double x, y, invmag, shear1, shear2, defx, defy;
+	lensmatrix hess;
+	for (j=jmin; j < jmax; j++) {
+		y = ymin + (j+0.5)*ystep;
+		for (i=imin; i < imax; i++) {
+			x = xmin + (i+0.5)*xstep;
+			k = (j-j0)*row_length + (i-i0);
+			if (planes[0] != NULL) planes[0][k] = kappa(x,y,reference_zfactor);
+			if (find_hessian) {
+				hessian(x,y,hess,thread,reference_zfactor);
+				invmag = (1-hess[0][0])*(1-hess[1][1]) - hess[0][1]*hess[1][0];
+				if (planes[1] != NULL) planes[1][k] = 1.0/invmag;
+				if (planes[2] != NULL) planes[2][k] = invmag;
+				if (planes[3] != NULL) {
+					shear1 = 0.5*(hess[0][0]-hess[1][1]);
+					shear2 = hess[0][1];
+					planes[3][k] = sqrt(shear1*shear1+shear2*shear2);
+				}
+			}
+			if (find_deflection) {
+				deflection(x,y,defx,defy,thread,reference_zfactor);
+				if (planes[4] != NULL) planes[4][k] = defx;
+				if (planes[5] != NULL) planes[5][k] = defy;
+			}
 		}
-		logkapout << endl;
 	}
 }
 
-void Lens::plot_logmag_map(const int x_N, const int y_N)
+void Lens::write_lens_map_text(string filename, double *plane, const int x_N, const int y_N, const bool log_scale, const bool log_abs)
 {
-	double x,xmin,xmax,xstep,y,ymin,ymax,ystep;
-	xmin = grid_xcenter-0.5*grid_xlength; xmax = grid_xcenter+0.5*grid_xlength;
-	ymin = grid_ycenter-0.5*grid_ylength; ymax = grid_ycenter+0.5*grid_ylength;
-	xstep = (xmax-xmin)/x_N;
-	ystep = (ymax-ymin)/y_N;
-	string x_filename = "lensmap.x";
-	string y_filename = "lensmap.y";
+	// same layout as the other pixel maps (one row of pixels per line); for log maps, the absolute value is used if log_abs
+	// is true (as for the magnification, which can be negative)
+	ofstream mapout(filename.c_str());
+	int i,j,k;
+	for (j=0, k=0; j < y_N; j++) {
+		for (i=0; i < x_N; i++, k++) {
+			if (log_scale) mapout << ((log_abs) ? log(abs(plane[k])) : log(plane[k]))/log(10) << " ";
+			else mapout << plane[k] << " ";
+		}
+		mapout << endl;
+	}
+}
+
+void Lens::write_lens_map_pixel_edges(string file_root, const int x_N, const int y_N)
+{
+	double x,xmin,xstep,y,ymin,ystep;
+	xmin = grid_xcenter-0.5*grid_xlength;
+	ymin = grid_ycenter-0.5*grid_ylength;
+	xstep = grid_xlength/x_N;
+	ystep = grid_ylength/y_N;
+	string x_filename = file_root + ".x";
+	string y_filename = file_root + ".y";
 	ofstream pixel_xvals(x_filename.c_str());
 	ofstream pixel_yvals(y_filename.c_str());
 	int i,j;
@@ -4951,106 +6564,239 @@ void Lens::plot_logmag_map(const int x_N, const int y_N)
 	for (j=0, y=ymin; j <= y_N; j++, y += ystep) {
 		pixel_yvals << y << endl;
 	}
-	pixel_xvals.close();
-	pixel_yvals.close();
+}
 
-	string logmagname = "lensmap.maglog";
-	ofstream logmagout(logmagname.c_str());
+void Lens::plot_logkappa_map(const int x_N, const int y_N)
+{
+	double *planes[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	planes[0] = new double[x_N*y_N];
+	evaluate_lens_maps(x_N,y_N,planes);
+	write_lens_map_pixel_edges("lensmap",x_N,y_N);
+	write_lens_map_text("lensmap.kappalog",planes[0],x_N,y_N,true,false);
+	delete[] planes[0];
+}
 
-	double mag, invmag, shearval, pot;
-	lensvector alpha;
-	lensvector pos;
-	for (j=0, y=ymin+0.5*ystep; j < y_N; j++, y += ystep) {
-		pos[1] = y;
-		for (i=0, x=xmin+0.5*xstep; i < x_N; i++, x += xstep) {
-			pos[0] = x;
-			mag = magnification(pos,0,reference_zfactor);
-			logmagout << log(abs(mag))/log(10) << " ";
-		}
-		logmagout << endl;
-	}
+void Lens::plot_logmag_map(const int x_N, const int y_N)
+{
+	double *planes[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	planes[1] = new double[x_N*y_N];
+	evaluate_lens_maps(x_N,y_N,planes);
+	write_lens_map_pixel_edges("lensmap",x_N,y_N);
+	write_lens_map_text("lensmap.maglog",planes[1],x_N,y_N,true,true);
+	delete[] planes[1];
 }
 
 void Lens::plot_lensinfo_maps(string file_root, const int x_N, const int y_N)
 {
 	if (fit_output_dir != ".") create_output_directory();
-	double x,xmin,xmax,xstep,y,ymin,ymax,ystep;
+	int k;
+	double *planes[6];
+	for (k=0; k < n_lensmap_planes; k++) planes[k] = new double[x_N*y_N];
+	evaluate_lens_maps(x_N,y_N,planes);
+
+	string root = fit_output_dir + "/" + file_root;
+	write_lens_map_pixel_edges(root,x_N,y_N);
+	for (k=0; k < n_lensmap_planes; k++) write_lens_map_text(root + "." + lensmap_plane_names[k],planes[k],x_N,y_N,false,false);
+	write_lens_map_text(root + ".kappalog",planes[0],x_N,y_N,true,false);
+	write_lens_map_text(root + ".maglog",planes[1],x_N,y_N,true,true);
+	write_lens_map_text(root + ".shearlog",planes[3],x_N,y_N,true,true);
+	for (k=0; k < n_lensmap_planes; k++) delete[] planes[k];
+}
+
+// Binary lens map file (written by 'lensmaps' if FITS output is not selected); all values are in native byte order:
+//   header: char[8] "QLMAPS01", int x_N, int y_N, int n_planes, int bytes_per_value (4 or 8),
+//           double xmin, double xmax, double ymin, double ymax (the outer edges of the grid),
+//           int plane_id[n_planes] (which quantity each plane holds: 0=kappa, 1=mag, 2=invmag, 3=shear, 4=defx, 5=defy)
+//   then n_planes planes of x_N*y_N values (float or double), each stored row by row with x varying fastest
+const char lens_map_file_tag[8] = { 'Q','L','M','A','P','S','0','1' };
+
+bool Lens::generate_lens_maps(string file_root, const int x_N, const int y_N, const bool *include_plane, const bool fits_output, const bool single_precision, const int preview_factor, const bool verbal)
+{
+	// Only the planes for which include_plane[k] is true are evaluated and written. Each tile is written to the file (and
+	// added to the preview maps) as soon as it has been evaluated, in order of the tiles, so the full maps are never stored.
+	if (mpi_id != 0) return true;
+	if ((x_N <= 0) or (y_N <= 0)) { warn("number of map pixels must be positive"); return false; }
+	int i,j,k,p,n_planes=0;
+	int plane_id[6];
+	for (k=0; k < n_lensmap_planes; k++) if (include_plane[k]) plane_id[n_planes++] = k;
+	if (n_planes==0) { warn("no lens map planes have been selected"); return false; }
+	if (fit_output_dir != ".") create_output_directory();
+	double xmin, xmax, ymin, ymax;
 	xmin = grid_xcenter-0.5*grid_xlength; xmax = grid_xcenter+0.5*grid_xlength;
 	ymin = grid_ycenter-0.5*grid_ylength; ymax = grid_ycenter+0.5*grid_ylength;
-	xstep = (xmax-xmin)/x_N;
-	ystep = (ymax-ymin)/y_N;
-	string x_filename = fit_output_dir + "/" + file_root + ".x";
-	string y_filename = fit_output_dir + "/" + file_root + ".y";
-	ofstream pixel_xvals(x_filename.c_str());
-	ofstream pixel_yvals(y_filename.c_str());
-	int i,j;
-	for (i=0, x=xmin; i <= x_N; i++, x += xstep) {
-		pixel_xvals << x << endl;
+	long long n_pixels = ((long long) x_N)*y_N;
+	int bytes_per_value = (single_precision) ? sizeof(float) : sizeof(double);
+
+	string root = fit_output_dir + "/" + file_root;
+	string out_filename;
+	bool status = true;
+#ifdef USE_FITS
+	fitsfile *outfptr;   // FITS file pointer, defined in fitsio.h
+	int fits_status = 0;   // CFITSIO status value MUST be initialized to zero!
+#endif
+	ofstream out;
+	long long data_start;
+	if (fits_output) {
+#ifndef USE_FITS
+		cout << "FITS capability disabled; QLens must be compiled with the CFITSIO library to write FITS files\n";
+		return false;
+#else
+		// each plane goes in its own image extension (the first in the primary HDU), labeled by EXTNAME; the extensions are
+		// all created first, and each tile is then written to them as a subset of the image
+		string fits_filename = "!" + root + ".fits"; // the '!' tells CFITSIO to overwrite an existing file
+		out_filename = root + ".fits";
+		int bitpix = (single_precision) ? -32 : -64;
+		long naxes[2] = {x_N,y_N};
+		char extname[16];
+		if (!fits_create_file(&outfptr, fits_filename.c_str(), &fits_status))
+		{
+			for (p=0; p < n_planes; p++) {
+				if (fits_create_img(outfptr, bitpix, 2, naxes, &fits_status)) break;
+				strcpy(extname,lensmap_plane_names[plane_id[p]]);
+				fits_write_key(outfptr, TSTRING, "EXTNAME", extname, "lens map quantity", &fits_status);
+				fits_write_key(outfptr, TDOUBLE, "XMIN", &xmin, "left edge of grid", &fits_status);
+				fits_write_key(outfptr, TDOUBLE, "XMAX", &xmax, "right edge of grid", &fits_status);
+				fits_write_key(outfptr, TDOUBLE, "YMIN", &ymin, "bottom edge of grid", &fits_status);
+				fits_write_key(outfptr, TDOUBLE, "YMAX", &ymax, "top edge of grid", &fits_status);
+			}
+		}
+		if (fits_status) { fits_report_error(stderr, fits_status); return false; }
+#endif
+	} else {
+		out_filename = root + ".maps";
+		out.open(out_filename.c_str(), ios::out | ios::binary);
+		if (!out.is_open()) { warn("could not open lens map file '%s' for writing",out_filename.c_str()); return false; }
+		out.write(lens_map_file_tag,8);
+		out.write((char*) &x_N, sizeof(int));
+		out.write((char*) &y_N, sizeof(int));
+		out.write((char*) &n_planes, sizeof(int));
+		out.write((char*) &bytes_per_value, sizeof(int));
+		out.write((char*) &xmin, sizeof(double));
+		out.write((char*) &xmax, sizeof(double));
+		out.write((char*) &ymin, sizeof(double));
+		out.write((char*) &ymax, sizeof(double));
+		out.write((char*) plane_id, n_planes*sizeof(int));
+		data_start = out.tellp();
+	}
+
+	// Preview maps are averaged over blocks of preview_factor x preview_factor pixels (blocks along the upper and right
+	// edges may be smaller) and written as text maps, in the same format as 'plotlensinfo', to '<file_root>_preview.*'
+	int px_N=0, py_N=0;
+	int *npix = NULL;
+	double **preview = NULL;
+	if (preview_factor > 1) {
+		px_N = (x_N + preview_factor - 1) / preview_factor;
+		py_N = (y_N + preview_factor - 1) / preview_factor;
+		npix = new int[px_N*py_N];
+		preview = new double*[n_planes];
+		for (i=0; i < px_N*py_N; i++) npix[i] = 0;
+		for (j=0; j < y_N; j++) {
+			for (i=0; i < x_N; i++) npix[(j/preview_factor)*px_N + (i/preview_factor)]++;
+		}
+		for (p=0; p < n_planes; p++) {
+			preview[p] = new double[px_N*py_N];
+			for (i=0; i < px_N*py_N; i++) preview[p][i] = 0;
+		}
 	}
-	for (j=0, y=ymin; j <= y_N; j++, y += ystep) {
-		pixel_yvals << y << endl;
+
+#ifdef USE_OPENMP
+	double wtime0 = omp_get_wtime();
+#endif
+	int tiles_x = (x_N + lensmap_tile_size - 1) / lensmap_tile_size;
+	int tiles_y = (y_N + lensmap_tile_size - 1) / lensmap_tile_size;
+	int n_tiles = tiles_x*tiles_y;
+	int tile;
+	#pragma omp parallel
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = omp_get_thread_num();
+#else
+		thread = 0;
+#endif
+		int ii, jj, q, imin, imax, jmin, jmax, width;
+		double *tile_planes[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+		for (q=0; q < n_planes; q++) tile_planes[plane_id[q]] = new double[lensmap_tile_size*lensmap_tile_size];
+		float *row = (single_precision) ? new float[lensmap_tile_size] : NULL;
+		#pragma omp for private(tile) ordered schedule(dynamic)
+		for (tile=0; tile < n_tiles; tile++) {
+			find_lens_map_tile_limits(tile,tiles_x,x_N,y_N,imin,imax,jmin,jmax);
+			width = imax-imin;
+			evaluate_lens_map_tile(imin,imax,jmin,jmax,x_N,y_N,tile_planes,imin,jmin,width,thread);
+			#pragma omp ordered
+			{
+				for (q=0; q < n_planes; q++) {
+					double *tp = tile_planes[plane_id[q]];
+					if (!fits_output) {
+						for (jj=jmin; jj < jmax; jj++) {
+							out.seekp(data_start + (q*n_pixels + ((long long) jj)*x_N + imin)*bytes_per_value);
+							if (single_precision) {
+								for (ii=0; ii < width; ii++) row[ii] = (float) tp[(jj-jmin)*width + ii];
+								out.write((char*) row, width*sizeof(float));
+							} else {
+								out.write((char*) (tp + (jj-jmin)*width), width*sizeof(double));
+							}
+						}
+					}
+#ifdef USE_FITS
+					else if (!fits_status) {
+						// CFITSIO converts to the image's data type (float or double) as the pixels are written
+						long fpixel[2] = {imin+1,jmin+1};
+						long lpixel[2] = {imax,jmax};
+						fits_movabs_hdu(outfptr, q+1, NULL, &fits_status);
+						fits_write_subset(outfptr, TDOUBLE, fpixel, lpixel, tp, &fits_status);
+					}
+#endif
+					if (preview != NULL) {
+						for (jj=jmin; jj < jmax; jj++) {
+							for (ii=imin; ii < imax; ii++) preview[q][(jj/preview_factor)*px_N + (ii/preview_factor)] += tp[(jj-jmin)*width + (ii-imin)];
+						}
+					}
+				}
+			}
+		}
+		for (q=0; q < n_planes; q++) delete[] tile_planes[plane_id[q]];
+		if (row != NULL) delete[] row;
 	}
-	pixel_xvals.close();
-	pixel_yvals.close();
-
-	string kapname = fit_output_dir + "/" + file_root + ".kappa";
-	string magname = fit_output_dir + "/" + file_root + ".mag";
-	string invmagname = fit_output_dir + "/" + file_root + ".invmag";
-	string shearname = fit_output_dir + "/" + file_root + ".shear";
-	//string potname = fit_output_dir + "/" + file_root + ".pot";
-	string defxname = fit_output_dir + "/" + file_root + ".defx";
-	string defyname = fit_output_dir + "/" + file_root + ".defy";
-
-	string logkapname = kapname + "log";
-	string logmagname = magname + "log";
-	string logshearname = shearname + "log";
-	ofstream kapout(kapname.c_str());
-	ofstream magout(magname.c_str());
-	ofstream invmagout(invmagname.c_str());
-	ofstream shearout(shearname.c_str());
-	//ofstream potout(potname.c_str());
-	ofstream defxout(defxname.c_str());
-	ofstream defyout(defyname.c_str());
-	ofstream logkapout(logkapname.c_str());
-	ofstream logmagout(logmagname.c_str());
-	ofstream logshearout(logshearname.c_str());
-
-	double kap, mag, invmag, shearval, pot;
-	lensvector alpha;
-	lensvector pos;
-	for (j=0, y=ymin+0.5*ystep; j < y_N; j++, y += ystep) {
-		pos[1] = y;
-		for (i=0, x=xmin+0.5*xstep; i < x_N; i++, x += xstep) {
-			pos[0] = x;
-			kap = kappa(pos,reference_zfactor);
-			mag = magnification(pos,0,reference_zfactor);
-			invmag = inverse_magnification(pos,0,reference_zfactor);
-			shearval = shear(pos,0,reference_zfactor);
-			//pot = lens->potential(pos);
-			deflection(pos,alpha,reference_zfactor);
-
-			kapout << kap << " ";
-			magout << mag << " ";
-			invmagout << invmag << " ";
-			shearout << shearval << " ";
-			//potout << pot << " ";
-			defxout << alpha[0] << " ";
-			defyout << alpha[1] << " ";
-			logkapout << log(kap)/log(10) << " ";
-			logmagout << log(abs(mag))/log(10) << " ";
-			logshearout << log(abs(shearval))/log(10) << " ";
-
-		}
-		kapout << endl;
-		invmagout << endl;
-		shearout << endl;
-		//potout << endl;
-		defxout << endl;
-		defyout << endl;
-		logkapout << endl;
-		logmagout << endl;
-		logshearout << endl;
+#ifdef USE_OPENMP
+	if (verbal) cout << "Lens maps evaluated in " << omp_get_wtime()-wtime0 << " seconds" << endl;
+#endif
+
+	if (fits_output) {
+#ifdef USE_FITS
+		fits_close_file(outfptr, &fits_status);
+		if (fits_status) { fits_report_error(stderr, fits_status); status = false; }
+#endif
+	} else {
+		out.close();
+		if (out.fail()) { warn("could not write lens map file '%s'",out_filename.c_str()); status = false; }
+	}
+	if ((status) and (verbal)) cout << "Lens maps written to '" << out_filename << "'" << endl;
+
+	if (preview != NULL) {
+		string preview_root = root + "_preview";
+		for (p=0; p < n_planes; p++) {
+			k = plane_id[p];
+			for (i=0; i < px_N*py_N; i++) preview[p][i] /= npix[i];
+			write_lens_map_text(preview_root + "." + lensmap_plane_names[k],preview[p],px_N,py_N,false,false);
+			if (k==0) write_lens_map_text(preview_root + ".kappalog",preview[p],px_N,py_N,true,false);
+			else if (k==1) write_lens_map_text(preview_root + ".maglog",preview[p],px_N,py_N,true,true);
+			else if (k==3) write_lens_map_text(preview_root + ".shearlog",preview[p],px_N,py_N,true,true);
+			delete[] preview[p];
+		}
+		// the edges of the preview grid are found from the full-resolution pixel edges, so the last block may be narrower
+		double xstep = grid_xlength/x_N, ystep = grid_ylength/y_N;
+		ofstream pixel_xvals((preview_root + ".x").c_str());
+		ofstream pixel_yvals((preview_root + ".y").c_str());
+		for (i=0; i < px_N; i++) pixel_xvals << xmin + i*preview_factor*xstep << endl;
+		pixel_xvals << xmax << endl;
+		for (j=0; j < py_N; j++) pixel_yvals << ymin + j*preview_factor*ystep << endl;
+		pixel_yvals << ymax << endl;
+		if (verbal) cout << "Preview maps (" << px_N << "x" << py_N << " pixels) written to '" << preview_root << ".*'" << endl;
+		delete[] npix;
+		delete[] preview;
 	}
+	return status;
 }
 
 // Pixel grid functions
@@ -5121,7 +6867,6 @@ bool Lens::create_source_surface_brightness_grid(bool verbal)
 		}
 	}
 
-	SourcePixelGrid::set_splitting(srcgrid_npixels_x,srcgrid_npixels_y,1e-6);
 	if (source_pixel_grid != NULL) delete source_pixel_grid;
 	source_pixel_grid = new SourcePixelGrid(this,sourcegrid_xmin,sourcegrid_xmax,sourcegrid_ymin,sourcegrid_ymax);
 	if (create_image_pixelgrid) source_pixel_grid->set_image_pixel_grid(image_pixel_grid);
@@ -5179,6 +6924,10 @@ void Lens::load_image_surface_brightness_grid(string image_pixel_filename_root)
 		set_gridcenter(0.5*(xmin+xmax),0.5*(ymin+ymax));
 	}
 	image_pixel_data->get_npixels(n_image_pixels_x,n_image_pixels_y);
+	if (n_extra_bands > 0) {
+		if ((mpi_id==0) and (verbal_mode)) cout << "Removing the extra image bands, since new image data has been loaded" << endl;
+		clear_image_bands();
+	}
 	if (image_pixel_grid != NULL) {
 		delete image_pixel_grid; // so when you invert, it will load a new image grid based on the data
 		// This should be changed! There should be a separate image_pixel_grid for the data, vs. lensed images. That way, you don't have to do this!
@@ -5233,6 +6982,67 @@ bool Lens::plot_lensed_surface_brightness(string imagefile, bool output_fits, bo
 	return true;
 }
 
+bool Lens::add_image_band(string image_pixel_filename_root)
+{
+	// The new band uses the same pixel grid as the main image data, which must have been loaded first
+	if (image_pixel_data == NULL) { warn("image data for the main band must be loaded before adding extra bands"); return false; }
+	ImagePixelData *band_data = new ImagePixelData();
+	band_data->set_lens(this);
+	bool status;
+	if (fits_format == true) {
+		double xmin,xmax,ymin,ymax;
+		int npx, npy;
+		image_pixel_data->get_grid_params(xmin,xmax,ymin,ymax,npx,npy);
+		status = band_data->load_data_fits(xmin,xmax,ymin,ymax,image_pixel_filename_root);
+	} else {
+		band_data->load_data(image_pixel_filename_root);
+		status = (band_data->surface_brightness != NULL);
+	}
+	if ((status) and ((band_data->npixels_x != image_pixel_data->npixels_x) or (band_data->npixels_y != image_pixel_data->npixels_y))) {
+		warn("number of pixels in image band (%i,%i) does not match the main image data (%i,%i)",band_data->npixels_x,band_data->npixels_y,image_pixel_data->npixels_x,image_pixel_data->npixels_y);
+		status = false;
+	}
+	if (!status) {
+		delete band_data;
+		return false;
+	}
+
+	ImagePixelBand *newbands = new ImagePixelBand[n_extra_bands+1];
+	for (int i=0; i < n_extra_bands; i++) newbands[i] = extra_bands[i];
+	newbands[n_extra_bands].data = band_data;
+	newbands[n_extra_bands].psf_width_x = psf_width_x;
+	newbands[n_extra_bands].psf_width_y = psf_width_y;
+	newbands[n_extra_bands].pixel_noise = data_pixel_noise;
+	newbands[n_extra_bands].chisq = 0;
+	if (extra_bands != NULL) delete[] extra_bands;
+	extra_bands = newbands;
+	n_extra_bands++;
+	return true;
+}
+
+void Lens::clear_image_bands()
+{
+	for (int i=0; i < n_extra_bands; i++) delete extra_bands[i].data;
+	if (extra_bands != NULL) delete[] extra_bands;
+	extra_bands = NULL;
+	n_extra_bands = 0;
+}
+
+void Lens::print_image_bands()
+{
+	if (image_pixel_data == NULL) { cout << "No image data has been loaded\n"; return; }
+	cout << "band 0 (main image data): psf_width=(" << psf_width_x << "," << psf_width_y << ")";
+	if (image_pixel_data->noise_map_loaded()) cout << ", noise map loaded";
+	else cout << ", pixel_noise=" << data_pixel_noise;
+	cout << endl;
+	for (int i=0; i < n_extra_bands; i++) {
+		cout << "band " << i+1 << ": psf_width=(" << extra_bands[i].psf_width_x << "," << extra_bands[i].psf_width_y << ")";
+		if (extra_bands[i].data->noise_map_loaded()) cout << ", noise map loaded";
+		else cout << ", pixel_noise=" << extra_bands[i].pixel_noise;
+		cout << ", chisq=" << extra_bands[i].chisq << endl;
+	}
+}
+
 double Lens::image_pixel_chi_square()
 {
 	if (image_pixel_grid==NULL) { warn("No image surface brightness map has been generated"); return -1e30; }
@@ -5267,6 +7077,7 @@ double Lens::invert_surface_brightness_map_from_data(bool verbal)
 	image_pixel_grid->lens = this;
 	image_pixel_grid->set_pixel_noise(data_pixel_noise);
 	double chisq = invert_image_surface_brightness_map(verbal);
+	if (chisq != 2e30) build_delaunay_display_grid();
 	if (chisq == 2e30) {
 		delete image_pixel_grid;
 		image_pixel_grid = NULL;
@@ -5274,6 +7085,57 @@ double Lens::invert_surface_brightness_map_from_data(bool verbal)
 	return chisq;
 }
 
+void Lens::check_lmatrix_single_precision(bool verbal)
+{
+	// Inverts the data with the Lmatrix in double and then in single precision, and compares the chi-square and the
+	// log-determinant of the F-matrix (which enters the Bayesian evidence when the regularization is varied), so one can
+	// check whether single precision is adequate for a given data set before using it in a fit
+	bool lmatrix_single_precision_setting = lmatrix_single_precision;
+	double chisq_double, chisq_single, logdet_double, logdet_single;
+	lmatrix_single_precision = false;
+	Fmatrix_log_determinant = 0;
+	chisq_double = invert_surface_brightness_map_from_data(verbal);
+	logdet_double = Fmatrix_log_determinant;
+	lmatrix_single_precision = true;
+	Fmatrix_log_determinant = 0;
+	chisq_single = invert_surface_brightness_map_from_data(verbal);
+	logdet_single = Fmatrix_log_determinant;
+	lmatrix_single_precision = lmatrix_single_precision_setting;
+	if ((chisq_double >= 1e30) or (chisq_single >= 1e30)) { warn("inversion failed; cannot compare single and double precision"); return; }
+
+	double chisq_reldiff, logdet_diff;
+	chisq_reldiff = abs(chisq_single-chisq_double)/abs(chisq_double);
+	logdet_diff = abs(logdet_single-logdet_double);
+	if (mpi_id==0) {
+		cout << "chisq (double precision) = " << chisq_double << ", chisq (single precision) = " << chisq_single << ", relative difference = " << chisq_reldiff << endl;
+		if ((vary_regularization_parameter) or (vary_pixel_fraction))
+			cout << "log(det(F)) (double precision) = " << logdet_double << ", log(det(F)) (single precision) = " << logdet_single << ", difference = " << logdet_diff << endl;
+	}
+	// a difference in chi-square (or in the log-evidence) well below 1 does not affect the inferred parameters
+	if ((abs(chisq_single-chisq_double) > 0.1) or (logdet_diff > 0.1)) warn("single and double precision results differ significantly; single precision may not be adequate here");
+}
+
+void Lens::check_multigrid_preconditioner(bool verbal)
+{
+	// Inverts the data with the CG method using the diagonal and then the multigrid preconditioner, and compares the resulting
+	// log-likelihoods. The preconditioner only changes how quickly the solution converges, and the log-determinant does not
+	// depend on it, so the two should agree to within the tolerance of the CG solve (1e-4).
+	if (inversion_method != CG_Method) { warn("the multigrid preconditioner is only used with 'inversion_method cg'"); return; }
+	if (use_delaunay_srcgrid) { warn("the multigrid preconditioner is not used with a Delaunay source grid"); return; }
+	bool use_multigrid_setting = use_multigrid_preconditioner;
+	double chisq_diag, chisq_mg;
+	use_multigrid_preconditioner = false;
+	chisq_diag = invert_surface_brightness_map_from_data(verbal);
+	use_multigrid_preconditioner = true;
+	chisq_mg = invert_surface_brightness_map_from_data(verbal);
+	use_multigrid_preconditioner = use_multigrid_setting;
+	if ((chisq_diag >= 1e30) or (chisq_mg >= 1e30)) { warn("inversion failed; cannot compare the preconditioners"); return; }
+
+	double loglike_reldiff = abs(chisq_mg-chisq_diag)/abs(chisq_diag);
+	if (mpi_id==0) cout << "loglike (diagonal preconditioner) = " << chisq_diag/2 << ", loglike (multigrid preconditioner) = " << chisq_mg/2 << ", relative difference = " << loglike_reldiff << endl;
+	if (loglike_reldiff > 1e-4) warn("log-likelihoods with the diagonal and multigrid preconditioners differ by more than the CG tolerance");
+}
+
 double Lens::invert_image_surface_brightness_map(bool verbal)
 {
 	if (image_pixel_data == NULL) { warn("No image surface brightness data has been loaded"); return -1e30; }
@@ -5302,6 +7164,13 @@ double Lens::invert_image_surface_brightness_map(bool verbal)
 		tot_wtime0 = omp_get_wtime();
 	}
 #endif
+	if (use_image_pixel_decomposition()) {
+		int psf_halo = 0; // the PSF convolution of each Lmatrix row needs the rows of the pixels within half the PSF width
+		if (generate_psf_matrix()) psf_halo = ((psf_npixels_x > psf_npixels_y) ? psf_npixels_x : psf_npixels_y)/2;
+		image_pixel_grid->assign_row_blocks(group_np,psf_halo);
+	} else {
+		image_pixel_grid->assign_row_blocks(1,0);
+	}
 	image_pixel_grid->redo_lensing_calculations();
 
 	if (auto_sourcegrid) image_pixel_grid->find_optimal_sourcegrid(sourcegrid_xmin,sourcegrid_xmax,sourcegrid_ymin,sourcegrid_ymax,sourcegrid_limit_xmin,sourcegrid_limit_xmax,sourcegrid_limit_ymin,sourcegrid_limit_ymax);
@@ -5324,43 +7193,65 @@ double Lens::invert_image_surface_brightness_map(bool verbal)
 		return 2e30;
 	}
 
-	SourcePixelGrid::set_splitting(srcgrid_npixels_x,srcgrid_npixels_y,1e-6);
-	if (source_pixel_grid != NULL) delete source_pixel_grid;
-#ifdef USE_OPENMP
-	if (show_wtime) {
-		wtime0 = omp_get_wtime();
+	if (source_pixel_grid != NULL) {
+		delete source_pixel_grid;
+		source_pixel_grid = NULL;
 	}
+	if (delaunay_srcgrid != NULL) {
+		delete delaunay_srcgrid;
+		delaunay_srcgrid = NULL;
+	}
+	if (use_delaunay_srcgrid) {
+		// the source pixels are the vertices of the triangulation; the rectangular grid is only created if the source is
+		// plotted afterward (see build_delaunay_display_grid), so it is not built during a fit
+		image_pixel_grid->set_source_pixel_grid(NULL);
+		{
+			ProfileTimer profile_timer(PROF_GRID_CONSTRUCTION);
+			delaunay_srcgrid = new DelaunaySourceGrid(this,image_pixel_grid,delaunay_srcgrid_stride);
+		}
+		Profiler::add_count(PROF_SOURCE_PIXELS,delaunay_srcgrid->n_srcpts);
+		if ((mpi_id==0) and (verbal)) cout << "# of Delaunay source points: " << delaunay_srcgrid->n_srcpts << endl;
+	} else {
+#ifdef USE_OPENMP
+		if (show_wtime) {
+			wtime0 = omp_get_wtime();
+		}
 #endif
-	source_pixel_grid = new SourcePixelGrid(this,sourcegrid_xmin,sourcegrid_xmax,sourcegrid_ymin,sourcegrid_ymax);
+		{
+			ProfileTimer profile_timer(PROF_GRID_CONSTRUCTION);
+			source_pixel_grid = new SourcePixelGrid(this,sourcegrid_xmin,sourcegrid_xmax,sourcegrid_ymin,sourcegrid_ymax);
+		}
+		Profiler::add_count(PROF_SOURCE_PIXELS,source_pixel_grid->number_of_pixels);
 #ifdef USE_OPENMP
-	if (show_wtime) {
-		wtime = omp_get_wtime() - wtime0;
-		if (mpi_id==0) cout << "Wall time for creating source pixel grid: " << wtime << endl;
-	}
+		if (show_wtime) {
+			wtime = omp_get_wtime() - wtime0;
+			if (mpi_id==0) cout << "Wall time for creating source pixel grid: " << wtime << endl;
+		}
 #endif
-	image_pixel_grid->set_source_pixel_grid(source_pixel_grid);
-	source_pixel_grid->set_image_pixel_grid(image_pixel_grid);
+		image_pixel_grid->set_source_pixel_grid(source_pixel_grid);
+		source_pixel_grid->set_image_pixel_grid(image_pixel_grid);
 
-	if ((mpi_id==0) and (verbal)) {
-		cout << "# of source pixels: " << source_pixel_grid->number_of_pixels;
-		if (auto_srcgrid_npixels) {
-			double pix_frac = ((double) source_pixel_grid->number_of_pixels) / n_expected_imgpixels;
-			cout << ", f=" << pix_frac;
-		}
-		cout << endl;
-	}
-	if (adaptive_grid) {
-		source_pixel_grid->adaptive_subgrid();
 		if ((mpi_id==0) and (verbal)) {
-			cout << "# of source pixels after subgridding: " << source_pixel_grid->number_of_pixels;
+			cout << "# of source pixels: " << source_pixel_grid->number_of_pixels;
 			if (auto_srcgrid_npixels) {
 				double pix_frac = ((double) source_pixel_grid->number_of_pixels) / n_expected_imgpixels;
 				cout << ", f=" << pix_frac;
 			}
 			cout << endl;
 		}
-	} else {
-		source_pixel_grid->calculate_pixel_magnifications();
+		if (adaptive_grid) {
+			source_pixel_grid->adaptive_subgrid();
+			if ((mpi_id==0) and (verbal)) {
+				cout << "# of source pixels after subgridding: " << source_pixel_grid->number_of_pixels;
+				if (auto_srcgrid_npixels) {
+					double pix_frac = ((double) source_pixel_grid->number_of_pixels) / n_expected_imgpixels;
+					cout << ", f=" << pix_frac;
+				}
+				cout << endl;
+			}
+		} else {
+			source_pixel_grid->calculate_pixel_magnifications();
+		}
 	}
 
 	if ((mpi_id==0) and (verbal)) cout << "Assigning pixel mappings...\n";
@@ -5370,22 +7261,31 @@ double Lens::invert_image_surface_brightness_map(bool verbal)
 	if ((mpi_id==0) and (verbal)) cout << "Initializing pixel matrices...\n";
 	initialize_pixel_matrices(verbal);
 	if (regularization_method != None) create_regularization_matrix();
-	PSF_convolution_Lmatrix(verbal);
-	image_pixel_grid->fill_surface_brightness_vector();
+	double extra_bands_chisq = 0;
+	if (n_extra_bands > 0) extra_bands_chisq = invert_extra_image_bands(verbal); // these are done first so the main band's solution is what remains stored afterward
+	if (inversion_method==Matrix_Free_CG) {
+		// the PSF convolution is applied on the fly, and the model image is found, as part of the inversion
+		image_pixel_grid->fill_surface_brightness_vector();
+		if ((mpi_id==0) and (verbal)) cout << "Inverting lens mapping (matrix-free)...\n" << flush;
+		invert_lens_mapping_matrix_free(verbal);
+	} else {
+		PSF_convolution_Lmatrix(verbal);
+		image_pixel_grid->fill_surface_brightness_vector();
 
-	if ((mpi_id==0) and (verbal)) cout << "Creating lensing matrices...\n" << flush;
-	create_lensing_matrices_from_Lmatrix(verbal);
+		if ((mpi_id==0) and (verbal)) cout << "Creating lensing matrices...\n" << flush;
+		create_lensing_matrices_from_Lmatrix(verbal);
 #ifdef USE_OPENMP
-	if (show_wtime) {
-		tot_wtime = omp_get_wtime() - tot_wtime0;
-		if (mpi_id==0) cout << "Total wall time before F-matrix inversion: " << tot_wtime << endl;
-	}
+		if (show_wtime) {
+			tot_wtime = omp_get_wtime() - tot_wtime0;
+			if (mpi_id==0) cout << "Total wall time before F-matrix inversion: " << tot_wtime << endl;
+		}
 #endif
 
-	if ((mpi_id==0) and (verbal)) cout << "Inverting lens mapping...\n" << flush;
-	if (inversion_method==MUMPS) invert_lens_mapping_MUMPS(verbal);
-	else if (inversion_method==UMFPACK) invert_lens_mapping_UMFPACK(verbal);
-	else invert_lens_mapping_CG_method(verbal);
+		if ((mpi_id==0) and (verbal)) cout << "Inverting lens mapping...\n" << flush;
+		if (inversion_method==MUMPS) invert_lens_mapping_MUMPS(verbal);
+		else if (inversion_method==UMFPACK) invert_lens_mapping_UMFPACK(verbal);
+		else invert_lens_mapping_CG_method(verbal);
+	}
 
 	double chisq;
 	if ((n_image_prior) and (n_images_at_sbmax < n_image_threshold)) {
@@ -5400,7 +7300,7 @@ double Lens::invert_image_surface_brightness_map(bool verbal)
 	}
 	else
 	{
-		calculate_image_pixel_surface_brightness();
+		if (inversion_method != Matrix_Free_CG) calculate_image_pixel_surface_brightness();
 
 #ifdef USE_OPENMP
 		if (show_wtime) {
@@ -5410,9 +7310,7 @@ double Lens::invert_image_surface_brightness_map(bool verbal)
 #endif
 		chisq=0;
 		double chisq_signal=0;
-		double covariance; // right now we're using a uniform uncorrelated noise for each pixel
-		if (data_pixel_noise==0) covariance = 1; // doesn't matter what covariance is, since we won't be regularizing
-		else covariance = SQR(data_pixel_noise);
+		double weight; // inverse variance of each pixel, from the noise map if one is loaded (otherwise uniform uncorrelated noise is assumed)
 		int i,j;
 		double dchisq, dchisq2;
 		int img_index;
@@ -5420,16 +7318,18 @@ double Lens::invert_image_surface_brightness_map(bool verbal)
 		int n_data_pixels=0;
 		for (i=0; i < image_pixel_data->npixels_x; i++) {
 			for (j=0; j < image_pixel_data->npixels_y; j++) {
-				if (image_pixel_data->require_fit[i][j]) {
+				if (image_pixel_data->fit_pixel(i,j)) {
 					n_data_pixels++;
+					weight = image_pixel_data->pixel_weight(i,j,data_pixel_noise);
 					if (image_pixel_grid->maps_to_source_pixel[i][j]) {
 						img_index = image_pixel_grid->pixel_index[i][j];
-						chisq += SQR(image_surface_brightness[img_index] - image_pixel_data->surface_brightness[i][j])/covariance; // generalize to full covariance matrix later
-						if (abs(image_pixel_data->surface_brightness[i][j]) > 2*data_pixel_noise)
-							chisq_signal += SQR(image_surface_brightness[img_index] - image_pixel_data->surface_brightness[i][j])/covariance; // generalize to full covariance matrix later
+						chisq += SQR(image_surface_brightness[img_index] - image_pixel_data->surface_brightness[i][j])*weight; // generalize to full covariance matrix later
+						// pixels count as signal if above twice their noise level (with a noise map, each pixel's sigma is 1/sqrt(weight))
+						if ((image_pixel_data->noise_map_loaded()) ? (SQR(image_pixel_data->surface_brightness[i][j])*weight > 4) : (abs(image_pixel_data->surface_brightness[i][j]) > 2*data_pixel_noise))
+							chisq_signal += SQR(image_surface_brightness[img_index] - image_pixel_data->surface_brightness[i][j])*weight; // generalize to full covariance matrix later
 						count++;
 					} else {
-						chisq += SQR(image_pixel_data->surface_brightness[i][j])/covariance;
+						chisq += SQR(image_pixel_data->surface_brightness[i][j])*weight;
 					}
 				}
 			}
@@ -5481,8 +7381,12 @@ double Lens::invert_image_surface_brightness_map(bool verbal)
 			}
 		}
 		//chisq += n_data_pixels*log(2*M_PI*data_pixel_noise); // this is not very relevant because the data fit window and assumed pixel noise are not varied
+		if (n_extra_bands > 0) {
+			chisq += extra_bands_chisq;
+			if ((group_id==0) and (logfile.is_open())) logfile << " chisq_bands=" << extra_bands_chisq;
+		}
 
-		if (max_sb_prior_unselected_pixels) {
+		if ((max_sb_prior_unselected_pixels) and (delaunay_srcgrid==NULL)) { // the Delaunay grid only covers the fit window
 			clear_lensing_matrices();
 			clear_pixel_matrices();
 			image_pixel_grid->include_all_pixels();
@@ -5523,6 +7427,175 @@ double Lens::invert_image_surface_brightness_map(bool verbal)
 
 	clear_lensing_matrices();
 	clear_pixel_matrices();
+	if (delaunay_srcgrid != NULL) delaunay_srcgrid->clear_image_mapping(); // only the triangulation and solution are kept, for display
+	return chisq;
+}
+
+void Lens::build_delaunay_display_grid()
+{
+	// If the source was reconstructed on a Delaunay grid, this creates the rectangular source grid with the same dimensions
+	// an ordinary inversion would use, and gives each cell the value interpolated from the triangulation, so the source
+	// can be plotted (or lensed back to the image plane) as usual. This is only done when the source is displayed, since
+	// it requires a point location for every cell.
+	if (delaunay_srcgrid==NULL) return;
+	if (source_pixel_grid != NULL) delete source_pixel_grid;
+	source_pixel_grid = new SourcePixelGrid(this,sourcegrid_xmin,sourcegrid_xmax,sourcegrid_ymin,sourcegrid_ymax);
+	if (image_pixel_grid != NULL) {
+		image_pixel_grid->set_source_pixel_grid(source_pixel_grid);
+		source_pixel_grid->set_image_pixel_grid(image_pixel_grid);
+	}
+	source_pixel_grid->assign_surface_brightness_from_delaunay(delaunay_srcgrid);
+}
+
+double Lens::invert_extra_image_bands(bool verbal)
+{
+	// Inverts each of the extra image bands using the lens mapping already found for the main image data, so the ray tracing,
+	// source grid and (unconvolved) Lmatrix are only constructed once; for each band, only the PSF convolution, the lensing
+	// matrices and the inversion are redone. The band's PSF, noise and data are swapped in temporarily so that the same
+	// routines used for the main band can be called. Must be called after the Lmatrix and Rmatrix are created, but before
+	// the PSF convolution of the main band; the unconvolved Lmatrix is restored afterward. Returns the total chi-square
+	// (including the regularization terms, if these are being included) of the extra bands.
+	int Lmatrix_n_elements_unconvolved = Lmatrix_n_elements;
+	double *Lmatrix_unconvolved = Lmatrix;
+	int *Lmatrix_index_unconvolved = Lmatrix_index;
+	int *image_pixel_location_Lmatrix_unconvolved = image_pixel_location_Lmatrix;
+	Lmatrix = NULL;
+	Lmatrix_index = NULL;
+	image_pixel_location_Lmatrix = NULL;
+
+	ImagePixelData *main_pixel_data = image_pixel_data;
+	double main_pixel_noise = data_pixel_noise;
+	double **main_psf_matrix = psf_matrix;
+	int main_psf_npixels_x = psf_npixels_x, main_psf_npixels_y = psf_npixels_y;
+	bool main_use_input_psf_matrix = use_input_psf_matrix;
+	double main_psf_width_x = psf_width_x, main_psf_width_y = psf_width_y;
+	use_input_psf_matrix = false;
+
+	double total_chisq = 0;
+	int band, i, j, img_index;
+	for (band=0; band < n_extra_bands; band++) {
+		ImagePixelBand& imgband = extra_bands[band];
+		Lmatrix_n_elements = Lmatrix_n_elements_unconvolved;
+		Lmatrix = new double[Lmatrix_n_elements];
+		Lmatrix_index = new int[Lmatrix_n_elements];
+		image_pixel_location_Lmatrix = new int[image_npixels+1];
+		for (i=0; i < Lmatrix_n_elements; i++) {
+			Lmatrix[i] = Lmatrix_unconvolved[i];
+			Lmatrix_index[i] = Lmatrix_index_unconvolved[i];
+		}
+		for (i=0; i <= image_npixels; i++) image_pixel_location_Lmatrix[i] = image_pixel_location_Lmatrix_unconvolved[i];
+
+		image_pixel_data = imgband.data;
+		data_pixel_noise = imgband.pixel_noise;
+		psf_width_x = imgband.psf_width_x;
+		psf_width_y = imgband.psf_width_y;
+		psf_matrix = NULL;
+		for (img_index=0; img_index < image_npixels; img_index++)
+			image_surface_brightness[img_index] = imgband.data->surface_brightness[active_image_pixel_i[img_index]][active_image_pixel_j[img_index]];
+		if (inversion_method==Matrix_Free_CG) {
+			invert_lens_mapping_matrix_free(verbal);
+		} else {
+			PSF_convolution_Lmatrix(verbal);
+			create_lensing_matrices_from_Lmatrix(verbal);
+			if (inversion_method==MUMPS) invert_lens_mapping_MUMPS(verbal);
+			else if (inversion_method==UMFPACK) invert_lens_mapping_UMFPACK(verbal);
+			else invert_lens_mapping_CG_method(verbal);
+			calculate_image_pixel_surface_brightness();
+		}
+		if (psf_matrix != NULL) {
+			for (i=0; i < psf_npixels_x; i++) delete[] psf_matrix[i];
+			delete[] psf_matrix;
+			psf_matrix = NULL;
+		}
+
+		// the fit window (and hence which pixels map to the source) is shared with the main band
+		double chisq = 0;
+		for (i=0; i < main_pixel_data->npixels_x; i++) {
+			for (j=0; j < main_pixel_data->npixels_y; j++) {
+				if (main_pixel_data->fit_pixel(i,j)) {
+					if (image_pixel_grid->maps_to_source_pixel[i][j])
+						chisq += SQR(image_surface_brightness[image_pixel_grid->pixel_index[i][j]] - imgband.data->surface_brightness[i][j])*imgband.data->pixel_weight(i,j,imgband.pixel_noise);
+					else
+						chisq += SQR(imgband.data->surface_brightness[i][j])*imgband.data->pixel_weight(i,j,imgband.pixel_noise);
+				}
+			}
+		}
+		if ((regularization_method != None) and ((vary_regularization_parameter) or (vary_pixel_fraction))) {
+			double Es=0;
+			for (i=0; i < source_npixels; i++) {
+				Es += Rmatrix[i]*SQR(source_surface_brightness[i]);
+				for (j=Rmatrix_index[i]; j < Rmatrix_index[i+1]; j++) {
+					Es += 2 * source_surface_brightness[i] * Rmatrix[j] * source_surface_brightness[Rmatrix_index[j]]; // factor of 2 since matrix is symmetric
+				}
+			}
+			if (regularization_parameter != 0) {
+				chisq -= source_npixels*log(regularization_parameter);
+				chisq -= Rmatrix_log_determinant;
+			}
+			chisq += regularization_parameter*Es;
+			chisq += Fmatrix_log_determinant;
+		}
+		imgband.chisq = chisq;
+		total_chisq += chisq;
+		if ((mpi_id==0) and (verbal)) cout << "band " << band+1 << ": chisq=" << chisq << endl;
+
+		delete[] Dvector;
+		delete[] Fmatrix;
+		delete[] Fmatrix_index;
+		Dvector = NULL;
+		Fmatrix = NULL;
+		Fmatrix_index = NULL;
+		delete[] Lmatrix;
+		delete[] Lmatrix_index;
+		delete[] image_pixel_location_Lmatrix;
+	}
+
+	image_pixel_data = main_pixel_data;
+	data_pixel_noise = main_pixel_noise;
+	psf_matrix = main_psf_matrix;
+	psf_npixels_x = main_psf_npixels_x;
+	psf_npixels_y = main_psf_npixels_y;
+	use_input_psf_matrix = main_use_input_psf_matrix;
+	psf_width_x = main_psf_width_x;
+	psf_width_y = main_psf_width_y;
+	Lmatrix_n_elements = Lmatrix_n_elements_unconvolved;
+	Lmatrix = Lmatrix_unconvolved;
+	Lmatrix_index = Lmatrix_index_unconvolved;
+	image_pixel_location_Lmatrix = image_pixel_location_Lmatrix_unconvolved;
+	return total_chisq;
+}
+
+double Lens::calculate_parameterized_source_chisq(bool redo_ray_tracing, bool verbal)
+{
+	// Fits the data pixels with the lensed image of the source objects (sb_list). Each image pixel is split into
+	// source_supersampling x source_supersampling subpixels, which are ray traced to the source plane and stored, so
+	// if only the source parameters are changed, the ray tracing is skipped and only the surface brightness is recalculated.
+	if (image_pixel_data == NULL) { warn("No image surface brightness data has been loaded"); return 2e30; }
+	if (n_sb==0) { warn("No source objects have been defined"); return 2e30; }
+	if (image_pixel_grid == NULL) load_pixel_grid_from_data();
+
+	int psf_nx_half=0, psf_ny_half=0;
+	if (fit_uses_psf) { // the PSF matrix was generated by initialize_fitmodel
+		psf_nx_half = psf_npixels_x/2;
+		psf_ny_half = psf_npixels_y/2;
+	}
+	if ((redo_ray_tracing) or (image_pixel_grid->n_supersampled_pixels==0) or (image_pixel_grid->supersampling_nsplit != source_supersampling) or (image_pixel_grid->supersampling_margin_x != psf_nx_half) or (image_pixel_grid->supersampling_margin_y != psf_ny_half)) {
+		image_pixel_grid->ray_trace_supersampled_pixels(source_supersampling,psf_nx_half,psf_ny_half);
+		if ((mpi_id==0) and (verbal)) cout << "Number of ray-traced image pixels: " << image_pixel_grid->n_supersampled_pixels << " (" << image_pixel_grid->n_supersampled_pixels*source_supersampling*source_supersampling << " subpixels)" << endl;
+	}
+	image_pixel_grid->find_surface_brightness_from_sb_profiles(sb_list,n_sb);
+	if ((psf_nx_half > 0) or (psf_ny_half > 0)) PSF_convolution_image_pixels(verbal);
+
+	double chisq=0;
+	int i,j;
+	for (i=0; i < image_pixel_data->npixels_x; i++) {
+		for (j=0; j < image_pixel_data->npixels_y; j++) {
+			if (image_pixel_data->fit_pixel(i,j)) {
+				chisq += SQR(image_pixel_grid->surface_brightness[i][j] - image_pixel_data->surface_brightness[i][j])*image_pixel_data->pixel_weight(i,j,data_pixel_noise);
+			}
+		}
+	}
+	if ((mpi_id==0) and (verbal)) cout << "chisq=" << chisq << endl;
 	return chisq;
 }
 
@@ -5991,6 +8064,7 @@ void Lens::create_output_directory()
 void Lens::reset()
 {
 	reset_grid();
+	update_lens_tree();
 	cc_rmin = default_autogrid_rmin;
 	cc_rmax = default_autogrid_rmax;
 }
@@ -6047,7 +8121,9 @@ Lens::~Lens()
 	delete grid;
 	delete param_settings;
 	if (defspline != NULL) delete defspline;
+	if (lens_tree != NULL) delete lens_tree;
 	if (fitmodel != NULL) delete fitmodel;
+	if (loglike_cache != NULL) delete loglike_cache;
 	if (sourcepts_fit != NULL) delete[] sourcepts_fit;
 	if (vary_sourcepts_x != NULL) delete[] vary_sourcepts_x;
 	if (vary_sourcepts_y != NULL) delete[] vary_sourcepts_y;
@@ -6061,11 +8137,14 @@ Lens::~Lens()
 	if (sourcepts_lower_limit != NULL) delete[] sourcepts_lower_limit;
 	if ((image_data != NULL) and (borrowed_image_data==false)) delete[] image_data;
 	if ((image_pixel_data != NULL) and (borrowed_image_data==false)) delete image_pixel_data;
+	if (borrowed_image_data==false) clear_image_bands();
+	else if ((thread_clone) and (extra_bands != NULL)) delete[] extra_bands;
 	if (image_surface_brightness != NULL) delete[] image_surface_brightness;
 	if (source_surface_brightness != NULL) delete[] source_surface_brightness;
 	if (source_pixel_n_images != NULL) delete[] source_pixel_n_images;
 	if (active_image_pixel_i != NULL) delete[] active_image_pixel_i;
 	if (active_image_pixel_j != NULL) delete[] active_image_pixel_j;
+	if (active_image_row_start != NULL) delete[] active_image_row_start;
 	if (image_pixel_location_Lmatrix != NULL) delete[] image_pixel_location_Lmatrix;
 	if (source_pixel_location_Lmatrix != NULL) delete[] source_pixel_location_Lmatrix;
 	if (Lmatrix_index != NULL) delete[] Lmatrix_index;
@@ -6075,6 +8154,7 @@ Lens::~Lens()
 	if (Fmatrix_index != NULL) delete[] Fmatrix_index;
 	if (Rmatrix != NULL) delete[] Rmatrix;
 	if (Rmatrix_index != NULL) delete[] Rmatrix_index;
+	if (delaunay_srcgrid != NULL) delete delaunay_srcgrid;
 	if (source_pixel_grid != NULL) delete source_pixel_grid;
 	if (image_pixel_grid != NULL) delete image_pixel_grid;
 }
@@ -0,0 +1,327 @@
+#include "lenstree.h"
+#include <cmath>
+using namespace std;
+
+LensTree::LensTree(const double accuracy_in)
+{
+	accuracy = accuracy_in;
+	theta = pow(accuracy,1.0/(lens_tree_order+1));
+}
+
+bool LensTree::update(LensProfile** lens_list, const int nlens, const double accuracy_in)
+{
+	// Returns true if there are enough compact lenses for the tree to be used. The masses and extents are only recalculated
+	// for lenses whose parameters have changed, and the tree is only rebuilt if any of them has.
+	bool recalculate_all = false, changed = false;
+	if (accuracy_in != accuracy) {
+		accuracy = accuracy_in;
+		theta = pow(accuracy,1.0/(lens_tree_order+1));
+		recalculate_all = true;
+	}
+	if (nlens != members.size()) {
+		members.resize(nlens);
+		changed = true;
+	}
+	vector<double> params;
+	LensProfileName lenstype;
+	for (int i=0; i < nlens; i++) {
+		LensTreeMember& member = members[i];
+		params.resize(lens_list[i]->get_n_params());
+		lens_list[i]->get_parameters(params.data());
+		if ((!recalculate_all) and (member.lens==lens_list[i]) and (member.params==params)) continue;
+		changed = true;
+		member.lens = lens_list[i];
+		member.params = params;
+		member.lens->get_center_coords(member.x,member.y);
+		lenstype = member.lens->get_lenstype();
+		// these are the profiles whose mass converges quickly enough for them to look like point masses from a distance
+		if ((lenstype==PTMASS) or (lenstype==PJAFFE) or (lenstype==TRUNCATED_nfw)) member.compact = find_mass_and_extent(member);
+		else member.compact = false;
+	}
+	if (changed) rebuild();
+	return in_use();
+}
+
+bool LensTree::find_mass_and_extent(LensTreeMember& member)
+{
+	// The enclosed mass is estimated from m(r) = r*(alpha.rhat), averaged over four directions at 45 degree intervals (which
+	// cancels the quadrupole term); the radius is doubled until m(r) has converged to within the accuracy at two successive
+	// radii. Returns false if it does not converge within a reasonable radius, in which case the lens is evaluated exactly.
+	static const double cosang[4] = { 1, M_SQRT1_2, 0, -M_SQRT1_2 };
+	static const double sinang[4] = { 0, M_SQRT1_2, 1, M_SQRT1_2 };
+	const double rmin = 1e-4, rmax = 1e8;
+	lensvector def;
+	double r, m, m_prev = 0, extent = -1;
+	int i;
+	for (r=rmin; r < rmax; r *= 2) {
+		m = 0;
+		for (i=0; i < 4; i++) {
+			member.lens->deflection(member.x+r*cosang[i],member.y+r*sinang[i],def);
+			m += r*(def[0]*cosang[i] + def[1]*sinang[i]);
+		}
+		m /= 4;
+		if (!isfinite(m)) return false;
+		if ((r > rmin) and (m != 0) and (abs(m-m_prev) <= 0.5*accuracy*abs(m))) {
+			if (extent > 0) break;
+			extent = r;
+		} else extent = -1;
+		m_prev = m;
+	}
+	if (r >= rmax) return false;
+	// for a profile whose mass converges as 1/r (e.g. pseudo-Jaffe), this extrapolates to the total mass
+	member.mass = 2*m - m_prev;
+	member.extent = (member.lens->get_lenstype()==PTMASS) ? 0 : extent;
+
+	// offset between the potential of the lens and that of a point mass, so the potential is continuous at the extent
+	double pot = 0;
+	for (i=0; i < 4; i++) pot += member.lens->potential(member.x+r*cosang[i],member.y+r*sinang[i]);
+	member.pot_const = pot/4 - member.mass*log(r);
+	if (!isfinite(member.pot_const)) member.pot_const = 0;
+	return true;
+}
+
+void LensTree::rebuild()
+{
+	int i;
+	member_index.clear();
+	direct_index.clear();
+	nodes.clear();
+	for (i=0; i < members.size(); i++) {
+		if (members[i].compact) member_index.push_back(i);
+	}
+	if (member_index.size() < lens_tree_min_members) {
+		member_index.clear();
+		for (i=0; i < members.size(); i++) direct_index.push_back(i);
+		return;
+	}
+	for (i=0; i < members.size(); i++) {
+		if (!members[i].compact) direct_index.push_back(i);
+	}
+
+	double xmin=1e30, xmax=-1e30, ymin=1e30, ymax=-1e30;
+	for (i=0; i < member_index.size(); i++) {
+		const LensTreeMember& member = members[member_index[i]];
+		if (member.x < xmin) xmin = member.x;
+		if (member.x > xmax) xmax = member.x;
+		if (member.y < ymin) ymin = member.y;
+		if (member.y > ymax) ymax = member.y;
+	}
+	double size = (xmax-xmin > ymax-ymin) ? xmax-xmin : ymax-ymin;
+	if (size==0) size = 1;
+	size *= 1.000001; // so the members on the upper edges fall inside the root cell
+	build_node(0,member_index.size(),xmin,ymin,size,0);
+}
+
+int LensTree::build_node(const int first, const int n, const double xmin, const double ymin, const double size, const int depth)
+{
+	int i, p, indx = nodes.size();
+	nodes.push_back(LensTreeNode()); // the nodes vector may be reallocated when the children are added, so it is filled in via indx
+	LensTreeNode& node = nodes[indx];
+	double dx, dy, r, zr, zi, tmp;
+	node.xc = xmin + size/2;
+	node.yc = ymin + size/2;
+	node.first = first;
+	node.n = n;
+	node.radius = 0;
+	node.max_extent = 0;
+	node.pot_const = 0;
+	for (p=0; p <= lens_tree_order; p++) node.moment_re[p] = node.moment_im[p] = 0;
+	for (i=first; i < first+n; i++) {
+		const LensTreeMember& member = members[member_index[i]];
+		dx = member.x - node.xc;
+		dy = member.y - node.yc;
+		r = sqrt(dx*dx+dy*dy);
+		if (r > node.radius) node.radius = r;
+		if (member.extent > node.max_extent) node.max_extent = member.extent;
+		node.pot_const += member.pot_const;
+		zr = 1; zi = 0; // (z-z_c)^p
+		for (p=0; p <= lens_tree_order; p++) {
+			node.moment_re[p] += member.mass*zr;
+			node.moment_im[p] += member.mass*zi;
+			tmp = zr*dx - zi*dy;
+			zi = zr*dy + zi*dx;
+			zr = tmp;
+		}
+	}
+	for (i=0; i < 4; i++) node.child[i] = -1;
+	node.leaf = ((n <= lens_tree_leaf_size) or (depth >= lens_tree_max_depth));
+	if (node.leaf) return indx;
+
+	// sort the members by quadrant (0: lower left, 1: lower right, 2: upper left, 3: upper right) and build the children
+	double xmid = node.xc, ymid = node.yc, half = size/2;
+	vector<int> sorted;
+	sorted.reserve(n);
+	int q, count, start = first;
+	int nq[4];
+	for (q=0; q < 4; q++) {
+		count = 0;
+		for (i=first; i < first+n; i++) {
+			const LensTreeMember& member = members[member_index[i]];
+			if ((((member.x >= xmid) ? 1 : 0) + ((member.y >= ymid) ? 2 : 0)) == q) {
+				sorted.push_back(member_index[i]);
+				count++;
+			}
+		}
+		nq[q] = count;
+	}
+	for (i=0; i < n; i++) member_index[first+i] = sorted[i];
+	int child;
+	for (q=0; q < 4; q++) {
+		if (nq[q]==0) continue;
+		child = build_node(start,nq[q],xmin+(q%2)*half,ymin+(q/2)*half,half,depth+1);
+		nodes[indx].child[q] = child;
+		start += nq[q];
+	}
+	return indx;
+}
+
+// In the following, a cell is replaced by its multipole expansion if the ray is far enough from it; with w = z - z_c,
+// conj(alpha) = sum_p a_p / w^(p+1), and the potential is Re[a_0 ln(w) - sum_{p>0} a_p / (p w^p)].
+
+void LensTree::deflection(const double x, const double y, double& def_x, double& def_y, lensvector& def_i)
+{
+	int i, p, indx, nstack = 0;
+	int stack[4*(lens_tree_max_depth+1)];
+	double dx, dy, dsq, d, wr, wi, pr, pi, fr, fi, tmp;
+	def_x = def_y = 0;
+	for (i=0; i < direct_index.size(); i++) {
+		members[direct_index[i]].lens->deflection(x,y,def_i);
+		def_x += def_i[0];
+		def_y += def_i[1];
+	}
+	stack[nstack++] = 0;
+	while (nstack > 0) {
+		const LensTreeNode& node = nodes[stack[--nstack]];
+		dx = x - node.xc;
+		dy = y - node.yc;
+		dsq = dx*dx + dy*dy;
+		d = sqrt(dsq);
+		if ((node.radius < theta*d) and (d - node.radius > node.max_extent)) {
+			wr = dx/dsq; wi = -dy/dsq; // 1/w
+			pr = wr; pi = wi;
+			fr = fi = 0;
+			for (p=0; p <= lens_tree_order; p++) {
+				fr += node.moment_re[p]*pr - node.moment_im[p]*pi;
+				fi += node.moment_re[p]*pi + node.moment_im[p]*pr;
+				tmp = pr*wr - pi*wi;
+				pi = pr*wi + pi*wr;
+				pr = tmp;
+			}
+			def_x += fr;
+			def_y -= fi;
+		} else if (node.leaf) {
+			for (i=node.first; i < node.first+node.n; i++) {
+				members[member_index[i]].lens->deflection(x,y,def_i);
+				def_x += def_i[0];
+				def_y += def_i[1];
+			}
+		} else {
+			for (i=0; i < 4; i++) if ((indx = node.child[i]) >= 0) stack[nstack++] = indx;
+		}
+	}
+}
+
+void LensTree::hessian(const double x, const double y, lensmatrix& hess, lensmatrix& hess_i)
+{
+	int i, p, indx, nstack = 0;
+	int stack[4*(lens_tree_max_depth+1)];
+	double dx, dy, dsq, d, wr, wi, pr, pi, fr, fi, tmp;
+	hess[0][0] = hess[1][1] = hess[0][1] = hess[1][0] = 0;
+	for (i=0; i < direct_index.size(); i++) {
+		members[direct_index[i]].lens->hessian(x,y,hess_i);
+		hess[0][0] += hess_i[0][0];
+		hess[1][1] += hess_i[1][1];
+		hess[0][1] += hess_i[0][1];
+		hess[1][0] += hess_i[1][0];
+	}
+	stack[nstack++] = 0;
+	while (nstack > 0) {
+		const LensTreeNode& node = nodes[stack[--nstack]];
+		dx = x - node.xc;
+		dy = y - node.yc;
+		dsq = dx*dx + dy*dy;
+		d = sqrt(dsq);
+		if ((node.radius < theta*d) and (d - node.radius > node.max_extent)) {
+			// the derivative of conj(alpha) is -sum_p (p+1) a_p / w^(p+2) = psi_xx - i*psi_xy, with psi_yy = -psi_xx
+			wr = dx/dsq; wi = -dy/dsq;
+			pr = wr*wr - wi*wi; pi = 2*wr*wi; // 1/w^2
+			fr = fi = 0;
+			for (p=0; p <= lens_tree_order; p++) {
+				fr -= (p+1)*(node.moment_re[p]*pr - node.moment_im[p]*pi);
+				fi -= (p+1)*(node.moment_re[p]*pi + node.moment_im[p]*pr);
+				tmp = pr*wr - pi*wi;
+				pi = pr*wi + pi*wr;
+				pr = tmp;
+			}
+			hess[0][0] += fr;
+			hess[1][1] -= fr;
+			hess[0][1] -= fi;
+			hess[1][0] -= fi;
+		} else if (node.leaf) {
+			for (i=node.first; i < node.first+node.n; i++) {
+				members[member_index[i]].lens->hessian(x,y,hess_i);
+				hess[0][0] += hess_i[0][0];
+				hess[1][1] += hess_i[1][1];
+				hess[0][1] += hess_i[0][1];
+				hess[1][0] += hess_i[1][0];
+			}
+		} else {
+			for (i=0; i < 4; i++) if ((indx = node.child[i]) >= 0) stack[nstack++] = indx;
+		}
+	}
+}
+
+double LensTree::potential(const double x, const double y)
+{
+	int i, p, indx, nstack = 0;
+	int stack[4*(lens_tree_max_depth+1)];
+	double dx, dy, dsq, d, wr, wi, pr, pi, tmp;
+	double pot = 0;
+	for (i=0; i < direct_index.size(); i++) pot += members[direct_index[i]].lens->potential(x,y);
+	stack[nstack++] = 0;
+	while (nstack > 0) {
+		const LensTreeNode& node = nodes[stack[--nstack]];
+		dx = x - node.xc;
+		dy = y - node.yc;
+		dsq = dx*dx + dy*dy;
+		d = sqrt(dsq);
+		if ((node.radius < theta*d) and (d - node.radius > node.max_extent)) {
+			pot += node.moment_re[0]*log(d) + node.pot_const;
+			wr = dx/dsq; wi = -dy/dsq;
+			pr = wr; pi = wi;
+			for (p=1; p <= lens_tree_order; p++) {
+				pot -= (node.moment_re[p]*pr - node.moment_im[p]*pi)/p;
+				tmp = pr*wr - pi*wi;
+				pi = pr*wi + pi*wr;
+				pr = tmp;
+			}
+		} else if (node.leaf) {
+			for (i=node.first; i < node.first+node.n; i++) pot += members[member_index[i]].lens->potential(x,y);
+		} else {
+			for (i=0; i < 4; i++) if ((indx = node.child[i]) >= 0) stack[nstack++] = indx;
+		}
+	}
+	return pot;
+}
+
+double LensTree::kappa(const double x, const double y)
+{
+	// beyond its extent, the convergence of a member is negligible, so cells the point is outside of are skipped entirely
+	int i, indx, nstack = 0;
+	int stack[4*(lens_tree_max_depth+1)];
+	double dx, dy, kap = 0;
+	for (i=0; i < direct_index.size(); i++) kap += members[direct_index[i]].lens->kappa(x,y);
+	stack[nstack++] = 0;
+	while (nstack > 0) {
+		const LensTreeNode& node = nodes[stack[--nstack]];
+		dx = x - node.xc;
+		dy = y - node.yc;
+		if (sqrt(dx*dx+dy*dy) - node.radius > node.max_extent) continue;
+		if (node.leaf) {
+			for (i=node.first; i < node.first+node.n; i++) kap += members[member_index[i]].lens->kappa(x,y);
+		} else {
+			for (i=0; i < 4; i++) if ((indx = node.child[i]) >= 0) stack[nstack++] = indx;
+		}
+	}
+	return kap;
+}
@@ -0,0 +1,78 @@
+// LENSTREE.H: Hierarchical (Barnes-Hut) summation of the lensing quantities of many compact lenses
+
+#ifndef LENSTREE_H
+#define LENSTREE_H
+
+#include "profile.h"
+#include "lensvec.h"
+#include <vector>
+using namespace std;
+
+// Lenses whose mass converges (point masses, pseudo-Jaffe and truncated NFW profiles, e.g. subhalos) are sorted into a
+// quadtree. Seen from a distance, each cell of the tree acts like a set of point masses and is replaced by a complex
+// multipole expansion about its center; a ray only descends into the cells that are too close for their expansion to be
+// accurate, so the cost per ray grows as log(N) rather than N. All other lenses (and the members of nearby cells) are
+// evaluated exactly.
+//
+// A member lens is only treated as a point mass beyond its "extent", the radius outside which the mass it encloses is
+// within a fraction 'accuracy' of its total mass; a cell is expanded only if the ray is outside the extent of all of its
+// members and far enough away that the truncation error of the expansion is also of order 'accuracy'. The mass, extent
+// and potential offset of each member are found numerically from its deflection, and are only recalculated when its
+// parameters change, so rebuilding the tree during a fit in which the subhalos are held fixed is cheap.
+
+const int lens_tree_order = 8; // highest order of the multipole expansion in each cell
+const int lens_tree_leaf_size = 8; // maximum number of members in a cell that is not subdivided
+const int lens_tree_max_depth = 40;
+const int lens_tree_min_members = 16; // with fewer compact lenses than this, the tree is not used
+
+struct LensTreeMember
+{
+	LensProfile *lens;
+	vector<double> params;
+	bool compact; // false if the mass of the lens does not converge, in which case it is evaluated exactly
+	double x, y; // center of the lens
+	double mass; // in units where a point mass of Einstein radius b has mass b^2
+	double extent; // beyond this radius the lens acts as a point mass (to the specified accuracy)
+	double pot_const; // potential minus that of a point mass of the same mass, at large radius
+
+	LensTreeMember() : lens(NULL), compact(false), x(0), y(0), mass(0), extent(0), pot_const(0) {}
+};
+
+struct LensTreeNode
+{
+	double xc, yc; // expansion center (the center of the cell)
+	double radius; // largest distance from (xc,yc) to a member
+	double max_extent; // largest extent of any member in the cell
+	double pot_const; // sum of the potential offsets of the members
+	double moment_re[lens_tree_order+1], moment_im[lens_tree_order+1]; // moment p is the sum over members of mass*(z-z_c)^p
+	int child[4]; // -1 if there is no child in that quadrant
+	int first, n; // the members of the cell are member_index[first] ... member_index[first+n-1]
+	bool leaf;
+};
+
+class LensTree
+{
+	double accuracy, theta; // theta is the opening angle, chosen so that the truncation error is of order 'accuracy'
+	vector<LensTreeMember> members; // one entry for each lens in lens_list
+	vector<int> member_index; // the compact members, in tree order
+	vector<int> direct_index; // the lenses evaluated exactly for every ray
+	vector<LensTreeNode> nodes;
+
+	bool find_mass_and_extent(LensTreeMember& member);
+	int build_node(const int first, const int n, const double xmin, const double ymin, const double size, const int depth);
+	void rebuild();
+
+	public:
+	LensTree(const double accuracy_in);
+	bool update(LensProfile** lens_list, const int nlens, const double accuracy_in);
+	bool in_use() { return (!member_index.empty()); }
+	int n_members() { return member_index.size(); }
+	int n_nodes() { return nodes.size(); }
+
+	void deflection(const double x, const double y, double& def_x, double& def_y, lensvector& def_i);
+	void hessian(const double x, const double y, lensmatrix& hess, lensmatrix& hess_i);
+	double potential(const double x, const double y);
+	double kappa(const double x, const double y);
+};
+
+#endif // LENSTREE_H
@@ -0,0 +1,90 @@
+#include "llcache.h"
+#include <cstring>
+using namespace std;
+
+const size_t LogLikeCache::max_byproduct_bytes = 134217728; // 128 MB
+
+LogLikeCache::LogLikeCache(const int n_params_in, const int capacity_in)
+{
+	n_params = n_params_in;
+	capacity = (capacity_in > 0) ? capacity_in : 1;
+	byproduct_bytes = 0;
+	epoch = 0;
+	n_hits = 0;
+	n_misses = 0;
+}
+
+unsigned long long LogLikeCache::hash_key(const double *params)
+{
+	// FNV-1a hash of the bytes of the parameter values, followed by the epoch
+	unsigned long long h = 14695981039346656037ULL;
+	const unsigned char *bytes = (const unsigned char*) params;
+	int i, nbytes = n_params*sizeof(double);
+	for (i=0; i < nbytes; i++) {
+		h ^= bytes[i];
+		h *= 1099511628211ULL;
+	}
+	bytes = (const unsigned char*) &epoch;
+	for (i=0; i < sizeof(epoch); i++) {
+		h ^= bytes[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+bool LogLikeCache::lookup(const double *params, double& loglike, vector<double>* byproducts)
+{
+	unsigned long long h = hash_key(params);
+	map<unsigned long long, list<Entry>::iterator>::iterator it = index.find(h);
+	if ((it == index.end()) or (it->second->epoch != epoch) or (memcmp(it->second->params.data(),params,n_params*sizeof(double)) != 0)) {
+		n_misses++;
+		return false;
+	}
+	entries.splice(entries.begin(),entries,it->second); // move the entry to the front, since it is now the most recently used
+	loglike = it->second->loglike;
+	if (byproducts != NULL) *byproducts = it->second->byproducts;
+	n_hits++;
+	return true;
+}
+
+void LogLikeCache::store(const double *params, const double loglike, const vector<double>* byproducts)
+{
+	unsigned long long h = hash_key(params);
+	map<unsigned long long, list<Entry>::iterator>::iterator it = index.find(h);
+	if (it != index.end()) {
+		// either the same point, or (very rarely) a different point with the same hash; either way, the old entry is replaced
+		byproduct_bytes -= it->second->byproducts.size()*sizeof(double);
+		entries.erase(it->second);
+		index.erase(it);
+	} else if (entries.size() >= capacity) {
+		evict_oldest();
+	}
+	Entry entry;
+	entry.hash = h;
+	entry.epoch = epoch;
+	entry.params.assign(params,params+n_params);
+	entry.loglike = loglike;
+	entries.push_front(entry);
+	index[h] = entries.begin();
+	if (byproducts != NULL) {
+		entries.front().byproducts = *byproducts;
+		byproduct_bytes += byproducts->size()*sizeof(double);
+		while ((byproduct_bytes > max_byproduct_bytes) and (entries.size() > 1)) evict_oldest(); // the newest entry is always kept
+	}
+}
+
+void LogLikeCache::evict_oldest()
+{
+	byproduct_bytes -= entries.back().byproducts.size()*sizeof(double);
+	index.erase(entries.back().hash);
+	entries.pop_back();
+}
+
+void LogLikeCache::clear()
+{
+	entries.clear();
+	index.clear();
+	byproduct_bytes = 0;
+	n_hits = 0;
+	n_misses = 0;
+}
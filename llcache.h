@@ -0,0 +1,54 @@
+// LLCACHE.H: Least-recently-used cache of fit likelihood values (and optional by-products), keyed on the parameter vector
+
+#ifndef LLCACHE_H
+#define LLCACHE_H
+
+#include <vector>
+#include <list>
+#include <map>
+#include <cstddef>
+
+using namespace std;
+
+// Optimizers and derivative routines often request the likelihood at exactly the same parameter values more than once
+// (e.g. when the simplex is restarted from its best-fit point). Entries are looked up by a hash of the parameter vector
+// and the current epoch, then compared bit-for-bit, so a cached value is only returned for identical parameters. Starting
+// a new epoch invalidates all the entries at once (e.g. if the likelihood function is changed during a fit); the stale
+// entries are never matched again and are evicted as new ones are stored. Since the by-products can be large (e.g. the model
+// image in pixel image fits), the least recently used entries are also evicted once the by-products stored in all the
+// entries exceed max_byproduct_bytes, so the number of entries kept may then be smaller than the capacity.
+class LogLikeCache
+{
+	struct Entry
+	{
+		unsigned long long hash;
+		unsigned long epoch;
+		vector<double> params;
+		double loglike;
+		vector<double> byproducts;
+	};
+
+	int n_params, capacity;
+	size_t byproduct_bytes;
+	static const size_t max_byproduct_bytes;
+	unsigned long epoch;
+	list<Entry> entries; // ordered from most to least recently used
+	map<unsigned long long, list<Entry>::iterator> index;
+	long int n_hits, n_misses;
+
+	unsigned long long hash_key(const double *params);
+	void evict_oldest();
+
+	public:
+	LogLikeCache(const int n_params_in, const int capacity_in);
+	void new_epoch() { epoch++; }
+	bool lookup(const double *params, double& loglike, vector<double>* byproducts = NULL);
+	void store(const double *params, const double loglike, const vector<double>* byproducts = NULL);
+	void clear();
+	int get_capacity() { return capacity; }
+	int size() { return entries.size(); }
+	long int hits() { return n_hits; }
+	long int misses() { return n_misses; }
+};
+
+#endif // LLCACHE_H
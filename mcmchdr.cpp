@@ -8,6 +8,10 @@
 #include <exception>
 #include <csignal>
 #include <string>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
 #include "GregsMathHdr.h"
 #include "mcmchdr.h"
 #include "random.h"
@@ -72,6 +76,13 @@ UCMC::UCMC() : Minimize(1.0e-6, 1000), LevenMarq(0.001, 3), Derivative(1.0e-6, 1
 	mpi_ngroups = 1;
 	mpi_group_id = mpi_group_num = 0;
 	mpi_group_leader = NULL;
+#ifdef USE_MPI
+	mpi_comm = MPI_COMM_WORLD;
+#endif
+	checkpoint_interval = 0;
+	resume_from_checkpoint = false;
+	n_loglike_evaluators = 0;
+	loglike_evaluators = NULL;
 }
 
 #ifdef USE_MPI
@@ -806,19 +817,135 @@ void quitproc(int sig)
 	exit(0);
 }
 
-void UCMC::TWalk(const char *name, const double div, const int proj, const double din, const double alim, const double alimt, const double tol, const int Threads, double *best_fit_params, bool logfile)
+// Checkpoint file (written by MonoSample and TWalk every checkpoint_interval iterations, and when interrupted):
+//   char[8] tag (identifies the sampler), int mpi_np, int mpi_ngroups, int ma, int n_global, int n_local,
+//   double global_state[n_global] (the sampler state from process 0, which all processes share on resuming),
+//   unsigned long long local_state[mpi_np][n_local] (the random number generator state and any output file sizes for
+//   each process, which differ between MPI groups)
+// A run can only be resumed with the same MPI layout and sampler settings, which are checked against the header.
+static bool SyncFile(ofstream &fout, const string &filename)
+{
+	// flushes the stream and forces the contents of the file to disk; an ofstream does not expose its file descriptor, so
+	// the file is opened again to call fsync (which applies to the file itself, whichever descriptor is used)
+	fout.flush();
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	bool status = (fsync(fd)==0);
+	if (close(fd) != 0) status = false;
+	return status;
+}
+
+static bool SyncParentDirectory(const string &filename)
 {
+	// a rename is only certain to survive a crash once the directory holding the file has been synced as well
+	size_t slash = filename.rfind('/');
+	string dirname = (slash==string::npos) ? "." : ((slash==0) ? "/" : filename.substr(0,slash));
+	int fd = open(dirname.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	bool status = (fsync(fd)==0);
+	if (close(fd) != 0) status = false;
+	return status;
+}
+
+bool UCMC::WriteCheckpoint(const char *name, const char *tag, vector<double> &global_state, vector<unsigned long long int> &local_state)
+{
+	int n_local = local_state.size();
+	vector<unsigned long long int> all_local(n_local*mpi_np);
+#ifdef USE_MPI
+	MPI_Gather(c_ptr(local_state), n_local, MPI_UNSIGNED_LONG_LONG, c_ptr(all_local), n_local, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+#else
+	all_local = local_state;
+#endif
+	bool status = true;
+	if (mpi_id==0) {
+		// the checkpoint is written to a temporary file, synced to disk, and then renamed over the old one (after which the
+		// directory is synced, so the rename itself is on disk); since the rename is atomic, a crash at any point leaves
+		// either the old or the new checkpoint intact
+		string filename = string(name) + ".checkpoint";
+		string tempname = filename + ".tmp";
+		FILE *fp = fopen(tempname.c_str(), "wb");
+		if (fp==NULL) status = false;
+		else {
+			int header[5] = { mpi_np, mpi_ngroups, ma, (int) global_state.size(), n_local };
+			if (fwrite(tag, 1, 8, fp) != 8) status = false;
+			if (fwrite(header, sizeof(int), 5, fp) != 5) status = false;
+			if (fwrite(c_ptr(global_state), sizeof(double), global_state.size(), fp) != global_state.size()) status = false;
+			if (fwrite(c_ptr(all_local), sizeof(unsigned long long int), all_local.size(), fp) != all_local.size()) status = false;
+			if ((fflush(fp) != 0) or (fsync(fileno(fp)) != 0)) status = false;
+			if (fclose(fp) != 0) status = false;
+			if ((status) and (std::rename(tempname.c_str(), filename.c_str()) != 0)) status = false;
+			if ((status) and (!SyncParentDirectory(filename))) status = false;
+		}
+		if (!status) cerr << "Warning: could not write checkpoint file '" << filename << "'" << endl;
+	}
+	return status;
+}
+
+bool UCMC::ReadCheckpoint(const char *name, const char *tag, vector<double> &global_state, vector<unsigned long long int> &local_state)
+{
+	// global_state and local_state must already have the sizes expected for the current sampler settings
+	int n_local = local_state.size();
+	vector<unsigned long long int> all_local(n_local*mpi_np);
+	int status = 1;
+	if (mpi_id==0) {
+		string filename = string(name) + ".checkpoint";
+		FILE *fp = fopen(filename.c_str(), "rb");
+		char file_tag[8];
+		int header[5];
+		if (fp==NULL) {
+			cerr << "Error: could not open checkpoint file '" << filename << "'" << endl;
+			status = 0;
+		} else if ((fread(file_tag, 1, 8, fp) != 8) or (strncmp(file_tag, tag, 8) != 0) or (fread(header, sizeof(int), 5, fp) != 5)) {
+			cerr << "Error: '" << filename << "' is not a checkpoint file for this fit method" << endl;
+			status = 0;
+		} else if ((header[0] != mpi_np) or (header[1] != mpi_ngroups)) {
+			cerr << "Error: checkpoint was written with " << header[0] << " MPI processes in " << header[1] << " groups; the run must be resumed with the same layout" << endl;
+			status = 0;
+		} else if ((header[2] != ma) or (header[3] != global_state.size()) or (header[4] != n_local)) {
+			cerr << "Error: checkpoint does not match the current fit parameters or sampler settings" << endl;
+			status = 0;
+		} else if ((fread(c_ptr(global_state), sizeof(double), global_state.size(), fp) != global_state.size()) or (fread(c_ptr(all_local), sizeof(unsigned long long int), all_local.size(), fp) != all_local.size())) {
+			cerr << "Error: checkpoint file '" << filename << "' is incomplete" << endl;
+			status = 0;
+		}
+		if (fp != NULL) fclose(fp);
+	}
+#ifdef USE_MPI
+	MPI_Bcast(&status, 1, MPI_INT, 0, mpi_comm);
+	if (status) {
+		MPI_Bcast(c_ptr(global_state), global_state.size(), MPI_DOUBLE, 0, mpi_comm);
+		MPI_Scatter(c_ptr(all_local), n_local, MPI_UNSIGNED_LONG_LONG, c_ptr(local_state), n_local, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+	}
+#else
+	if (status) local_state = all_local;
+#endif
+	return (status != 0);
+}
+
+bool UCMC::TWalk(const char *name, const double div, const int proj, const double din, const double alim, const double alimt, const double tol, const int Threads, double *best_fit_params, bool logfile)
+{
+	// Each MPI group moves n_walkers chains per iteration; if there is more than one, their proposals are all drawn first
+	// (so the random number sequence does not depend on the thread scheduling), then their likelihoods are evaluated at
+	// the same time using the thread evaluators, and finally they are accepted or rejected in order. The moving chains
+	// are always paired with chains that are not moving in the same iteration, as is done for the MPI groups.
+	int n_walkers = (n_loglike_evaluators > 1) ? n_loglike_evaluators : 1;
+	int n_movers = mpi_ngroups*n_walkers;
 	int NThreads = (Threads > ma+1) ? Threads : ma + 2;
-	if (NThreads < 5+mpi_ngroups) NThreads = 5 + mpi_ngroups;
+	if (NThreads < 5+n_movers) NThreads = 5 + n_movers;
 	if (NThreads <= proj) NThreads = proj + 1; // it might be ok for NThreads to be equal to proj, I'm not sure
-	if (mpi_id==0) cout << "Number of chains for T-Walk algorithm: " << NThreads << endl << endl;
+	if (mpi_id==0) {
+		cout << "Number of chains for T-Walk algorithm: " << NThreads << endl;
+		if (n_walkers > 1) cout << "Number of chains moved concurrently per process: " << n_walkers << endl;
+		cout << endl;
+	}
 	vector<double> loglike(NThreads);
-	vector<double> aNext(ma, 0.0);
+	vector<vector<double> > aNext(n_walkers, vector<double>(ma, 0.0));
 	vector<vector<double> > a0 = vector<vector<double> > (NThreads, vector<double>(ma, 0.0));
-	double ans, loglikenext;
+	double ans;
+	vector<double> loglikenext(n_walkers), logZ(n_walkers);
 	vector<int> mult(NThreads, 1);
 	vector<int> count(NThreads, 1);
-	int i,j,end;
+	int i,j,k,end;
 	int t, tt, ttt;
 	int total=1, ttotal=0;
 	int Nlength=1;
@@ -831,64 +958,102 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 	vector<vector<double> > avgT(NThreads, vector<double>(ma, 0.0));
 	double *W = new double[ma];
 	double *avgTot = new double[ma];
-	double *atrans = new double[ma];
+	vector<vector<double> > atrans(n_walkers, vector<double>(ma, 0.0));
 	for (i=0; i < ma; i++) {
 		W[i]=0;
 		avgTot[i]=0;
 	}
 	bool cont;
-	double logZ, Ravg = 0.0;
+	double Ravg = 0.0;
 	double Rmax = -1e30;
 	double minloglike = 1e30;
 	ofstream logout;
+
+	// The checkpointed state consists of the counters and convergence statistics, the best fit so far, the walkers
+	// (positions, log-likelihoods, multiplicities and acceptance counts), the running means and variances of each chain,
+	// and the chain order used to pick the walkers moved by each MPI group; each process also saves its random number generator
+	// state and the size of each of its chain files, so points written after the checkpoint can be discarded on resuming.
+	int n_checkpoint_global = 7 + 3*ma + 3*NThreads*ma + 4*NThreads;
+	vector<double> checkpoint_state(n_checkpoint_global);
+	vector<unsigned long long int> checkpoint_local(3 + NThreads, 0);
+	const char checkpoint_tag[8] = { 'Q','L','T','W','A','L','K','1' };
+	bool resumed = false;
+	KEEP_RUNNING = 1;
+	if (resume_from_checkpoint) {
+		if (!ReadCheckpoint(name,checkpoint_tag,checkpoint_state,checkpoint_local)) {
+			delete[] W;
+			delete[] avgTot;
+			return false;
+		}
+		resumed = true;
+	}
 #ifdef USE_MPI
 	if (mpi_id==0)
 	{
 #endif
 		if (logfile) {
 			string log_filename = string(name) + ".twalk.log";
-			logout.open(log_filename.c_str());
+			if (resumed) logout.open(log_filename.c_str(), ios::app);
+			else logout.open(log_filename.c_str());
 		}
 #ifdef USE_MPI
 	}
 #endif
 
-#ifdef USE_MPI
-	MPI_Barrier(MPI_COMM_WORLD);
-
+	// talls holds the chains moved in this iteration (the one moved by walker k of group g is talls[k*mpi_ngroups+g]),
+	// followed by the chains they are paired with; tints lists the chains, with the moving ones shuffled to the end
 	vector<int> tints(NThreads);
 	for (i=0; i < NThreads; i++) tints[i] = i;
-	vector<int> talls(2*mpi_ngroups);
+	vector<int> talls(2*n_movers);
+	bool select_movers;
+#ifdef USE_MPI
+	MPI_Barrier(mpi_comm);
+
+	select_movers = true;
 	bool leader = false;
 	if (mpi_id == mpi_group_leader[mpi_group_num]) leader = true;
+#else
+	select_movers = (n_walkers > 1);
 #endif
 
 	RandomPlane gDev(proj, ma, din, alim, alimt, rand+mpi_group_num);
+	if (resumed) gDev.SetState(&checkpoint_local[0]);
 
 	ofstream *out;
 	out = new ofstream[NThreads];
+	vector<string> chain_filenames(NThreads); // kept so the chain files can be synced to disk at each checkpoint
+	string chain_filename;
 	for (t=0; t < NThreads; t++)
 	{
 		stringstream s,ps;
 		s << t;
 		string endstring;
 		s >> endstring;
+		chain_filename = "";
 #ifdef USE_MPI
 		if (leader) {
 			if (mpi_ngroups > 1) {
 				ps << mpi_group_num;
 				string pstring;
 				ps >> pstring;
-				out[t].open((string(name)+string("_")+endstring+"."+pstring).c_str());
+				chain_filename = string(name)+string("_")+endstring+"."+pstring;
 			}
-			else out[t].open((string(name)+string("_")+endstring).c_str());
+			else chain_filename = string(name)+string("_")+endstring;
 		}
 #else
-		out[t].open((string(name)+string("_")+endstring).c_str());
+		chain_filename = string(name)+string("_")+endstring;
 #endif
+		if (chain_filename != "") {
+			if (resumed) {
+				if (truncate(chain_filename.c_str(), checkpoint_local[3+t]) != 0) cerr << "Warning: could not truncate chain file '" << chain_filename << "' to its checkpointed size" << endl;
+				out[t].open(chain_filename.c_str(), ios::app);
+			}
+			else out[t].open(chain_filename.c_str());
+		}
+		chain_filenames[t] = chain_filename;
 	}
 
-	for (t=0; t < NThreads; t++)
+	for (t=0; (t < NThreads) and (!resumed); t++)
 	{
 #ifdef USE_MPI
 		if (mpi_group_num == 0)
@@ -899,13 +1064,13 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 			}
 #ifdef USE_MPI
 		}
-		MPI_Bcast (c_ptr(a0[t]), a0[t].size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+		MPI_Bcast (c_ptr(a0[t]), a0[t].size(), MPI_DOUBLE, 0, mpi_comm);
 		if (mpi_group_num == 0) {
 #endif
 			for (j=0; j < ma; j++) {
-				atrans[j] = lowerLimits_initial[j] + a0[t][j]*(upperLimits_initial[j] - lowerLimits_initial[j]);
+				atrans[0][j] = lowerLimits_initial[j] + a0[t][j]*(upperLimits_initial[j] - lowerLimits_initial[j]);
 			}
-			loglike[t] = LOGLIKE(atrans);
+			loglike[t] = LOGLIKE(c_ptr(atrans[0]));
 			//for (j=0; j < ma; j++) cout << atrans[j] << " ";
 			//cout << 2*loglike[t] << endl << flush;
 			
@@ -915,13 +1080,13 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 	}
 
 #ifdef USE_MPI
-	MPI_Bcast (c_ptr(loglike), loglike.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	MPI_Bcast (c_ptr(loglike), loglike.size(), MPI_DOUBLE, 0, mpi_comm);
 
 	if (mpi_id==0)
 	{
 #endif
-		if (logfile) logout << "Metropolis-Hastings/T-Walk Algorithm Started\n\n";
-		else cout << "Metropolis-Hastings/T-Walk Algorithm Started\n" << "\tpoints = " << "\n\taccept ratio = " << "\n\tR = "  << endl;
+		if (logfile) logout << "Metropolis-Hastings/T-Walk Algorithm " << ((resumed) ? "Resumed" : "Started") << "\n\n";
+		else cout << "Metropolis-Hastings/T-Walk Algorithm " << ((resumed) ? "Resumed" : "Started") << "\n" << "\tpoints = " << "\n\taccept ratio = " << "\n\tR = "  << endl;
 #ifdef USE_MPI
 	}
 #endif
@@ -935,116 +1100,164 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 	int lastcnt=0;
 	double ran, davg, dcov;
 	double Bn, R;
+	int indx;
+	if (resumed) {
+		indx = 0;
+		total = (int) checkpoint_state[indx++];
+		ttotal = (int) checkpoint_state[indx++];
+		Nlength = (int) checkpoint_state[indx++];
+		lastcnt = (int) checkpoint_state[indx++];
+		Ravg = checkpoint_state[indx++];
+		Rmax = checkpoint_state[indx++];
+		minloglike = checkpoint_state[indx++];
+		for (i=0; i < ma; i++) best_fit_params[i] = checkpoint_state[indx++];
+		for (t=0; t < NThreads; t++) {
+			for (i=0; i < ma; i++) a0[t][i] = checkpoint_state[indx++];
+			loglike[t] = checkpoint_state[indx++];
+			mult[t] = (int) checkpoint_state[indx++];
+			count[t] = (int) checkpoint_state[indx++];
+			for (i=0; i < ma; i++) covT[t][i] = checkpoint_state[indx++];
+			for (i=0; i < ma; i++) avgT[t][i] = checkpoint_state[indx++];
+			tints[t] = (int) checkpoint_state[indx++];
+		}
+		for (i=0; i < ma; i++) W[i] = checkpoint_state[indx++];
+		for (i=0; i < ma; i++) avgTot[i] = checkpoint_state[indx++];
+	}
 	do
 	{       
-#ifdef USE_MPI
-		if (mpi_id == 0) 
+		if (select_movers)
 		{
-			j = NThreads;
-			for (i=0; i < mpi_ngroups; i++)
+#ifdef USE_MPI
+			if (mpi_id == 0) 
+#endif
 			{
-				int temp = int((j--)*gDev.Doub());
-				talls[i] = tints[temp];
-				tints[temp] = tints[j];
-				tints[j] = talls[i];
-			}
+				j = NThreads;
+				for (i=0; i < n_movers; i++)
+				{
+					int temp = int((j--)*gDev.Doub());
+					talls[i] = tints[temp];
+					tints[temp] = tints[j];
+					tints[j] = talls[i];
+				}
             
-			for (i=mpi_ngroups, end=talls.size(); i < end; i++)
+				for (i=n_movers, end=talls.size(); i < end; i++)
+				{
+					talls[i] = tints[int(j*gDev.Doub())];
+				}
+			}
+#ifdef USE_MPI
+			else if (mpi_group_num == 0)
 			{
-				talls[i] = tints[int(j*gDev.Doub())];
+				// the following ensures that all the processes in group 0 will be working together to perform the same
+				// likelihood calculation with the same values (otherwise absurd results happen)
+				for (i=0; i < n_movers; i++) gDev.Doub();
+				for (i=n_movers, end=talls.size(); i < end; i++) gDev.Doub();
 			}
-		}
-		else if (mpi_group_num == 0)
-		{
-			// the following ensures that all the processes in group 0 will be working together to perform the same
-			// likelihood calculation with the same values (otherwise absurd results happen)
-			for (i=0; i < mpi_ngroups; i++) gDev.Doub();
-			for (i=mpi_ngroups, end=talls.size(); i < end; i++) gDev.Doub();
-		}
-
-		MPI_Bcast (c_ptr(talls), talls.size(), MPI_INT, 0, MPI_COMM_WORLD);
-		MPI_Bcast (c_ptr(tints), tints.size(), MPI_INT, 0, MPI_COMM_WORLD);
 
-		t = talls[mpi_group_num];
-		tt = talls[mpi_group_num + mpi_ngroups];
-#else
-		t = int(NThreads*gDev.Doub());
-		tt = int((NThreads - 1)*gDev.Doub());
-		if (tt >= t) tt++;
+			MPI_Bcast (c_ptr(talls), talls.size(), MPI_INT, 0, mpi_comm);
+			MPI_Bcast (c_ptr(tints), tints.size(), MPI_INT, 0, mpi_comm);
 #endif
-		ran = gDev.Doub();
-		if (ran < b0)
-		{
-			logZ = gDev.WalkDev(c_ptr(aNext), c_ptr(a0[t]), c_ptr(a0[tt]));
 		}
-		else if (ran < b1)
+		else
 		{
-			logZ = gDev.TransDev(c_ptr(aNext), c_ptr(a0[t]), c_ptr(a0[tt]));
+			talls[0] = int(NThreads*gDev.Doub());
+			talls[1] = int((NThreads - 1)*gDev.Doub());
+			if (talls[1] >= talls[0]) talls[1]++;
 		}
-		else if (ran < b2)
+
+		for (k=0; k < n_walkers; k++)
 		{
-			vector<vector<double> > temp = a0;
-#ifdef USE_MPI
-			for (i=0, end=NThreads - mpi_ngroups; i < end; i++)
+			t = talls[k*mpi_ngroups + mpi_group_num];
+			tt = talls[n_movers + k*mpi_ngroups + mpi_group_num];
+			ran = gDev.Doub();
+			if (ran < b0)
 			{
-				temp.push_back(a0[tints[i]]);
+				logZ[k] = gDev.WalkDev(c_ptr(aNext[k]), c_ptr(a0[t]), c_ptr(a0[tt]));
 			}
-#else
-			for (i=0, end=a0.size(); i < end; i++)
+			else if (ran < b1)
 			{
-				if (i != tt)
-					temp.push_back(a0[i]);
+				logZ[k] = gDev.TransDev(c_ptr(aNext[k]), c_ptr(a0[t]), c_ptr(a0[tt]));
 			}
-#endif
-			if (!gDev.EnterMat(calcCov(temp)))
+			else if (ran < b2)
 			{
-				gDev.EnterMat(calcIndent(temp));
-			}
+				vector<vector<double> > temp = a0;
+				if (select_movers)
+				{
+					for (i=0, end=NThreads - n_movers; i < end; i++)
+					{
+						temp.push_back(a0[tints[i]]);
+					}
+				}
+				else
+				{
+					for (i=0, end=a0.size(); i < end; i++)
+					{
+						if (i != tt)
+							temp.push_back(a0[i]);
+					}
+				}
+				if (!gDev.EnterMat(calcCov(temp)))
+				{
+					gDev.EnterMat(calcIndent(temp));
+				}
 
-			gDev.MultiDev(c_ptr(aNext), c_ptr(a0[t]));
-			logZ = 0.0;
-		}
-		else
-		{
-			vector<vector<double> > temp;
-#ifdef USE_MPI
-			for (i=0, end=NThreads - mpi_ngroups; i < end; i++)
-			{
-				temp.push_back(a0[tints[i]]);
+				gDev.MultiDev(c_ptr(aNext[k]), c_ptr(a0[t]));
+				logZ[k] = 0.0;
 			}
-#else
-			for (i=0, end=a0.size(); i < end; i++)
-			{
-				if (i != tt)
-					temp.push_back(a0[i]);
-			}
-#endif
-			if (!gDev.EnterMat(calcCov(temp)))
+			else
 			{
-				gDev.EnterMat(calcIndent(temp));
-			}
+				vector<vector<double> > temp;
+				if (select_movers)
+				{
+					for (i=0, end=NThreads - n_movers; i < end; i++)
+					{
+						temp.push_back(a0[tints[i]]);
+					}
+				}
+				else
+				{
+					for (i=0, end=a0.size(); i < end; i++)
+					{
+						if (i != tt)
+							temp.push_back(a0[i]);
+					}
+				}
+				if (!gDev.EnterMat(calcCov(temp)))
+				{
+					gDev.EnterMat(calcIndent(temp));
+				}
 
-			gDev.MultiDev(c_ptr(aNext), c_ptr(a0[tt]));
-			logZ = 0.0;
+				gDev.MultiDev(c_ptr(aNext[k]), c_ptr(a0[tt]));
+				logZ[k] = 0.0;
+			}
 		}
 
-		if (!notUnit(aNext))
+#ifdef USE_OPENMP
+		if (mpi_id==0) time0 = omp_get_wtime();
+#endif
+		#pragma omp parallel for private(j) schedule(dynamic) if (n_walkers > 1)
+		for (k=0; k < n_walkers; k++)
 		{
+			if (notUnit(aNext[k])) continue;
 			for (j=0; j < ma; j++) {
-				atrans[j] = lowerLimits[j] + aNext[j]*(upperLimits[j] - lowerLimits[j]);
+				atrans[k][j] = lowerLimits[j] + aNext[k][j]*(upperLimits[j] - lowerLimits[j]);
 			}
+			if (n_walkers > 1) loglikenext[k] = (loglike_evaluators[k]->*LogLikePtr)(c_ptr(atrans[k]));
+			else loglikenext[k] = LOGLIKE(c_ptr(atrans[k]));
+		}
 #ifdef USE_OPENMP
-			if (mpi_id==0) time0 = omp_get_wtime();
-#endif
-			loglikenext = LOGLIKE(atrans);
-#ifdef USE_OPENMP
-			if (mpi_id==0) {
-				total_loglike_time += omp_get_wtime() - time0;
-				n_loglikes++;
-			}
+		if (mpi_id==0) {
+			total_loglike_time += omp_get_wtime() - time0;
+			for (k=0; k < n_walkers; k++) if (!notUnit(aNext[k])) n_loglikes++;
+		}
 #endif
-			ans = loglikenext - loglike[t] - logZ;
-			//cout << "rank " << mpi_id << ": a[0]=" << atrans[0] << " loglike=" << loglikenext << " " << ans << endl << flush;
+
+		for (k=0; k < n_walkers; k++)
+		{
+			if (notUnit(aNext[k])) continue;
+			t = talls[k*mpi_ngroups + mpi_group_num];
+			ans = loglikenext[k] - loglike[t] - logZ[k];
+			//cout << "rank " << mpi_id << ": a[0]=" << atrans[k][0] << " loglike=" << loglikenext[k] << " " << ans << endl << flush;
 
 			if ((ans <= 0.0)||(gDev.ExpDev() >= ans))
 			{
@@ -1054,29 +1267,33 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 					out[t] << mult[t] << "   ";
 					for (i = 0; i < ma; i++)
 					{
-						out[t] << atrans[i] << "   ";
+						out[t] << atrans[k][i] << "   ";
 					}
 					//out[t] << "   " << 2.0*loglike[t] << endl;
-					out[t] << "   " << 2.0*loglikenext << endl << flush;
+					out[t] << "   " << 2.0*loglikenext[k] << endl << flush;
 #ifdef USE_MPI
 				}
 #endif
 
-				a0[t] = aNext;
-				loglike[t] = loglikenext;
+				a0[t] = aNext[k];
+				loglike[t] = loglikenext[k];
 				mult[t] = 0;
 				count[t]++;
 			}
 		}
 #ifdef USE_MPI
-		MPI_Barrier(MPI_COMM_WORLD);
+		MPI_Barrier(mpi_comm);
 		for (i=0; i < mpi_ngroups; i++)
 		{
 			id = mpi_group_leader[i];
-			MPI_Bcast (c_ptr(a0[talls[i]]), a0[talls[i]].size(), MPI_DOUBLE, id, MPI_COMM_WORLD);
-			MPI_Bcast (&loglike[talls[i]], 1, MPI_DOUBLE, id, MPI_COMM_WORLD);
-			MPI_Bcast (&mult[talls[i]], 1, MPI_INT, id, MPI_COMM_WORLD);
-			MPI_Bcast (&count[talls[i]], 1, MPI_INT, id, MPI_COMM_WORLD);
+			for (k=0; k < n_walkers; k++)
+			{
+				t = talls[k*mpi_ngroups + i];
+				MPI_Bcast (c_ptr(a0[t]), a0[t].size(), MPI_DOUBLE, id, mpi_comm);
+				MPI_Bcast (&loglike[t], 1, MPI_DOUBLE, id, mpi_comm);
+				MPI_Bcast (&mult[t], 1, MPI_INT, id, mpi_comm);
+				MPI_Bcast (&count[t], 1, MPI_INT, id, mpi_comm);
+			}
 		}
 #endif
 		for (i=0; i < NThreads; i++)
@@ -1158,7 +1375,7 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 
 			if (logfile) {
 				if ((cnt % 10 == 0) and (cnt != lastcnt)) {
-					logout << "points = " << cnt  << " (" << cnt/double(NThreads) << ")" << " accept ratio=" << (double)cnt/(double)total/(double)mpi_ngroups << " R=" << Ravg/ma << " Rmax=" << Rmax;
+					logout << "points = " << cnt  << " (" << cnt/double(NThreads) << ")" << " accept ratio=" << (double)cnt/(double)total/(double)n_movers << " R=" << Ravg/ma << " Rmax=" << Rmax;
 #ifdef USE_OPENMP
 					logout << "   avg_loglike_time = " << total_loglike_time / n_loglikes << " total_time = " << total_loglike_time << endl << flush;
 #else
@@ -1167,7 +1384,7 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 					lastcnt = cnt;
 				}
 			} else {
-				if (mpi_id==0) cout << "\033[3A\tpoints = " << cnt << " (" << cnt/double(NThreads) << ")" << "\n\taccept ratio = " << blank << (double)cnt/(double)total/(double)mpi_ngroups << "\n\tR = " << Ravg/ma << " Rmax=" << Rmax;
+				if (mpi_id==0) cout << "\033[3A\tpoints = " << cnt << " (" << cnt/double(NThreads) << ")" << "\n\taccept ratio = " << blank << (double)cnt/(double)total/(double)n_movers << "\n\tR = " << Ravg/ma << " Rmax=" << Rmax;
 #ifdef USE_OPENMP
 					cout << "   avg_loglike_time = " << total_loglike_time / n_loglikes << endl << flush;
 #else
@@ -1177,24 +1394,61 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 			}
 #ifdef USE_MPI
 		}
-		MPI_Bcast(best_fit_params,ma,MPI_DOUBLE,0,MPI_COMM_WORLD);
-		MPI_Bcast (&cont, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
-		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,MPI_COMM_WORLD);
+		MPI_Bcast(best_fit_params,ma,MPI_DOUBLE,0,mpi_comm);
+		MPI_Bcast (&cont, 1, MPI_C_BOOL, 0, mpi_comm);
+		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,mpi_comm);
 #endif
 		signal(SIGABRT, &sighandler);
 		signal(SIGTERM, &sighandler);
 		signal(SIGINT, &sighandler);
 		signal(SIGUSR1, &sighandler);
 		signal(SIGQUIT, &quitproc);
+
+		if ((checkpoint_interval > 0) and ((total % checkpoint_interval == 0) or (!KEEP_RUNNING))) {
+			indx = 0;
+			checkpoint_state[indx++] = total;
+			checkpoint_state[indx++] = ttotal;
+			checkpoint_state[indx++] = Nlength;
+			checkpoint_state[indx++] = lastcnt;
+			checkpoint_state[indx++] = Ravg;
+			checkpoint_state[indx++] = Rmax;
+			checkpoint_state[indx++] = minloglike;
+			for (i=0; i < ma; i++) checkpoint_state[indx++] = best_fit_params[i];
+			for (ttt=0; ttt < NThreads; ttt++) {
+				for (i=0; i < ma; i++) checkpoint_state[indx++] = a0[ttt][i];
+				checkpoint_state[indx++] = loglike[ttt];
+				checkpoint_state[indx++] = mult[ttt];
+				checkpoint_state[indx++] = count[ttt];
+				for (i=0; i < ma; i++) checkpoint_state[indx++] = covT[ttt][i];
+				for (i=0; i < ma; i++) checkpoint_state[indx++] = avgT[ttt][i];
+				checkpoint_state[indx++] = tints[ttt];
+				checkpoint_local[3+ttt] = 0;
+				if (out[ttt].is_open()) {
+					// the chain file must be on disk up to the recorded size, since it is truncated to that size on resume
+					if (!SyncFile(out[ttt],chain_filenames[ttt])) cerr << "Warning: could not sync chain file '" << chain_filenames[ttt] << "' to disk" << endl;
+					checkpoint_local[3+ttt] = (unsigned long long int) out[ttt].tellp();
+				}
+			}
+			for (i=0; i < ma; i++) checkpoint_state[indx++] = W[i];
+			for (i=0; i < ma; i++) checkpoint_state[indx++] = avgTot[i];
+			gDev.GetState(&checkpoint_local[0]);
+			WriteCheckpoint(name,checkpoint_tag,checkpoint_state,checkpoint_local);
+		}
 	}
 	while((cont) and (KEEP_RUNNING));
 
+	if ((checkpoint_interval > 0) and (mpi_id==0)) {
+		// the checkpoint is kept only if the run was interrupted, so that it can be resumed
+		if (KEEP_RUNNING) remove((string(name) + ".checkpoint").c_str());
+		else cout << "T-Walk interrupted; sampler state saved to '" << name << ".checkpoint'" << endl;
+	}
+
 	cout << "twalk for rank " << mpi_id << " has finished." << endl;
 
+	delete[] out;
 	delete[] W;
 	delete[] avgTot;
-	delete[] atrans;
-	return;
+	return true;
 }
 
 void UCMC::McmcAd(const char *name, const int N)
@@ -2863,7 +3117,7 @@ class Counter
 		}
 };
 
-void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, double *parameter_errors, bool logfile)
+bool UCMC::MonoSample(const char *name, const int N, double *best_fit_params, double *parameter_errors, bool logfile)
 {
 	int i, j, k;
 	double **points = matrix <double> (N, ma);
@@ -2879,6 +3133,31 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 #endif
 	double area = 1.0;
 
+	// The checkpointed state consists of the sampling phase and counters, the evidence accumulator (slope) and the
+	// likelihood bounds, the best fit so far, the size of the '.temp' file of discarded points, and the live points
+	// with their likelihoods and priors; each process also saves its random number generator state.
+	int n_checkpoint_global = 13 + ma + N*ma + 2*N;
+	vector<double> checkpoint_state(n_checkpoint_global);
+	vector<unsigned long long int> checkpoint_local(3);
+	const char checkpoint_tag[8] = { 'Q','L','N','E','S','T','0','1' };
+	bool resumed = false;
+	int phase = 0; // 0 = sampling from the prior volume; 1 = sampling from ellipsoids around the live points
+	int indx;
+	KEEP_RUNNING = 1;
+	if (resume_from_checkpoint) {
+		if (!ReadCheckpoint(name,checkpoint_tag,checkpoint_state,checkpoint_local)) {
+			del <double> (points, N);
+			del <double> (logLikes);
+			del <double> (cpt);
+			del <double> (logPriors);
+#ifdef USE_MPI
+			delete[] loglike_attempts;
+#endif
+			return false;
+		}
+		resumed = true;
+	}
+
 	ofstream out;
 	ofstream binout;
 	ofstream logout;
@@ -2888,10 +3167,17 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 	{
 #endif
 		out.open(name);
-		binout.open((string(name)+string(".temp")).c_str(), ios::binary);
+		if (resumed) {
+			// points written to the '.temp' file after the checkpoint will be written again, so they are discarded
+			string temp_filename = string(name)+string(".temp");
+			if (truncate(temp_filename.c_str(), (off_t) checkpoint_state[12]) != 0) cerr << "Warning: could not truncate '" << temp_filename << "' to its checkpointed size" << endl;
+			binout.open(temp_filename.c_str(), ios::binary | ios::app);
+		}
+		else binout.open((string(name)+string(".temp")).c_str(), ios::binary);
 		if (logfile) {
 			string log_filename = string(name) + ".nest.log";
-			logout.open(log_filename.c_str());
+			if (resumed) logout.open(log_filename.c_str(), ios::app);
+			else logout.open(log_filename.c_str());
 		}
 #ifdef USE_MPI
 	}
@@ -2915,41 +3201,54 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 	int iterations=0;
 	double *ptr1, *ptr2;
 
-	if (mpi_id==0) cout << "Status:  Preparing samples \nProgress:  [\033[20C]\033[21D" << flush;
+	if (mpi_id==0) {
+		if (resumed) cout << "Status:  Resuming from checkpoint \n" << flush;
+		else cout << "Status:  Preparing samples \nProgress:  [\033[20C]\033[21D" << flush;
+	}
 
 #ifdef USE_OPENMP
 	double total_time0, total_time;
 #endif
 	
-	// divide this up among the processes
-	for (i = mpi_group_num; i < N; i += mpi_ngroups)
-	{	
-		ptr1 = points[i];
-		for (j = 0; j < ma; j++)
-		{
-			ptr1[j] = random.Doub();
-		}
-		Convert_initial(cpt, ptr1);
-		logPriors[i] = LogPrior(cpt);
-		logLikes[i] = LOGLIKE(cpt) + logPriors[i];
-		if ((logLikes[i]*0.0) or (isinf(logLikes[i])))
-		{
-			i -= mpi_ngroups;
-		}
-		else if ((i % (N/20)) == 0)
-		{
-			if (mpi_id==0) cout << "=" << flush;
+	if (resumed) {
+		indx = 13 + ma;
+		for (i = 0; i < N; i++) {
+			for (j = 0; j < ma; j++) points[i][j] = checkpoint_state[indx++];
+		}
+		for (i = 0; i < N; i++) logLikes[i] = checkpoint_state[indx++];
+		for (i = 0; i < N; i++) logPriors[i] = checkpoint_state[indx++];
+		random.SetState(&checkpoint_local[0]);
+	} else {
+		// divide this up among the processes
+		for (i = mpi_group_num; i < N; i += mpi_ngroups)
+		{	
+			ptr1 = points[i];
+			for (j = 0; j < ma; j++)
+			{
+				ptr1[j] = random.Doub();
+			}
+			Convert_initial(cpt, ptr1);
+			logPriors[i] = LogPrior(cpt);
+			logLikes[i] = LOGLIKE(cpt) + logPriors[i];
+			if ((logLikes[i]*0.0) or (isinf(logLikes[i])))
+			{
+				i -= mpi_ngroups;
+			}
+			else if ((i % (N/20)) == 0)
+			{
+				if (mpi_id==0) cout << "=" << flush;
+			}
 		}
-	}
 #ifdef USE_MPI
-	for (int group_num=0; group_num < mpi_ngroups; group_num++) {
-		for (i=group_num; i < N; i += mpi_ngroups) {
-			id = mpi_group_leader[group_num];
-			MPI_Bcast(logLikes+i,1,MPI_DOUBLE,id,MPI_COMM_WORLD);
-			MPI_Bcast(points[i],ma,MPI_DOUBLE,id,MPI_COMM_WORLD);
+		for (int group_num=0; group_num < mpi_ngroups; group_num++) {
+			for (i=group_num; i < N; i += mpi_ngroups) {
+				id = mpi_group_leader[group_num];
+				MPI_Bcast(logLikes+i,1,MPI_DOUBLE,id,mpi_comm);
+				MPI_Bcast(points[i],ma,MPI_DOUBLE,id,mpi_comm);
+			}
 		}
-	}
 #endif
+	}
 
 	signal(SIGABRT, &sighandler);
 	signal(SIGTERM, &sighandler);
@@ -2964,23 +3263,39 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 		area *= (upperLimits[j] - lowerLimits[j]);
 	}
 	
-	likeMax = likeMin = logLikes[0];
-	imin = 0;
-	for (i = 0; i < N; i++)
-	{
-		if (likeMax > logLikes[i])
-		{
-			likeMax = logLikes[i];
-		}
-		else if (likeMin < logLikes[i])
+	if (resumed) {
+		indx = 0;
+		phase = (int) checkpoint_state[indx++];
+		count = (int) checkpoint_state[indx++];
+		iterations = (int) checkpoint_state[indx++];
+		trystot = (int) checkpoint_state[indx++];
+		likeMax = checkpoint_state[indx++];
+		likeMin = checkpoint_state[indx++];
+		imin = (int) checkpoint_state[indx++];
+		likeLast = checkpoint_state[indx++];
+		slope = checkpoint_state[indx++];
+		minloglike = checkpoint_state[indx++];
+		ratio = checkpoint_state[indx++];
+		for (j = 0; j < ma; j++) best_fit_params[j] = checkpoint_state[13+j];
+	} else {
+		likeMax = likeMin = logLikes[0];
+		imin = 0;
+		for (i = 0; i < N; i++)
 		{
-			likeMin = logLikes[i];
-			imin = i;
+			if (likeMax > logLikes[i])
+			{
+				likeMax = logLikes[i];
+			}
+			else if (likeMin < logLikes[i])
+			{
+				likeMin = logLikes[i];
+				imin = i;
+			}
 		}
+		likeLast = likeMin;
 	}
 	
 	ptr1 = points[imin];
-	likeLast = likeMin;
 	if (mpi_id==0) {
 		if (!logfile) {
 			cout << "\n\033[2AStatus:  Nested Sampling Started" << endl;
@@ -2996,7 +3311,8 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 	total_time0 = omp_get_wtime();
 #endif
 	bool first_interrupt=true;
-	do
+	int overflow = (resumed) ? (int) checkpoint_state[11] : 0;
+	if (phase==0) do
 	{
 		if (mpi_id==0) {
 			Convert(cpt, points[imin]);
@@ -3027,12 +3343,12 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 			i=0;
 			do {
 				id = mpi_group_leader[i];
-				MPI_Bcast(loglike_attempts+i,1,MPI_DOUBLE,id,MPI_COMM_WORLD);
+				MPI_Bcast(loglike_attempts+i,1,MPI_DOUBLE,id,mpi_comm);
 				if (loglike_attempts[i] < likeMin) {
 					accepted = true;
 					temp = loglike_attempts[i];
-					MPI_Bcast(ptr2,ma,MPI_DOUBLE,id,MPI_COMM_WORLD);
-					MPI_Bcast(&temp1,1,MPI_DOUBLE,id,MPI_COMM_WORLD);
+					MPI_Bcast(ptr2,ma,MPI_DOUBLE,id,mpi_comm);
+					MPI_Bcast(&temp1,1,MPI_DOUBLE,id,mpi_comm);
 				}
 				trystot++;
 			} while ((!accepted) and (++i < mpi_ngroups));
@@ -3107,12 +3423,40 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 			}
 		}
 #ifdef USE_MPI
-		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,MPI_COMM_WORLD);
+		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,mpi_comm);
 #endif
+		if ((checkpoint_interval > 0) and ((count % checkpoint_interval == 0) or (!KEEP_RUNNING)))
+		{
+			if ((mpi_id==0) and (!SyncFile(binout,string(name)+string(".temp")))) cerr << "Warning: could not sync '" << name << ".temp' to disk" << endl;
+			indx = 0;
+			checkpoint_state[indx++] = phase;
+			checkpoint_state[indx++] = count;
+			checkpoint_state[indx++] = iterations;
+			checkpoint_state[indx++] = trystot;
+			checkpoint_state[indx++] = likeMax;
+			checkpoint_state[indx++] = likeMin;
+			checkpoint_state[indx++] = imin;
+			checkpoint_state[indx++] = likeLast;
+			checkpoint_state[indx++] = slope;
+			checkpoint_state[indx++] = minloglike;
+			checkpoint_state[indx++] = ratio;
+			checkpoint_state[indx++] = overflow;
+			checkpoint_state[indx++] = (mpi_id==0) ? (double) binout.tellp() : 0;
+			for (j = 0; j < ma; j++) checkpoint_state[indx++] = best_fit_params[j];
+			for (i = 0; i < N; i++) {
+				for (j = 0; j < ma; j++) checkpoint_state[indx++] = points[i][j];
+			}
+			for (i = 0; i < N; i++) checkpoint_state[indx++] = logLikes[i];
+			for (i = 0; i < N; i++) checkpoint_state[indx++] = logPriors[i];
+			random.GetState(&checkpoint_local[0]);
+			WriteCheckpoint(name,checkpoint_tag,checkpoint_state,checkpoint_local);
+		}
 	}
 	while(ratio > 1.0/senfac && KEEP_RUNNING);
+	phase = 1;
 
 	group = new Points(points, ma, N, exp(-double(count+1)/N)*senfac, lvl, enl, &random, 0x00);
+	if ((resumed) and (checkpoint_state[0]==1)) random.SetState(&checkpoint_local[0]); // this group is replaced in the first iteration, so its deviates are not part of the resumed sequence
 	
 	if (mpi_id==0) {
 		if (logfile)
@@ -3121,7 +3465,6 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 			cout << "\033[5AStatus:  MultNest Sampling Started\r\033[5B" << blank << endl;
 	}
 
-	int overflow = 0;
 	do
 	{
 		Convert(cpt, points[imin]);
@@ -3172,12 +3515,12 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 			i=0;
 			do {
 				id = mpi_group_leader[i];
-				MPI_Bcast(loglike_attempts+i,1,MPI_DOUBLE,id,MPI_COMM_WORLD);
+				MPI_Bcast(loglike_attempts+i,1,MPI_DOUBLE,id,mpi_comm);
 				if (loglike_attempts[i] < likeMin) {
 					accepted = true;
 					temp = loglike_attempts[i];
-					MPI_Bcast(ptr2,ma,MPI_DOUBLE,id,MPI_COMM_WORLD);
-					MPI_Bcast(&temp1,1,MPI_DOUBLE,id,MPI_COMM_WORLD);
+					MPI_Bcast(ptr2,ma,MPI_DOUBLE,id,mpi_comm);
+					MPI_Bcast(&temp1,1,MPI_DOUBLE,id,mpi_comm);
 				}
 				trystot++;
 			} while ((!accepted) and (++i < mpi_ngroups));
@@ -3267,8 +3610,34 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 
 		}
 #ifdef USE_MPI
-		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,MPI_COMM_WORLD);
+		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,mpi_comm);
 #endif
+		if ((checkpoint_interval > 0) and ((count % checkpoint_interval == 0) or (!KEEP_RUNNING)))
+		{
+			if ((mpi_id==0) and (!SyncFile(binout,string(name)+string(".temp")))) cerr << "Warning: could not sync '" << name << ".temp' to disk" << endl;
+			indx = 0;
+			checkpoint_state[indx++] = phase;
+			checkpoint_state[indx++] = count;
+			checkpoint_state[indx++] = iterations;
+			checkpoint_state[indx++] = trystot;
+			checkpoint_state[indx++] = likeMax;
+			checkpoint_state[indx++] = likeMin;
+			checkpoint_state[indx++] = imin;
+			checkpoint_state[indx++] = likeLast;
+			checkpoint_state[indx++] = slope;
+			checkpoint_state[indx++] = minloglike;
+			checkpoint_state[indx++] = ratio;
+			checkpoint_state[indx++] = overflow;
+			checkpoint_state[indx++] = (mpi_id==0) ? (double) binout.tellp() : 0;
+			for (j = 0; j < ma; j++) checkpoint_state[indx++] = best_fit_params[j];
+			for (i = 0; i < N; i++) {
+				for (j = 0; j < ma; j++) checkpoint_state[indx++] = points[i][j];
+			}
+			for (i = 0; i < N; i++) checkpoint_state[indx++] = logLikes[i];
+			for (i = 0; i < N; i++) checkpoint_state[indx++] = logPriors[i];
+			random.GetState(&checkpoint_local[0]);
+			WriteCheckpoint(name,checkpoint_tag,checkpoint_state,checkpoint_local);
+		}
 	}
 	while(test < 1.0/tol && KEEP_RUNNING);
 	
@@ -3349,8 +3718,8 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 		delete[] cov;
 	}
 #ifdef USE_MPI
-		MPI_Bcast(best_fit_params,ma,MPI_DOUBLE,0,MPI_COMM_WORLD);
-		MPI_Bcast(parameter_errors,ma,MPI_DOUBLE,0,MPI_COMM_WORLD);
+		MPI_Bcast(best_fit_params,ma,MPI_DOUBLE,0,mpi_comm);
+		MPI_Bcast(parameter_errors,ma,MPI_DOUBLE,0,mpi_comm);
 #endif
 	
 	Z*=area;
@@ -3369,7 +3738,13 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 		}
 	}
 	
-	system((string("rm -f ") + string(name) + string(".temp")).c_str());
+	if ((checkpoint_interval > 0) and (!KEEP_RUNNING)) {
+		// the discarded points in the '.temp' file are needed to resume the run, so it is kept along with the checkpoint
+		if (mpi_id==0) cout << "Nested sampling interrupted; sampler state saved to '" << name << ".checkpoint'" << endl;
+	} else {
+		system((string("rm -f ") + string(name) + string(".temp")).c_str());
+		if ((checkpoint_interval > 0) and (mpi_id==0)) remove((string(name) + ".checkpoint").c_str());
+	}
 	
 	signal(SIGABRT, SIG_DFL);
 	signal(SIGTERM, SIG_DFL);
@@ -3385,6 +3760,7 @@ void UCMC::MonoSample(const char *name, const int N, double *best_fit_params, do
 #ifdef USE_MPI
 	delete[] loglike_attempts;
 #endif
+	return true;
 }
 
 void UCMC::HMC(const char *name, double tol, const char flag)
@@ -29,8 +29,8 @@ inline typename T::iterator::pointer c_ptr(T &it){return &(*it.begin());}
 
 inline vector<vector<double> > calcCov(const vector<vector<double> > &pts)
 {
-	static size_t dim = pts[0].size();
-	static size_t N = pts.size();
+	size_t dim = pts[0].size();
+	size_t N = pts.size();
 
 	vector<vector<double> > covar(dim, vector<double>(dim, 0.0));
 	vector<double> avg(dim, 0.0);
@@ -61,7 +61,7 @@ inline vector<vector<double> > calcCov(const vector<vector<double> > &pts)
 
 inline vector<vector<double> > calcIndent (const vector<vector<double> > &pts)
 {
-	static size_t dim = pts[0].size();
+	size_t dim = pts[0].size();
 			  
 	vector<vector<double> > covar(dim, vector<double>(dim, 0.0));
 	vector<double> hi(dim, 1.0), low(dim, 0.0);
@@ -105,12 +105,23 @@ class UCMC : public Minimize, private LevenMarq, private Derivative
 		unsigned long long int rand;
 		int mpi_np, mpi_id, mpi_ngroups, mpi_group_num, mpi_group_id;
 		int *mpi_group_leader;
+#ifdef USE_MPI
+		MPI_Comm mpi_comm; // all the processes taking part in the sampling (MPI_COMM_WORLD unless a batch of lens systems is being run)
+#endif
+		int checkpoint_interval; // iterations between checkpoints of the sampler state (no checkpoints if zero)
+		bool resume_from_checkpoint;
+		int n_loglike_evaluators; // if > 1, T-Walk moves this many walkers at once, each evaluated on its own thread
+		UCMC **loglike_evaluators; // independent copies of this object, used to evaluate LogLikePtr concurrently
+
+		bool WriteCheckpoint(const char *name, const char *tag, vector<double> &global_state, vector<unsigned long long int> &local_state);
+		bool ReadCheckpoint(const char *name, const char *tag, vector<double> &global_state, vector<unsigned long long int> &local_state);
 		
 	public:
 		UCMC();
 #ifdef USE_MPI
 		void Set_MCMC_MPI(const int mpi_np_in, const int mpi_id_in); // Use this if the likelihood itself is not MPI'd (i.e., there will be a separate likelihood evaluation per MPI process)
 		void Set_MCMC_MPI(const int mpi_np_in, const int mpi_id_in, const int mpi_ngroups_in, const int mpi_group_num_in, int *mpi_group_leader_in);
+		void Set_MCMC_MPI_Comm(MPI_Comm comm) { mpi_comm = comm; }
 #endif
 		void InputPoint(double *, double *, double *, double *, double *, int);
 		void InputPoint(double *, double *, double *, int);
@@ -129,11 +140,11 @@ class UCMC : public Minimize, private LevenMarq, private Derivative
 		void MetHas(const char *, int, const char flag = 0x00);
 		void Barker(const char *, int, const char flag = 0x00);
 		void MetHasAdapt(const char *name, const double tol, const int Threads, const int cut, double *best_fit_params, const char flag = 0x00);
-		void TWalk(const char *name, const double div, const int proj, const double din, const double alim, const double alimt, const double tol, const int Threads, double *best_fit_params, bool logfile);
+		bool TWalk(const char *name, const double div, const int proj, const double din, const double alim, const double alimt, const double tol, const int Threads, double *best_fit_params, bool logfile);
 		void McmcAd(const char *, int);
 		void Slicing(const char *, int, const char flag = NOTRANSFORM);
 		void SlicingFull(const char *, int);
-		void MonoSample(const char *name, const int N, double *best_fit_params, double *parameter_errors, bool logfile);
+		bool MonoSample(const char *name, const int N, double *best_fit_params, double *parameter_errors, bool logfile);
 		void HMC(const char *name, double tol, const char flag);
 		void ApproxCovMatrix();
 		void FindCovMatrix();
@@ -151,6 +162,9 @@ class UCMC : public Minimize, private LevenMarq, private Derivative
 		double OutputParam(int i){return a[i];}
 		void ChangeFactor(const double in){factor = in;}
 		void SetRan(int n){rand = n;};
+		void SetCheckpointInterval(const int n){checkpoint_interval = n;}
+		void SetResume(const bool resume){resume_from_checkpoint = resume;}
+		void SetLogLikeEvaluators(const int n, UCMC **evaluators){n_loglike_evaluators = n; loglike_evaluators = evaluators;}
 		double (UCMC::*LogLikePtr)(double *);
 		virtual double LogLike(double *);
 		virtual double LogPrior(double *);
@@ -19,6 +19,7 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <map>
 #define USE_COMM_WORLD -987654
 #define MUMPS_SILENT -1
 #define MUMPS_OUTPUT 6
@@ -28,28 +29,13 @@ using namespace std;
 
 int SourcePixelGrid::nthreads;
 const int SourcePixelGrid::max_levels = 6;
-int SourcePixelGrid::number_of_pixels;
+const int SourcePixelGrid::max_lookup_buckets = 2097152;
+const int SourcePixelGrid::lookup_buckets_per_cell = 16;
 int *SourcePixelGrid::imin, *SourcePixelGrid::imax, *SourcePixelGrid::jmin, *SourcePixelGrid::jmax;
 TriRectangleOverlap *SourcePixelGrid::trirec;
 InterpolationCells *SourcePixelGrid::nearest_interpolation_cells;
 lensvector **SourcePixelGrid::interpolation_pts[3];
 int *SourcePixelGrid::n_interpolation_pts;
-double SourcePixelGrid::zfactor;
-double ImagePixelGrid::zfactor;
-
-// parameters for creating the recursive grid
-double SourcePixelGrid::xcenter, SourcePixelGrid::ycenter;
-double SourcePixelGrid::srcgrid_xmin, SourcePixelGrid::srcgrid_xmax, SourcePixelGrid::srcgrid_ymin, SourcePixelGrid::srcgrid_ymax;
-int SourcePixelGrid::u_split_initial, SourcePixelGrid::w_split_initial;
-double SourcePixelGrid::min_cell_area;
-
-// NOTE!!! It would be better to make a few of these (e.g. levels) non-static and contained in the zeroth-level grid, and just give all the subcells a pointer to the zeroth-level grid.
-// That way, you can create multiple source grids and they won't interfere with each other.
-int SourcePixelGrid::levels, SourcePixelGrid::splitlevels;
-lensvector SourcePixelGrid::d1, SourcePixelGrid::d2, SourcePixelGrid::d3, SourcePixelGrid::d4;
-double SourcePixelGrid::product1, SourcePixelGrid::product2, SourcePixelGrid::product3;
-ImagePixelGrid* SourcePixelGrid::image_pixel_grid;
-bool SourcePixelGrid::regrid;
 int *SourcePixelGrid::maxlevs;
 lensvector ***SourcePixelGrid::xvals_threads;
 lensvector ***SourcePixelGrid::corners_threads;
@@ -58,14 +44,6 @@ ifstream SourcePixelGrid::sb_infile;
 
 /***************************************** Functions in class SourcePixelGrid ****************************************/
 
-void SourcePixelGrid::set_splitting(int usplit0, int wsplit0, double min_cs)
-{
-	u_split_initial = usplit0;
-	w_split_initial = wsplit0;
-	if ((u_split_initial < 2) or (w_split_initial < 2)) die("source grid dimensions cannot be smaller than 2 along either direction");
-	min_cell_area = min_cs;
-}
-
 void SourcePixelGrid::allocate_multithreaded_variables(const int& threads)
 {
 	nthreads = threads;
@@ -112,6 +90,13 @@ void SourcePixelGrid::deallocate_multithreaded_variables()
 SourcePixelGrid::SourcePixelGrid(Lens* lens_in, double x_min, double x_max, double y_min, double y_max) : lens(lens_in)	// use for top-level cell only; subcells use constructor below
 {
 // this constructor is used for a Cartesian grid
+	top_grid = this;
+	image_pixel_grid = NULL;
+	regrid = false;
+	u_split_initial = lens->srcgrid_npixels_x;
+	w_split_initial = lens->srcgrid_npixels_y;
+	if ((u_split_initial < 2) or (w_split_initial < 2)) die("source grid dimensions cannot be smaller than 2 along either direction");
+	min_cell_area = 1e-6;
 	center_pt = 0;
 	// For the Cartesian grid, u = x, w = y
 	u_N = u_split_initial;
@@ -121,6 +106,11 @@ SourcePixelGrid::SourcePixelGrid(Lens* lens_in, double x_min, double x_max, doub
 	ii=jj=0;
 	cell = NULL;
 	parent_cell = NULL;
+	cell_lookup = NULL;
+	mg_n_coarse_levels = -1;
+	mg_n_aggregates = NULL;
+	mg_aggregate_index = NULL;
+	Rmatrix_logdet_found = false;
 	maps_to_image_pixel = false;
 	maps_to_image_window = false;
 	active_pixel = false;
@@ -165,10 +155,14 @@ SourcePixelGrid::SourcePixelGrid(Lens* lens_in, double x_min, double x_max, doub
 	for (int i=0; i < u_N+1; i++)
 		delete[] firstlevel_xvals[i];
 	delete[] firstlevel_xvals;
+	build_cell_lookup_table();
 }
 
 SourcePixelGrid::SourcePixelGrid(Lens* lens_in, string pixel_data_fileroot, const double& minarea_in) : lens(lens_in)	// use for top-level cell only; subcells use constructor below
 {
+	top_grid = this;
+	image_pixel_grid = NULL;
+	regrid = false;
 	min_cell_area = minarea_in;
 	string info_filename = pixel_data_fileroot + ".info";
 	ifstream infofile(info_filename.c_str());
@@ -186,6 +180,11 @@ SourcePixelGrid::SourcePixelGrid(Lens* lens_in, string pixel_data_fileroot, cons
 	ii=jj=0;
 	cell = NULL;
 	parent_cell = NULL;
+	cell_lookup = NULL;
+	mg_n_coarse_levels = -1;
+	mg_n_aggregates = NULL;
+	mg_aggregate_index = NULL;
+	Rmatrix_logdet_found = false;
 	maps_to_image_pixel = false;
 	maps_to_image_window = false;
 	active_pixel = false;
@@ -233,6 +232,7 @@ SourcePixelGrid::SourcePixelGrid(Lens* lens_in, string pixel_data_fileroot, cons
 	for (int i=0; i < u_N+1; i++)
 		delete[] firstlevel_xvals[i];
 	delete[] firstlevel_xvals;
+	build_cell_lookup_table();
 }
 
 void SourcePixelGrid::read_surface_brightness_data()
@@ -244,7 +244,7 @@ void SourcePixelGrid::read_surface_brightness_data()
 			sb_infile >> sb;
 			if (sb==-1e30) // I can't think of a better dividing value to use right now, so -1e30 is what I am using at the moment
 			{
-				cell[i][j]->split_cells(2,2,0);
+				cell[i][j]->split_cells(2,2,lens->lens_thread);
 				cell[i][j]->read_surface_brightness_data();
 			} else {
 				cell[i][j]->surface_brightness = sb;
@@ -253,12 +253,12 @@ void SourcePixelGrid::read_surface_brightness_data()
 	}
 }
 
-// ***NOTE: the following constructor should NOT be used because there are static variables (e.g. levels), so more than one source grid
-// is a bad idea. To make this work, you need to make those variables non-static and contained in the zeroth-level grid (and give subcells
-// a pointer to the zeroth-level grid).
 SourcePixelGrid::SourcePixelGrid(Lens* lens_in, SourcePixelGrid* input_pixel_grid) : lens(lens_in)	// use for top-level cell only; subcells use constructor below
 {
-	// these are all static anyway, so this might be superfluous
+	top_grid = this;
+	image_pixel_grid = input_pixel_grid->image_pixel_grid;
+	zfactor = input_pixel_grid->zfactor;
+	regrid = false;
 	min_cell_area = input_pixel_grid->min_cell_area;
 	u_split_initial = input_pixel_grid->u_split_initial;
 	w_split_initial = input_pixel_grid->w_split_initial;
@@ -277,6 +277,11 @@ SourcePixelGrid::SourcePixelGrid(Lens* lens_in, SourcePixelGrid* input_pixel_gri
 	ii=jj=0;
 	cell = NULL;
 	parent_cell = NULL;
+	cell_lookup = NULL;
+	mg_n_coarse_levels = -1;
+	mg_n_aggregates = NULL;
+	mg_aggregate_index = NULL;
+	Rmatrix_logdet_found = false;
 	maps_to_image_pixel = false;
 	maps_to_image_window = false;
 	active_pixel = false;
@@ -316,6 +321,7 @@ SourcePixelGrid::SourcePixelGrid(Lens* lens_in, SourcePixelGrid* input_pixel_gri
 	assign_firstlevel_neighbors();
 	number_of_pixels = u_N*w_N;
 	copy_source_pixel_grid(input_pixel_grid); // this copies the surface brightnesses and splits the source pixels in the same manner as the input grid
+	build_cell_lookup_table();
 	assign_all_neighbors();
 
 	for (int i=0; i < u_N+1; i++)
@@ -329,7 +335,7 @@ void SourcePixelGrid::copy_source_pixel_grid(SourcePixelGrid* input_pixel_grid)
 	for (j=0; j < w_N; j++) {
 		for (i=0; i < u_N; i++) {
 			if (input_pixel_grid->cell[i][j]->cell != NULL) {
-				cell[i][j]->split_cells(input_pixel_grid->cell[i][j]->u_N,input_pixel_grid->cell[i][j]->w_N,0);
+				cell[i][j]->split_cells(input_pixel_grid->cell[i][j]->u_N,input_pixel_grid->cell[i][j]->w_N,lens->lens_thread);
 				cell[i][j]->copy_source_pixel_grid(input_pixel_grid->cell[i][j]);
 			} else {
 				cell[i][j]->surface_brightness = input_pixel_grid->cell[i][j]->surface_brightness;
@@ -346,10 +352,16 @@ SourcePixelGrid::SourcePixelGrid(Lens* lens_in, lensvector** xij, const int& i,
 	cell = NULL;
 	ii=i; jj=j; // store the index carried by this cell in the grid of the parent cell
 	parent_cell = parent_ptr;
+	cell_lookup = NULL;
+	mg_n_coarse_levels = -1;
+	mg_n_aggregates = NULL;
+	mg_aggregate_index = NULL;
+	Rmatrix_logdet_found = false;
 	maps_to_image_pixel = false;
 	maps_to_image_window = false;
 	active_pixel = false;
 	lens = lens_in;
+	top_grid = parent_ptr->top_grid;
 
 	corner_pt[0] = xij[i][j];
 	corner_pt[1] = xij[i][j+1];
@@ -376,6 +388,27 @@ void SourcePixelGrid::assign_surface_brightness()
 	}
 }
 
+void SourcePixelGrid::assign_surface_brightness_from_delaunay(DelaunaySourceGrid* delaunay_grid)
+{
+	// Used to display a source reconstructed on a Delaunay grid (see DelaunaySourceGrid); each cell is given the values
+	// interpolated at its center
+	int tri = 0;
+	assign_surface_brightness_from_delaunay_recursive(delaunay_grid,tri);
+}
+
+void SourcePixelGrid::assign_surface_brightness_from_delaunay_recursive(DelaunaySourceGrid* delaunay_grid, int& tri)
+{
+	int i,j;
+	for (j=0; j < w_N; j++) {
+		for (i=0; i < u_N; i++) {
+			if (cell[i][j]->cell != NULL) cell[i][j]->assign_surface_brightness_from_delaunay_recursive(delaunay_grid,tri);
+			else {
+				delaunay_grid->interpolate(cell[i][j]->center_pt[0],cell[i][j]->center_pt[1],tri,cell[i][j]->surface_brightness,cell[i][j]->total_magnification,cell[i][j]->n_images);
+			}
+		}
+	}
+}
+
 void SourcePixelGrid::update_surface_brightness(int& index)
 {
 	for (int j=0; j < w_N; j++) {
@@ -448,8 +481,8 @@ void SourcePixelGrid::store_surface_brightness_grid_data(string root)
 	pixel_surface_brightness_file.close();
 
 	ofstream pixel_info(info_filename.c_str());
-	pixel_info << u_split_initial << " " << w_split_initial << " " << levels << endl;
-	pixel_info << srcgrid_xmin << " " << srcgrid_xmax << " " << srcgrid_ymin << " " << srcgrid_ymax << endl;
+	pixel_info << top_grid->u_split_initial << " " << top_grid->w_split_initial << " " << top_grid->levels << endl;
+	pixel_info << top_grid->srcgrid_xmin << " " << top_grid->srcgrid_xmax << " " << top_grid->srcgrid_ymin << " " << top_grid->srcgrid_ymax << endl;
 }
 
 void SourcePixelGrid::write_surface_brightness_to_file()
@@ -484,7 +517,7 @@ void SourcePixelGrid::plot_surface_brightness(string root)
 	n_plot_ycells = w_N;
 	pixels_per_cell_x = 1;
 	pixels_per_cell_y = 1;
-	for (i=0; i < levels-1; i++) {
+	for (i=0; i < top_grid->levels-1; i++) {
 		cell_xlength /= 2;
 		cell_ylength /= 2;
 		n_plot_xcells *= 2;
@@ -528,8 +561,8 @@ void SourcePixelGrid::plot_surface_brightness(string root)
 	pixel_n_image_file.close();
 
 	ofstream pixel_info(info_filename.c_str());
-	pixel_info << u_split_initial << " " << w_split_initial << " " << levels << endl;
-	pixel_info << srcgrid_xmin << " " << srcgrid_xmax << " " << srcgrid_ymin << " " << srcgrid_ymax << endl;
+	pixel_info << top_grid->u_split_initial << " " << top_grid->w_split_initial << " " << top_grid->levels << endl;
+	pixel_info << top_grid->srcgrid_xmin << " " << top_grid->srcgrid_xmax << " " << top_grid->srcgrid_ymin << " " << top_grid->srcgrid_ymax << endl;
 }
 
 void SourcePixelGrid::plot_cell_surface_brightness(int line_number, int pixels_per_cell_x, int pixels_per_cell_y)
@@ -556,6 +589,7 @@ void SourcePixelGrid::plot_cell_surface_brightness(int line_number, int pixels_p
 
 inline void SourcePixelGrid::find_cell_area()
 {
+	lensvector d1, d2, d3, d4;
 	d1[0] = corner_pt[2][0] - corner_pt[0][0]; d1[1] = corner_pt[2][1] - corner_pt[0][1];
 	d2[0] = corner_pt[1][0] - corner_pt[0][0]; d2[1] = corner_pt[1][1] - corner_pt[0][1];
 	d3[0] = corner_pt[2][0] - corner_pt[3][0]; d3[1] = corner_pt[2][1] - corner_pt[3][1];
@@ -603,7 +637,7 @@ void SourcePixelGrid::assign_neighborhood()
 	int l,k;
 	for (l=0; l < 4; l++)
 		if ((neighbor[l] != NULL) and (neighbor[l]->cell != NULL)) {
-		for (k=level; k <= levels; k++) {
+		for (k=level; k <= top_grid->levels; k++) {
 			neighbor[l]->assign_level_neighbors(k);
 		}
 	}
@@ -614,7 +648,7 @@ void SourcePixelGrid::assign_all_neighbors()
 	if (level!=0) die("assign_all_neighbors should only be run from level 0");
 
 	int k,i,j;
-	for (k=1; k < levels; k++) {
+	for (k=1; k < top_grid->levels; k++) {
 		for (i=0; i < u_N; i++) {
 			for (j=0; j < w_N; j++) {
 				cell[i][j]->assign_level_neighbors(k); // we've just created our grid, so we only need to go to level+1
@@ -733,12 +767,14 @@ void SourcePixelGrid::split_cells(const int usplit, const int wsplit, const int&
 	if (level == maxlevs[thread]) {
 		maxlevs[thread]++; // our subcells are at the max level, so splitting them increases the number of levels by 1
 	}
-	number_of_pixels += u_N*w_N - 1; // subtract one because we're not counting the parent cell as a source pixel
+	#pragma omp atomic
+	top_grid->number_of_pixels += u_N*w_N - 1; // subtract one because we're not counting the parent cell as a source pixel
 }
 
 void SourcePixelGrid::unsplit()
 {
 	if (cell==NULL) return;
+	invalidate_cell_lookup_table();
 	surface_brightness = 0;
 	int i,j;
 	for (i=0; i < u_N; i++) {
@@ -750,7 +786,7 @@ void SourcePixelGrid::unsplit()
 		delete[] cell[i];
 	}
 	delete[] cell;
-	number_of_pixels -= (u_N*w_N - 1);
+	top_grid->number_of_pixels -= (u_N*w_N - 1);
 	cell = NULL;
 	surface_brightness /= (u_N*w_N);
 	u_N=1; w_N = 1;
@@ -942,23 +978,33 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 #endif
 
 	double xstep, ystep;
-	xstep = (srcgrid_xmax-srcgrid_xmin)/u_N;
-	ystep = (srcgrid_ymax-srcgrid_ymin)/w_N;
+	xstep = (top_grid->srcgrid_xmax-top_grid->srcgrid_xmin)/u_N;
+	ystep = (top_grid->srcgrid_ymax-top_grid->srcgrid_ymin)/w_N;
 	int src_raytrace_i, src_raytrace_j;
 	int img_i, img_j;
 
-	int ntot = image_pixel_grid->x_N * image_pixel_grid->y_N;
+	int ntot = top_grid->image_pixel_grid->x_N * top_grid->image_pixel_grid->y_N;
 	int *overlap_matrix_row_nn = new int[ntot];
 	vector<double> *overlap_matrix_rows = new vector<double>[ntot];
 	vector<int> *overlap_matrix_index_rows = new vector<int>[ntot];
 	vector<double> *overlap_area_matrix_rows;
 	if (lens->n_image_prior) overlap_area_matrix_rows = new vector<double>[ntot];
 
+	// If each process has only ray traced its own block of image rows, it finds the overlaps for the pixels in that block, and
+	// the resulting cell magnifications are summed over the group at the end (rather than sharing all the overlaps)
+	bool own_rows_only = top_grid->image_pixel_grid->own_rows_traced_only;
 	int mpi_chunk, mpi_start, mpi_end;
-	mpi_chunk = ntot / lens->group_np;
-	mpi_start = lens->group_id*mpi_chunk;
-	if (lens->group_id == lens->group_np-1) mpi_chunk += (ntot % lens->group_np); // assign the remainder elements to the last mpi process
-	mpi_end = mpi_start + mpi_chunk;
+	if (own_rows_only) {
+		top_grid->image_pixel_grid->find_row_block(lens->group_id,mpi_start,mpi_end);
+		mpi_start *= top_grid->image_pixel_grid->x_N;
+		mpi_end *= top_grid->image_pixel_grid->x_N;
+		for (k=0; k < ntot; k++) overlap_matrix_row_nn[k] = 0;
+	} else {
+		mpi_chunk = ntot / lens->group_np;
+		mpi_start = lens->group_id*mpi_chunk;
+		if (lens->group_id == lens->group_np-1) mpi_chunk += (ntot % lens->group_np); // assign the remainder elements to the last mpi process
+		mpi_end = mpi_start + mpi_chunk;
+	}
 
 	int overlap_matrix_nn;
 	int overlap_matrix_nn_part=0;
@@ -971,29 +1017,29 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 		int corner_raytrace_j;
 		int min_i, max_i, min_j, max_j;
 #ifdef USE_OPENMP
-		thread = omp_get_thread_num();
+		thread = lens->lens_thread + omp_get_thread_num();
 #else
-		thread = 0;
+		thread = lens->lens_thread;
 #endif
 		#pragma omp for private(i,j,nsrc,overlap_area,weighted_overlap,triangle1_overlap,triangle2_overlap,triangle1_weight,triangle2_weight,inside) schedule(dynamic) reduction(+:overlap_matrix_nn_part)
 		for (n=mpi_start; n < mpi_end; n++)
 		{
 			overlap_matrix_row_nn[n] = 0;
-			img_j = n / image_pixel_grid->x_N;
-			img_i = n % image_pixel_grid->x_N;
+			img_j = n / top_grid->image_pixel_grid->x_N;
+			img_i = n % top_grid->image_pixel_grid->x_N;
 
-			corners_threads[thread][0] = &image_pixel_grid->corner_sourcepts[img_i][img_j];
-			corners_threads[thread][1] = &image_pixel_grid->corner_sourcepts[img_i][img_j+1];
-			corners_threads[thread][2] = &image_pixel_grid->corner_sourcepts[img_i+1][img_j];
-			corners_threads[thread][3] = &image_pixel_grid->corner_sourcepts[img_i+1][img_j+1];
+			corners_threads[thread][0] = &top_grid->image_pixel_grid->corner_sourcepts[img_i][img_j];
+			corners_threads[thread][1] = &top_grid->image_pixel_grid->corner_sourcepts[img_i][img_j+1];
+			corners_threads[thread][2] = &top_grid->image_pixel_grid->corner_sourcepts[img_i+1][img_j];
+			corners_threads[thread][3] = &top_grid->image_pixel_grid->corner_sourcepts[img_i+1][img_j+1];
 
-			min_i = (int) (((*corners_threads[thread][0])[0] - srcgrid_xmin) / xstep);
-			min_j = (int) (((*corners_threads[thread][0])[1] - srcgrid_ymin) / ystep);
+			min_i = (int) (((*corners_threads[thread][0])[0] - top_grid->srcgrid_xmin) / xstep);
+			min_j = (int) (((*corners_threads[thread][0])[1] - top_grid->srcgrid_ymin) / ystep);
 			max_i = min_i;
 			max_j = min_j;
 			for (i=1; i < 4; i++) {
-				corner_raytrace_i = (int) (((*corners_threads[thread][i])[0] - srcgrid_xmin) / xstep);
-				corner_raytrace_j = (int) (((*corners_threads[thread][i])[1] - srcgrid_ymin) / ystep);
+				corner_raytrace_i = (int) (((*corners_threads[thread][i])[0] - top_grid->srcgrid_xmin) / xstep);
+				corner_raytrace_j = (int) (((*corners_threads[thread][i])[1] - top_grid->srcgrid_ymin) / ystep);
 				if (corner_raytrace_i < min_i) min_i = corner_raytrace_i;
 				if (corner_raytrace_i > max_i) max_i = corner_raytrace_i;
 				if (corner_raytrace_j < min_j) min_j = corner_raytrace_j;
@@ -1011,19 +1057,19 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 						if (inside) {
 							triangle1_overlap = cell[i][j]->find_triangle1_overlap(corners_threads[thread],thread);
 							triangle2_overlap = cell[i][j]->find_triangle2_overlap(corners_threads[thread],thread);
-							triangle1_weight = triangle1_overlap / image_pixel_grid->source_plane_triangle1_area[img_i][img_j];
-							triangle2_weight = triangle2_overlap / image_pixel_grid->source_plane_triangle2_area[img_i][img_j];
+							triangle1_weight = triangle1_overlap / top_grid->image_pixel_grid->source_plane_triangle1_area[img_i][img_j];
+							triangle2_weight = triangle2_overlap / top_grid->image_pixel_grid->source_plane_triangle2_area[img_i][img_j];
 						} else {
 							if (cell[i][j]->check_triangle1_overlap(corners_threads[thread],thread)) {
 								triangle1_overlap = cell[i][j]->find_triangle1_overlap(corners_threads[thread],thread);
-								triangle1_weight = triangle1_overlap / image_pixel_grid->source_plane_triangle1_area[img_i][img_j];
+								triangle1_weight = triangle1_overlap / top_grid->image_pixel_grid->source_plane_triangle1_area[img_i][img_j];
 							} else {
 								triangle1_overlap = 0;
 								triangle1_weight = 0;
 							}
 							if (cell[i][j]->check_triangle2_overlap(corners_threads[thread],thread)) {
 								triangle2_overlap = cell[i][j]->find_triangle2_overlap(corners_threads[thread],thread);
-								triangle2_weight = triangle2_overlap / image_pixel_grid->source_plane_triangle2_area[img_i][img_j];
+								triangle2_weight = triangle2_overlap / top_grid->image_pixel_grid->source_plane_triangle2_area[img_i][img_j];
 							} else {
 								triangle2_overlap = 0;
 								triangle2_weight = 0;
@@ -1049,7 +1095,8 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 	}
 
 #ifdef USE_MPI
-	MPI_Allreduce(&overlap_matrix_nn_part, &overlap_matrix_nn, 1, MPI_INT, MPI_SUM, sub_comm);
+	if (own_rows_only) overlap_matrix_nn = overlap_matrix_nn_part;
+	else MPI_Allreduce(&overlap_matrix_nn_part, &overlap_matrix_nn, 1, MPI_INT, MPI_SUM, sub_comm);
 #else
 	overlap_matrix_nn = overlap_matrix_nn_part;
 #endif
@@ -1062,11 +1109,13 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 
 #ifdef USE_MPI
 	int id, chunk, start, end, length;
-	for (id=0; id < lens->group_np; id++) {
-		chunk = ntot / lens->group_np;
-		start = id*chunk;
-		if (id == lens->group_np-1) chunk += (ntot % lens->group_np); // assign the remainder elements to the last mpi process
-		MPI_Bcast(overlap_matrix_row_nn + start,chunk,MPI_INT,id,sub_comm);
+	if (!own_rows_only) {
+		for (id=0; id < lens->group_np; id++) {
+			chunk = ntot / lens->group_np;
+			start = id*chunk;
+			if (id == lens->group_np-1) chunk += (ntot % lens->group_np); // assign the remainder elements to the last mpi process
+			MPI_Bcast(overlap_matrix_row_nn + start,chunk,MPI_INT,id,sub_comm);
+		}
 	}
 #endif
 
@@ -1087,23 +1136,25 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 	}
 
 #ifdef USE_MPI
-	for (id=0; id < lens->group_np; id++) {
-		chunk = ntot / lens->group_np;
-		start = id*chunk;
-		if (id == lens->group_np-1) chunk += (ntot % lens->group_np); // assign the remainder elements to the last mpi process
-		end = start + chunk;
-		length = image_pixel_location_overlap[end] - image_pixel_location_overlap[start];
-		MPI_Bcast(overlap_matrix + image_pixel_location_overlap[start],length,MPI_DOUBLE,id,sub_comm);
-		MPI_Bcast(overlap_matrix_index + image_pixel_location_overlap[start],length,MPI_INT,id,sub_comm);
-		if (lens->n_image_prior)
-			MPI_Bcast(overlap_area_matrix + image_pixel_location_overlap[start],length,MPI_DOUBLE,id,sub_comm);
+	if (!own_rows_only) {
+		for (id=0; id < lens->group_np; id++) {
+			chunk = ntot / lens->group_np;
+			start = id*chunk;
+			if (id == lens->group_np-1) chunk += (ntot % lens->group_np); // assign the remainder elements to the last mpi process
+			end = start + chunk;
+			length = image_pixel_location_overlap[end] - image_pixel_location_overlap[start];
+			MPI_Bcast(overlap_matrix + image_pixel_location_overlap[start],length,MPI_DOUBLE,id,sub_comm);
+			MPI_Bcast(overlap_matrix_index + image_pixel_location_overlap[start],length,MPI_INT,id,sub_comm);
+			if (lens->n_image_prior)
+				MPI_Bcast(overlap_area_matrix + image_pixel_location_overlap[start],length,MPI_DOUBLE,id,sub_comm);
+		}
 	}
 	MPI_Comm_free(&sub_comm);
 #endif
 
 	for (n=0; n < ntot; n++) {
-		img_j = n / image_pixel_grid->x_N;
-		img_i = n % image_pixel_grid->x_N;
+		img_j = n / top_grid->image_pixel_grid->x_N;
+		img_i = n % top_grid->image_pixel_grid->x_N;
 		for (l=image_pixel_location_overlap[n]; l < image_pixel_location_overlap[n+1]; l++) {
 			nsrc = overlap_matrix_index[l];
 			j = nsrc / u_N;
@@ -1111,7 +1162,7 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 			mag_matrix[nsrc] += overlap_matrix[l];
 			if (lens->n_image_prior) area_matrix[nsrc] += overlap_area_matrix[l];
 			cell[i][j]->overlap_pixel_n.push_back(n);
-			if ((image_pixel_grid->fit_to_data==NULL) or (image_pixel_grid->fit_to_data[img_i][img_j]==true)) cell[i][j]->maps_to_image_window = true;
+			if ((top_grid->image_pixel_grid->fit_to_data==NULL) or (top_grid->image_pixel_grid->fit_to_data[img_i][img_j]==true)) cell[i][j]->maps_to_image_window = true;
 		}
 	}
 
@@ -1139,11 +1190,14 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 	for (nsrc=0; nsrc < ntot_src; nsrc++) {
 		j = nsrc / u_N;
 		i = nsrc % u_N;
-		cell[i][j]->total_magnification = mag_matrix[nsrc] * image_pixel_grid->triangle_area / cell[i][j]->cell_area;
+		cell[i][j]->total_magnification = mag_matrix[nsrc] * top_grid->image_pixel_grid->triangle_area / cell[i][j]->cell_area;
 		if (lens->n_image_prior) cell[i][j]->n_images = area_matrix[nsrc] / cell[i][j]->cell_area;
 		//cout << mag_matrix[nsrc] << " " << cell[i][j]->total_magnification << endl;
 		if (cell[i][j]->total_magnification*0.0) warn("Nonsensical source cell magnification (mag=%g",cell[i][j]->total_magnification);
 	}
+#ifdef USE_MPI
+	if (own_rows_only) sum_cell_data_over_group(1);
+#endif
 
 	delete[] overlap_matrix;
 	delete[] overlap_matrix_index;
@@ -1161,6 +1215,7 @@ void SourcePixelGrid::calculate_pixel_magnifications()
 
 void SourcePixelGrid::adaptive_subgrid()
 {
+	ProfileTimer profile_timer(PROF_GRID_CONSTRUCTION);
 	calculate_pixel_magnifications();
 #ifdef USE_OPENMP
 	double wtime0, wtime;
@@ -1171,11 +1226,15 @@ void SourcePixelGrid::adaptive_subgrid()
 
 	int i, prev_levels;
 	for (i=0; i < max_levels-1; i++) {
-		prev_levels = levels;
+		prev_levels = top_grid->levels;
 		split_subcells_firstlevel(i);
-		if (prev_levels==levels) break; // no splitting occurred, so no need to attempt further subgridding
+#ifdef USE_MPI
+		if (top_grid->image_pixel_grid->own_rows_traced_only) sum_cell_data_over_group(i+2); // the new subcells are at level i+2
+#endif
+		if (prev_levels==top_grid->levels) break; // no splitting occurred, so no need to attempt further subgridding
 	}
 	assign_all_neighbors();
+	build_cell_lookup_table();
 
 #ifdef USE_OPENMP
 	if (lens->show_wtime) {
@@ -1192,16 +1251,19 @@ void SourcePixelGrid::split_subcells_firstlevel(const int splitlevel)
 
 	int ntot = u_N*w_N;
 	int i,j,n;
+	int nthreads_used = 1; // only the maxlevs entries of the threads used here are checked, since thread clones may be using the others
 	if (splitlevel > level) {
 		#pragma omp parallel
 		{
 			int thread;
 #ifdef USE_OPENMP
-			thread = omp_get_thread_num();
+			thread = lens->lens_thread + omp_get_thread_num();
+			#pragma omp master
+			nthreads_used = omp_get_num_threads();
 #else
-			thread = 0;
+			thread = lens->lens_thread;
 #endif
-			maxlevs[thread] = levels;
+			maxlevs[thread] = top_grid->levels;
 			#pragma omp for private(i,j,n) schedule(dynamic)
 			for (n=0; n < ntot; n++) {
 				j = n / u_N;
@@ -1209,7 +1271,7 @@ void SourcePixelGrid::split_subcells_firstlevel(const int splitlevel)
 				if (cell[i][j]->cell != NULL) cell[i][j]->split_subcells(splitlevel,thread);
 			}
 		}
-		for (i=0; i < nthreads; i++) if (maxlevs[i] > levels) levels = maxlevs[i];
+		for (i=lens->lens_thread; i < lens->lens_thread + nthreads_used; i++) if (maxlevs[i] > top_grid->levels) top_grid->levels = maxlevs[i];
 	} else {
 		int k,l,m;
 		double overlap_area, weighted_overlap, triangle1_overlap, triangle2_overlap, triangle1_weight, triangle2_weight;
@@ -1226,14 +1288,16 @@ void SourcePixelGrid::split_subcells_firstlevel(const int splitlevel)
 			int nn, img_i, img_j;
 			int thread;
 #ifdef USE_OPENMP
-			thread = omp_get_thread_num();
+			thread = lens->lens_thread + omp_get_thread_num();
+			#pragma omp master
+			nthreads_used = omp_get_num_threads();
 #else
-			thread = 0;
+			thread = lens->lens_thread;
 #endif
-			maxlevs[thread] = levels;
+			maxlevs[thread] = top_grid->levels;
 			double xstep, ystep;
-			xstep = (srcgrid_xmax-srcgrid_xmin)/u_N/2.0;
-			ystep = (srcgrid_ymax-srcgrid_ymin)/w_N/2.0;
+			xstep = (top_grid->srcgrid_xmax-top_grid->srcgrid_xmin)/u_N/2.0;
+			ystep = (top_grid->srcgrid_ymax-top_grid->srcgrid_ymin)/w_N/2.0;
 			int min_i,max_i,min_j,max_j;
 			int corner_raytrace_i, corner_raytrace_j;
 			int ii,lmin,lmax,mmin,mmax;
@@ -1248,12 +1312,12 @@ void SourcePixelGrid::split_subcells_firstlevel(const int splitlevel)
 					cell[i][j]->split_cells(2,2,thread);
 					for (k=0; k < cell[i][j]->overlap_pixel_n.size(); k++) {
 						nn = cell[i][j]->overlap_pixel_n[k];
-						img_j = nn / image_pixel_grid->x_N;
-						img_i = nn % image_pixel_grid->x_N;
-						corners_threads[thread][0] = &image_pixel_grid->corner_sourcepts[img_i][img_j];
-						corners_threads[thread][1] = &image_pixel_grid->corner_sourcepts[img_i][img_j+1];
-						corners_threads[thread][2] = &image_pixel_grid->corner_sourcepts[img_i+1][img_j];
-						corners_threads[thread][3] = &image_pixel_grid->corner_sourcepts[img_i+1][img_j+1];
+						img_j = nn / top_grid->image_pixel_grid->x_N;
+						img_i = nn % top_grid->image_pixel_grid->x_N;
+						corners_threads[thread][0] = &top_grid->image_pixel_grid->corner_sourcepts[img_i][img_j];
+						corners_threads[thread][1] = &top_grid->image_pixel_grid->corner_sourcepts[img_i][img_j+1];
+						corners_threads[thread][2] = &top_grid->image_pixel_grid->corner_sourcepts[img_i+1][img_j];
+						corners_threads[thread][3] = &top_grid->image_pixel_grid->corner_sourcepts[img_i+1][img_j+1];
 
 						min_i = (int) (((*corners_threads[thread][0])[0] - cell[i][j]->corner_pt[0][0]) / xstep);
 						min_j = (int) (((*corners_threads[thread][0])[1] - cell[i][j]->corner_pt[0][1]) / ystep);
@@ -1281,12 +1345,12 @@ void SourcePixelGrid::split_subcells_firstlevel(const int splitlevel)
 								subcell = cell[i][j]->cell[l][m];
 								triangle1_overlap = subcell->find_triangle1_overlap(corners_threads[thread],thread);
 								triangle2_overlap = subcell->find_triangle2_overlap(corners_threads[thread],thread);
-								triangle1_weight = triangle1_overlap / image_pixel_grid->source_plane_triangle1_area[img_i][img_j];
-								triangle2_weight = triangle2_overlap / image_pixel_grid->source_plane_triangle2_area[img_i][img_j];
+								triangle1_weight = triangle1_overlap / top_grid->image_pixel_grid->source_plane_triangle1_area[img_i][img_j];
+								triangle2_weight = triangle2_overlap / top_grid->image_pixel_grid->source_plane_triangle2_area[img_i][img_j];
 								weighted_overlap = triangle1_weight + triangle2_weight;
 
 								subcell->total_magnification += weighted_overlap;
-								if ((weighted_overlap != 0) and ((image_pixel_grid->fit_to_data==NULL) or (image_pixel_grid->fit_to_data[img_i][img_j]==true))) subcell->maps_to_image_window = true;
+								if ((weighted_overlap != 0) and ((top_grid->image_pixel_grid->fit_to_data==NULL) or (top_grid->image_pixel_grid->fit_to_data[img_i][img_j]==true))) subcell->maps_to_image_window = true;
 								subcell->overlap_pixel_n.push_back(nn);
 								if (lens->n_image_prior) {
 									overlap_area = triangle1_overlap + triangle2_overlap;
@@ -1298,14 +1362,14 @@ void SourcePixelGrid::split_subcells_firstlevel(const int splitlevel)
 					for (l=0; l < cell[i][j]->u_N; l++) {
 						for (m=0; m < cell[i][j]->w_N; m++) {
 							subcell = cell[i][j]->cell[l][m];
-							subcell->total_magnification *= image_pixel_grid->triangle_area / subcell->cell_area;
+							subcell->total_magnification *= top_grid->image_pixel_grid->triangle_area / subcell->cell_area;
 							if (lens->n_image_prior) subcell->n_images /= subcell->cell_area;
 						}
 					}
 				}
 			}
 		}
-		for (i=0; i < nthreads; i++) if (maxlevs[i] > levels) levels = maxlevs[i];
+		for (i=lens->lens_thread; i < lens->lens_thread + nthreads_used; i++) if (maxlevs[i] > top_grid->levels) top_grid->levels = maxlevs[i];
 	}
 }
 
@@ -1347,12 +1411,12 @@ void SourcePixelGrid::split_subcells(const int splitlevel, const int thread)
 					cell[i][j]->split_cells(2,2,thread);
 					for (k=0; k < cell[i][j]->overlap_pixel_n.size(); k++) {
 						nn = cell[i][j]->overlap_pixel_n[k];
-						img_j = nn / image_pixel_grid->x_N;
-						img_i = nn % image_pixel_grid->x_N;
-						corners_threads[thread][0] = &image_pixel_grid->corner_sourcepts[img_i][img_j];
-						corners_threads[thread][1] = &image_pixel_grid->corner_sourcepts[img_i][img_j+1];
-						corners_threads[thread][2] = &image_pixel_grid->corner_sourcepts[img_i+1][img_j];
-						corners_threads[thread][3] = &image_pixel_grid->corner_sourcepts[img_i+1][img_j+1];
+						img_j = nn / top_grid->image_pixel_grid->x_N;
+						img_i = nn % top_grid->image_pixel_grid->x_N;
+						corners_threads[thread][0] = &top_grid->image_pixel_grid->corner_sourcepts[img_i][img_j];
+						corners_threads[thread][1] = &top_grid->image_pixel_grid->corner_sourcepts[img_i][img_j+1];
+						corners_threads[thread][2] = &top_grid->image_pixel_grid->corner_sourcepts[img_i+1][img_j];
+						corners_threads[thread][3] = &top_grid->image_pixel_grid->corner_sourcepts[img_i+1][img_j+1];
 
 						min_i = (int) (((*corners_threads[thread][0])[0] - cell[i][j]->corner_pt[0][0]) / xstep);
 						min_j = (int) (((*corners_threads[thread][0])[1] - cell[i][j]->corner_pt[0][1]) / ystep);
@@ -1380,13 +1444,13 @@ void SourcePixelGrid::split_subcells(const int splitlevel, const int thread)
 								subcell = cell[i][j]->cell[l][m];
 								triangle1_overlap = subcell->find_triangle1_overlap(corners_threads[thread],thread);
 								triangle2_overlap = subcell->find_triangle2_overlap(corners_threads[thread],thread);
-								triangle1_weight = triangle1_overlap / image_pixel_grid->source_plane_triangle1_area[img_i][img_j];
-								triangle2_weight = triangle2_overlap / image_pixel_grid->source_plane_triangle2_area[img_i][img_j];
+								triangle1_weight = triangle1_overlap / top_grid->image_pixel_grid->source_plane_triangle1_area[img_i][img_j];
+								triangle2_weight = triangle2_overlap / top_grid->image_pixel_grid->source_plane_triangle2_area[img_i][img_j];
 								weighted_overlap = triangle1_weight + triangle2_weight;
 
 								subcell->total_magnification += weighted_overlap;
 								subcell->overlap_pixel_n.push_back(nn);
-								if ((weighted_overlap != 0) and ((image_pixel_grid->fit_to_data==NULL) or (image_pixel_grid->fit_to_data[img_i][img_j]==true))) subcell->maps_to_image_window = true;
+								if ((weighted_overlap != 0) and ((top_grid->image_pixel_grid->fit_to_data==NULL) or (top_grid->image_pixel_grid->fit_to_data[img_i][img_j]==true))) subcell->maps_to_image_window = true;
 								if (lens->n_image_prior) {
 									overlap_area = triangle1_overlap + triangle2_overlap;
 									subcell->n_images += overlap_area;
@@ -1397,7 +1461,7 @@ void SourcePixelGrid::split_subcells(const int splitlevel, const int thread)
 					for (l=0; l < cell[i][j]->u_N; l++) {
 						for (m=0; m < cell[i][j]->w_N; m++) {
 							subcell = cell[i][j]->cell[l][m];
-							subcell->total_magnification *= image_pixel_grid->triangle_area / subcell->cell_area;
+							subcell->total_magnification *= top_grid->image_pixel_grid->triangle_area / subcell->cell_area;
 							if (lens->n_image_prior) subcell->n_images /= subcell->cell_area;
 						}
 					}
@@ -1454,14 +1518,28 @@ void SourcePixelGrid::subcell_assign_source_mapping_flags_overlap(lensvector **i
 void SourcePixelGrid::calculate_Lmatrix_overlap(const int &img_index, const int &image_pixel_i, const int &image_pixel_j, int& index, lensvector **input_corner_pts, const int& thread)
 {
 	double overlap, total_overlap=0;
-	int i,j,k;
+	int i;
 	int Lmatrix_index_initial = index;
 	SourcePixelGrid *subcell;
-
-	for (i=0; i < image_pixel_grid->mapped_source_pixels[image_pixel_i][image_pixel_j].size(); i++) {
-		subcell = image_pixel_grid->mapped_source_pixels[image_pixel_i][image_pixel_j][i];
-		lens->Lmatrix_index_rows[img_index].push_back(subcell->active_index);
-		overlap = subcell->find_rectangle_overlap(input_corner_pts,thread);
+	vector<SourcePixelGrid*>& mapped_cells = top_grid->image_pixel_grid->mapped_source_pixels[image_pixel_i][image_pixel_j];
+	int n_mapped_cells = mapped_cells.size();
+
+	// the overlap areas for both triangles of the image pixel are found for all the mapped cells in one pass
+	TriRectangleOverlap& batch = trirec[thread];
+	batch.set_batch_capacity(n_mapped_cells);
+	for (i=0; i < n_mapped_cells; i++) {
+		subcell = mapped_cells[i];
+		batch.rect_xmin[i] = subcell->corner_pt[0][0];
+		batch.rect_xmax[i] = subcell->corner_pt[2][0];
+		batch.rect_ymin[i] = subcell->corner_pt[0][1];
+		batch.rect_ymax[i] = subcell->corner_pt[1][1];
+	}
+	batch.find_overlap_areas(*input_corner_pts[0],*input_corner_pts[1],*input_corner_pts[2],n_mapped_cells,batch.rect_xmin,batch.rect_xmax,batch.rect_ymin,batch.rect_ymax,batch.rect_area);
+	batch.find_overlap_areas(*input_corner_pts[1],*input_corner_pts[3],*input_corner_pts[2],n_mapped_cells,batch.rect_xmin,batch.rect_xmax,batch.rect_ymin,batch.rect_ymax,batch.rect_area,true);
+
+	for (i=0; i < n_mapped_cells; i++) {
+		lens->Lmatrix_index_rows[img_index].push_back(mapped_cells[i]->active_index);
+		overlap = batch.rect_area[i];
 		lens->Lmatrix_rows[img_index].push_back(overlap);
 		index++;
 		total_overlap += overlap;
@@ -1567,13 +1645,24 @@ bool SourcePixelGrid::bisection_search_interpolate(lensvector &input_center_pt,
 
 bool SourcePixelGrid::assign_source_mapping_flags_interpolate(lensvector &input_center_pt, vector<SourcePixelGrid*>& mapped_source_pixels, const int& thread, const int& image_pixel_i, const int& image_pixel_j)
 {
+	SourcePixelGrid *cellptr, *cellptr1, *cellptr2;
+	if ((cell_lookup != NULL) and ((cellptr = find_containing_leaf_cell(input_center_pt)) != NULL)) {
+		cellptr->maps_to_image_pixel = true;
+		mapped_source_pixels.push_back(cellptr);
+		cellptr->find_interpolation_neighbors(input_center_pt,cellptr1,cellptr2);
+		cellptr1->maps_to_image_pixel = true;
+		mapped_source_pixels.push_back(cellptr1);
+		cellptr2->maps_to_image_pixel = true;
+		mapped_source_pixels.push_back(cellptr2);
+		return true;
+	}
+
 	imin[thread]=0; imax[thread]=u_N-1;
 	jmin[thread]=0; jmax[thread]=w_N-1;
 	if (bisection_search_interpolate(input_center_pt,thread)==false) return false;
 
 	bool image_pixel_maps_to_source_grid = false;
-	int i,j,side;
-	SourcePixelGrid* cellptr;
+	int i,j;
 	for (j=jmin[thread]; j <= jmax[thread]; j++) {
 		for (i=imin[thread]; i <= imax[thread]; i++) {
 			if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
@@ -1582,52 +1671,11 @@ bool SourcePixelGrid::assign_source_mapping_flags_interpolate(lensvector &input_
 					cell[i][j]->maps_to_image_pixel = true;
 					mapped_source_pixels.push_back(cell[i][j]);
 					if (!image_pixel_maps_to_source_grid) image_pixel_maps_to_source_grid = true;
-					if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-						if (cell[i][j]->neighbor[0]->cell != NULL) {
-							side=0;
-							cellptr = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[0]->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cell[i][j]->neighbor[0]);
-						}
-					} else {
-						if (cell[i][j]->neighbor[1]->cell != NULL) {
-							side=1;
-							cellptr = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[1]->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cell[i][j]->neighbor[1]);
-						}
-					}
-					if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-						if (cell[i][j]->neighbor[2]->cell != NULL) {
-							side=2;
-							cellptr = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[2]->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cell[i][j]->neighbor[2]);
-						}
-					} else {
-						if (cell[i][j]->neighbor[3]->cell != NULL) {
-							side=3;
-							cellptr = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[3]->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cell[i][j]->neighbor[3]);
-						}
-					}
+					cell[i][j]->find_interpolation_neighbors(input_center_pt,cellptr1,cellptr2);
+					cellptr1->maps_to_image_pixel = true;
+					mapped_source_pixels.push_back(cellptr1);
+					cellptr2->maps_to_image_pixel = true;
+					mapped_source_pixels.push_back(cellptr2);
 				}
 				break;
 			}
@@ -1641,8 +1689,8 @@ bool SourcePixelGrid::assign_source_mapping_flags_interpolate(lensvector &input_
 bool SourcePixelGrid::subcell_assign_source_mapping_flags_interpolate(lensvector &input_center_pt, vector<SourcePixelGrid*>& mapped_source_pixels, const int& thread)
 {
 	bool image_pixel_maps_to_source_grid = false;
-	int i,j,side;
-	SourcePixelGrid* cellptr;
+	int i,j;
+	SourcePixelGrid *cellptr1, *cellptr2;
 	for (j=0; j < w_N; j++) {
 		for (i=0; i < u_N; i++) {
 			if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
@@ -1651,52 +1699,11 @@ bool SourcePixelGrid::subcell_assign_source_mapping_flags_interpolate(lensvector
 					cell[i][j]->maps_to_image_pixel = true;
 					mapped_source_pixels.push_back(cell[i][j]);
 					if (!image_pixel_maps_to_source_grid) image_pixel_maps_to_source_grid = true;
-					if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-						if (cell[i][j]->neighbor[0]->cell != NULL) {
-							side=0;
-							cellptr = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[0]->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cell[i][j]->neighbor[0]);
-						}
-					} else {
-						if (cell[i][j]->neighbor[1]->cell != NULL) {
-							side=1;
-							cellptr = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[1]->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cell[i][j]->neighbor[1]);
-						}
-					}
-					if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-						if (cell[i][j]->neighbor[2]->cell != NULL) {
-							side=2;
-							cellptr = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[2]->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cell[i][j]->neighbor[2]);
-						}
-					} else {
-						if (cell[i][j]->neighbor[3]->cell != NULL) {
-							side=3;
-							cellptr = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[3]->maps_to_image_pixel = true;
-							mapped_source_pixels.push_back(cell[i][j]->neighbor[3]);
-						}
-					}
+					cell[i][j]->find_interpolation_neighbors(input_center_pt,cellptr1,cellptr2);
+					cellptr1->maps_to_image_pixel = true;
+					mapped_source_pixels.push_back(cellptr1);
+					cellptr2->maps_to_image_pixel = true;
+					mapped_source_pixels.push_back(cellptr2);
 				}
 				break;
 			}
@@ -1708,8 +1715,8 @@ bool SourcePixelGrid::subcell_assign_source_mapping_flags_interpolate(lensvector
 void SourcePixelGrid::calculate_Lmatrix_interpolate(const int img_index, const int image_pixel_i, const int image_pixel_j, int& index, lensvector &input_center_pt, const int& thread)
 {
 	for (int i=0; i < 3; i++) {
-		lens->Lmatrix_index_rows[img_index].push_back(image_pixel_grid->mapped_source_pixels[image_pixel_i][image_pixel_j][i]->active_index);
-		interpolation_pts[i][thread] = &image_pixel_grid->mapped_source_pixels[image_pixel_i][image_pixel_j][i]->center_pt;
+		lens->Lmatrix_index_rows[img_index].push_back(top_grid->image_pixel_grid->mapped_source_pixels[image_pixel_i][image_pixel_j][i]->active_index);
+		interpolation_pts[i][thread] = &top_grid->image_pixel_grid->mapped_source_pixels[image_pixel_i][image_pixel_j][i]->center_pt;
 	}
 
 	double d = ((*interpolation_pts[0][thread])[0]-(*interpolation_pts[1][thread])[0])*((*interpolation_pts[1][thread])[1]-(*interpolation_pts[2][thread])[1]) - ((*interpolation_pts[1][thread])[0]-(*interpolation_pts[2][thread])[0])*((*interpolation_pts[0][thread])[1]-(*interpolation_pts[1][thread])[1]);
@@ -1725,50 +1732,31 @@ double SourcePixelGrid::find_lensed_surface_brightness_interpolate(lensvector &i
 	lensvector *pts[3];
 	double *sb[3];
 	int indx=0;
+	int i,j;
 	nearest_interpolation_cells[thread].found_containing_cell = false;
-	for (int i=0; i < 3; i++) nearest_interpolation_cells[thread].pixel[i] = NULL;
-
-	imin[thread]=0; imax[thread]=u_N-1;
-	jmin[thread]=0; jmax[thread]=w_N-1;
-	if (bisection_search_interpolate(input_center_pt,thread)==false) return false;
+	for (i=0; i < 3; i++) nearest_interpolation_cells[thread].pixel[i] = NULL;
 
-	bool image_pixel_maps_to_source_grid = false;
-	int i,j,side;
-	for (j=jmin[thread]; j <= jmax[thread]; j++) {
-		for (i=imin[thread]; i <= imax[thread]; i++) {
-			if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
-				if (cell[i][j]->cell != NULL) cell[i][j]->find_interpolation_cells(input_center_pt,thread);
-				else {
-					nearest_interpolation_cells[thread].found_containing_cell = true;
-					nearest_interpolation_cells[thread].pixel[0] = cell[i][j];
-					if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-						if (cell[i][j]->neighbor[0]->cell != NULL) {
-							side=0;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0];
-					} else {
-						if (cell[i][j]->neighbor[1]->cell != NULL) {
-							side=1;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1];
-					}
-					if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-						if (cell[i][j]->neighbor[2]->cell != NULL) {
-							side=2;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2];
-					} else {
-						if (cell[i][j]->neighbor[3]->cell != NULL) {
-							side=3;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3];
+	SourcePixelGrid *cellptr;
+	if ((cell_lookup != NULL) and ((cellptr = find_containing_leaf_cell(input_center_pt)) != NULL)) {
+		nearest_interpolation_cells[thread].found_containing_cell = true;
+		nearest_interpolation_cells[thread].pixel[0] = cellptr;
+		cellptr->find_interpolation_neighbors(input_center_pt,nearest_interpolation_cells[thread].pixel[1],nearest_interpolation_cells[thread].pixel[2]);
+	} else {
+		imin[thread]=0; imax[thread]=u_N-1;
+		jmin[thread]=0; jmax[thread]=w_N-1;
+		if (bisection_search_interpolate(input_center_pt,thread)==false) return false;
+
+		for (j=jmin[thread]; j <= jmax[thread]; j++) {
+			for (i=imin[thread]; i <= imax[thread]; i++) {
+				if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
+					if (cell[i][j]->cell != NULL) cell[i][j]->find_interpolation_cells(input_center_pt,thread);
+					else {
+						nearest_interpolation_cells[thread].found_containing_cell = true;
+						nearest_interpolation_cells[thread].pixel[0] = cell[i][j];
+						cell[i][j]->find_interpolation_neighbors(input_center_pt,nearest_interpolation_cells[thread].pixel[1],nearest_interpolation_cells[thread].pixel[2]);
 					}
+					break;
 				}
-				break;
 			}
 		}
 	}
@@ -1790,7 +1778,7 @@ double SourcePixelGrid::find_lensed_surface_brightness_interpolate(lensvector &i
 
 void SourcePixelGrid::find_interpolation_cells(lensvector &input_center_pt, const int& thread)
 {
-	int i,j,side;
+	int i,j;
 	for (j=0; j < w_N; j++) {
 		for (i=0; i < u_N; i++) {
 			if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
@@ -1798,32 +1786,7 @@ void SourcePixelGrid::find_interpolation_cells(lensvector &input_center_pt, cons
 				else {
 					nearest_interpolation_cells[thread].found_containing_cell = true;
 					nearest_interpolation_cells[thread].pixel[0] = cell[i][j];
-					if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-						if (cell[i][j]->neighbor[0]->cell != NULL) {
-							side=0;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0];
-					} else {
-						if (cell[i][j]->neighbor[1]->cell != NULL) {
-							side=1;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1];
-					}
-					if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-						if (cell[i][j]->neighbor[2]->cell != NULL) {
-							side=2;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2];
-					} else {
-						if (cell[i][j]->neighbor[3]->cell != NULL) {
-							side=3;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3];
-					}
+					cell[i][j]->find_interpolation_neighbors(input_center_pt,nearest_interpolation_cells[thread].pixel[1],nearest_interpolation_cells[thread].pixel[2]);
 				}
 				break;
 			}
@@ -1831,6 +1794,137 @@ void SourcePixelGrid::find_interpolation_cells(lensvector &input_center_pt, cons
 	}
 }
 
+void SourcePixelGrid::find_interpolation_neighbors(lensvector &input_center_pt, SourcePixelGrid* &cellptr1, SourcePixelGrid* &cellptr2)
+{
+	// For a leaf cell containing the given point, finds the neighboring cells used for interpolation: the nearest cell in the
+	// x-direction (on the side of the point relative to the cell center) and likewise in the y-direction
+	int side;
+	if (((input_center_pt[0] > center_pt[0]) and (neighbor[0] != NULL)) or (neighbor[1] == NULL)) side=0;
+	else side=1;
+	if (neighbor[side]->cell != NULL) cellptr1 = neighbor[side]->find_nearest_neighbor_cell(input_center_pt,side);
+	else cellptr1 = neighbor[side];
+	if (((input_center_pt[1] > center_pt[1]) and (neighbor[2] != NULL)) or (neighbor[3] == NULL)) side=2;
+	else side=3;
+	if (neighbor[side]->cell != NULL) cellptr2 = neighbor[side]->find_nearest_neighbor_cell(input_center_pt,side);
+	else cellptr2 = neighbor[side];
+}
+
+void SourcePixelGrid::build_cell_lookup_table()
+{
+	// Called from the top-level grid whenever the grid has been constructed or split (or regridded after unsplitting cells),
+	// so the table is built once per grid rather than every time the cells are searched. Besides the absolute cap, the
+	// number of buckets is limited to a few per cell, so a grid with only a small region split down to the smallest cells
+	// does not get a table much larger than the grid itself.
+	delete_cell_lookup_table();
+	double dx=1e30, dy=1e30;
+	find_smallest_cell_size(dx,dy);
+	lookup_xmin = cell[0][0]->corner_pt[0][0];
+	lookup_ymin = cell[0][0]->corner_pt[0][1];
+	double xlength = cell[u_N-1][w_N-1]->corner_pt[3][0] - lookup_xmin;
+	double ylength = cell[u_N-1][w_N-1]->corner_pt[3][1] - lookup_ymin;
+	lookup_nx = (int) (xlength/dx + 0.5);
+	lookup_ny = (int) (ylength/dy + 0.5);
+	if (lookup_nx < 1) lookup_nx = 1;
+	if (lookup_ny < 1) lookup_ny = 1;
+	double bucket_limit = lookup_buckets_per_cell*((double) top_grid->number_of_pixels);
+	if (bucket_limit > max_lookup_buckets) bucket_limit = max_lookup_buckets;
+	while ((((double) lookup_nx)*lookup_ny > bucket_limit) and ((lookup_nx > 1) or (lookup_ny > 1))) {
+		// the buckets will then be larger than the smallest cells, so finding the leaf cell may require descending a few levels
+		lookup_nx = (lookup_nx+1)/2;
+		lookup_ny = (lookup_ny+1)/2;
+	}
+	lookup_dx = xlength/lookup_nx;
+	lookup_dy = ylength/lookup_ny;
+	cell_lookup = new SourcePixelGrid*[lookup_nx*lookup_ny];
+	for (int i=0; i < lookup_nx*lookup_ny; i++) cell_lookup[i] = NULL;
+	fill_cell_lookup_table(cell_lookup,lookup_nx,lookup_ny,lookup_xmin,lookup_ymin,lookup_dx,lookup_dy);
+}
+
+void SourcePixelGrid::delete_cell_lookup_table()
+{
+	if (cell_lookup != NULL) {
+		delete[] cell_lookup;
+		cell_lookup = NULL;
+	}
+}
+
+void SourcePixelGrid::invalidate_cell_lookup_table()
+{
+	// called when subcells are removed, since the table (kept in the top-level grid) may then point to deleted cells; until
+	// the table is rebuilt, cells are found with the recursive search
+	SourcePixelGrid *top = this;
+	while (top->parent_cell != NULL) top = top->parent_cell;
+	top->delete_cell_lookup_table();
+}
+
+void SourcePixelGrid::find_smallest_cell_size(double& dx, double& dy)
+{
+	int i,j;
+	for (j=0; j < w_N; j++) {
+		for (i=0; i < u_N; i++) {
+			if (cell[i][j]->cell != NULL) cell[i][j]->find_smallest_cell_size(dx,dy);
+			else {
+				if (cell[i][j]->corner_pt[2][0] - cell[i][j]->corner_pt[0][0] < dx) dx = cell[i][j]->corner_pt[2][0] - cell[i][j]->corner_pt[0][0];
+				if (cell[i][j]->corner_pt[1][1] - cell[i][j]->corner_pt[0][1] < dy) dy = cell[i][j]->corner_pt[1][1] - cell[i][j]->corner_pt[0][1];
+			}
+		}
+	}
+}
+
+void SourcePixelGrid::fill_cell_lookup_table(SourcePixelGrid** table, const int nx, const int ny, const double xmin, const double ymin, const double dx, const double dy)
+{
+	// Each cell is assigned to the buckets that lie entirely within it; since the subcells are assigned after their parent, each
+	// bucket ends up pointing to the smallest cell that contains it. A small tolerance allows for roundoff in the cell corners.
+	static const double tol = 1e-6;
+	int i,j,a,b,a_start,a_end,b_start,b_end;
+	for (j=0; j < w_N; j++) {
+		for (i=0; i < u_N; i++) {
+			a_start = (int) ceil((cell[i][j]->corner_pt[0][0] - xmin)/dx - tol);
+			a_end = (int) floor((cell[i][j]->corner_pt[2][0] - xmin)/dx + tol);
+			b_start = (int) ceil((cell[i][j]->corner_pt[0][1] - ymin)/dy - tol);
+			b_end = (int) floor((cell[i][j]->corner_pt[1][1] - ymin)/dy + tol);
+			if (a_start < 0) a_start = 0;
+			if (b_start < 0) b_start = 0;
+			if (a_end > nx) a_end = nx;
+			if (b_end > ny) b_end = ny;
+			for (b=b_start; b < b_end; b++) {
+				for (a=a_start; a < a_end; a++) table[b*nx+a] = cell[i][j];
+			}
+			if (cell[i][j]->cell != NULL) cell[i][j]->fill_cell_lookup_table(table,nx,ny,xmin,ymin,dx,dy);
+		}
+	}
+}
+
+SourcePixelGrid* SourcePixelGrid::find_containing_leaf_cell(lensvector &input_center_pt)
+{
+	// Returns the leaf cell containing the point, using the same criterion as the recursive search (so that the result is
+	// identical); returns NULL if the point is outside the table, or falls in a bucket whose cell does not contain it due to
+	// roundoff at the bucket edges, in which case the caller should fall back on the recursive search.
+	int a = (int) floor((input_center_pt[0] - lookup_xmin)/lookup_dx);
+	int b = (int) floor((input_center_pt[1] - lookup_ymin)/lookup_dy);
+	if ((a < 0) or (a >= lookup_nx) or (b < 0) or (b >= lookup_ny)) return NULL;
+	SourcePixelGrid *cellptr = cell_lookup[b*lookup_nx+a];
+	if (cellptr==NULL) return NULL;
+	if ((input_center_pt[0] < cellptr->corner_pt[0][0]) or (input_center_pt[0] >= cellptr->corner_pt[2][0]) or (input_center_pt[1] < cellptr->corner_pt[0][1]) or (input_center_pt[1] >= cellptr->corner_pt[3][1])) return NULL;
+	int i,j;
+	bool found;
+	while (cellptr->cell != NULL) {
+		found = false;
+		for (j=0; j < cellptr->w_N; j++) {
+			for (i=0; i < cellptr->u_N; i++) {
+				if ((input_center_pt[0] >= cellptr->cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cellptr->cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cellptr->cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cellptr->cell[i][j]->corner_pt[3][1])) {
+					cellptr = cellptr->cell[i][j];
+					found = true;
+					break;
+				}
+			}
+			if (found) break;
+		}
+		if (!found) return NULL;
+	}
+	return cellptr;
+}
+
 SourcePixelGrid* SourcePixelGrid::find_nearest_neighbor_cell(lensvector &input_center_pt, const int& side)
 {
 	int i,ncells;
@@ -2494,7 +2588,7 @@ void Lens::generate_Rmatrix_from_gmatrices()
 
 int SourcePixelGrid::assign_indices_and_count_levels()
 {
-	levels=1; // we are going to recount the number of levels
+	top_grid->levels=1; // we are going to recount the number of levels
 	int source_pixel_i=0;
 	assign_indices(source_pixel_i);
 	return source_pixel_i;
@@ -2502,7 +2596,7 @@ int SourcePixelGrid::assign_indices_and_count_levels()
 
 void SourcePixelGrid::assign_indices(int& source_pixel_i)
 {
-	if (levels < level+1) levels=level+1;
+	if (top_grid->levels < level+1) top_grid->levels=level+1;
 	int i, j;
 	for (j=0; j < w_N; j++) {
 		for (i=0; i < u_N; i++) {
@@ -2529,20 +2623,31 @@ void SourcePixelGrid::print_indices()
 	}
 }
 
-bool SourcePixelGrid::regrid_if_unmapped_source_subcells;
-bool SourcePixelGrid::activate_unmapped_source_pixels;
-bool SourcePixelGrid::exclude_source_pixels_outside_fit_window;
 
 int SourcePixelGrid::assign_active_indices_and_count_source_pixels(bool regrid_if_inactive_cells, bool activate_unmapped_pixels, bool exclude_pixels_outside_window)
 {
-	regrid_if_unmapped_source_subcells = regrid_if_inactive_cells;
-	activate_unmapped_source_pixels = activate_unmapped_pixels;
-	exclude_source_pixels_outside_fit_window = exclude_pixels_outside_window;
+	top_grid->regrid_if_unmapped_source_subcells = regrid_if_inactive_cells;
+	top_grid->activate_unmapped_source_pixels = activate_unmapped_pixels;
+	top_grid->exclude_source_pixels_outside_fit_window = exclude_pixels_outside_window;
+	top_grid->clear_inversion_cache(); // the active pixels may change
 	int source_pixel_i=0;
 	assign_active_indices(source_pixel_i);
 	return source_pixel_i;
 }
 
+void SourcePixelGrid::clear_inversion_cache()
+{
+	if (mg_n_coarse_levels > 0) {
+		for (int l=0; l < mg_n_coarse_levels; l++) delete[] mg_aggregate_index[l];
+	}
+	if (mg_aggregate_index != NULL) delete[] mg_aggregate_index;
+	if (mg_n_aggregates != NULL) delete[] mg_n_aggregates;
+	mg_n_coarse_levels = -1;
+	mg_n_aggregates = NULL;
+	mg_aggregate_index = NULL;
+	Rmatrix_logdet_found = false;
+}
+
 ofstream SourcePixelGrid::missed_cells_out; // remove later?
 
 void SourcePixelGrid::assign_active_indices(int& source_pixel_i)
@@ -2560,16 +2665,16 @@ void SourcePixelGrid::assign_active_indices(int& source_pixel_i)
 					cell[i][j]->active_pixel = true;
 				} else {
 					if (lens->mpi_id==0) warn(lens->warnings,"A source pixel does not map to any image pixel (for source pixel %i,%i), level %i, center (%g,%g)",i,j,cell[i][j]->level,cell[i][j]->center_pt[0],cell[i][j]->center_pt[1]);
-					if ((activate_unmapped_source_pixels) and ((!regrid_if_unmapped_source_subcells) or (level==0))) { // if we are removing unmapped subpixels, we may still want to activate first-level unmapped pixels
-						if ((exclude_source_pixels_outside_fit_window) and (cell[i][j]->maps_to_image_window==false)) ;
+					if ((top_grid->activate_unmapped_source_pixels) and ((!top_grid->regrid_if_unmapped_source_subcells) or (level==0))) { // if we are removing unmapped subpixels, we may still want to activate first-level unmapped pixels
+						if ((top_grid->exclude_source_pixels_outside_fit_window) and (cell[i][j]->maps_to_image_window==false)) ;
 						else {
 							cell[i][j]->active_index = source_pixel_i++;
 							cell[i][j]->active_pixel = true;
 						}
 					} else {
 						cell[i][j]->active_pixel = false;
-						if ((regrid_if_unmapped_source_subcells) and (level >= 1)) {
-							if (!regrid) regrid = true;
+						if ((top_grid->regrid_if_unmapped_source_subcells) and (level >= 1)) {
+							if (!top_grid->regrid) top_grid->regrid = true;
 							unsplit_cell = true;
 						}
 						//missed_cells_out << cell[i][j]->center_pt[0] << " " << cell[i][j]->center_pt[1] << endl;
@@ -2588,8 +2693,93 @@ void SourcePixelGrid::assign_active_indices(int& source_pixel_i)
 	if (unsplit_cell) unsplit();
 }
 
+void SourcePixelGrid::find_active_pixel_ancestors(SourcePixelGrid*** ancestors, int* pixel_level, int* firstlevel_i, int* firstlevel_j, const int i0, const int j0)
+{
+	// For each active pixel, records the cells containing it at each level (ancestors[k][l-1] is the cell at level l, so the
+	// last one is the pixel itself), along with the indices of the first-level cell that contains it
+	int i,j,k,fi,fj;
+	SourcePixelGrid *cellptr;
+	for (j=0; j < w_N; j++) {
+		for (i=0; i < u_N; i++) {
+			fi = (level==0) ? i : i0;
+			fj = (level==0) ? j : j0;
+			if (cell[i][j]->cell != NULL) cell[i][j]->find_active_pixel_ancestors(ancestors,pixel_level,firstlevel_i,firstlevel_j,fi,fj);
+			else if (cell[i][j]->active_pixel) {
+				k = cell[i][j]->active_index;
+				pixel_level[k] = cell[i][j]->level;
+				firstlevel_i[k] = fi;
+				firstlevel_j[k] = fj;
+				ancestors[k] = new SourcePixelGrid*[pixel_level[k]];
+				for (cellptr = cell[i][j]; cellptr->level > 0; cellptr = cellptr->parent_cell) ancestors[k][cellptr->level-1] = cellptr;
+			}
+		}
+	}
+}
+
+#ifdef USE_MPI
+void SourcePixelGrid::sum_cell_data_over_group(const int cell_level)
+{
+	// With image-pixel decomposition, each process only finds the magnifications (and number of images) of the source cells
+	// from its own rows of image pixels; these are summed over the group for all the cells at the given level, and a cell
+	// maps to the fit window if it does so for any process
+	vector<double> celldata;
+	int k=0;
+	transfer_cell_data(celldata,k,cell_level,false);
+	if (celldata.size()==0) return;
+	MPI_Allreduce(MPI_IN_PLACE,celldata.data(),celldata.size(),MPI_DOUBLE,MPI_SUM,*(lens->group_comm));
+	k=0;
+	transfer_cell_data(celldata,k,cell_level,true);
+}
+
+void SourcePixelGrid::transfer_cell_data(vector<double>& celldata, int& k, const int cell_level, const bool unpack)
+{
+	int i,j;
+	for (j=0; j < w_N; j++) {
+		for (i=0; i < u_N; i++) {
+			if (cell[i][j]->level==cell_level) {
+				if (unpack) {
+					cell[i][j]->total_magnification = celldata[k++];
+					cell[i][j]->n_images = celldata[k++];
+					cell[i][j]->maps_to_image_window = (celldata[k++] > 0);
+				} else {
+					celldata.push_back(cell[i][j]->total_magnification);
+					celldata.push_back((lens->n_image_prior) ? cell[i][j]->n_images : 0);
+					celldata.push_back((cell[i][j]->maps_to_image_window) ? 1 : 0);
+				}
+			}
+			else if (cell[i][j]->cell != NULL) cell[i][j]->transfer_cell_data(celldata,k,cell_level,unpack);
+		}
+	}
+}
+
+void SourcePixelGrid::combine_mapping_flags_over_group()
+{
+	// a source pixel maps to an image pixel if it does so for any process in the group
+	vector<int> flags;
+	int k=0;
+	transfer_mapping_flags(flags,k,false);
+	MPI_Allreduce(MPI_IN_PLACE,flags.data(),flags.size(),MPI_INT,MPI_MAX,*(lens->group_comm));
+	k=0;
+	transfer_mapping_flags(flags,k,true);
+}
+
+void SourcePixelGrid::transfer_mapping_flags(vector<int>& flags, int& k, const bool unpack)
+{
+	int i,j;
+	for (j=0; j < w_N; j++) {
+		for (i=0; i < u_N; i++) {
+			if (cell[i][j]->cell != NULL) cell[i][j]->transfer_mapping_flags(flags,k,unpack);
+			else if (unpack) cell[i][j]->maps_to_image_pixel = (flags[k++]==1);
+			else flags.push_back((cell[i][j]->maps_to_image_pixel) ? 1 : 0);
+		}
+	}
+}
+#endif
+
 SourcePixelGrid::~SourcePixelGrid()
 {
+	delete_cell_lookup_table();
+	clear_inversion_cache();
 	if (cell != NULL) {
 		int i,j;
 		for (i=0; i < u_N; i++) {
@@ -2602,6 +2792,7 @@ SourcePixelGrid::~SourcePixelGrid()
 
 void SourcePixelGrid::clear()
 {
+	delete_cell_lookup_table();
 	if (cell == NULL) return;
 
 	int i,j;
@@ -2618,6 +2809,7 @@ void SourcePixelGrid::clear_subgrids()
 {
 	if (level>0) {
 		if (cell == NULL) return;
+		invalidate_cell_lookup_table();
 		int i,j;
 		for (i=0; i < u_N; i++) {
 			for (j=0; j < w_N; j++) {
@@ -2627,7 +2819,7 @@ void SourcePixelGrid::clear_subgrids()
 		}
 		delete[] cell;
 		cell = NULL;
-		number_of_pixels -= (u_N*w_N - 1);
+		top_grid->number_of_pixels -= (u_N*w_N - 1);
 		u_N=1; w_N=1;
 	} else {
 		int i,j;
@@ -2639,6 +2831,204 @@ void SourcePixelGrid::clear_subgrids()
 	}
 }
 
+/*************************************** Functions in class DelaunaySourceGrid **************************************/
+
+DelaunaySourceGrid::DelaunaySourceGrid(Lens* lens_in, ImagePixelGrid* image_pixel_grid_in, const int stride) : lens(lens_in), image_pixel_grid(image_pixel_grid_in)
+{
+	int i,j,k,n=0;
+	x_N = image_pixel_grid->x_N;
+	y_N = image_pixel_grid->y_N;
+	for (j=0; j < y_N; j += stride) {
+		for (i=0; i < x_N; i += stride) {
+			if ((image_pixel_grid->fit_to_data == NULL) or (image_pixel_grid->fit_to_data[i][j])) n++;
+		}
+	}
+	if (n < 3) die("not enough image pixels in the fit window to construct a Delaunay source grid");
+	srcpts_x = new double[n];
+	srcpts_y = new double[n];
+	n_srcpts = 0;
+	// rows are traversed in alternating directions so that consecutive points are always close together, which speeds
+	// up the point location during the triangulation
+	int ii;
+	for (j=0, k=0; j < y_N; j += stride, k++) {
+		for (ii=0; ii < x_N; ii += stride) {
+			i = (k % 2 == 0) ? ii : ((x_N-1)/stride)*stride - ii;
+			if ((image_pixel_grid->fit_to_data == NULL) or (image_pixel_grid->fit_to_data[i][j])) {
+				srcpts_x[n_srcpts] = image_pixel_grid->center_sourcepts[i][j][0];
+				srcpts_y[n_srcpts] = image_pixel_grid->center_sourcepts[i][j][1];
+				n_srcpts++;
+			}
+		}
+	}
+	triangulation = new Delaunay(srcpts_x,srcpts_y,n_srcpts);
+	int n_included = 0;
+	for (k=0; k < n_srcpts; k++) if (triangulation->point_included(k)) n_included++;
+	if (n_included < n_srcpts) {
+		// points that coincide (which can happen if the lens is symmetric) are removed, so each source pixel is a vertex
+		for (k=0, n=0; k < n_srcpts; k++) {
+			if (triangulation->point_included(k)) {
+				srcpts_x[n] = srcpts_x[k];
+				srcpts_y[n] = srcpts_y[k];
+				n++;
+			}
+		}
+		n_srcpts = n;
+		delete triangulation;
+		triangulation = new Delaunay(srcpts_x,srcpts_y,n_srcpts);
+	}
+
+	surface_brightness = new double[n_srcpts];
+	total_magnification = new double[n_srcpts];
+	n_images = new double[n_srcpts];
+	neighbors = new vector<int>[n_srcpts];
+	boundary_pt = new bool[n_srcpts];
+	for (k=0; k < n_srcpts; k++) surface_brightness[k] = total_magnification[k] = n_images[k] = 0;
+	triangulation->find_vertex_neighbors(neighbors,boundary_pt);
+
+	image_pixel_triangle = new int*[x_N];
+	image_pixel_weights = new double*[x_N];
+	for (i=0; i < x_N; i++) {
+		image_pixel_triangle[i] = new int[y_N];
+		image_pixel_weights[i] = new double[3*y_N];
+		for (j=0; j < y_N; j++) image_pixel_triangle[i][j] = -1;
+	}
+}
+
+int DelaunaySourceGrid::assign_image_mapping_flags()
+{
+	// An image pixel maps to the source grid if its ray-traced center lies inside the triangulation. Returns the number of
+	// source pixels (all the points of the triangulation are used as source pixels).
+	int i,j;
+	image_pixel_grid->n_active_pixels = 0;
+	for (j=0; j < y_N; j++) {
+		for (i=0; i < x_N; i++) {
+			image_pixel_grid->mapped_source_pixels[i][j].clear();
+			image_pixel_grid->maps_to_source_pixel[i][j] = false;
+			image_pixel_triangle[i][j] = -1;
+		}
+	}
+	int n_active_pixels = 0;
+	#pragma omp parallel
+	{
+		int tri = 0; // the search for each pixel starts from the triangle found for the previous pixel
+		#pragma omp for private(i,j) schedule(static) reduction(+:n_active_pixels)
+		for (j=0; j < y_N; j++) {
+			for (i=0; i < x_N; i++) {
+				if ((image_pixel_grid->fit_to_data == NULL) or (image_pixel_grid->fit_to_data[i][j])) {
+					if (triangulation->find_triangle(image_pixel_grid->center_sourcepts[i][j][0],image_pixel_grid->center_sourcepts[i][j][1],tri,image_pixel_weights[i]+3*j)) {
+						image_pixel_triangle[i][j] = tri;
+						image_pixel_grid->maps_to_source_pixel[i][j] = true;
+						n_active_pixels++;
+					}
+				}
+			}
+		}
+	}
+	image_pixel_grid->n_active_pixels = n_active_pixels;
+	return n_srcpts;
+}
+
+void DelaunaySourceGrid::calculate_Lmatrix(const int img_index, const int image_pixel_i, const int image_pixel_j, int& Lmatrix_index)
+{
+	const Triangle& tri = triangulation->triangle(image_pixel_triangle[image_pixel_i][image_pixel_j]);
+	double *weights = image_pixel_weights[image_pixel_i] + 3*image_pixel_j;
+	for (int k=0; k < 3; k++) {
+		lens->Lmatrix_index_rows[img_index].push_back(tri.vertex[k]);
+		lens->Lmatrix_rows[img_index].push_back(weights[k]);
+		Lmatrix_index++;
+	}
+}
+
+void DelaunaySourceGrid::calculate_pixel_magnifications()
+{
+	// As for the adaptive grid, the total magnification of a source pixel is the image-plane area that maps to it divided by
+	// its source-plane area, and n_images is the corresponding source-plane area divided by the pixel area; here the area of
+	// each image pixel is shared among the triangle vertices according to the interpolation weights, and the area of a
+	// source pixel is taken to be one third of the area of the triangles it belongs to.
+	int i,j,k;
+	double *pixel_area = new double[n_srcpts];
+	for (k=0; k < n_srcpts; k++) total_magnification[k] = n_images[k] = pixel_area[k] = 0;
+	for (i=0; i < triangulation->n_triangles(); i++) {
+		double area = triangulation->triangle_area(i)/3;
+		for (k=0; k < 3; k++) pixel_area[triangulation->triangle(i).vertex[k]] += area;
+	}
+	double image_pixel_area = image_pixel_grid->pixel_xlength*image_pixel_grid->pixel_ylength;
+	int src_index;
+	double weight;
+	for (j=0; j < y_N; j++) {
+		for (i=0; i < x_N; i++) {
+			if (image_pixel_triangle[i][j] < 0) continue;
+			const Triangle& tri = triangulation->triangle(image_pixel_triangle[i][j]);
+			for (k=0; k < 3; k++) {
+				src_index = tri.vertex[k];
+				weight = image_pixel_weights[i][3*j+k];
+				total_magnification[src_index] += weight*image_pixel_area;
+				if (image_pixel_grid->center_magnifications[i][j] != 0) n_images[src_index] += weight*image_pixel_area/image_pixel_grid->center_magnifications[i][j];
+			}
+		}
+	}
+	for (k=0; k < n_srcpts; k++) {
+		if (pixel_area[k] > 0) {
+			total_magnification[k] /= pixel_area[k];
+			n_images[k] /= pixel_area[k];
+		}
+	}
+	delete[] pixel_area;
+}
+
+void DelaunaySourceGrid::interpolate(const double x, const double y, int& tri, double& sb, double& mag, double& nimg)
+{
+	// interpolates the surface brightness, magnification and number of images at the given point (all are zero outside the
+	// triangulation); tri is the triangle to start the search from, and is updated
+	double weights[3];
+	if (!triangulation->find_triangle(x,y,tri,weights)) {
+		sb = mag = nimg = 0;
+		return;
+	}
+	const int *v = triangulation->triangle(tri).vertex;
+	sb = weights[0]*surface_brightness[v[0]] + weights[1]*surface_brightness[v[1]] + weights[2]*surface_brightness[v[2]];
+	mag = weights[0]*total_magnification[v[0]] + weights[1]*total_magnification[v[1]] + weights[2]*total_magnification[v[2]];
+	nimg = weights[0]*n_images[v[0]] + weights[1]*n_images[v[1]] + weights[2]*n_images[v[2]];
+}
+
+void DelaunaySourceGrid::update_surface_brightness(const double* sb)
+{
+	for (int k=0; k < n_srcpts; k++) surface_brightness[k] = sb[k];
+}
+
+void DelaunaySourceGrid::fill_n_image_vector()
+{
+	for (int k=0; k < n_srcpts; k++) lens->source_pixel_n_images[k] = n_images[k];
+}
+
+void DelaunaySourceGrid::clear_image_mapping()
+{
+	// the mapping of the image pixels is only needed while the matrices are constructed; the triangulation and the source
+	// solution are kept so the source can be displayed
+	if (image_pixel_triangle==NULL) return;
+	for (int i=0; i < x_N; i++) {
+		delete[] image_pixel_triangle[i];
+		delete[] image_pixel_weights[i];
+	}
+	delete[] image_pixel_triangle;
+	delete[] image_pixel_weights;
+	image_pixel_triangle = NULL;
+	image_pixel_weights = NULL;
+}
+
+DelaunaySourceGrid::~DelaunaySourceGrid()
+{
+	clear_image_mapping();
+	delete triangulation;
+	delete[] srcpts_x;
+	delete[] srcpts_y;
+	delete[] surface_brightness;
+	delete[] total_magnification;
+	delete[] n_images;
+	delete[] neighbors;
+	delete[] boundary_pt;
+}
+
 /***************************************** Functions in class ImagePixelGrid ****************************************/
 
 void ImagePixelData::load_data(string root)
@@ -2659,6 +3049,7 @@ void ImagePixelData::load_data(string root)
 		for (i=0; i < npixels_x; i++) delete[] require_fit[i];
 		delete[] require_fit;
 	}
+	clear_noise_map();
 
 	ifstream xfile(xfilename.c_str());
 	i=0;
@@ -2710,6 +3101,7 @@ bool ImagePixelData::load_data_fits(bool use_pixel_size, string fits_filename)
 		for (i=0; i < npixels_x; i++) delete[] require_fit[i];
 		delete[] require_fit;
 	}
+	clear_noise_map();
 
 	fitsfile *fptr;   // FITS file pointer, defined in fitsio.h
 	int status = 0;   // CFITSIO status value MUST be initialized to zero!
@@ -2823,9 +3215,102 @@ bool ImagePixelData::load_mask_fits(string fits_filename)
 #endif
 }
 
-bool Lens::load_psf_fits(string fits_filename)
+bool ImagePixelData::load_noise_map(string filename, const bool weight_map)
 {
-#ifndef USE_FITS
+	// text file with the same layout as the surface brightness (.dat) file; if weight_map is false, each entry is taken to be
+	// the noise (sigma) of that pixel, otherwise it is the weight (inverse variance). Pixels with zero weight are left out of the fit.
+	if (surface_brightness==NULL) { cout << "Error: pixel data must be loaded before loading a noise map\n"; return false; }
+	ifstream noisefile(filename.c_str());
+	if (!noisefile.is_open()) { cout << "Error: could not open noise map file '" << filename << "'\n"; return false; }
+	int i,j;
+	double **weights = new double*[npixels_x];
+	for (i=0; i < npixels_x; i++) weights[i] = new double[npixels_y];
+	bool load_status = true;
+	double val;
+	for (j=0; j < npixels_y; j++) {
+		for (i=0; i < npixels_x; i++) {
+			if (!(noisefile >> val)) { load_status = false; break; }
+			if (weight_map) weights[i][j] = (val > 0) ? val : 0;
+			else weights[i][j] = (val > 0) ? 1.0/(val*val) : 0;
+		}
+		if (!load_status) break;
+	}
+	if (!load_status) {
+		cout << "Error: number of pixels in noise map file does not match number of pixels in loaded data\n";
+		for (i=0; i < npixels_x; i++) delete[] weights[i];
+		delete[] weights;
+		return false;
+	}
+	clear_noise_map();
+	noise_weight = weights;
+	return true;
+}
+
+bool ImagePixelData::load_noise_map_fits(string fits_filename, const bool weight_map)
+{
+#ifndef USE_FITS
+	cout << "FITS capability disabled; QLens must be compiled with the CFITSIO library to read FITS files\n"; return false;
+#else
+	if (surface_brightness==NULL) { cout << "Error: pixel data must be loaded before loading a noise map\n"; return false; }
+	bool image_load_status = false;
+	int i,j,kk;
+
+	fitsfile *fptr;   // FITS file pointer, defined in fitsio.h
+	int status = 0;   // CFITSIO status value MUST be initialized to zero!
+	int bitpix, naxis;
+	long naxes[2] = {1,1};
+	double *pixels;
+
+	if (!fits_open_file(&fptr, fits_filename.c_str(), READONLY, &status))
+	{
+		if (!fits_get_img_param(fptr, 2, &bitpix, &naxis, naxes, &status) )
+		{
+			if (naxis == 0) {
+				die("Error: only 1D or 2D images are supported (dimension is %i)\n",naxis);
+			} else {
+				kk=0;
+				long fpixel[naxis];
+				for (kk=0; kk < naxis; kk++) fpixel[kk] = 1;
+				if ((naxes[0] != npixels_x) or (naxes[1] != npixels_y)) { cout << "Error: number of pixels in noise map file does not match number of pixels in loaded data\n"; fits_close_file(fptr, &status); return false; }
+				clear_noise_map();
+				noise_weight = new double*[npixels_x];
+				for (i=0; i < npixels_x; i++) noise_weight[i] = new double[npixels_y];
+				pixels = new double[npixels_x];
+				for (fpixel[1]=1, j=0; fpixel[1] <= naxes[1]; fpixel[1]++, j++)
+				{
+					if (fits_read_pix(fptr, TDOUBLE, fpixel, naxes[0], NULL, pixels, NULL, &status) )  // read row of pixels
+						break; // jump out of loop on error
+
+					for (i=0; i < naxes[0]; i++) {
+						if (weight_map) noise_weight[i][j] = (pixels[i] > 0) ? pixels[i] : 0;
+						else noise_weight[i][j] = (pixels[i] > 0) ? 1.0/(pixels[i]*pixels[i]) : 0;
+					}
+				}
+				delete[] pixels;
+				if (status) clear_noise_map();
+				else image_load_status = true;
+			}
+		}
+		fits_close_file(fptr, &status);
+	} 
+
+	if (status) fits_report_error(stderr, status); // print any error message
+	return image_load_status;
+#endif
+}
+
+void ImagePixelData::clear_noise_map()
+{
+	if (noise_weight != NULL) {
+		for (int i=0; i < npixels_x; i++) delete[] noise_weight[i];
+		delete[] noise_weight;
+		noise_weight = NULL;
+	}
+}
+
+bool Lens::load_psf_fits(string fits_filename)
+{
+#ifndef USE_FITS
 	cout << "FITS capability disabled; QLens must be compiled with the CFITSIO library to read FITS files\n"; return false;
 #else
 	use_input_psf_matrix = true;
@@ -2941,6 +3426,7 @@ ImagePixelData::~ImagePixelData()
 		for (int i=0; i < npixels_x; i++) delete[] surface_brightness[i];
 		delete[] surface_brightness;
 	}
+	clear_noise_map();
 }
 
 void ImagePixelData::set_no_required_data_pixels()
@@ -3165,6 +3651,12 @@ ImagePixelGrid::ImagePixelGrid(Lens* lens_in, RayTracingMethod method, double xm
 	maps_to_source_pixel = new bool*[x_N];
 	pixel_index = new int*[x_N];
 	mapped_source_pixels = new vector<SourcePixelGrid*>*[x_N];
+	n_supersampled_pixels = supersampling_nsplit = 0;
+	row_block_start = NULL;
+	halo_rows = 0;
+	own_rows_traced_only = false;
+	supersampled_pixel_i = supersampled_pixel_j = NULL;
+	supersampled_srcx = supersampled_srcy = supersampled_sb = NULL;
 	surface_brightness = new double*[x_N];
 	source_plane_triangle1_area = new double*[x_N];
 	source_plane_triangle2_area = new double*[x_N];
@@ -3190,6 +3682,8 @@ ImagePixelGrid::ImagePixelGrid(Lens* lens_in, RayTracingMethod method, double xm
 	pixel_ylength = (ymax-ymin)/y_N;
 	triangle_area = 0.5*pixel_xlength*pixel_ylength;
 
+	ProfileTimer profile_timer(PROF_RAY_TRACING);
+	Profiler::add_count(PROF_RAYS_TRACED,(x_N+1)*(y_N+1) + x_N*y_N);
 #ifdef USE_OPENMP
 	double wtime0, wtime;
 	if (lens->show_wtime) {
@@ -3201,9 +3695,9 @@ ImagePixelGrid::ImagePixelGrid(Lens* lens_in, RayTracingMethod method, double xm
 	{
 		int thread;
 #ifdef USE_OPENMP
-		thread = omp_get_thread_num();
+		thread = lens->lens_thread + omp_get_thread_num();
 #else
-		thread = 0;
+		thread = lens->lens_thread;
 #endif
 		double x,y;
 		lensvector d1,d2,d3,d4;
@@ -3268,6 +3762,12 @@ ImagePixelGrid::ImagePixelGrid(Lens* lens_in, ImagePixelGrid* input_pixel_grid)
 	maps_to_source_pixel = new bool*[x_N];
 	pixel_index = new int*[x_N];
 	mapped_source_pixels = new vector<SourcePixelGrid*>*[x_N];
+	n_supersampled_pixels = supersampling_nsplit = 0;
+	row_block_start = NULL;
+	halo_rows = 0;
+	own_rows_traced_only = false;
+	supersampled_pixel_i = supersampled_pixel_j = NULL;
+	supersampled_srcx = supersampled_srcy = supersampled_sb = NULL;
 	surface_brightness = new double*[x_N];
 	source_plane_triangle1_area = new double*[x_N];
 	source_plane_triangle2_area = new double*[x_N];
@@ -3341,6 +3841,12 @@ ImagePixelGrid::ImagePixelGrid(Lens* lens_in, RayTracingMethod method, ImagePixe
 	fit_to_data = new bool*[x_N];
 	pixel_index = new int*[x_N];
 	mapped_source_pixels = new vector<SourcePixelGrid*>*[x_N];
+	n_supersampled_pixels = supersampling_nsplit = 0;
+	row_block_start = NULL;
+	halo_rows = 0;
+	own_rows_traced_only = false;
+	supersampled_pixel_i = supersampled_pixel_j = NULL;
+	supersampled_srcx = supersampled_srcy = supersampled_sb = NULL;
 	surface_brightness = new double*[x_N];
 	source_plane_triangle1_area = new double*[x_N];
 	source_plane_triangle2_area = new double*[x_N];
@@ -3368,6 +3874,8 @@ ImagePixelGrid::ImagePixelGrid(Lens* lens_in, RayTracingMethod method, ImagePixe
 	max_sb = -1e30;
 	triangle_area = 0.5*pixel_xlength*pixel_ylength;
 
+	ProfileTimer profile_timer(PROF_RAY_TRACING);
+	Profiler::add_count(PROF_RAYS_TRACED,(x_N+1)*(y_N+1) + x_N*y_N);
 #ifdef USE_OPENMP
 	double wtime0, wtime;
 	if (lens->show_wtime) {
@@ -3379,9 +3887,9 @@ ImagePixelGrid::ImagePixelGrid(Lens* lens_in, RayTracingMethod method, ImagePixe
 	{
 		int thread;
 #ifdef USE_OPENMP
-		thread = omp_get_thread_num();
+		thread = lens->lens_thread + omp_get_thread_num();
 #else
-		thread = 0;
+		thread = lens->lens_thread;
 #endif
 		double x,y;
 		lensvector d1,d2,d3,d4;
@@ -3396,7 +3904,7 @@ ImagePixelGrid::ImagePixelGrid(Lens* lens_in, RayTracingMethod method, ImagePixe
 					lens->find_sourcept(center_pts[i][j],center_sourcepts[i][j],thread,zfactor);
 					center_magnifications[i][j] = abs(lens->magnification(center_pts[i][j],thread,zfactor));
 					surface_brightness[i][j] = pixel_data.surface_brightness[i][j];
-					fit_to_data[i][j] = pixel_data.require_fit[i][j];
+					fit_to_data[i][j] = pixel_data.fit_pixel(i,j);
 					if (surface_brightness[i][j] > max_sb) max_sb=surface_brightness[i][j];
 				}
 				corner_pts[i][j][0] = x;
@@ -3443,6 +3951,12 @@ ImagePixelGrid::ImagePixelGrid(double zfactor_in, RayTracingMethod method, Image
 	maps_to_source_pixel = new bool*[x_N];
 	pixel_index = new int*[x_N];
 	mapped_source_pixels = new vector<SourcePixelGrid*>*[x_N];
+	n_supersampled_pixels = supersampling_nsplit = 0;
+	row_block_start = NULL;
+	halo_rows = 0;
+	own_rows_traced_only = false;
+	supersampled_pixel_i = supersampled_pixel_j = NULL;
+	supersampled_srcx = supersampled_srcy = supersampled_sb = NULL;
 	surface_brightness = new double*[x_N];
 	source_plane_triangle1_area = new double*[x_N];
 	source_plane_triangle2_area = new double*[x_N];
@@ -3479,7 +3993,7 @@ ImagePixelGrid::ImagePixelGrid(double zfactor_in, RayTracingMethod method, Image
 				center_pts[i][j][0] = x + 0.5*pixel_xlength;
 				center_pts[i][j][1] = y + 0.5*pixel_ylength;
 				surface_brightness[i][j] = pixel_data.surface_brightness[i][j];
-				fit_to_data[i][j] = pixel_data.require_fit[i][j];
+				fit_to_data[i][j] = pixel_data.fit_pixel(i,j);
 				if (surface_brightness[i][j] > max_sb) max_sb=surface_brightness[i][j];
 			}
 			corner_pts[i][j][0] = x;
@@ -3501,7 +4015,7 @@ void ImagePixelGrid::set_fit_window(ImagePixelData& pixel_data)
 	}
 	for (j=0; j < y_N; j++) {
 		for (i=0; i < x_N; i++) {
-			fit_to_data[i][j] = pixel_data.require_fit[i][j];
+			fit_to_data[i][j] = pixel_data.fit_pixel(i,j);
 		}
 	}
 }
@@ -3527,6 +4041,7 @@ void ImagePixelGrid::redo_lensing_calculations()
 	MPI_Comm_create(*(lens->group_comm), *(lens->mpi_group), &sub_comm);
 #endif
 
+	ProfileTimer profile_timer(PROF_RAY_TRACING);
 #ifdef USE_OPENMP
 	double wtime0, wtime;
 	if (lens->show_wtime) {
@@ -3549,25 +4064,42 @@ void ImagePixelGrid::redo_lensing_calculations()
 	area_tri1 = new double[ntot_cells];
 	area_tri2 = new double[ntot_cells];
 
+	// With image-pixel decomposition, each process only ray traces the rows of its own block (and the halo rows around it)
+	// and keeps the results to itself. This is not possible with a Delaunay source grid, since every process needs all the
+	// traced points to construct the triangulation; in that case (as without decomposition), the tracing is divided up
+	// among the processes and the results are broadcast to all of them.
+	own_rows_traced_only = ((row_block_start != NULL) and (!lens->use_delaunay_srcgrid));
 	int mpi_chunk, mpi_start, mpi_end;
-	mpi_chunk = ntot_corners / lens->group_np;
-	mpi_start = lens->group_id*mpi_chunk;
-	if (lens->group_id == lens->group_np-1) mpi_chunk += (ntot_corners % lens->group_np); // assign the remainder elements to the last mpi process
-	mpi_end = mpi_start + mpi_chunk;
-
 	int mpi_chunk2, mpi_start2, mpi_end2;
-	mpi_chunk2 = ntot_cells / lens->group_np;
-	mpi_start2 = lens->group_id*mpi_chunk2;
-	if (lens->group_id == lens->group_np-1) mpi_chunk2 += (ntot_cells % lens->group_np); // assign the remainder elements to the last mpi process
-	mpi_end2 = mpi_start2 + mpi_chunk2;
+	if (own_rows_traced_only) {
+		int row_start, row_end;
+		find_row_block(lens->group_id,row_start,row_end,true);
+		mpi_start = row_start*(x_N+1);
+		mpi_end = (row_end+1)*(x_N+1); // includes the corners along the top edge of the last row
+		mpi_start2 = row_start*x_N;
+		mpi_end2 = row_end*x_N;
+		mpi_chunk = mpi_end - mpi_start;
+		mpi_chunk2 = mpi_end2 - mpi_start2;
+	} else {
+		mpi_chunk = ntot_corners / lens->group_np;
+		mpi_start = lens->group_id*mpi_chunk;
+		if (lens->group_id == lens->group_np-1) mpi_chunk += (ntot_corners % lens->group_np); // assign the remainder elements to the last mpi process
+		mpi_end = mpi_start + mpi_chunk;
+
+		mpi_chunk2 = ntot_cells / lens->group_np;
+		mpi_start2 = lens->group_id*mpi_chunk2;
+		if (lens->group_id == lens->group_np-1) mpi_chunk2 += (ntot_cells % lens->group_np); // assign the remainder elements to the last mpi process
+		mpi_end2 = mpi_start2 + mpi_chunk2;
+	}
+	Profiler::add_count(PROF_RAYS_TRACED,mpi_chunk + mpi_chunk2);
 
 	#pragma omp parallel
 	{
 		int thread;
 #ifdef USE_OPENMP
-		thread = omp_get_thread_num();
+		thread = lens->lens_thread + omp_get_thread_num();
 #else
-		thread = 0;
+		thread = lens->lens_thread;
 #endif
 		lensvector d1,d2,d3,d4;
 		#pragma omp for private(n,i,j) schedule(dynamic)
@@ -3578,6 +4110,7 @@ void ImagePixelGrid::redo_lensing_calculations()
 		}
 #ifdef USE_MPI
 		#pragma omp master
+		if (!own_rows_traced_only)
 		{
 			int id, chunk, start;
 			for (id=0; id < lens->group_np; id++) {
@@ -3612,30 +4145,37 @@ void ImagePixelGrid::redo_lensing_calculations()
 		}
 	}
 #ifdef USE_MPI
-	int id, chunk, start;
-	for (id=0; id < lens->group_np; id++) {
-		chunk = ntot_cells / lens->group_np;
-		start = id*chunk;
-		if (id == lens->group_np-1) chunk += (ntot_cells % lens->group_np); // assign the remainder elements to the last mpi process
-		MPI_Bcast(defx_centers+start,chunk,MPI_DOUBLE,id,sub_comm);
-		MPI_Bcast(defy_centers+start,chunk,MPI_DOUBLE,id,sub_comm);
-		MPI_Bcast(area_tri1+start,chunk,MPI_DOUBLE,id,sub_comm);
-		MPI_Bcast(area_tri2+start,chunk,MPI_DOUBLE,id,sub_comm);
+	if (own_rows_traced_only) {
+		MPI_Comm_free(&sub_comm);
+	} else {
+		int id, chunk, start;
+		for (id=0; id < lens->group_np; id++) {
+			chunk = ntot_cells / lens->group_np;
+			start = id*chunk;
+			if (id == lens->group_np-1) chunk += (ntot_cells % lens->group_np); // assign the remainder elements to the last mpi process
+			MPI_Bcast(defx_centers+start,chunk,MPI_DOUBLE,id,sub_comm);
+			MPI_Bcast(defy_centers+start,chunk,MPI_DOUBLE,id,sub_comm);
+			MPI_Bcast(area_tri1+start,chunk,MPI_DOUBLE,id,sub_comm);
+			MPI_Bcast(area_tri2+start,chunk,MPI_DOUBLE,id,sub_comm);
+		}
+		MPI_Comm_free(&sub_comm);
+		mpi_start = 0; mpi_end = ntot_corners;
+		mpi_start2 = 0; mpi_end2 = ntot_cells;
 	}
-	MPI_Comm_free(&sub_comm);
 #endif
-	for (n=0; n < ntot_corners; n++) {
+	for (n=mpi_start; n < mpi_end; n++) {
 		j = n / (x_N+1);
 		i = n % (x_N+1);
 		corner_sourcepts[i][j][0] = defx_corners[n];
 		corner_sourcepts[i][j][1] = defy_corners[n];
-		if ((i < x_N) and (j < y_N)) {
-			n_cell = j*x_N+i;
-			source_plane_triangle1_area[i][j] = area_tri1[n_cell];
-			source_plane_triangle2_area[i][j] = area_tri2[n_cell];
-			center_sourcepts[i][j][0] = defx_centers[n_cell];
-			center_sourcepts[i][j][1] = defy_centers[n_cell];
-		}
+	}
+	for (n_cell=mpi_start2; n_cell < mpi_end2; n_cell++) {
+		j = n_cell / x_N;
+		i = n_cell % x_N;
+		source_plane_triangle1_area[i][j] = area_tri1[n_cell];
+		source_plane_triangle2_area[i][j] = area_tri2[n_cell];
+		center_sourcepts[i][j][0] = defx_centers[n_cell];
+		center_sourcepts[i][j][1] = defy_centers[n_cell];
 	}
 
 #ifdef USE_OPENMP
@@ -3652,6 +4192,51 @@ void ImagePixelGrid::redo_lensing_calculations()
 	delete[] area_tri2;
 }
 
+void ImagePixelGrid::assign_row_blocks(const int nblocks, const int halo)
+{
+	// Divides the rows of the image among nblocks processes for image-pixel decomposition, so that each block has roughly the
+	// same number of pixels in the fit window; the halo gives the number of rows on either side of each block that must also
+	// be ray traced, so the Lmatrix rows can be convolved with the PSF. If nblocks is 1, the decomposition is turned off.
+	if (row_block_start != NULL) {
+		delete[] row_block_start;
+		row_block_start = NULL;
+	}
+	halo_rows = 0;
+	own_rows_traced_only = false;
+	if (nblocks <= 1) return;
+	row_block_start = new int[nblocks+1];
+	halo_rows = halo;
+	int i,j,id,nfit=0;
+	int *nfit_before_row = new int[y_N+1];
+	for (j=0; j < y_N; j++) {
+		nfit_before_row[j] = nfit;
+		for (i=0; i < x_N; i++) {
+			if ((fit_to_data==NULL) or (fit_to_data[i][j])) nfit++;
+		}
+	}
+	nfit_before_row[y_N] = nfit;
+	row_block_start[0] = 0;
+	for (id=1, j=0; id < nblocks; id++) {
+		if (nfit==0) j = (id*y_N)/nblocks;
+		else while ((j < y_N) and (((double) nfit_before_row[j]) < ((double) id)*nfit/nblocks)) j++;
+		row_block_start[id] = j;
+	}
+	row_block_start[nblocks] = y_N;
+	delete[] nfit_before_row;
+}
+
+void ImagePixelGrid::find_row_block(const int id, int& row_start, int& row_end, const bool include_halo)
+{
+	row_start = row_block_start[id];
+	row_end = row_block_start[id+1];
+	if (include_halo) {
+		row_start -= halo_rows;
+		row_end += halo_rows;
+		if (row_start < 0) row_start = 0;
+		if (row_end > y_N) row_end = y_N;
+	}
+}
+
 bool ImagePixelData::test_if_in_fit_region(const double& x, const double& y)
 {
 	// it would be faster to just use division to figure out which pixel it's in, but this is good enough
@@ -3729,8 +4314,10 @@ void ImagePixelGrid::find_optimal_sourcegrid(double& sourcegrid_xmin, double& so
 	int ii,jj,il,ih,jl,jh,nn;
 	double sbavg;
 	int window_size=2;
+	int row_start=0, row_end=y_N;
+	if (own_rows_traced_only) find_row_block(lens->group_id,row_start,row_end);
 	for (i=0; i < x_N; i++) {
-		for (j=0; j < y_N; j++) {
+		for (j=row_start; j < row_end; j++) {
 			if (fit_to_data[i][j]) {
 				sbavg=0;
 				nn=0;
@@ -3770,6 +4357,14 @@ void ImagePixelGrid::find_optimal_sourcegrid(double& sourcegrid_xmin, double& so
 			}
 		}
 	}
+#ifdef USE_MPI
+	if (own_rows_traced_only) {
+		MPI_Allreduce(MPI_IN_PLACE,&sourcegrid_xmin,1,MPI_DOUBLE,MPI_MIN,*(lens->group_comm));
+		MPI_Allreduce(MPI_IN_PLACE,&sourcegrid_xmax,1,MPI_DOUBLE,MPI_MAX,*(lens->group_comm));
+		MPI_Allreduce(MPI_IN_PLACE,&sourcegrid_ymin,1,MPI_DOUBLE,MPI_MIN,*(lens->group_comm));
+		MPI_Allreduce(MPI_IN_PLACE,&sourcegrid_ymax,1,MPI_DOUBLE,MPI_MAX,*(lens->group_comm));
+	}
+#endif
 	// Now let's make the box slightly wider just to be sure
 	double xwidth_adj = 0.3*(sourcegrid_xmax-sourcegrid_xmin);
 	double ywidth_adj = 0.3*(sourcegrid_ymax-sourcegrid_ymin);
@@ -3817,7 +4412,9 @@ void ImagePixelGrid::plot_grid(string filename, bool show_inactive_pixels)
 void ImagePixelGrid::find_optimal_sourcegrid_npixels(double pixel_fraction, double srcgrid_xmin, double srcgrid_xmax, double srcgrid_ymin, double srcgrid_ymax, int& nsrcpixel_x, int& nsrcpixel_y, int& n_expected_active_pixels)
 {
 	int i,j,count=0;
-	for (j=0; j < y_N; j++) {
+	int row_start=0, row_end=y_N;
+	if (own_rows_traced_only) find_row_block(lens->group_id,row_start,row_end);
+	for (j=row_start; j < row_end; j++) {
 		for (i=0; i < x_N; i++) {
 			if ((fit_to_data==NULL) or (fit_to_data[i][j])) {
 				if ((center_sourcepts[i][j][0] > srcgrid_xmin) and (center_sourcepts[i][j][0] < srcgrid_xmax) and (center_sourcepts[i][j][1] > srcgrid_ymin) and (center_sourcepts[i][j][1] < srcgrid_ymax)) {
@@ -3826,6 +4423,9 @@ void ImagePixelGrid::find_optimal_sourcegrid_npixels(double pixel_fraction, doub
 			}
 		}
 	}
+#ifdef USE_MPI
+	if (own_rows_traced_only) MPI_Allreduce(MPI_IN_PLACE,&count,1,MPI_INT,MPI_SUM,*(lens->group_comm));
+#endif
 	double dx = srcgrid_xmax-srcgrid_xmin;
 	double dy = srcgrid_ymax-srcgrid_ymin;
 	nsrcpixel_x = (int) sqrt(pixel_fraction*count*dx/dy);
@@ -3839,7 +4439,9 @@ void ImagePixelGrid::find_optimal_firstlevel_sourcegrid_npixels(double srcgrid_x
 	double lowest_magnification = 1e30;
 	double average_magnification = 0;
 	int i,j,count=0;
-	for (j=0; j < y_N; j++) {
+	int row_start=0, row_end=y_N;
+	if (own_rows_traced_only) find_row_block(lens->group_id,row_start,row_end);
+	for (j=row_start; j < row_end; j++) {
 		for (i=0; i < x_N; i++) {
 			if ((fit_to_data==NULL) or (fit_to_data[i][j])) {
 				if ((center_sourcepts[i][j][0] > srcgrid_xmin) and (center_sourcepts[i][j][0] < srcgrid_xmax) and (center_sourcepts[i][j][1] > srcgrid_ymin) and (center_sourcepts[i][j][1] < srcgrid_ymax)) {
@@ -3848,6 +4450,9 @@ void ImagePixelGrid::find_optimal_firstlevel_sourcegrid_npixels(double srcgrid_x
 			}
 		}
 	}
+#ifdef USE_MPI
+	if (own_rows_traced_only) MPI_Allreduce(MPI_IN_PLACE,&count,1,MPI_INT,MPI_SUM,*(lens->group_comm));
+#endif
 
 	double pixel_area, source_lowlevel_pixel_area, dx, dy, srcgrid_area, srcgrid_firstlevel_npixels;
 	pixel_area = pixel_xlength * pixel_ylength;
@@ -3879,11 +4484,11 @@ void ImagePixelGrid::assign_required_data_pixels(double srcgrid_xmin, double src
 	}
 }
 
-int ImagePixelGrid::count_nonzero_source_pixel_mappings()
+int ImagePixelGrid::count_nonzero_source_pixel_mappings(const int img_start, const int img_end)
 {
 	int tot=0;
 	int i,j,img_index;
-	for (img_index=0; img_index < lens->image_npixels; img_index++) {
+	for (img_index=img_start; img_index < img_end; img_index++) {
 		i = lens->active_image_pixel_i[img_index];
 		j = lens->active_image_pixel_j[img_index];
 		tot += mapped_source_pixels[i][j].size();
@@ -3901,19 +4506,21 @@ void ImagePixelGrid::assign_image_mapping_flags()
 			maps_to_source_pixel[i][j] = false;
 		}
 	}
+	int row_start=0, row_end=y_N;
+	if (own_rows_traced_only) find_row_block(lens->group_id,row_start,row_end,true);
 	if (ray_tracing_method == Area_Overlap)
 	{
 		#pragma omp parallel
 		{
 			int thread;
 #ifdef USE_OPENMP
-			thread = omp_get_thread_num();
+			thread = lens->lens_thread + omp_get_thread_num();
 #else
-			thread = 0;
+			thread = lens->lens_thread;
 #endif
 			lensvector *corners[4];
 			#pragma omp for private(i,j,corners) schedule(dynamic)
-			for (j=0; j < y_N; j++) {
+			for (j=row_start; j < row_end; j++) {
 				for (i=0; i < x_N; i++) {
 					if ((fit_to_data == NULL) or (fit_to_data[i][j])) {
 						corners[0] = &corner_sourcepts[i][j];
@@ -3937,12 +4544,12 @@ void ImagePixelGrid::assign_image_mapping_flags()
 		{
 			int thread;
 #ifdef USE_OPENMP
-			thread = omp_get_thread_num();
+			thread = lens->lens_thread + omp_get_thread_num();
 #else
-			thread = 0;
+			thread = lens->lens_thread;
 #endif
 			#pragma omp for private(i,j) schedule(dynamic)
-			for (j=0; j < y_N; j++) {
+			for (j=row_start; j < row_end; j++) {
 				for (i=0; i < x_N; i++) {
 					if ((fit_to_data == NULL) or (fit_to_data[i][j])) {
 						if (source_pixel_grid->assign_source_mapping_flags_interpolate(center_sourcepts[i][j],mapped_source_pixels[i][j],thread,i,j)==true) {
@@ -3956,6 +4563,38 @@ void ImagePixelGrid::assign_image_mapping_flags()
 			}
 		}
 	}
+#ifdef USE_MPI
+	if (own_rows_traced_only) {
+		// Each process has only found the mappings for its own rows (and the halo rows), so the source pixel flags are
+		// combined over the group, and the flags for the image pixels in each block are sent to every process, so that all
+		// the processes agree on which pixels are active and on their indices
+		source_pixel_grid->combine_mapping_flags_over_group();
+		int id, rs, re;
+		int *counts = new int[lens->group_np];
+		int *displs = new int[lens->group_np];
+		char *pixel_flags = new char[x_N*y_N];
+		for (id=0; id < lens->group_np; id++) {
+			find_row_block(id,rs,re);
+			displs[id] = rs*x_N;
+			counts[id] = (re-rs)*x_N;
+		}
+		find_row_block(lens->group_id,rs,re);
+		for (j=rs; j < re; j++) {
+			for (i=0; i < x_N; i++) pixel_flags[j*x_N+i] = (maps_to_source_pixel[i][j]) ? 1 : 0;
+		}
+		MPI_Allgatherv(MPI_IN_PLACE,0,MPI_DATATYPE_NULL,pixel_flags,counts,displs,MPI_CHAR,*(lens->group_comm));
+		n_active_pixels = 0;
+		for (j=0; j < y_N; j++) {
+			for (i=0; i < x_N; i++) {
+				maps_to_source_pixel[i][j] = (pixel_flags[j*x_N+i]==1);
+				if (maps_to_source_pixel[i][j]) n_active_pixels++;
+			}
+		}
+		delete[] counts;
+		delete[] displs;
+		delete[] pixel_flags;
+	}
+#endif
 }
 
 void ImagePixelGrid::find_surface_brightness()
@@ -3969,7 +4608,7 @@ void ImagePixelGrid::find_surface_brightness()
 				corners[1] = &corner_sourcepts[i][j+1];
 				corners[2] = &corner_sourcepts[i+1][j];
 				corners[3] = &corner_sourcepts[i+1][j+1];
-				surface_brightness[i][j] = source_pixel_grid->find_lensed_surface_brightness_overlap(corners,0);
+				surface_brightness[i][j] = source_pixel_grid->find_lensed_surface_brightness_overlap(corners,lens->lens_thread);
 			}
 		}
 		delete[] corners;
@@ -3978,12 +4617,133 @@ void ImagePixelGrid::find_surface_brightness()
 		int i,j;
 		for (j=0; j < y_N; j++) {
 			for (i=0; i < x_N; i++) {
-				surface_brightness[i][j] = source_pixel_grid->find_lensed_surface_brightness_interpolate(center_sourcepts[i][j],0);
+				surface_brightness[i][j] = source_pixel_grid->find_lensed_surface_brightness_interpolate(center_sourcepts[i][j],lens->lens_thread);
 			}
 		}
 	}
 }
 
+void ImagePixelGrid::ray_trace_supersampled_pixels(const int nsplit, const int margin_x, const int margin_y)
+{
+	// Ray traces an nsplit x nsplit grid of points within each pixel that is either in the fit window, or within margin_x, margin_y
+	// pixels of it (so that flux from outside the window can be included when convolving with the PSF). The source points are
+	// stored so they can be reused as long as the lens model does not change.
+	int i,j,k,l,n;
+	bool **trace_pixel = new bool*[x_N];
+	for (i=0; i < x_N; i++) {
+		trace_pixel[i] = new bool[y_N];
+		for (j=0; j < y_N; j++) trace_pixel[i][j] = false;
+	}
+	int npix = 0;
+	for (i=0; i < x_N; i++) {
+		for (j=0; j < y_N; j++) {
+			if ((fit_to_data==NULL) or (fit_to_data[i][j])) {
+				for (k=i-margin_x; k <= i+margin_x; k++) {
+					if ((k < 0) or (k >= x_N)) continue;
+					for (l=j-margin_y; l <= j+margin_y; l++) {
+						if ((l < 0) or (l >= y_N)) continue;
+						if (!trace_pixel[k][l]) { trace_pixel[k][l] = true; npix++; }
+					}
+				}
+			}
+		}
+	}
+	int nsub = nsplit*nsplit;
+	if ((npix != n_supersampled_pixels) or (nsplit != supersampling_nsplit)) {
+		delete_supersampled_pixels();
+		supersampled_pixel_i = new int[npix];
+		supersampled_pixel_j = new int[npix];
+		supersampled_srcx = new double[npix*nsub];
+		supersampled_srcy = new double[npix*nsub];
+		supersampled_sb = new double[npix*nsub];
+	}
+	n_supersampled_pixels = npix;
+	supersampling_nsplit = nsplit;
+	supersampling_margin_x = margin_x;
+	supersampling_margin_y = margin_y;
+	n = 0;
+	for (i=0; i < x_N; i++) {
+		for (j=0; j < y_N; j++) {
+			if (trace_pixel[i][j]) {
+				supersampled_pixel_i[n] = i;
+				supersampled_pixel_j[n] = j;
+				n++;
+			}
+		}
+		delete[] trace_pixel[i];
+	}
+	delete[] trace_pixel;
+
+	ProfileTimer profile_timer(PROF_RAY_TRACING);
+	Profiler::add_count(PROF_RAYS_TRACED,npix*nsub);
+#ifdef USE_OPENMP
+	double wtime0, wtime;
+	if (lens->show_wtime) {
+		wtime0 = omp_get_wtime();
+	}
+#endif
+	double sub_xlength = pixel_xlength/nsplit;
+	double sub_ylength = pixel_ylength/nsplit;
+	#pragma omp parallel
+	{
+		int thread;
+#ifdef USE_OPENMP
+		thread = lens->lens_thread + omp_get_thread_num();
+#else
+		thread = lens->lens_thread;
+#endif
+		int ii, jj, kk, ll, m;
+		lensvector pt;
+		#pragma omp for private(n) schedule(dynamic)
+		for (n=0; n < npix; n++) {
+			ii = supersampled_pixel_i[n];
+			jj = supersampled_pixel_j[n];
+			m = n*nsub;
+			for (kk=0; kk < nsplit; kk++) {
+				for (ll=0; ll < nsplit; ll++) {
+					pt[0] = corner_pts[ii][jj][0] + (kk+0.5)*sub_xlength;
+					pt[1] = corner_pts[ii][jj][1] + (ll+0.5)*sub_ylength;
+					lens->find_sourcept(pt,supersampled_srcx[m],supersampled_srcy[m],thread,zfactor);
+					m++;
+				}
+			}
+		}
+	}
+#ifdef USE_OPENMP
+	if (lens->show_wtime) {
+		wtime = omp_get_wtime() - wtime0;
+		if (lens->mpi_id==0) cout << "Wall time for ray-tracing supersampled image pixels: " << wtime << endl;
+	}
+#endif
+}
+
+void ImagePixelGrid::find_surface_brightness_from_sb_profiles(SB_Profile** sb_list, const int n_sb)
+{
+	// Evaluates the source objects at the stored source points, one profile at a time over each pixel's subpixels, and
+	// averages over the subpixels. Pixels that were not ray traced are given zero surface brightness.
+	int i,j;
+	for (i=0; i < x_N; i++) {
+		for (j=0; j < y_N; j++) surface_brightness[i][j] = 0;
+	}
+	int nsub = supersampling_nsplit*supersampling_nsplit;
+	double subpixel_fraction = 1.0/nsub;
+	int n;
+	#pragma omp parallel
+	{
+		int k,m,start;
+		double sb;
+		#pragma omp for private(n) schedule(static)
+		for (n=0; n < n_supersampled_pixels; n++) {
+			start = n*nsub;
+			for (m=start; m < start+nsub; m++) supersampled_sb[m] = 0;
+			for (k=0; k < n_sb; k++) sb_list[k]->add_surface_brightness(nsub,supersampled_srcx+start,supersampled_srcy+start,supersampled_sb+start);
+			sb = 0;
+			for (m=start; m < start+nsub; m++) sb += supersampled_sb[m];
+			surface_brightness[supersampled_pixel_i[n]][supersampled_pixel_j[n]] = sb*subpixel_fraction;
+		}
+	}
+}
+
 void ImagePixelGrid::plot_surface_brightness(string outfile_root, bool plot_residual)
 {
 	string sb_filename = outfile_root + ".dat";
@@ -4065,6 +4825,7 @@ void ImagePixelGrid::output_fits_file(string fits_filename, bool plot_residual)
 
 void Lens::assign_Lmatrix(bool verbal)
 {
+	ProfileTimer profile_timer(PROF_LMATRIX);
 	int img_index;
 	int index;
 	int i,j;
@@ -4076,19 +4837,39 @@ void Lens::assign_Lmatrix(bool verbal)
 		wtime0 = omp_get_wtime();
 	}
 #endif
-	if (image_pixel_grid->ray_tracing_method == Area_Overlap)
+	// With image-pixel decomposition, each process only finds and stores the rows for its own block of image pixels, along
+	// with the halo rows around it that are needed for the PSF convolution; the other rows are left empty
+	bool decompose = image_pixels_decomposed();
+	int img_start=0, img_end=image_npixels;
+	if (decompose) {
+		find_image_pixel_block(group_id,img_start,img_end,true);
+		for (img_index=0; img_index < image_npixels; img_index++) Lmatrix_row_nn[img_index] = 0;
+	}
+
+	if (delaunay_srcgrid != NULL)
+	{
+		#pragma omp parallel for private(img_index,i,j,index) schedule(static)
+		for (img_index=img_start; img_index < img_end; img_index++) {
+			index=0;
+			i = active_image_pixel_i[img_index];
+			j = active_image_pixel_j[img_index];
+			delaunay_srcgrid->calculate_Lmatrix(img_index,i,j,index);
+			Lmatrix_row_nn[img_index] = index;
+		}
+	}
+	else if (image_pixel_grid->ray_tracing_method == Area_Overlap)
 	{
 		lensvector *corners[4];
 		#pragma omp parallel
 		{
 			int thread;
 #ifdef USE_OPENMP
-			thread = omp_get_thread_num();
+			thread = lens_thread + omp_get_thread_num();
 #else
-			thread = 0;
+			thread = lens_thread;
 #endif
 			#pragma omp for private(img_index,i,j,index,corners) schedule(dynamic)
-			for (img_index=0; img_index < image_npixels; img_index++) {
+			for (img_index=img_start; img_index < img_end; img_index++) {
 				index=0;
 				i = active_image_pixel_i[img_index];
 				j = active_image_pixel_j[img_index];
@@ -4107,12 +4888,12 @@ void Lens::assign_Lmatrix(bool verbal)
 		{
 			int thread;
 #ifdef USE_OPENMP
-			thread = omp_get_thread_num();
+			thread = lens_thread + omp_get_thread_num();
 #else
-			thread = 0;
+			thread = lens_thread;
 #endif
 			#pragma omp for private(img_index,i,j,index) schedule(dynamic)
-			for (img_index=0; img_index < image_npixels; img_index++) {
+			for (img_index=img_start; img_index < img_end; img_index++) {
 				index=0;
 				i = active_image_pixel_i[img_index];
 				j = active_image_pixel_j[img_index];
@@ -4128,8 +4909,8 @@ void Lens::assign_Lmatrix(bool verbal)
 	}
 	if (image_pixel_location_Lmatrix[img_index] != Lmatrix_n_elements) die("Number of Lmatrix elements don't match (%i vs %i)",image_pixel_location_Lmatrix[img_index],Lmatrix_n_elements);
 
-	index=0;
-	for (i=0; i < image_npixels; i++) {
+	index=image_pixel_location_Lmatrix[img_start];
+	for (i=img_start; i < img_end; i++) {
 		for (j=0; j < Lmatrix_row_nn[i]; j++) {
 			Lmatrix[index] = Lmatrix_rows[i][j];
 			Lmatrix_index[index] = Lmatrix_index_rows[i][j];
@@ -4137,6 +4918,7 @@ void Lens::assign_Lmatrix(bool verbal)
 		}
 	}
 
+	Profiler::add_count(PROF_LMATRIX_ELEMENTS,Lmatrix_n_elements);
 #ifdef USE_OPENMP
 	if (show_wtime) {
 		wtime = omp_get_wtime() - wtime0;
@@ -4147,6 +4929,7 @@ void Lens::assign_Lmatrix(bool verbal)
 		int Lmatrix_ntot = source_npixels*image_npixels;
 		double sparseness = ((double) Lmatrix_n_elements)/Lmatrix_ntot;
 		cout << "image has " << image_pixel_grid->n_active_pixels << " active pixels, Lmatrix has " << Lmatrix_n_elements << " nonzero elements (sparseness " << sparseness << ")\n";
+		if (decompose) cout << "(process 0 only stores Lmatrix rows " << img_start << " to " << img_end-1 << ", including the halo rows for the PSF)\n";
 	}
 
 	delete[] Lmatrix_row_nn;
@@ -4186,13 +4969,29 @@ ImagePixelGrid::~ImagePixelGrid()
 		for (int i=0; i < x_N; i++) delete[] fit_to_data[i];
 		delete[] fit_to_data;
 	}
+	delete_supersampled_pixels();
+	if (row_block_start != NULL) delete[] row_block_start;
+}
 
+void ImagePixelGrid::delete_supersampled_pixels()
+{
+	if (supersampled_srcx != NULL) {
+		delete[] supersampled_pixel_i;
+		delete[] supersampled_pixel_j;
+		delete[] supersampled_srcx;
+		delete[] supersampled_srcy;
+		delete[] supersampled_sb;
+		supersampled_pixel_i = supersampled_pixel_j = NULL;
+		supersampled_srcx = supersampled_srcy = supersampled_sb = NULL;
+	}
+	n_supersampled_pixels = 0;
 }
 
 /************************** Functions in class Lens that pertain to pixel mapping and inversion ****************************/
 
 bool Lens::assign_pixel_mappings(bool verbal)
 {
+	ProfileTimer profile_timer(PROF_LMATRIX);
 
 #ifdef USE_OPENMP
 	if (show_wtime) {
@@ -4200,32 +4999,42 @@ bool Lens::assign_pixel_mappings(bool verbal)
 	}
 #endif
 	int tot_npixels_count;
-	tot_npixels_count = source_pixel_grid->assign_indices_and_count_levels();
-	if ((mpi_id==0) and (adaptive_grid) and (verbal==true)) cout << "Number of source cells: " << tot_npixels_count << endl;
-	image_pixel_grid->assign_image_mapping_flags();
-
-	//source_pixel_grid->missed_cells_out.open("missed_cells.dat");
-	source_pixel_grid->regrid = false;
-	source_npixels = source_pixel_grid->assign_active_indices_and_count_source_pixels(regrid_if_unmapped_source_subpixels,activate_unmapped_source_pixels,exclude_source_pixels_beyond_fit_window);
-	if (source_npixels==0) { warn(warnings,"number of source pixels cannot be zero"); return false; }
-	//source_pixel_grid->missed_cells_out.close();
-	while (source_pixel_grid->regrid) {
-		if ((mpi_id==0) and (verbal==true)) cout << "Redrawing the source grid after reverse-splitting unmapped source pixels...\n";
-		source_pixel_grid->regrid = false;
-		source_pixel_grid->assign_all_neighbors();
+	if (delaunay_srcgrid != NULL) {
+		// every point of the triangulation is a source pixel, so there is nothing to regrid
+		source_npixels = delaunay_srcgrid->assign_image_mapping_flags();
+		delaunay_srcgrid->calculate_pixel_magnifications();
+		tot_npixels_count = source_npixels;
+	} else {
 		tot_npixels_count = source_pixel_grid->assign_indices_and_count_levels();
-		if ((mpi_id==0) and (verbal==true)) cout << "Number of source cells after re-gridding: " << tot_npixels_count << endl;
+		if ((mpi_id==0) and (adaptive_grid) and (verbal==true)) cout << "Number of source cells: " << tot_npixels_count << endl;
 		image_pixel_grid->assign_image_mapping_flags();
-		//source_pixel_grid->print_indices();
+
+		//source_pixel_grid->missed_cells_out.open("missed_cells.dat");
+		source_pixel_grid->regrid = false;
 		source_npixels = source_pixel_grid->assign_active_indices_and_count_source_pixels(regrid_if_unmapped_source_subpixels,activate_unmapped_source_pixels,exclude_source_pixels_beyond_fit_window);
+		if (source_npixels==0) { warn(warnings,"number of source pixels cannot be zero"); return false; }
+		//source_pixel_grid->missed_cells_out.close();
+		while (source_pixel_grid->regrid) {
+			if ((mpi_id==0) and (verbal==true)) cout << "Redrawing the source grid after reverse-splitting unmapped source pixels...\n";
+			source_pixel_grid->regrid = false;
+			source_pixel_grid->assign_all_neighbors();
+			source_pixel_grid->build_cell_lookup_table();
+			tot_npixels_count = source_pixel_grid->assign_indices_and_count_levels();
+			if ((mpi_id==0) and (verbal==true)) cout << "Number of source cells after re-gridding: " << tot_npixels_count << endl;
+			image_pixel_grid->assign_image_mapping_flags();
+			//source_pixel_grid->print_indices();
+			source_npixels = source_pixel_grid->assign_active_indices_and_count_source_pixels(regrid_if_unmapped_source_subpixels,activate_unmapped_source_pixels,exclude_source_pixels_beyond_fit_window);
+		}
 	}
 
 	//image_pixel_grid->plot_center_pts_source_plane();
 	image_npixels = image_pixel_grid->n_active_pixels;
 	active_image_pixel_i = new int[image_npixels];
 	active_image_pixel_j = new int[image_npixels];
+	active_image_row_start = new int[image_pixel_grid->y_N+1];
 	int i, j, image_pixel_index=0;
 	for (j=0; j < image_pixel_grid->y_N; j++) {
+		active_image_row_start[j] = image_pixel_index;
 		for (i=0; i < image_pixel_grid->x_N; i++) {
 			if (image_pixel_grid->maps_to_source_pixel[i][j]) {
 				active_image_pixel_i[image_pixel_index] = i;
@@ -4234,9 +5043,10 @@ bool Lens::assign_pixel_mappings(bool verbal)
 			} else image_pixel_grid->pixel_index[i][j] = -1;
 		}
 	}
+	active_image_row_start[image_pixel_grid->y_N] = image_pixel_index;
 	if (image_pixel_index != image_npixels) die("Number of active pixels (%i) doesn't seem to match image_npixels (%i)",image_pixel_index,image_npixels);
 
-	if ((verbal) and (mpi_id==0)) cout << "source # of pixels: " << source_pixel_grid->number_of_pixels << ", counted up as " << tot_npixels_count << ", # of active pixels: " << source_npixels << endl;
+	if ((verbal) and (mpi_id==0) and (delaunay_srcgrid==NULL)) cout << "source # of pixels: " << source_pixel_grid->number_of_pixels << ", counted up as " << tot_npixels_count << ", # of active pixels: " << source_npixels << endl;
 #ifdef USE_OPENMP
 	if (show_wtime) {
 		wtime = omp_get_wtime() - wtime0;
@@ -4256,10 +5066,16 @@ void Lens::initialize_pixel_matrices(bool verbal)
 	source_surface_brightness = new double[source_npixels];
 	if (n_image_prior) {
 		source_pixel_n_images = new double[source_npixels];
-		source_pixel_grid->fill_n_image_vector();
+		if (delaunay_srcgrid != NULL) delaunay_srcgrid->fill_n_image_vector();
+		else source_pixel_grid->fill_n_image_vector();
 	}
 
-	Lmatrix_n_elements = image_pixel_grid->count_nonzero_source_pixel_mappings();
+	// with image-pixel decomposition, only the Lmatrix rows for this process's block of image pixels (and the halo around it,
+	// which is needed for the PSF convolution) are found and stored
+	int img_start=0, img_end=image_npixels;
+	if (image_pixels_decomposed()) find_image_pixel_block(group_id,img_start,img_end,true);
+	if (delaunay_srcgrid != NULL) Lmatrix_n_elements = 3*(img_end-img_start); // each image pixel is interpolated from the three vertices of a triangle
+	else Lmatrix_n_elements = image_pixel_grid->count_nonzero_source_pixel_mappings(img_start,img_end);
 	if ((mpi_id==0) and (verbal)) cout << "Expected Lmatrix_n_elements=" << Lmatrix_n_elements << endl << flush;
 	Lmatrix_index = new int[Lmatrix_n_elements];
 	image_pixel_location_Lmatrix = new int[image_npixels+1];
@@ -4275,6 +5091,7 @@ void Lens::clear_pixel_matrices()
 	if (source_surface_brightness != NULL) delete[] source_surface_brightness;
 	if (active_image_pixel_i != NULL) delete[] active_image_pixel_i;
 	if (active_image_pixel_j != NULL) delete[] active_image_pixel_j;
+	if (active_image_row_start != NULL) delete[] active_image_row_start;
 	if (image_pixel_location_Lmatrix != NULL) delete[] image_pixel_location_Lmatrix;
 	if (Lmatrix_index != NULL) delete[] Lmatrix_index;
 	if (Lmatrix != NULL) delete[] Lmatrix;
@@ -4283,6 +5100,7 @@ void Lens::clear_pixel_matrices()
 	source_surface_brightness = NULL;
 	active_image_pixel_i = NULL;
 	active_image_pixel_j = NULL;
+	active_image_row_start = NULL;
 	image_pixel_location_Lmatrix = NULL;
 	source_pixel_location_Lmatrix = NULL;
 	Lmatrix = NULL;
@@ -4294,8 +5112,101 @@ void Lens::clear_pixel_matrices()
 	}
 }
 
+bool Lens::generate_psf_matrix()
+{
+	// If an input PSF has been loaded, it is used as is; otherwise a Gaussian PSF matrix is generated using the current image
+	// pixel size. Returns false if there is no PSF to convolve with.
+	static const double sigma_fraction = 1.6; // the bigger you make this, the less sparse the matrix will become (more pixel-pixel correlations)
+	if (use_input_psf_matrix) {
+		if (psf_matrix == NULL) return false;
+		return true;
+	}
+	if ((psf_width_x==0) or (psf_width_y==0)) return false;
+	int nx_half, ny_half, nx, ny;
+	double x, y, xmax, ymax;
+	int i,j;
+	double normalization = 0;
+	double xstep, ystep, nx_half_dec, ny_half_dec;
+	xstep = image_pixel_grid->pixel_xlength;
+	ystep = image_pixel_grid->pixel_ylength;
+	nx_half_dec = sigma_fraction*psf_width_x/xstep;
+	ny_half_dec = sigma_fraction*psf_width_y/ystep;
+	nx_half = ((int) nx_half_dec);
+	ny_half = ((int) ny_half_dec);
+	if ((nx_half_dec - nx_half) > 0.5) nx_half++;
+	if ((ny_half_dec - ny_half) > 0.5) ny_half++;
+	xmax = nx_half*xstep;
+	ymax = ny_half*ystep;
+	nx = 2*nx_half+1;
+	ny = 2*ny_half+1;
+	if (psf_matrix != NULL) {
+		for (i=0; i < psf_npixels_x; i++) delete[] psf_matrix[i];
+		delete[] psf_matrix;
+	}
+	psf_matrix = new double*[nx];
+	for (i=0; i < nx; i++) psf_matrix[i] = new double[ny];
+	psf_npixels_x = nx;
+	psf_npixels_y = ny;
+	for (i=0, x=-xmax; i < nx; i++, x += xstep) {
+		for (j=0, y=-ymax; j < ny; j++, y += ystep) {
+			psf_matrix[i][j] = exp(-0.5*(SQR(x/psf_width_x) + SQR(y/psf_width_y)));
+			normalization += psf_matrix[i][j];
+		}
+	}
+	for (i=0; i < nx; i++) {
+		for (j=0; j < ny; j++) {
+			psf_matrix[i][j] /= normalization;
+		}
+	}
+	return true;
+}
+
+void Lens::PSF_convolution_image_pixels(bool verbal)
+{
+	// Convolves the model surface brightness of the image pixels with the PSF. Only the pixels in the fit window are
+	// convolved, using all the pixels whose surface brightness has been calculated (see ray_trace_supersampled_pixels).
+	// The PSF matrix must already have been set up by generate_psf_matrix().
+	ProfileTimer profile_timer(PROF_PSF_CONVOLUTION);
+	if (psf_matrix == NULL) return;
+	int nx_half, ny_half;
+	nx_half = psf_npixels_x/2;
+	ny_half = psf_npixels_y/2;
+	int x_N = image_pixel_grid->x_N;
+	int y_N = image_pixel_grid->y_N;
+	double **sb = image_pixel_grid->surface_brightness;
+	bool **fit_to_data = image_pixel_grid->fit_to_data;
+	double **convolved_sb = new double*[x_N];
+	int i,j;
+	for (i=0; i < x_N; i++) convolved_sb[i] = new double[y_N];
+
+	#pragma omp parallel for private(i,j) schedule(static)
+	for (i=0; i < x_N; i++) {
+		int k,l,psf_i,psf_j;
+		for (j=0; j < y_N; j++) {
+			convolved_sb[i][j] = 0;
+			if ((fit_to_data != NULL) and (!fit_to_data[i][j])) continue;
+			for (psf_i=0; psf_i < psf_npixels_x; psf_i++) {
+				k = i + nx_half - psf_i;
+				if ((k < 0) or (k >= x_N)) continue;
+				for (psf_j=0; psf_j < psf_npixels_y; psf_j++) {
+					l = j + ny_half - psf_j;
+					if ((l < 0) or (l >= y_N)) continue;
+					convolved_sb[i][j] += psf_matrix[psf_i][psf_j]*sb[k][l];
+				}
+			}
+		}
+	}
+	for (i=0; i < x_N; i++) {
+		for (j=0; j < y_N; j++) sb[i][j] = convolved_sb[i][j];
+		delete[] convolved_sb[i];
+	}
+	delete[] convolved_sb;
+	if ((mpi_id==0) and (verbal)) cout << "Convolved image pixels with PSF (" << psf_npixels_x << "x" << psf_npixels_y << " pixels)" << endl;
+}
+
 void Lens::PSF_convolution_Lmatrix(bool verbal)
 {
+	ProfileTimer profile_timer(PROF_PSF_CONVOLUTION);
 #ifdef USE_MPI
 	MPI_Comm sub_comm;
 	if (psf_convolution_mpi) {
@@ -4304,52 +5215,13 @@ void Lens::PSF_convolution_Lmatrix(bool verbal)
 #endif
 
 	if ((mpi_id==0) and (verbal)) cout << "Beginning PSF convolution...\n";
-	static const double sigma_fraction = 1.6; // the bigger you make this, the less sparse the matrix will become (more pixel-pixel correlations)
+	if (!generate_psf_matrix()) return;
 	int nx_half, ny_half, nx, ny;
-	double x, y, xmax, ymax;
 	int i,j;
-	if (use_input_psf_matrix) {
-		if (psf_matrix == NULL) return;
-		nx = psf_npixels_x;
-		ny = psf_npixels_y;
-		nx_half = nx/2;
-		ny_half = ny/2;
-	} else {
-		if ((psf_width_x==0) or (psf_width_y==0)) return;
-		double normalization = 0;
-		double xstep, ystep, nx_half_dec, ny_half_dec;
-		xstep = image_pixel_grid->pixel_xlength;
-		ystep = image_pixel_grid->pixel_ylength;
-		nx_half_dec = sigma_fraction*psf_width_x/xstep;
-		ny_half_dec = sigma_fraction*psf_width_y/ystep;
-		nx_half = ((int) nx_half_dec);
-		ny_half = ((int) ny_half_dec);
-		if ((nx_half_dec - nx_half) > 0.5) nx_half++;
-		if ((ny_half_dec - ny_half) > 0.5) ny_half++;
-		xmax = nx_half*xstep;
-		ymax = ny_half*ystep;
-		nx = 2*nx_half+1;
-		ny = 2*ny_half+1;
-		if (psf_matrix != NULL) {
-			for (i=0; i < psf_npixels_x; i++) delete[] psf_matrix[i];
-			delete[] psf_matrix;
-		}
-		psf_matrix = new double*[nx];
-		for (i=0; i < nx; i++) psf_matrix[i] = new double[ny];
-		psf_npixels_x = nx;
-		psf_npixels_y = ny;
-		for (i=0, x=-xmax; i < nx; i++, x += xstep) {
-			for (j=0, y=-ymax; j < ny; j++, y += ystep) {
-				psf_matrix[i][j] = exp(-0.5*(SQR(x/psf_width_x) + SQR(y/psf_width_y)));
-				normalization += psf_matrix[i][j];
-			}
-		}
-		for (i=0; i < nx; i++) {
-			for (j=0; j < ny; j++) {
-				psf_matrix[i][j] /= normalization;
-			}
-		}
-	}
+	nx = psf_npixels_x;
+	ny = psf_npixels_y;
+	nx_half = nx/2;
+	ny_half = ny/2;
 	int *Lmatrix_psf_row_nn = new int[image_npixels];
 	vector<double> *Lmatrix_psf_rows = new vector<double>[image_npixels];
 	vector<int> *Lmatrix_psf_index_rows = new vector<int>[image_npixels];
@@ -4361,8 +5233,14 @@ void Lens::PSF_convolution_Lmatrix(bool verbal)
 #endif
 
 	// If the PSF is sufficiently wide, it may save time to MPI the PSF convolution by setting psf_convolution_mpi to 'true'. This option is off by default.
+	// With image-pixel decomposition, each process only finds the convolved rows for its own block of image pixels (using the
+	// unconvolved rows of the halo around it); the other rows are left empty.
 	int mpi_chunk, mpi_start, mpi_end;
-	if (psf_convolution_mpi) {
+	bool decompose = image_pixels_decomposed();
+	if (decompose) {
+		find_image_pixel_block(group_id,mpi_start,mpi_end);
+		for (i=0; i < image_npixels; i++) Lmatrix_psf_row_nn[i] = 0;
+	} else if (psf_convolution_mpi) {
 		mpi_chunk = image_npixels / group_np;
 		mpi_start = group_id*mpi_chunk;
 		if (group_id == group_np-1) mpi_chunk += (image_npixels % group_np); // assign the remainder elements to the last mpi process
@@ -4797,6 +5675,99 @@ void Lens::generate_Rmatrix_norm()
 	delete[] Rmatrix_index_rows;
 }
 
+void Lens::generate_Rmatrix_delaunay(const bool curvature)
+{
+	// Regularization on the Delaunay source grid, where the source pixels have no fixed directions along which to take finite
+	// differences; instead, R = sum_k c_k c_k^T over a set of difference vectors c_k built from the triangle edges. For the
+	// gradient, there is one difference for each point and each of its neighbors (so, as for the rectangular grid, each edge
+	// is counted twice); for the curvature, each point minus the mean of its neighbors. Points on the edge of the triangulation
+	// get an extra neighbor outside the grid with zero surface brightness, which makes R positive definite.
+	int i,j,k,l,m,n_terms;
+	Rmatrix_diags = new double[source_npixels];
+	Rmatrix_rows = new vector<double>[source_npixels];
+	Rmatrix_index_rows = new vector<int>[source_npixels];
+	Rmatrix_row_nn = new int[source_npixels];
+	for (i=0; i < source_npixels; i++) {
+		Rmatrix_diags[i] = 0;
+		Rmatrix_row_nn[i] = 0;
+	}
+
+	vector<int> term_index;
+	vector<double> term_coef;
+	vector<int> *neighbors = delaunay_srcgrid->neighbors;
+	bool *boundary_pt = delaunay_srcgrid->boundary_pt;
+	int src_index1, src_index2, n_diffs;
+	double element;
+	bool new_entry;
+	for (i=0; i < source_npixels; i++) {
+		n_diffs = (curvature) ? 1 : neighbors[i].size() + ((boundary_pt[i]) ? 1 : 0);
+		for (n_terms=0; n_terms < n_diffs; n_terms++) {
+			term_index.clear();
+			term_coef.clear();
+			term_index.push_back(i);
+			term_coef.push_back(1.0);
+			if (curvature) {
+				for (k=0; k < neighbors[i].size(); k++) {
+					term_index.push_back(neighbors[i][k]);
+					term_coef.push_back(-1.0/(neighbors[i].size() + ((boundary_pt[i]) ? 1 : 0)));
+				}
+			} else if (n_terms < neighbors[i].size()) {
+				term_index.push_back(neighbors[i][n_terms]);
+				term_coef.push_back(-1.0);
+			} // otherwise, this is the difference with the (zero) point outside the grid
+
+			for (k=0; k < term_index.size(); k++) {
+				for (l=0; l < term_index.size(); l++) {
+					src_index1 = term_index[k];
+					src_index2 = term_index[l];
+					if (src_index1 > src_index2) continue;
+					element = term_coef[k]*term_coef[l];
+					if (src_index1==src_index2) Rmatrix_diags[src_index1] += element;
+					else {
+						new_entry = true;
+						for (m=0; m < Rmatrix_row_nn[src_index1]; m++) {
+							if (Rmatrix_index_rows[src_index1][m]==src_index2) {
+								Rmatrix_rows[src_index1][m] += element;
+								new_entry = false;
+								break;
+							}
+						}
+						if (new_entry) {
+							Rmatrix_rows[src_index1].push_back(element);
+							Rmatrix_index_rows[src_index1].push_back(src_index2);
+							Rmatrix_row_nn[src_index1]++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	Rmatrix_nn = source_npixels+1;
+	for (i=0; i < source_npixels; i++) Rmatrix_nn += Rmatrix_row_nn[i];
+	Rmatrix = new double[Rmatrix_nn];
+	Rmatrix_index = new int[Rmatrix_nn];
+	for (i=0; i < source_npixels; i++) Rmatrix[i] = Rmatrix_diags[i];
+
+	Rmatrix_index[0] = source_npixels+1;
+	for (i=0; i < source_npixels; i++)
+		Rmatrix_index[i+1] = Rmatrix_index[i] + Rmatrix_row_nn[i];
+
+	int indx;
+	for (i=0; i < source_npixels; i++) {
+		indx = Rmatrix_index[i];
+		for (j=0; j < Rmatrix_row_nn[i]; j++) {
+			Rmatrix[indx+j] = Rmatrix_rows[i][j];
+			Rmatrix_index[indx+j] = Rmatrix_index_rows[i][j];
+		}
+	}
+
+	delete[] Rmatrix_row_nn;
+	delete[] Rmatrix_diags;
+	delete[] Rmatrix_rows;
+	delete[] Rmatrix_index_rows;
+}
+
 void Lens::create_regularization_matrix()
 {
 	if (Rmatrix != NULL) delete[] Rmatrix;
@@ -4808,9 +5779,13 @@ void Lens::create_regularization_matrix()
 		case Norm:
 			generate_Rmatrix_norm(); break;
 		case Gradient:
-			generate_Rmatrix_from_gmatrices(); break;
+			if (delaunay_srcgrid != NULL) generate_Rmatrix_delaunay(false);
+			else generate_Rmatrix_from_gmatrices();
+			break;
 		case Curvature:
-			generate_Rmatrix_from_hmatrices(); break;
+			if (delaunay_srcgrid != NULL) generate_Rmatrix_delaunay(true);
+			else generate_Rmatrix_from_hmatrices();
+			break;
 		case Image_Plane_Curvature:
 			generate_Rmatrix_from_image_plane_curvature(); break;
 		default:
@@ -4818,8 +5793,121 @@ void Lens::create_regularization_matrix()
 	}
 }
 
+bool Lens::use_image_pixel_decomposition()
+{
+	// Image-pixel decomposition is used if requested, except with the options that need the whole Lmatrix on every process
+	// (the matrix-free inversion, image plane curvature regularization, extra image bands, the surface brightness prior for
+	// pixels outside the fit window, and the MPI'd PSF convolution)
+	if ((!mpi_image_decomposition) or (group_np <= 1)) return false;
+	if ((inversion_method==Matrix_Free_CG) or (regularization_method==Image_Plane_Curvature)) return false;
+	if ((n_extra_bands > 0) or (max_sb_prior_unselected_pixels) or (psf_convolution_mpi)) return false;
+	return true;
+}
+
+bool Lens::image_pixels_decomposed()
+{
+	return ((image_pixel_grid != NULL) and (image_pixel_grid->row_block_start != NULL));
+}
+
+void Lens::find_image_pixel_block(const int id, int& img_start, int& img_end, const bool include_halo)
+{
+	// block of active image pixels assigned to process 'id' in the group when using image-pixel decomposition; this is a
+	// horizontal strip of the image (see ImagePixelGrid::assign_row_blocks), and since the active pixels are ordered by row,
+	// the pixels in the strip have consecutive indices. With include_halo, the halo rows on either side are included.
+	int row_start, row_end;
+	image_pixel_grid->find_row_block(id,row_start,row_end,include_halo);
+	img_start = active_image_row_start[row_start];
+	img_end = active_image_row_start[row_end];
+}
+
+#ifdef USE_MPI
+void Lens::reduce_Fmatrix_rows(vector<double>* Fmatrix_rows, vector<int>* Fmatrix_index_rows, int* Fmatrix_row_nn, double* Fmatrix_diags, MPI_Comm& sub_comm)
+{
+	// Sends the partial Fmatrix rows found from this process's image pixels to the processes that own them, and sums the
+	// partial rows received for the rows owned here. Each row is sent as its number of off-diagonal elements and its diagonal
+	// element, followed by the column index and value of each off-diagonal element; thus the communication scales with the
+	// number of nonzero Fmatrix elements, rather than with the number of image pixels.
+	int i,k,m,id,row,nn,col_index;
+	int *row_start = new int[group_np+1];
+	int *send_counts = new int[group_np];
+	int *send_displs = new int[group_np];
+	int *recv_counts = new int[group_np];
+	int *recv_displs = new int[group_np];
+	for (id=0; id < group_np; id++) row_start[id] = id*(source_npixels / group_np);
+	row_start[group_np] = source_npixels; // the last process also gets the remainder rows
+
+	int send_length=0, recv_length=0;
+	for (id=0; id < group_np; id++) {
+		send_displs[id] = send_length;
+		send_counts[id] = 0;
+		for (row=row_start[id]; row < row_start[id+1]; row++) send_counts[id] += 1 + Fmatrix_row_nn[row];
+		send_length += send_counts[id];
+	}
+	int *send_indices = new int[send_length];
+	double *send_values = new double[send_length];
+	for (i=0, row=0; row < source_npixels; row++) {
+		send_indices[i] = Fmatrix_row_nn[row];
+		send_values[i++] = Fmatrix_diags[row];
+		for (k=0; k < Fmatrix_row_nn[row]; k++) {
+			send_indices[i] = Fmatrix_index_rows[row][k];
+			send_values[i++] = Fmatrix_rows[row][k];
+		}
+		Fmatrix_rows[row].clear();
+		Fmatrix_index_rows[row].clear();
+		Fmatrix_row_nn[row] = 0;
+		Fmatrix_diags[row] = 0;
+	}
+
+	MPI_Alltoall(send_counts,1,MPI_INT,recv_counts,1,MPI_INT,sub_comm);
+	for (id=0; id < group_np; id++) {
+		recv_displs[id] = recv_length;
+		recv_length += recv_counts[id];
+	}
+	int *recv_indices = new int[recv_length];
+	double *recv_values = new double[recv_length];
+	MPI_Alltoallv(send_indices,send_counts,send_displs,MPI_INT,recv_indices,recv_counts,recv_displs,MPI_INT,sub_comm);
+	MPI_Alltoallv(send_values,send_counts,send_displs,MPI_DOUBLE,recv_values,recv_counts,recv_displs,MPI_DOUBLE,sub_comm);
+
+	bool new_entry;
+	for (id=0; id < group_np; id++) {
+		i = recv_displs[id];
+		for (row=row_start[group_id]; row < row_start[group_id+1]; row++) {
+			nn = recv_indices[i];
+			Fmatrix_diags[row] += recv_values[i++];
+			for (k=0; k < nn; k++, i++) {
+				new_entry = true;
+				for (m=0; m < Fmatrix_row_nn[row]; m++) {
+					if (Fmatrix_index_rows[row][m]==recv_indices[i]) {
+						new_entry = false;
+						col_index = m;
+						break;
+					}
+				}
+				if (new_entry) {
+					Fmatrix_rows[row].push_back(recv_values[i]);
+					Fmatrix_index_rows[row].push_back(recv_indices[i]);
+					Fmatrix_row_nn[row]++;
+				}
+				else Fmatrix_rows[row][col_index] += recv_values[i];
+			}
+		}
+	}
+
+	delete[] row_start;
+	delete[] send_counts;
+	delete[] send_displs;
+	delete[] recv_counts;
+	delete[] recv_displs;
+	delete[] send_indices;
+	delete[] send_values;
+	delete[] recv_indices;
+	delete[] recv_values;
+}
+#endif
+
 void Lens::create_lensing_matrices_from_Lmatrix(bool verbal)
 {
+	ProfileTimer profile_timer(PROF_FMATRIX);
 #ifdef USE_MPI
 	MPI_Comm sub_comm;
 	MPI_Comm_create(*group_comm, *mpi_group, &sub_comm);
@@ -4838,6 +5926,29 @@ void Lens::create_lensing_matrices_from_Lmatrix(bool verbal)
 
 	int i,j,k,l,m,t;
 
+	// With a noise map, each Lmatrix entry is scaled by the square root of its pixel's weight as the matrices are assembled,
+	// so that each element of Fmatrix = L^T W L is still a product of two (weighted) Lmatrix entries
+	double *sqrt_weights = NULL;
+	if ((image_pixel_data != NULL) and (image_pixel_data->noise_map_loaded())) {
+		sqrt_weights = new double[image_npixels];
+		covariance = 1.0; // the weights now take the place of the uniform pixel noise
+		for (i=0; i < image_npixels; i++) sqrt_weights[i] = sqrt(image_pixel_data->noise_weight[active_image_pixel_i[i]][active_image_pixel_j[i]]);
+	}
+	// In single-precision mode, the (weighted) Lmatrix values are read from a float copy, which halves the memory traffic in
+	// the assembly below (where each Lmatrix element is read once for every element in its row); the products are still
+	// accumulated in double precision. Note that the float copy is made in addition to the Lmatrix (which is still needed
+	// afterward), so this mode reduces bandwidth rather than the peak memory.
+	float *Lmatrix_float = NULL;
+	if (lmatrix_single_precision) {
+		Lmatrix_float = new float[image_pixel_location_Lmatrix[image_npixels]];
+		#pragma omp parallel for private(i,j) schedule(static)
+		for (i=0; i < image_npixels; i++) {
+			for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
+				Lmatrix_float[j] = (float) ((sqrt_weights != NULL) ? Lmatrix[j]*sqrt_weights[i] : Lmatrix[j]);
+			}
+		}
+	}
+
 	vector<jl_pair> **jlvals = new vector<jl_pair>*[nthreads];
 	for (i=0; i < nthreads; i++) {
 		jlvals[i] = new vector<jl_pair>[source_npixels];
@@ -4855,23 +5966,38 @@ void Lens::create_lensing_matrices_from_Lmatrix(bool verbal)
 	}
 
 	bool new_entry;
-	int src_index1, src_index2, col_index, col_i;
+	int src_index1, src_index2, col_index;
 	double tmp, element;
 	int tmp_i;
+
+	// Each process assembles the rows of Fmatrix in the range mpi_start..mpi_end. Without image-pixel decomposition, it does so
+	// using all the image pixels; with decomposition, it finds the contributions to every row from its own block of image
+	// pixels, and these partial rows are then summed by the process that owns each row (see reduce_Fmatrix_rows).
+	bool decompose = image_pixels_decomposed();
+	int img_start=0, img_end=image_npixels;
+	if (decompose) find_image_pixel_block(group_id,img_start,img_end);
+
 	Dvector = new double[source_npixels];
 	for (i=0; i < source_npixels; i++) Dvector[i] = 0;
 
-	for (i=0; i < image_npixels; i++) {
+	for (i=img_start; i < img_end; i++) {
 		for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
-			Dvector[Lmatrix_index[j]] += Lmatrix[j]*image_surface_brightness[i]/covariance;
+			if (Lmatrix_float != NULL) Dvector[Lmatrix_index[j]] += Lmatrix_float[j]*((sqrt_weights != NULL) ? sqrt_weights[i] : 1.0/covariance)*image_surface_brightness[i];
+			else if (sqrt_weights != NULL) Dvector[Lmatrix_index[j]] += Lmatrix[j]*sqrt_weights[i]*sqrt_weights[i]*image_surface_brightness[i];
+			else Dvector[Lmatrix_index[j]] += Lmatrix[j]*image_surface_brightness[i]/covariance;
 		}
 	}
+#ifdef USE_MPI
+	if (decompose) MPI_Allreduce(MPI_IN_PLACE, Dvector, source_npixels, MPI_DOUBLE, MPI_SUM, sub_comm);
+#endif
 
 	int mpi_chunk, mpi_start, mpi_end;
 	mpi_chunk = source_npixels / group_np;
 	mpi_start = group_id*mpi_chunk;
 	if (group_id == group_np-1) mpi_chunk += (source_npixels % group_np); // assign the remainder elements to the last mpi process
 	mpi_end = mpi_start + mpi_chunk;
+	int row_start = (decompose) ? 0 : mpi_start;
+	int row_end = (decompose) ? source_npixels : mpi_end;
 
 	jl_pair jl;
 
@@ -4885,7 +6011,8 @@ void Lens::create_lensing_matrices_from_Lmatrix(bool verbal)
 #endif
 	// idea: just store j and l, so that all the calculating can be done in the loop below (which can be made parallel much more easily)
 		#pragma omp for private(i,j,l,jl,src_index1,src_index2,tmp) schedule(dynamic)
-		for (i=0; i < image_npixels; i++) {
+		for (i=img_start; i < img_end; i++) {
+			jl.i=i;
 			for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
 				for (l=j; l < image_pixel_location_Lmatrix[i+1]; l++) {
 					src_index1 = Lmatrix_index[j];
@@ -4913,16 +6040,20 @@ void Lens::create_lensing_matrices_from_Lmatrix(bool verbal)
 		}
 #endif
 
-		#pragma omp for private(i,j,k,l,m,t,src_index1,src_index2,new_entry,col_index,col_i,element) schedule(static) reduction(+:Fmatrix_nn_part)
-		for (src_index1=mpi_start; src_index1 < mpi_end; src_index1++) {
-			col_i=0;
+		#pragma omp for private(i,j,k,l,m,t,src_index1,src_index2,new_entry,col_index,element) schedule(static)
+		for (src_index1=row_start; src_index1 < row_end; src_index1++) {
 			for (t=0; t < nthreads; t++) {
 				for (k=0; k < jlvals[t][src_index1].size(); k++) {
 					j = jlvals[t][src_index1][k].j;
 					l = jlvals[t][src_index1][k].l;
 					src_index2 = Lmatrix_index[l];
 					new_entry = true;
-					element = Lmatrix[j]*Lmatrix[l]/covariance; // generalize this to full covariance matrix later
+					if (Lmatrix_float != NULL) element = ((double) Lmatrix_float[j])*Lmatrix_float[l]/covariance;
+					else if (sqrt_weights != NULL) {
+						i = jlvals[t][src_index1][k].i;
+						element = (Lmatrix[j]*sqrt_weights[i])*(Lmatrix[l]*sqrt_weights[i]);
+					}
+					else element = Lmatrix[j]*Lmatrix[l]/covariance; // generalize this to full covariance matrix later
 					if (src_index1==src_index2) Fmatrix_diags[src_index1] += element;
 					else {
 						m=0;
@@ -4938,17 +6069,25 @@ void Lens::create_lensing_matrices_from_Lmatrix(bool verbal)
 							Fmatrix_rows[src_index1].push_back(element);
 							Fmatrix_index_rows[src_index1].push_back(src_index2);
 							Fmatrix_row_nn[src_index1]++;
-							col_i++;
 						}
 						else Fmatrix_rows[src_index1][col_index] += element;
 					}
 				}
 			}
-			Fmatrix_nn_part += col_i;
+		}
+
+#ifdef USE_MPI
+		if (decompose) {
+			#pragma omp master
+			reduce_Fmatrix_rows(Fmatrix_rows,Fmatrix_index_rows,Fmatrix_row_nn,Fmatrix_diags,sub_comm);
+			#pragma omp barrier
+		}
+#endif
 
+		#pragma omp for private(j,k,src_index1,new_entry,col_index) schedule(static) reduction(+:Fmatrix_nn_part)
+		for (src_index1=mpi_start; src_index1 < mpi_end; src_index1++) {
 			if (regularization_method != None) {
 				Fmatrix_diags[src_index1] += effective_reg_parameter*Rmatrix[src_index1];
-				col_i=0;
 				for (j=Rmatrix_index[src_index1]; j < Rmatrix_index[src_index1+1]; j++) {
 					new_entry = true;
 					k=0;
@@ -4963,13 +6102,12 @@ void Lens::create_lensing_matrices_from_Lmatrix(bool verbal)
 						Fmatrix_rows[src_index1].push_back(effective_reg_parameter*Rmatrix[j]);
 						Fmatrix_index_rows[src_index1].push_back(Rmatrix_index[j]);
 						Fmatrix_row_nn[src_index1]++;
-						col_i++;
 					} else {
 						Fmatrix_rows[src_index1][col_index] += effective_reg_parameter*Rmatrix[j];
 					}
 				}
-				Fmatrix_nn_part += col_i;
 			}
+			Fmatrix_nn_part += Fmatrix_row_nn[src_index1];
 		}
 	}
 
@@ -5056,10 +6194,138 @@ void Lens::create_lensing_matrices_from_Lmatrix(bool verbal)
 	delete[] Fmatrix_rows;
 	delete[] Fmatrix_diags;
 	delete[] Fmatrix_row_nn;
+	if (sqrt_weights != NULL) delete[] sqrt_weights;
+	if (Lmatrix_float != NULL) delete[] Lmatrix_float;
+}
+
+int Lens::find_multigrid_aggregates(int*& n_aggregates, int**& aggregate_index)
+{
+	// Builds the coarse levels for the multigrid preconditioner from the source pixel grid. The first coarse levels merge
+	// source pixels that share a parent cell, going up the adaptive grid one level at a time; after that, the first-level
+	// cells are merged in 2x2 blocks until the number of aggregates is small enough to solve directly. A level is only kept
+	// if it reduces the number of unknowns substantially. Returns the number of coarse levels. The aggregates belong to the
+	// source grid, which keeps them for any later inversions on the same grid, so they must not be deleted by the caller.
+	if (source_pixel_grid->mg_n_coarse_levels >= 0) {
+		n_aggregates = source_pixel_grid->mg_n_aggregates;
+		aggregate_index = source_pixel_grid->mg_aggregate_index;
+		return source_pixel_grid->mg_n_coarse_levels;
+	}
+	static const int max_coarse_npixels = 100;
+	int i,k,l,s,depth,max_depth=0;
+	int n_current = source_npixels, n_new;
+	SourcePixelGrid ***ancestors = new SourcePixelGrid**[source_npixels];
+	int *pixel_level = new int[source_npixels];
+	int *firstlevel_i = new int[source_npixels];
+	int *firstlevel_j = new int[source_npixels];
+	int *current_aggregate = new int[source_npixels];
+	int *new_aggregate = new int[source_npixels];
+	vector<int> level_sizes;
+	vector<int*> level_aggregates;
+	for (k=0; k < source_npixels; k++) ancestors[k] = NULL;
+	source_pixel_grid->find_active_pixel_ancestors(ancestors,pixel_level,firstlevel_i,firstlevel_j,0,0);
+	for (k=0; k < source_npixels; k++) {
+		if (ancestors[k]==NULL) die("active source pixel %i was not found in source pixel grid",k);
+		if (pixel_level[k] > max_depth) max_depth = pixel_level[k];
+		current_aggregate[k] = k;
+	}
+
+	for (depth=max_depth-1, s=0; n_current > max_coarse_npixels; ) {
+		if (depth >= 1) {
+			map<SourcePixelGrid*,int> ids;
+			SourcePixelGrid *cellptr;
+			for (k=0; k < source_npixels; k++) {
+				cellptr = ancestors[k][((pixel_level[k] < depth) ? pixel_level[k] : depth)-1];
+				if (ids.find(cellptr)==ids.end()) { n_new = ids.size(); ids[cellptr] = n_new; }
+				new_aggregate[k] = ids[cellptr];
+			}
+			n_new = ids.size();
+			depth--;
+		} else {
+			s++;
+			map<pair<int,int>,int> ids;
+			pair<int,int> block;
+			for (k=0; k < source_npixels; k++) {
+				block = make_pair(firstlevel_i[k] >> s, firstlevel_j[k] >> s);
+				if (ids.find(block)==ids.end()) { n_new = ids.size(); ids[block] = n_new; }
+				new_aggregate[k] = ids[block];
+			}
+			n_new = ids.size();
+		}
+		if ((n_new <= 0.6*n_current) or ((n_new < n_current) and (n_new <= max_coarse_npixels))) {
+			int *agg = new int[n_current];
+			for (k=0; k < source_npixels; k++) {
+				agg[current_aggregate[k]] = new_aggregate[k];
+				current_aggregate[k] = new_aggregate[k];
+			}
+			level_sizes.push_back(n_new);
+			level_aggregates.push_back(agg);
+			n_current = n_new;
+		}
+		if ((depth < 1) and (n_new==1)) break;
+	}
+
+	int n_coarse_levels = level_sizes.size();
+	n_aggregates = new int[n_coarse_levels];
+	aggregate_index = new int*[n_coarse_levels];
+	for (l=0; l < n_coarse_levels; l++) {
+		n_aggregates[l] = level_sizes[l];
+		aggregate_index[l] = level_aggregates[l];
+	}
+	source_pixel_grid->mg_n_coarse_levels = n_coarse_levels;
+	source_pixel_grid->mg_n_aggregates = n_aggregates;
+	source_pixel_grid->mg_aggregate_index = aggregate_index;
+	for (k=0; k < source_npixels; k++) delete[] ancestors[k];
+	delete[] ancestors;
+	delete[] pixel_level;
+	delete[] firstlevel_i;
+	delete[] firstlevel_j;
+	delete[] current_aggregate;
+	delete[] new_aggregate;
+	return n_coarse_levels;
+}
+
+void Lens::find_Rmatrix_log_determinant(const bool verbal)
+{
+	// The regularization matrix depends only on the source grid, so for a rectangular grid its log-determinant is kept by the
+	// grid and reused by any later inversions on it
+	if ((delaunay_srcgrid==NULL) and (source_pixel_grid->Rmatrix_logdet_found)) {
+		Rmatrix_log_determinant = source_pixel_grid->Rmatrix_logdet;
+	} else {
+#ifdef USE_MPI
+		MPI_Comm sub_comm;
+		MPI_Comm_create(*group_comm, *mpi_group, &sub_comm);
+#endif
+		CG_sparse cg_det(Rmatrix,Rmatrix_index,3e-4,100000,inversion_nthreads,group_np,group_id);
+#ifdef USE_MPI
+		cg_det.set_MPI_comm(&sub_comm);
+#endif
+		Rmatrix_log_determinant = cg_det.calculate_log_determinant();
+#ifdef USE_MPI
+		MPI_Comm_free(&sub_comm);
+#endif
+		if (delaunay_srcgrid==NULL) {
+			source_pixel_grid->Rmatrix_logdet = Rmatrix_log_determinant;
+			source_pixel_grid->Rmatrix_logdet_found = true;
+		}
+	}
+	if ((mpi_id==0) and (verbal)) cout << "Rmatrix log determinant = " << Rmatrix_log_determinant << endl;
+}
+
+void Lens::update_source_pixel_surface_brightness()
+{
+	// copies the solution for the source surface brightness into the source grid (for a Delaunay source grid, the rectangular
+	// grid is only given interpolated values if the source is displayed; see build_delaunay_display_grid)
+	if (delaunay_srcgrid != NULL) {
+		delaunay_srcgrid->update_surface_brightness(source_surface_brightness);
+	} else {
+		int index=0;
+		source_pixel_grid->update_surface_brightness(index);
+	}
 }
 
 void Lens::invert_lens_mapping_CG_method(bool verbal)
 {
+	ProfileTimer profile_timer(PROF_INVERSION);
 #ifdef USE_MPI
 	MPI_Comm sub_comm;
 	MPI_Comm_create(*group_comm, *mpi_group, &sub_comm);
@@ -5082,9 +6348,19 @@ void Lens::invert_lens_mapping_CG_method(bool verbal)
 	cg_method.set_MPI_comm(&sub_comm);
 #endif
 	for (int i=0; i < source_npixels; i++) temp[i] = 0;
-	if ((regularization_method != None) and ((vary_regularization_parameter) or (vary_pixel_fraction)))
-		cg_method.set_determinant_mode(true);
-	else cg_method.set_determinant_mode(false);
+	if ((use_multigrid_preconditioner) and (delaunay_srcgrid==NULL)) { // the coarse levels are built from the rectangular source grid
+		int *n_aggregates, **aggregate_index;
+		int n_coarse_levels = find_multigrid_aggregates(n_aggregates,aggregate_index);
+		if (n_coarse_levels > 0) {
+			if (cg_method.set_multigrid_aggregates(n_coarse_levels,n_aggregates,aggregate_index)) {
+				if ((mpi_id==0) and (verbal)) {
+					cout << "Multigrid preconditioner: " << n_coarse_levels+1 << " levels (" << source_npixels;
+					for (int l=0; l < n_coarse_levels; l++) cout << "," << n_aggregates[l];
+					cout << " unknowns)" << endl;
+				}
+			} else if ((mpi_id==0) and (verbal)) warn(warnings,"coarse matrix is not positive definite; using diagonal preconditioner instead of multigrid");
+		}
+	}
 #ifdef USE_OPENMP
 	if (show_wtime) {
 		wtime = omp_get_wtime() - wtime0;
@@ -5114,14 +6390,14 @@ void Lens::invert_lens_mapping_CG_method(bool verbal)
 	}
 
 	if ((regularization_method != None) and ((vary_regularization_parameter) or (vary_pixel_fraction))) {
-		cg_method.get_log_determinant(Fmatrix_log_determinant);
-		if ((mpi_id==0) and (verbal)) cout << "log determinant = " << Fmatrix_log_determinant << endl;
-		CG_sparse cg_det(Rmatrix,Rmatrix_index,3e-4,100000,inversion_nthreads,group_np,group_id);
-#ifdef USE_MPI
-		cg_det.set_MPI_comm(&sub_comm);
-#endif
-		Rmatrix_log_determinant = cg_det.calculate_log_determinant();
-		if ((mpi_id==0) and (verbal)) cout << "Rmatrix log determinant = " << Rmatrix_log_determinant << endl;
+		// The log-determinant is estimated from the F-matrix itself by stochastic Lanczos quadrature, so that it does not
+		// depend on the preconditioner used for the solve. (The determinant that CG_sparse can find from the Lanczos
+		// coefficients of its own solve requires n iterations with the diagonal preconditioner, and rounding errors over
+		// those n iterations can make it off by ~1% for a few thousand source pixels.)
+		ProfileTimer profile_timer(PROF_LOG_DETERMINANT);
+		Fmatrix_log_determinant = cg_method.estimate_log_determinant(logdet_nprobes,logdet_lanczos_steps,1);
+		if ((mpi_id==0) and (verbal)) cout << "log determinant (stochastic estimate) = " << Fmatrix_log_determinant << endl;
+		find_Rmatrix_log_determinant(verbal);
 	}
 
 #ifdef USE_OPENMP
@@ -5137,15 +6413,369 @@ void Lens::invert_lens_mapping_CG_method(bool verbal)
 	if ((mpi_id==0) and (verbal)) cout << iterations << " iterations, error=" << error << endl << endl;
 
 	delete[] temp;
-	int index=0;
-	source_pixel_grid->update_surface_brightness(index);
+	update_source_pixel_surface_brightness();
 #ifdef USE_MPI
 	MPI_Comm_free(&sub_comm);
 #endif
 }
 
+// Applies the matrix F = (PL)^T W (PL) + lambda*R as an operator, where L is the (unconvolved) Lmatrix, P the PSF
+// convolution, W the diagonal matrix of pixel weights and R the regularization matrix, so that neither F nor the
+// convolved Lmatrix PL ever has to be formed; apart from work vectors over the image pixels, the only extra storage is
+// a transposed copy of the Lmatrix (so that L^T can be applied one source pixel at a time without write conflicts).
+class LensingOperatorCG : public CG_matrix_free
+{
+	Lens *lens;
+	int image_npixels;
+	bool use_psf;
+	double *weights;
+	double *Lt_values; // Lmatrix stored by source pixel (compressed column form)
+	float *L_values_sp, *Lt_values_sp; // used instead of the Lmatrix and Lt_values in single-precision mode
+	int *Lt_image_index;
+	int *Lt_location;
+	double *R_values; // full (both triangles) regularization matrix in compressed row form
+	int *R_index;
+	int *R_location;
+	double *img_vec1, *img_vec2, *img_vec3;
+
+	void apply_L(const double* x, double* u);
+	void apply_PSF(const double* u, double* v, const double* wgts);
+	void apply_PSF_transpose(const double* v, double* w);
+	void apply_Lt(const double* w, double* r);
+
+	public:
+	LensingOperatorCG(Lens* lens_in, const bool use_psf_in, const double tol_in, const int itmax_in, const int nt_in);
+	~LensingOperatorCG();
+	void A_matrix_multiply(const double* const x, double* const r);
+	void find_data_vector(const double* data, double* dvec);
+	void find_model_image(const double* x, double* model);
+};
+
+LensingOperatorCG::LensingOperatorCG(Lens* lens_in, const bool use_psf_in, const double tol_in, const int itmax_in, const int nt_in) : CG_matrix_free(lens_in->source_npixels,tol_in,itmax_in,nt_in)
+{
+	lens = lens_in;
+	use_psf = use_psf_in;
+	image_npixels = lens->image_npixels;
+	int i,j,k;
+
+	weights = new double[image_npixels];
+	for (i=0; i < image_npixels; i++) weights[i] = lens->image_pixel_data->pixel_weight(lens->active_image_pixel_i[i],lens->active_image_pixel_j[i],lens->data_pixel_noise);
+
+	int Lmatrix_n_elements = lens->image_pixel_location_Lmatrix[image_npixels];
+	// in single-precision mode, L and L^T are only kept as floats, since each CG iteration streams through both of them
+	L_values_sp = Lt_values_sp = NULL;
+	Lt_values = NULL;
+	if (lens->lmatrix_single_precision) {
+		L_values_sp = new float[Lmatrix_n_elements];
+		Lt_values_sp = new float[Lmatrix_n_elements];
+		for (j=0; j < Lmatrix_n_elements; j++) L_values_sp[j] = (float) lens->Lmatrix[j];
+	} else {
+		Lt_values = new double[Lmatrix_n_elements];
+	}
+	Lt_image_index = new int[Lmatrix_n_elements];
+	Lt_location = new int[n+1];
+	for (k=0; k <= n; k++) Lt_location[k] = 0;
+	for (j=0; j < Lmatrix_n_elements; j++) Lt_location[lens->Lmatrix_index[j]+1]++;
+	for (k=0; k < n; k++) Lt_location[k+1] += Lt_location[k];
+	int *fill = new int[n];
+	for (k=0; k < n; k++) fill[k] = Lt_location[k];
+	for (i=0; i < image_npixels; i++) {
+		for (j=lens->image_pixel_location_Lmatrix[i]; j < lens->image_pixel_location_Lmatrix[i+1]; j++) {
+			k = fill[lens->Lmatrix_index[j]]++;
+			if (Lt_values_sp != NULL) Lt_values_sp[k] = (float) lens->Lmatrix[j];
+			else Lt_values[k] = lens->Lmatrix[j];
+			Lt_image_index[k] = i;
+		}
+	}
+	delete[] fill;
+
+	// the Rmatrix is stored like the Fmatrix: diagonal elements first, then the upper off-diagonal elements of each row
+	R_values = NULL; R_index = NULL; R_location = NULL;
+	if (lens->regularization_method != Lens::None) {
+		double *Rmatrix = lens->Rmatrix;
+		int *Rmatrix_index = lens->Rmatrix_index;
+		int *row_nn = new int[n];
+		for (k=0; k < n; k++) row_nn[k] = 1;
+		for (k=0; k < n; k++) {
+			for (j=Rmatrix_index[k]; j < Rmatrix_index[k+1]; j++) {
+				row_nn[k]++;
+				row_nn[Rmatrix_index[j]]++;
+			}
+		}
+		R_location = new int[n+1];
+		R_location[0] = 0;
+		for (k=0; k < n; k++) R_location[k+1] = R_location[k] + row_nn[k];
+		R_values = new double[R_location[n]];
+		R_index = new int[R_location[n]];
+		for (k=0; k < n; k++) {
+			R_values[R_location[k]] = Rmatrix[k];
+			R_index[R_location[k]] = k;
+			row_nn[k] = R_location[k] + 1;
+		}
+		for (k=0; k < n; k++) {
+			for (j=Rmatrix_index[k]; j < Rmatrix_index[k+1]; j++) {
+				R_values[row_nn[k]] = Rmatrix[j];
+				R_index[row_nn[k]++] = Rmatrix_index[j];
+				R_values[row_nn[Rmatrix_index[j]]] = Rmatrix[j];
+				R_index[row_nn[Rmatrix_index[j]]++] = k;
+			}
+		}
+		delete[] row_nn;
+	}
+
+	img_vec1 = new double[image_npixels];
+	img_vec2 = new double[image_npixels];
+	img_vec3 = new double[image_npixels];
+
+	// The diagonal preconditioner uses the diagonal of L^T W L + lambda*R, where the PSF is accounted for only approximately
+	// (by the sum of the squares of the PSF elements, which gives the diagonal exactly if the PSF were spatially isolated)
+	double psf_sqr_sum = 1.0;
+	if (use_psf) {
+		psf_sqr_sum = 0;
+		for (i=0; i < lens->psf_npixels_x; i++) {
+			for (j=0; j < lens->psf_npixels_y; j++) psf_sqr_sum += SQR(lens->psf_matrix[i][j]);
+		}
+	}
+	for (k=0; k < n; k++) {
+		diag[k] = 0;
+		for (j=Lt_location[k]; j < Lt_location[k+1]; j++) diag[k] += weights[Lt_image_index[j]]*SQR((Lt_values_sp != NULL) ? Lt_values_sp[j] : Lt_values[j]);
+		diag[k] *= psf_sqr_sum;
+		if (R_values != NULL) diag[k] += lens->regularization_parameter*R_values[R_location[k]];
+		if (diag[k] <= 0) diag[k] = 1.0;
+	}
+}
+
+void LensingOperatorCG::apply_L(const double* x, double* u)
+{
+	int i,j;
+	if (L_values_sp != NULL) {
+		#pragma omp for schedule(static)
+		for (i=0; i < image_npixels; i++) {
+			u[i] = 0;
+			for (j=lens->image_pixel_location_Lmatrix[i]; j < lens->image_pixel_location_Lmatrix[i+1]; j++) {
+				u[i] += L_values_sp[j]*x[lens->Lmatrix_index[j]];
+			}
+		}
+	} else {
+		#pragma omp for schedule(static)
+		for (i=0; i < image_npixels; i++) {
+			u[i] = 0;
+			for (j=lens->image_pixel_location_Lmatrix[i]; j < lens->image_pixel_location_Lmatrix[i+1]; j++) {
+				u[i] += lens->Lmatrix[j]*x[lens->Lmatrix_index[j]];
+			}
+		}
+	}
+}
+
+void LensingOperatorCG::apply_PSF(const double* u, double* v, const double* wgts)
+{
+	// same convolution as in PSF_convolution_Lmatrix, applied to a vector over the active image pixels
+	int nx = lens->psf_npixels_x, ny = lens->psf_npixels_y;
+	int nx_half = nx/2, ny_half = ny/2;
+	int x_N = lens->image_pixel_grid->x_N, y_N = lens->image_pixel_grid->y_N;
+	bool **maps_to_source_pixel = lens->image_pixel_grid->maps_to_source_pixel;
+	int **pixel_index = lens->image_pixel_grid->pixel_index;
+	double **psf = lens->psf_matrix;
+	int img_index, i, j, k, l, psf_k, psf_l;
+	#pragma omp for schedule(static)
+	for (img_index=0; img_index < image_npixels; img_index++) {
+		k = lens->active_image_pixel_i[img_index];
+		l = lens->active_image_pixel_j[img_index];
+		v[img_index] = 0;
+		for (psf_k=0; psf_k < ny; psf_k++) {
+			i = k + ny_half - psf_k;
+			if ((i < 0) or (i >= x_N)) continue;
+			for (psf_l=0; psf_l < nx; psf_l++) {
+				j = l + nx_half - psf_l;
+				if ((j >= 0) and (j < y_N) and (maps_to_source_pixel[i][j])) v[img_index] += psf[psf_l][psf_k]*u[pixel_index[i][j]];
+			}
+		}
+		if (wgts != NULL) v[img_index] *= wgts[img_index];
+	}
+}
+
+void LensingOperatorCG::apply_PSF_transpose(const double* v, double* w)
+{
+	int nx = lens->psf_npixels_x, ny = lens->psf_npixels_y;
+	int nx_half = nx/2, ny_half = ny/2;
+	int x_N = lens->image_pixel_grid->x_N, y_N = lens->image_pixel_grid->y_N;
+	bool **maps_to_source_pixel = lens->image_pixel_grid->maps_to_source_pixel;
+	int **pixel_index = lens->image_pixel_grid->pixel_index;
+	double **psf = lens->psf_matrix;
+	int img_index, i, j, k, l, psf_k, psf_l;
+	#pragma omp for schedule(static)
+	for (img_index=0; img_index < image_npixels; img_index++) {
+		i = lens->active_image_pixel_i[img_index];
+		j = lens->active_image_pixel_j[img_index];
+		w[img_index] = 0;
+		for (psf_k=0; psf_k < ny; psf_k++) {
+			k = i - ny_half + psf_k;
+			if ((k < 0) or (k >= x_N)) continue;
+			for (psf_l=0; psf_l < nx; psf_l++) {
+				l = j - nx_half + psf_l;
+				if ((l >= 0) and (l < y_N) and (maps_to_source_pixel[k][l])) w[img_index] += psf[psf_l][psf_k]*v[pixel_index[k][l]];
+			}
+		}
+	}
+}
+
+void LensingOperatorCG::apply_Lt(const double* w, double* r)
+{
+	int j,k;
+	if (Lt_values_sp != NULL) {
+		#pragma omp for schedule(static)
+		for (k=0; k < n; k++) {
+			r[k] = 0;
+			for (j=Lt_location[k]; j < Lt_location[k+1]; j++) r[k] += Lt_values_sp[j]*w[Lt_image_index[j]];
+		}
+	} else {
+		#pragma omp for schedule(static)
+		for (k=0; k < n; k++) {
+			r[k] = 0;
+			for (j=Lt_location[k]; j < Lt_location[k+1]; j++) r[k] += Lt_values[j]*w[Lt_image_index[j]];
+		}
+	}
+}
+
+void LensingOperatorCG::A_matrix_multiply(const double* const x, double* const r)
+{
+	// called by all threads in the parallel region of the solver; each step is an orphaned work-sharing loop, with the
+	// implied barrier at the end of each loop keeping the steps in order
+	int i,j,k;
+	apply_L(x,img_vec1);
+	if (use_psf) {
+		apply_PSF(img_vec1,img_vec2,weights);
+		apply_PSF_transpose(img_vec2,img_vec3);
+	} else {
+		#pragma omp for schedule(static)
+		for (i=0; i < image_npixels; i++) img_vec3[i] = weights[i]*img_vec1[i];
+	}
+	apply_Lt(img_vec3,r);
+	if (R_values != NULL) {
+		double lambda = lens->regularization_parameter;
+		#pragma omp for schedule(static)
+		for (k=0; k < n; k++) {
+			for (j=R_location[k]; j < R_location[k+1]; j++) r[k] += lambda*R_values[j]*x[R_index[j]];
+		}
+	}
+}
+
+void LensingOperatorCG::find_data_vector(const double* data, double* dvec)
+{
+	// dvec = (PL)^T W d
+	int i;
+	#pragma omp parallel
+	{
+		#pragma omp for schedule(static)
+		for (i=0; i < image_npixels; i++) img_vec2[i] = weights[i]*data[i];
+		if (use_psf) {
+			apply_PSF_transpose(img_vec2,img_vec3);
+			apply_Lt(img_vec3,dvec);
+		} else {
+			apply_Lt(img_vec2,dvec);
+		}
+	}
+}
+
+void LensingOperatorCG::find_model_image(const double* x, double* model)
+{
+	// model = PL x
+	#pragma omp parallel
+	{
+		if (use_psf) {
+			apply_L(x,img_vec1);
+			apply_PSF(img_vec1,model,NULL);
+		} else {
+			apply_L(x,model);
+		}
+	}
+}
+
+LensingOperatorCG::~LensingOperatorCG()
+{
+	delete[] weights;
+	if (Lt_values != NULL) delete[] Lt_values;
+	if (L_values_sp != NULL) {
+		delete[] L_values_sp;
+		delete[] Lt_values_sp;
+	}
+	delete[] Lt_image_index;
+	delete[] Lt_location;
+	if (R_values != NULL) {
+		delete[] R_values;
+		delete[] R_index;
+		delete[] R_location;
+	}
+	delete[] img_vec1;
+	delete[] img_vec2;
+	delete[] img_vec3;
+}
+
+void Lens::invert_lens_mapping_matrix_free(bool verbal)
+{
+	// Solves for the source pixel surface brightness without forming the Fmatrix or the PSF-convolved Lmatrix (see
+	// LensingOperatorCG); on input, image_surface_brightness holds the data, and on output, the model image
+	ProfileTimer profile_timer(PROF_INVERSION);
+#ifdef USE_OPENMP
+	if (show_wtime) {
+		wtime0 = omp_get_wtime();
+	}
+#endif
+	bool use_psf = generate_psf_matrix();
+	LensingOperatorCG lensing_operator(this,use_psf,1e-4,100000,inversion_nthreads);
+	double *temp = new double[source_npixels];
+	double *dvec = new double[source_npixels];
+	int i;
+	for (i=0; i < source_npixels; i++) temp[i] = 0;
+	lensing_operator.find_data_vector(image_surface_brightness,dvec);
+	lensing_operator.solve(dvec,temp);
+
+	if ((n_image_prior) or (max_sb_prior_unselected_pixels)) {
+		max_pixel_sb=-1e30;
+		int max_sb_i;
+		for (i=0; i < source_npixels; i++) {
+			if ((data_pixel_noise==0) and (temp[i] < 0)) temp[i] = 0; // This might be a bad idea, but with zero noise there should be no negatives, and they annoy me when plotted
+			source_surface_brightness[i] = temp[i];
+			if (source_surface_brightness[i] > max_pixel_sb) {
+				max_pixel_sb = source_surface_brightness[i];
+				max_sb_i = i;
+			}
+		}
+		if (n_image_prior) n_images_at_sbmax = source_pixel_n_images[max_sb_i];
+	} else {
+		for (i=0; i < source_npixels; i++) {
+			if ((data_pixel_noise==0) and (temp[i] < 0)) temp[i] = 0; // This might be a bad idea, but with zero noise there should be no negatives, and they annoy me when plotted
+			source_surface_brightness[i] = temp[i];
+		}
+	}
+
+	if ((regularization_method != None) and ((vary_regularization_parameter) or (vary_pixel_fraction))) {
+		ProfileTimer profile_timer(PROF_LOG_DETERMINANT);
+		Fmatrix_log_determinant = lensing_operator.estimate_log_determinant(logdet_nprobes,logdet_lanczos_steps,1);
+		if ((mpi_id==0) and (verbal)) cout << "log determinant (stochastic estimate) = " << Fmatrix_log_determinant << endl;
+		find_Rmatrix_log_determinant(verbal);
+	}
+	lensing_operator.find_model_image(source_surface_brightness,image_surface_brightness);
+
+#ifdef USE_OPENMP
+	if (show_wtime) {
+		wtime = omp_get_wtime() - wtime0;
+		if (mpi_id==0) cout << "Wall time for matrix-free inversion: " << wtime << endl;
+	}
+#endif
+	int iterations;
+	double error;
+	lensing_operator.get_error(iterations,error);
+	if ((mpi_id==0) and (verbal)) cout << iterations << " iterations, error=" << error << endl << endl;
+
+	delete[] temp;
+	delete[] dvec;
+	update_source_pixel_surface_brightness();
+}
+
 void Lens::invert_lens_mapping_UMFPACK(bool verbal)
 {
+	ProfileTimer profile_timer(PROF_INVERSION);
 #ifndef USE_UMFPACK
 	die("QLens requires compilation with UMFPACK for factorization");
 #else
@@ -5317,6 +6947,7 @@ void Lens::invert_lens_mapping_UMFPACK(bool verbal)
 		}
 	}
 	if (calculate_determinant) {
+		ProfileTimer profile_timer(PROF_LOG_DETERMINANT);
 		double mantissa, exponent;
 		status = umfpack_di_get_determinant (&mantissa, &exponent, Numeric, Info) ;
 		if (status < 0) {
@@ -5477,13 +7108,13 @@ void Lens::invert_lens_mapping_UMFPACK(bool verbal)
 	delete[] Fmatrix_unsymmetric_cols;
 	delete[] Fmatrix_unsymmetric_indices;
 	delete[] Fmatrix_unsymmetric;
-	int index=0;
-	source_pixel_grid->update_surface_brightness(index);
+	update_source_pixel_surface_brightness();
 #endif
 }
 
 void Lens::invert_lens_mapping_MUMPS(bool verbal)
 {
+	ProfileTimer profile_timer(PROF_INVERSION);
 #ifdef USE_MPI
 	MPI_Comm sub_comm;
 	MPI_Comm_create(*group_comm, *mpi_group, &sub_comm);
@@ -5606,6 +7237,7 @@ void Lens::invert_lens_mapping_MUMPS(bool verbal)
 
 	if ((regularization_method != None) and ((vary_regularization_parameter) or (vary_pixel_fraction)))
 	{
+		ProfileTimer profile_timer(PROF_LOG_DETERMINANT);
 		Fmatrix_log_determinant = log(mumps_solver->rinfog[11]) + mumps_solver->infog[33]*log(2);
 		//cout << "Fmatrix log determinant = " << Fmatrix_log_determinant << endl;
 		if ((mpi_id==0) and (verbal)) cout << "log determinant = " << Fmatrix_log_determinant << endl;
@@ -5680,8 +7312,7 @@ void Lens::invert_lens_mapping_MUMPS(bool verbal)
 	delete[] irn;
 	delete[] jcn;
 	delete[] Fmatrix_elements;
-	int index=0;
-	source_pixel_grid->update_surface_brightness(index);
+	update_source_pixel_surface_brightness();
 #endif
 #ifdef USE_MPI
 	MPI_Comm_free(&sub_comm);
@@ -5772,13 +7403,33 @@ void Lens::clear_lensing_matrices()
 
 void Lens::calculate_image_pixel_surface_brightness()
 {
+	// With image-pixel decomposition, each process finds the model surface brightness for its own block of pixels, and the
+	// blocks are then gathered so that every process has the whole model image
 	int i,j;
-	for (i=0; i < image_npixels; i++) {
+	int img_start=0, img_end=image_npixels;
+	bool decompose = image_pixels_decomposed();
+	if (decompose) find_image_pixel_block(group_id,img_start,img_end);
+	for (i=img_start; i < img_end; i++) {
 		image_surface_brightness[i] = 0;
 		for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
 			image_surface_brightness[i] += Lmatrix[j]*source_surface_brightness[Lmatrix_index[j]];
 		}
 	}
+#ifdef USE_MPI
+	if (decompose) {
+		int id, *counts, *displs;
+		counts = new int[group_np];
+		displs = new int[group_np];
+		for (id=0; id < group_np; id++) {
+			find_image_pixel_block(id,i,j);
+			displs[id] = i;
+			counts[id] = j - i;
+		}
+		MPI_Allgatherv(MPI_IN_PLACE,0,MPI_DATATYPE_NULL,image_surface_brightness,counts,displs,MPI_DOUBLE,*group_comm);
+		delete[] counts;
+		delete[] displs;
+	}
+#endif
 }
 
 void Lens::store_image_pixel_surface_brightness()
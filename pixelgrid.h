@@ -5,12 +5,14 @@
 #include "rand.h"
 #include "lensvec.h"
 #include "trirectangle.h"
+#include "delaunay.h"
 #include <vector>
 #include <iostream>
 using namespace std;
 
 class ImagePixelGrid;
 class SourcePixelGrid;
+class DelaunaySourceGrid;
 struct ImagePixelData;
 
 struct InterpolationCells {
@@ -27,20 +29,38 @@ class SourcePixelGrid
 
 	SourcePixelGrid ***cell;
 	Lens *lens;
-	static ImagePixelGrid *image_pixel_grid;
+	SourcePixelGrid *top_grid; // the zeroth-level grid, which holds the variables shared by all of its subcells (see below)
 	static TriRectangleOverlap *trirec;
 	static int nthreads;
 	SourcePixelGrid *neighbor[4]; // 0 = i+1 neighbor, 1 = i-1 neighbor, 2 = j+1 neighbor, 3 = j-1 neighbor
 	SourcePixelGrid *parent_cell;
 	int ii, jj; // this is the index assigned to this cell in the grid of the parent cell
 
-	static double zfactor; // kappa ratio used for modeling source points at different redshifts
-	static double xcenter, ycenter;
-	static double srcgrid_xmin, srcgrid_xmax, srcgrid_ymin, srcgrid_ymax;
+	// The following are only set in the zeroth-level grid (subcells reach them through top_grid), so that each Lens object
+	// (including the thread clones used to evaluate the likelihood concurrently) can have its own source grid
+	ImagePixelGrid *image_pixel_grid;
+	double zfactor; // kappa ratio used for modeling source points at different redshifts
+	double xcenter, ycenter;
+	double srcgrid_xmin, srcgrid_xmax, srcgrid_ymin, srcgrid_ymax;
+	int number_of_pixels;
+	bool regrid;
+	bool regrid_if_unmapped_source_subcells;
+	bool activate_unmapped_source_pixels;
+	bool exclude_source_pixels_outside_fit_window;
+	int u_split_initial, w_split_initial;
+	int levels; // keeps track of the total number of grid cell levels
+	double min_cell_area;
+	// The multigrid aggregates and the log-determinant of the regularization matrix depend only on the active source pixels,
+	// so they are found once per grid and reused by later inversions on it (e.g. those of the extra image bands)
+	int mg_n_coarse_levels; // -1 if the aggregates have not been found yet
+	int *mg_n_aggregates;
+	int **mg_aggregate_index;
+	bool Rmatrix_logdet_found;
+	double Rmatrix_logdet;
+
 	int u_N, w_N;
 	int level;
 	static int *imin, *imax, *jmin, *jmax; // defines "window" within which we will check all the cells for overlap
-	static int number_of_pixels;
 	lensvector center_pt;
 	double cell_area;
 	lensvector corner_pt[4];
@@ -56,24 +76,22 @@ class SourcePixelGrid
 	static InterpolationCells *nearest_interpolation_cells;
 	static lensvector **interpolation_pts[3];
 	static int *n_interpolation_pts;
-	static bool regrid;
-	static bool regrid_if_unmapped_source_subcells;
-	static bool activate_unmapped_source_pixels;
-	static bool exclude_source_pixels_outside_fit_window;
-
-	// Used for calculating areas and finding whether points are inside a given cell
-	static lensvector d1, d2, d3, d4;
-	static double product1, product2, product3;
+
+	// These are indexed by thread (see Lens::lens_thread for how thread clones are assigned their own index)
 	static int *maxlevs;
 	static lensvector ***xvals_threads;
 	static lensvector ***corners_threads;
 
-	static int u_split_initial, w_split_initial;
 	static const int max_levels;
 
-	static int levels; // keeps track of the total number of grid cell levels
-	static int splitlevels; // specifies the number of initial splittings to perform (not counting extra splittings if critical curves present)
-	static double min_cell_area;
+	// Lookup table for finding the cell containing a point (used for the Interpolate ray tracing method; top-level grid only).
+	// The source plane is divided into uniform buckets at the resolution of the smallest cells, and each bucket points to the
+	// smallest cell that contains it entirely (normally a leaf cell, unless the number of buckets had to be capped).
+	SourcePixelGrid **cell_lookup;
+	int lookup_nx, lookup_ny;
+	double lookup_xmin, lookup_ymin, lookup_dx, lookup_dy;
+	static const int max_lookup_buckets;
+	static const int lookup_buckets_per_cell;
 
 	void split_cells(const int usplit, const int wsplit, const int& thread);
 	void unsplit();
@@ -90,6 +108,14 @@ class SourcePixelGrid
 	void assign_indices(int& source_pixel_i);
 	int assign_active_indices_and_count_source_pixels(bool regrid_if_inactive_cells, bool activate_unmapped_pixels, bool exclude_pixels_outside_window);
 	void assign_active_indices(int& source_pixel_i);
+	void find_active_pixel_ancestors(SourcePixelGrid*** ancestors, int* pixel_level, int* firstlevel_i, int* firstlevel_j, const int i0, const int j0);
+	void clear_inversion_cache();
+#ifdef USE_MPI
+	void sum_cell_data_over_group(const int cell_level);
+	void transfer_cell_data(vector<double>& celldata, int& k, const int cell_level, const bool unpack);
+	void combine_mapping_flags_over_group();
+	void transfer_mapping_flags(vector<int>& flags, int& k, const bool unpack);
+#endif
 
 	void print_indices();
 
@@ -97,7 +123,6 @@ class SourcePixelGrid
 	SourcePixelGrid(Lens* lens_in, double x_min, double x_max, double y_min, double y_max);
 	SourcePixelGrid(Lens* lens_in, SourcePixelGrid* input_pixel_grid);
 	SourcePixelGrid(Lens* lens_in, string pixel_data_fileroot, const double& minarea_in);
-	static void set_splitting(int rs0, int ts0, double min_cs);
 	static void allocate_multithreaded_variables(const int& threads);
 	static void deallocate_multithreaded_variables();
 	void copy_source_pixel_grid(SourcePixelGrid* input_pixel_grid);
@@ -127,12 +152,21 @@ class SourcePixelGrid
 	void calculate_Lmatrix_interpolate(const int img_index, const int image_pixel_i, const int image_pixel_j, int& Lmatrix_index, lensvector &input_center_pts, const int& thread);
 	double find_lensed_surface_brightness_interpolate(lensvector &input_center_pt, const int& thread);
 	void find_interpolation_cells(lensvector &input_center_pt, const int& thread);
+	void find_interpolation_neighbors(lensvector &input_center_pt, SourcePixelGrid* &cellptr1, SourcePixelGrid* &cellptr2);
+	void build_cell_lookup_table();
+	void delete_cell_lookup_table();
+	void invalidate_cell_lookup_table();
+	void find_smallest_cell_size(double& dx, double& dy);
+	void fill_cell_lookup_table(SourcePixelGrid** table, const int nx, const int ny, const double xmin, const double ymin, const double dx, const double dy);
+	SourcePixelGrid* find_containing_leaf_cell(lensvector &input_center_pt);
 	SourcePixelGrid* find_nearest_neighbor_cell(lensvector &input_center_pt, const int& side);
 	SourcePixelGrid* find_nearest_neighbor_cell(lensvector &input_center_pt, const int& side, const int tiebreaker_side);
 	void find_nearest_two_cells(SourcePixelGrid* &cellptr1, SourcePixelGrid* &cellptr2, const int& side);
 	SourcePixelGrid* find_corner_cell(const int i, const int j);
 
 	void assign_surface_brightness();
+	void assign_surface_brightness_from_delaunay(DelaunaySourceGrid* delaunay_grid);
+	void assign_surface_brightness_from_delaunay_recursive(DelaunaySourceGrid* delaunay_grid, int& tri);
 	void update_surface_brightness(int& index);
 	void fill_surface_brightness_vector();
 	void fill_surface_brightness_vector_recursive(int& column_j);
@@ -146,7 +180,7 @@ class SourcePixelGrid
 
 	void clear(void);
 	void clear_subgrids();
-	void set_image_pixel_grid(ImagePixelGrid* image_pixel_ptr) { image_pixel_grid = image_pixel_ptr; }
+	void set_image_pixel_grid(ImagePixelGrid* image_pixel_ptr) { top_grid->image_pixel_grid = image_pixel_ptr; }
 	~SourcePixelGrid();
 
 	//static ofstream bad_interps;
@@ -162,11 +196,46 @@ class SourcePixelGrid
 	void plot_corner_coordinates(void);
 };
 
+// Alternative to the adaptive source grid: the source pixels are the ray-traced centers of a subset of the image pixels in
+// the fit window (every 'stride' pixels along each direction), and the source surface brightness is interpolated linearly
+// over their Delaunay triangulation. The source points thus concentrate wherever the magnification is high, and none are
+// placed in regions of the source plane that do not map to the data. The source pixel index is the index of the point.
+class DelaunaySourceGrid
+{
+	friend class Lens;
+	friend class SourcePixelGrid;
+	Lens *lens;
+	ImagePixelGrid *image_pixel_grid;
+	Delaunay *triangulation;
+	int n_srcpts;
+	double *srcpts_x, *srcpts_y;
+	double *surface_brightness;
+	double *total_magnification, *n_images;
+	vector<int> *neighbors; // points that share a triangle edge with each point
+	bool *boundary_pt; // points on the edge of the triangulation
+	int x_N, y_N; // dimensions of the image pixel grid
+	int **image_pixel_triangle; // triangle containing the ray-traced center of each image pixel (-1 if outside the triangulation)
+	double **image_pixel_weights; // interpolation weights of the triangle vertices for pixel (i,j) are stored in [i][3*j]...[i][3*j+2]
+
+	public:
+	DelaunaySourceGrid(Lens* lens_in, ImagePixelGrid* image_pixel_grid_in, const int stride);
+	~DelaunaySourceGrid();
+	int assign_image_mapping_flags();
+	void calculate_Lmatrix(const int img_index, const int image_pixel_i, const int image_pixel_j, int& Lmatrix_index);
+	void calculate_pixel_magnifications();
+	void interpolate(const double x, const double y, int& tri, double& sb, double& mag, double& nimg);
+	void update_surface_brightness(const double* sb);
+	void fill_n_image_vector();
+	void clear_image_mapping();
+};
+
 class ImagePixelGrid : public Sort
 {
 	// the image pixel grid is simpler because its cells will never be split. So there is no recursion in this grid
 	friend class Lens;
 	friend class SourcePixelGrid;
+	friend class DelaunaySourceGrid;
+	friend class LensingOperatorCG;
 	Lens *lens;
 	SourcePixelGrid *source_pixel_grid;
 	lensvector **corner_pts;
@@ -190,7 +259,22 @@ class ImagePixelGrid : public Sort
 	int xy_N; // gives x_N*y_N if the entire pixel grid is used
 	double pixel_xlength, pixel_ylength;
 	inline bool test_if_inside_cell(const lensvector& point);
-	static double zfactor;
+	double zfactor;
+
+	// supersampled source points for modeling a parameterized source; the nsplit*nsplit subpixels of each traced pixel are stored contiguously
+	int n_supersampled_pixels, supersampling_nsplit;
+	int supersampling_margin_x, supersampling_margin_y; // number of pixels outside the fit window that are also traced (to allow for PSF convolution)
+	int *supersampled_pixel_i, *supersampled_pixel_j;
+	double *supersampled_srcx, *supersampled_srcy, *supersampled_sb;
+	void delete_supersampled_pixels();
+
+	// With image-pixel decomposition, the image is divided into horizontal strips with similar numbers of pixels in the fit
+	// window, one for each process in the MPI group; process id owns rows row_block_start[id] to row_block_start[id+1]-1.
+	// If own_rows_traced_only is set, each process has only ray traced its own rows, plus halo_rows rows on either side.
+	int *row_block_start;
+	int halo_rows;
+	bool own_rows_traced_only;
+	void find_row_block(const int id, int& row_start, int& row_end, const bool include_halo = false);
 
 	public:
 	ImagePixelGrid(Lens* lens_in, RayTracingMethod method, double xmin_in, double xmax_in, double ymin_in, double ymax_in, int x_N_in, int y_N_in);
@@ -212,14 +296,17 @@ class ImagePixelGrid : public Sort
 	void find_optimal_sourcegrid_npixels(double pixel_fraction, double srcgrid_xmin, double srcgrid_xmax, double srcgrid_ymin, double srcgrid_ymax, int& nsrcpixel_x, int& nsrcpixel_y, int& n_expected_active_pixels);
 	void find_optimal_firstlevel_sourcegrid_npixels(double srcgrid_xmin, double srcgrid_xmax, double srcgrid_ymin, double srcgrid_ymax, int& nsrcpixel_x, int& nsrcpixel_y, int& n_expected_active_pixels);
 	void find_surface_brightness();
+	void ray_trace_supersampled_pixels(const int nsplit, const int margin_x, const int margin_y);
+	void find_surface_brightness_from_sb_profiles(SB_Profile** sb_list, const int n_sb);
 	void plot_surface_brightness(string outfile_root, bool plot_residual = false);
 	void output_fits_file(string fits_filename, bool plot_residual = false);
 
 	void add_pixel_noise(const double& pixel_noise_sig);
 	void set_pixel_noise(const double& pn) { pixel_noise = pn; }
 	double calculate_signal_to_noise(const double& pixel_noise_sig);
+	void assign_row_blocks(const int nblocks, const int halo);
 	void assign_image_mapping_flags();
-	int count_nonzero_source_pixel_mappings();
+	int count_nonzero_source_pixel_mappings(const int img_start, const int img_end);
 	void plot_center_pts_source_plane();
 };
 
@@ -231,6 +318,7 @@ struct ImagePixelData
 	int n_required_pixels;
 	double **surface_brightness;
 	bool **require_fit;
+	double **noise_weight; // inverse variance (1/sigma^2) of each pixel; NULL unless a noise or weight map has been loaded
 	double *xvals, *yvals;
 	double xmin, xmax, ymin, ymax;
 	double pixel_size;
@@ -238,6 +326,7 @@ struct ImagePixelData
 	{
 		surface_brightness = NULL;
 		require_fit = NULL;
+		noise_weight = NULL;
 		xvals = NULL;
 		yvals = NULL;
 	}
@@ -253,6 +342,17 @@ struct ImagePixelData
 	}
 	bool load_data_fits(bool use_pixel_size, string fits_filename);
 	bool load_mask_fits(string fits_filename);
+	bool load_noise_map(string filename, const bool weight_map);
+	bool load_noise_map_fits(string fits_filename, const bool weight_map);
+	void clear_noise_map();
+	bool noise_map_loaded() { return (noise_weight != NULL); }
+	double pixel_weight(const int i, const int j, const double uniform_noise)
+	{
+		if (noise_weight != NULL) return noise_weight[i][j];
+		return (uniform_noise==0) ? 1.0 : 1.0/(uniform_noise*uniform_noise);
+	}
+	// pixels with zero weight are excluded from the fit entirely, so they never enter the Lmatrix
+	bool fit_pixel(const int i, const int j) { return ((require_fit[i][j]) and ((noise_weight==NULL) or (noise_weight[i][j] > 0))); }
 	void set_no_required_data_pixels();
 	void set_all_required_data_pixels();
 	void set_required_data_pixels(const double xmin, const double xmax, const double ymin, const double ymax, const bool unset = false);
@@ -287,6 +387,16 @@ struct ImagePixelData
 	void plot_surface_brightness(string outfile_root);
 };
 
+struct ImagePixelBand
+{
+	// An additional band of image data, fit simultaneously with the main image data using the same lens mapping (and the
+	// same fit window), but with its own PSF, pixel noise and source surface brightness
+	ImagePixelData *data;
+	double psf_width_x, psf_width_y; // widths of a Gaussian PSF for this band (no PSF convolution if zero)
+	double pixel_noise; // uniform pixel noise, used if no noise map has been loaded for this band
+	double chisq; // contribution of this band to the chi-square in the most recent inversion
+};
+
 
 
 #endif // PIXELGRID_H
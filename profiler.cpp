@@ -0,0 +1,240 @@
+#include "profiler.h"
+#include "errors.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sys/time.h>
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+#ifdef USE_MPI
+#include "mpi.h"
+#endif
+
+using namespace std;
+
+bool Profiler::active = false;
+int Profiler::nthreads = 0;
+double **Profiler::stage_time = NULL;
+long int **Profiler::stage_calls = NULL;
+long int **Profiler::counts = NULL;
+long int Profiler::n_loglike_calls = 0;
+int Profiler::report_interval = 0;
+string Profiler::report_filename = "";
+double Profiler::start_time = 0;
+int Profiler::mpi_id = 0;
+int Profiler::mpi_np = 1;
+const char *Profiler::stage_names[PROF_NSTAGES] = { "likelihood", "ray_tracing", "grid_construction", "lmatrix", "psf_convolution", "fmatrix", "inversion", "log_determinant", "image_finding", "sampler" };
+const char *Profiler::counter_names[PROF_NCOUNTERS] = { "rays_traced", "lmatrix_elements", "source_pixels", "images_found", "loglike_cache_hits" };
+
+void Profiler::allocate_multithreaded_variables(const int& threads)
+{
+	nthreads = threads;
+	stage_time = new double*[threads];
+	stage_calls = new long int*[threads];
+	counts = new long int*[threads];
+	for (int i=0; i < threads; i++) {
+		stage_time[i] = new double[PROF_NSTAGES];
+		stage_calls[i] = new long int[PROF_NSTAGES];
+		counts[i] = new long int[PROF_NCOUNTERS];
+	}
+	reset();
+}
+
+void Profiler::deallocate_multithreaded_variables()
+{
+	for (int i=0; i < nthreads; i++) {
+		delete[] stage_time[i];
+		delete[] stage_calls[i];
+		delete[] counts[i];
+	}
+	delete[] stage_time;
+	delete[] stage_calls;
+	delete[] counts;
+	stage_time = NULL;
+	stage_calls = NULL;
+	counts = NULL;
+	nthreads = 0;
+}
+
+double Profiler::wtime()
+{
+#ifdef USE_OPENMP
+	return omp_get_wtime();
+#else
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+#endif
+}
+
+int Profiler::thread_slot()
+{
+	int thread = 0;
+#ifdef USE_OPENMP
+	// use the thread number from the outermost team with more than one thread, so that the thread clones (whose own
+	// parallel regions are nested inside the one that runs the clones, and hence inactive) each keep their own slot
+	for (int level=1; level <= omp_get_level(); level++) {
+		if (omp_get_team_size(level) > 1) {
+			thread = omp_get_ancestor_thread_num(level);
+			break;
+		}
+	}
+#endif
+	// threads beyond the number allocated share the last slot
+	if (thread >= nthreads) thread = nthreads-1;
+	return thread;
+}
+
+void Profiler::reset()
+{
+	for (int i=0; i < nthreads; i++) {
+		for (int j=0; j < PROF_NSTAGES; j++) {
+			stage_time[i][j] = 0;
+			stage_calls[i][j] = 0;
+		}
+		for (int j=0; j < PROF_NCOUNTERS; j++) counts[i][j] = 0;
+	}
+	n_loglike_calls = 0;
+	start_time = wtime();
+}
+
+void Profiler::add_time(const ProfileStage stage, const double dt)
+{
+	int thread = thread_slot();
+	stage_time[thread][stage] += dt;
+	stage_calls[thread][stage]++;
+}
+
+void Profiler::loglike_call_done()
+{
+	long int ncalls;
+	#pragma omp atomic capture
+	ncalls = ++n_loglike_calls;
+	if ((report_interval > 0) and (ncalls % report_interval == 0) and (mpi_id==0) and (report_filename != "")) {
+		// periodic snapshots are written from the local process only, since the other MPI processes may be elsewhere
+		// in the sampler; the totals from the other threads may be slightly behind if they are in the middle of a stage
+		double times[PROF_NSTAGES], max_thread_times[PROF_NSTAGES];
+		long int calls[PROF_NSTAGES], countvals[PROF_NCOUNTERS];
+		int i,j;
+		for (j=0; j < PROF_NSTAGES; j++) {
+			times[j] = max_thread_times[j] = 0;
+			calls[j] = 0;
+			for (i=0; i < nthreads; i++) {
+				times[j] += stage_time[i][j];
+				if (stage_time[i][j] > max_thread_times[j]) max_thread_times[j] = stage_time[i][j];
+				calls[j] += stage_calls[i][j];
+			}
+		}
+		for (j=0; j < PROF_NCOUNTERS; j++) {
+			countvals[j] = 0;
+			for (i=0; i < nthreads; i++) countvals[j] += counts[i][j];
+		}
+		#pragma omp critical (profiler_report)
+		{
+			ofstream out(report_filename.c_str(), ios::out | ios::app);
+			if (!out.is_open()) warn("could not open profile report file '%s'",report_filename.c_str());
+			else write_report_line(out,"interval",times,max_thread_times,times,calls,countvals,wtime()-start_time,ncalls,1,false);
+		}
+	}
+}
+
+double Profiler::get_stage_time(const ProfileStage stage)
+{
+	double totaltime = 0;
+	for (int i=0; i < nthreads; i++) totaltime += stage_time[i][stage];
+	return totaltime;
+}
+
+long int Profiler::get_count(const ProfileCounter counter)
+{
+	long int count = 0;
+	for (int i=0; i < nthreads; i++) count += counts[i][counter];
+	return count;
+}
+
+void Profiler::write_report(const char *label)
+{
+	// Combines the per-thread totals and (with MPI) reduces them over all processes, then appends the result to the report
+	// file as a single line of JSON. This must be called by all MPI processes.
+	double times[PROF_NSTAGES], max_thread_times[PROF_NSTAGES], max_process_times[PROF_NSTAGES];
+	long int calls[PROF_NSTAGES], countvals[PROF_NCOUNTERS];
+	int i,j;
+	for (j=0; j < PROF_NSTAGES; j++) {
+		times[j] = max_thread_times[j] = 0;
+		calls[j] = 0;
+		for (i=0; i < nthreads; i++) {
+			times[j] += stage_time[i][j];
+			if (stage_time[i][j] > max_thread_times[j]) max_thread_times[j] = stage_time[i][j];
+			calls[j] += stage_calls[i][j];
+		}
+		max_process_times[j] = times[j];
+	}
+	for (j=0; j < PROF_NCOUNTERS; j++) {
+		countvals[j] = 0;
+		for (i=0; i < nthreads; i++) countvals[j] += counts[i][j];
+	}
+	long int loglike_calls = n_loglike_calls;
+	double walltime = wtime() - start_time;
+#ifdef USE_MPI
+	MPI_Allreduce(MPI_IN_PLACE, times, PROF_NSTAGES, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, max_thread_times, PROF_NSTAGES, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, max_process_times, PROF_NSTAGES, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, calls, PROF_NSTAGES, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, countvals, PROF_NCOUNTERS, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, &loglike_calls, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, &walltime, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+	for (j=0; j < PROF_NSTAGES; j++) times[j] /= mpi_np; // report the mean time per process
+#endif
+	if ((mpi_id==0) and (report_filename != "")) {
+		ofstream out(report_filename.c_str(), ios::out | ios::app);
+		if (!out.is_open()) warn("could not open profile report file '%s'",report_filename.c_str());
+		else write_report_line(out,label,times,max_thread_times,max_process_times,calls,countvals,walltime,loglike_calls,mpi_np,true);
+	}
+}
+
+void Profiler::write_report_line(ofstream& out, const char *label, double *times, double *max_thread_times, double *max_process_times, long int *calls, long int *countvals, const double walltime, const long int loglike_calls, const int nprocs, const bool mpi_aggregated)
+{
+	// stage times are summed over threads; with MPI aggregation, "time" is the mean over processes, "max_process_time" the
+	// largest total on any one process, and the calls and counters are summed over all processes
+	out << setprecision(6);
+	out << "{\"label\": \"" << label << "\", \"wall_time\": " << walltime << ", \"loglike_calls\": " << loglike_calls;
+	out << ", \"threads\": " << nthreads << ", \"mpi_processes\": " << nprocs << ", \"mpi_aggregated\": " << ((mpi_aggregated) ? "true" : "false");
+	out << ", \"stages\": {";
+	for (int j=0; j < PROF_NSTAGES; j++) {
+		if (j > 0) out << ", ";
+		out << "\"" << stage_names[j] << "\": {\"calls\": " << calls[j] << ", \"time\": " << times[j] << ", \"max_thread_time\": " << max_thread_times[j] << ", \"max_process_time\": " << max_process_times[j] << "}";
+	}
+	double overhead = times[PROF_SAMPLER] - times[PROF_LIKELIHOOD];
+	if (overhead < 0) overhead = 0; // the likelihood may also have been called outside of a sampler
+	out << "}, \"sampler_overhead\": " << overhead << ", \"counters\": {";
+	for (int j=0; j < PROF_NCOUNTERS; j++) {
+		if (j > 0) out << ", ";
+		out << "\"" << counter_names[j] << "\": " << countvals[j];
+	}
+	out << "}}" << endl;
+}
+
+void Profiler::print_summary()
+{
+	// prints the totals for the local process (summed over threads)
+	double totaltime;
+	long int ncalls, count;
+	cout << "Profiling: " << ((active) ? "on" : "off") << ", " << n_loglike_calls << " likelihood calls, " << (wtime()-start_time) << " sec since reset" << endl;
+	for (int j=0; j < PROF_NSTAGES; j++) {
+		totaltime = 0;
+		ncalls = 0;
+		for (int i=0; i < nthreads; i++) {
+			totaltime += stage_time[i][j];
+			ncalls += stage_calls[i][j];
+		}
+		if (ncalls > 0) cout << "   " << left << setw(20) << stage_names[j] << right << setw(10) << ncalls << " calls   " << totaltime << " sec" << endl;
+	}
+	for (int j=0; j < PROF_NCOUNTERS; j++) {
+		count = 0;
+		for (int i=0; i < nthreads; i++) count += counts[i][j];
+		if (count > 0) cout << "   " << left << setw(20) << counter_names[j] << right << setw(10) << count << endl;
+	}
+}
@@ -0,0 +1,102 @@
+// PROFILER.H: Lightweight timers and counters for the main stages of a likelihood evaluation
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <fstream>
+
+using namespace std;
+
+enum ProfileStage {
+	PROF_LIKELIHOOD,
+	PROF_RAY_TRACING,
+	PROF_GRID_CONSTRUCTION,
+	PROF_LMATRIX,
+	PROF_PSF_CONVOLUTION,
+	PROF_FMATRIX,
+	PROF_INVERSION,
+	PROF_LOG_DETERMINANT,
+	PROF_IMAGE_FINDING,
+	PROF_SAMPLER,
+	PROF_NSTAGES
+};
+
+enum ProfileCounter {
+	PROF_RAYS_TRACED,
+	PROF_LMATRIX_ELEMENTS,
+	PROF_SOURCE_PIXELS,
+	PROF_IMAGES_FOUND,
+	PROF_LOGLIKE_CACHE_HITS,
+	PROF_NCOUNTERS
+};
+
+// Each thread accumulates into its own slot, so timers and counters can be used inside parallel regions without locking;
+// the slots are combined (and, with MPI, reduced over all processes) only when a report is written. Stage times are
+// inclusive, so a stage that runs inside another (e.g. ray tracing inside a likelihood evaluation) is counted in both.
+class Profiler
+{
+	static bool active;
+	static int nthreads;
+	static double **stage_time; // indexed by [thread][stage]
+	static long int **stage_calls;
+	static long int **counts; // indexed by [thread][counter]
+	static long int n_loglike_calls;
+	static int report_interval; // if > 0, a report is written every report_interval likelihood calls
+	static string report_filename;
+	static double start_time;
+	static int mpi_id, mpi_np;
+	static const char *stage_names[PROF_NSTAGES];
+	static const char *counter_names[PROF_NCOUNTERS];
+
+	static int thread_slot();
+	static void write_report_line(ofstream& out, const char *label, double *times, double *max_thread_times, double *max_process_times, long int *calls, long int *countvals, const double walltime, const long int loglike_calls, const int nprocs, const bool mpi_aggregated);
+
+	public:
+	static void allocate_multithreaded_variables(const int& threads);
+	static void deallocate_multithreaded_variables();
+	static void set_mpi_params(const int id, const int np) { mpi_id = id; mpi_np = np; }
+	static void set_active(const bool activate) { active = activate; }
+	static bool is_active() { return active; }
+	static void set_report_interval(const int interval) { report_interval = interval; }
+	static int get_report_interval() { return report_interval; }
+	static void set_report_filename(const string filename) { report_filename = filename; }
+	static string get_report_filename() { return report_filename; }
+	static long int get_loglike_calls() { return n_loglike_calls; }
+	static double wtime();
+	static void reset();
+	static void add_time(const ProfileStage stage, const double dt);
+	static void add_count(const ProfileCounter counter, const long int n)
+	{
+		if (active) counts[thread_slot()][counter] += n;
+	}
+	static void loglike_call_done();
+	static double get_stage_time(const ProfileStage stage); // totals for the local process (summed over threads)
+	static long int get_count(const ProfileCounter counter);
+	static void write_report(const char *label);
+	static void print_summary();
+};
+
+// Scoped timer: the time between construction and destruction is added to the given stage (if profiling is active)
+class ProfileTimer
+{
+	ProfileStage stage;
+	double t0;
+	bool on;
+
+	public:
+	ProfileTimer(const ProfileStage stage_in) : stage(stage_in)
+	{
+		on = Profiler::is_active();
+		if (on) t0 = Profiler::wtime();
+	}
+	~ProfileTimer()
+	{
+		if (on) {
+			Profiler::add_time(stage,Profiler::wtime()-t0);
+			if (stage==PROF_LIKELIHOOD) Profiler::loglike_call_done();
+		}
+	}
+};
+
+#endif // PROFILER_H
@@ -38,11 +38,15 @@ int main(int argc, char *argv[])
 	Grid::allocate_multithreaded_variables(nthreads);
 	SourcePixelGrid::allocate_multithreaded_variables(nthreads);
 	Lens::allocate_multithreaded_variables(nthreads);
+	Profiler::allocate_multithreaded_variables(nthreads);
+	Profiler::set_mpi_params(mpi_id,mpi_np);
 
 	bool read_from_file = false;
 	bool verbal_mode = true;
 	bool quit_after_reading_file = false;
 	char input_filename[40];
+	bool run_batch = false;
+	char batch_manifest[100];
 	bool find_total_time = false;
 	int inversion_nthreads = nthreads;
 	int ngroups = mpi_np;
@@ -71,6 +75,13 @@ int main(int argc, char *argv[])
 						if (sscanf(argv[i], "t%i", &inversion_nthreads)==0) usage_error(mpi_id);
 						argv[i] = advance(argv[i]);
 						break;
+					case 'b':
+						if (sscanf(argv[i], "b:%99s", batch_manifest)==1) {
+							run_batch = true;
+							argv[i] += (1 + strlen(batch_manifest));
+						} else usage_error(mpi_id);
+						argv[i] = advance(argv[i]);
+						break;
 					case 'f':
 						read_from_file = true;
 						if (sscanf(argv[i], "f:%s", input_filename)==1)
@@ -188,10 +199,10 @@ int main(int argc, char *argv[])
 			cerr << "Error: could not open input file '" << input_filename << "'\n\n";
 			exit(1);
 		}
-		lens.set_quit_after_reading_file(quit_after_reading_file);
+		lens.set_quit_after_reading_file((run_batch) ? true : quit_after_reading_file); // in batch mode, the input script is only used to change settings
 	}
 
-	if ((mpi_id==0) and (verbal_mode==true)) {
+	if ((mpi_id==0) and (verbal_mode==true) and (!run_batch)) {
 		cout << "QLens by Quinn Minor (2017)\n";
 		cout << "Type 'help' for a list of commands, or 'demo1' or 'demo2' to see demos (or 'q' to quit).\n\n";
 	}
@@ -207,7 +218,11 @@ int main(int argc, char *argv[])
 #endif
 	}
 
-	lens.process_commands(read_from_file);
+	if (run_batch) {
+		if (read_from_file) lens.process_commands(true);
+		lens.run_batch(batch_manifest,"batch");
+	}
+	else lens.process_commands(read_from_file);
 
 	if (disptime) {
 		double wtime;
@@ -225,6 +240,7 @@ int main(int argc, char *argv[])
 	Grid::deallocate_multithreaded_variables();
 	SourcePixelGrid::deallocate_multithreaded_variables();
 	Lens::deallocate_multithreaded_variables();
+	Profiler::deallocate_multithreaded_variables();
 
 #ifdef USE_MPI
 	MPI_Finalize();
@@ -249,7 +265,9 @@ void usage_error(const int mpi_id)
 				"  -c:<file> Load cosmology parameters from input file (default: 'planck.csm')\n"
 				"  -s        Run qlens in nonverbal mode (does not echo commands read from file, etc.)\n"
 				"  -q        Quit after reading input file (rather than enter interactive mode)\n"
-				"  -Q        Do not quit if an error is encountered while running an input script\n";
+				"  -Q        Do not quit if an error is encountered while running an input script\n"
+				"  -b:<file> Run a batch of lens systems listed in manifest <file>, then quit (see 'help batch');\n"
+				"            if an input script is also given, it is run first (e.g. to change settings)\n";
 #ifdef USE_OPENMP
 		cout << "  -t        # of OpenMP threads for matrix inversion (only inversion part)\n";
 		cout << "  -w        Show wall time for computationally intensive parts (matrix inversion, etc.)\n";
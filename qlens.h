@@ -13,11 +13,15 @@
 #include "simplex.h"
 #include "mcmchdr.h"
 #include "cosmo.h"
+#include "profiler.h"
+#include "llcache.h"
+#include "lenstree.h"
 #ifdef USE_MUMPS
 #include "dmumps_c.h"
 #endif
 #include <string>
 #include <vector>
+#include <map>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
@@ -48,10 +52,12 @@ enum RayTracingMethod {
 
 class Lens;			// Defined after class Grid
 class SourcePixelGrid;
+class DelaunaySourceGrid;
 class ImagePixelGrid;
 class Defspline;	// ...
 struct ImageData;
 struct ImagePixelData;
+struct ImagePixelBand;
 struct ParamSettings;
 
 struct image {
@@ -62,6 +68,33 @@ struct image {
 
 struct jl_pair {
 	int j,l;
+	int i; // image pixel (Lmatrix row) that both entries belong to
+};
+
+// Variables shared by all the cells of an image-searching grid. These are allocated by the zeroth-level grid and the subcells
+// are given a pointer to them, so each Lens object (including the thread clones used to evaluate the likelihood concurrently)
+// can search for images with its own grid.
+struct GridData {
+	double zfactor; // kappa ratio used for modeling source points at different redshifts
+	bool radial_grid; // if false, a Cartesian grid is assumed
+	bool enforce_min_area;
+	bool cc_neighbor_splittings;
+	double rmin, rmax;
+	double xcenter, ycenter;
+	double grid_q;
+	int u_split_initial, w_split_initial;
+	int levels; // keeps track of the total number of grid cell levels
+	int splitlevels; // specifies the number of initial splittings to perform (not counting extra splittings if critical curves present)
+	int cc_splitlevels; // specifies the additional splittings to perform if critical curves are present
+	double min_cell_area;
+
+	// used for finding critical curves within a grid cell
+	lensvector ccsearch_initial_pt, ccsearch_interval;
+
+	// results of the image search
+	bool finished_search;
+	int nfound, nfound_max, nfound_pos, nfound_neg;
+	image *images;
 };
 
 class Grid : public Brent
@@ -71,21 +104,16 @@ class Grid : public Brent
 	Grid(lensvector** xij, const int& i, const int& j, const int& level_in, Grid* parent_ptr);
 
 	Grid*** cell;
-	static Lens* lens;
+	Lens* lens;
+	GridData* grid_data; // allocated by the zeroth-level grid (see above)
 	static int nthreads;
 	Grid* neighbor[4]; // 0 = i+1 neighbor, 1 = i-1 neighbor, 2 = j+1 neighbor, 3 = j-1 neighbor
 	Grid* parent_cell;
 	Grid** search_subcells;
 
-	static double zfactor; // kappa ratio used for modeling source points at different redshifts
 	static const int u_split, w_split;
-	static bool radial_grid; // if false, a Cartesian grid is assumed
-	static bool enforce_min_area;
-	static bool cc_neighbor_splittings;
-	static double rmin, rmax;
-	static double xcenter, ycenter;
-	static double grid_q;
 	static double theta_offset;
+	void set_splitting_from_lens();
 
 	int u_N, w_N;
 	int level;
@@ -113,16 +141,12 @@ class Grid : public Brent
 	void reassign_subcell_lensing_properties_firstlevel();
 	void assign_subcell_lensing_properties(const int& thread);
 
-	// Used for image searching. If you ever multi-thread, be careful about making these static variables
+	// Used for image searching; these are indexed by thread (see Lens::lens_thread for how thread clones are assigned their own index)
 	static lensvector *d1, *d2, *d3, *d4;
 	static double *product1, *product2, *product3;
 	static int *maxlevs;
 	static lensvector ***xvals_threads;
 
-	// Used for finding critical curves within a grid cell
-	static int corner_positive_mag[4], corner_negative_mag[4];
-	static lensvector ccsearch_initial_pt, ccsearch_interval;
-
 	bool cc_inside;
 	bool singular_pt_inside;
 	bool cell_in_central_image_region;
@@ -130,19 +154,11 @@ class Grid : public Brent
 	void check_if_singular_point_inside(const int& thread);
 	void check_if_central_image_region();
 
-	static double ccroot_t;
-	static lensvector ccroot;
-	static double cclength1, cclength2, long_diagonal_length;
 	double invmag_along_diagonal(const double t);
 
-	static int u_split_initial, w_split_initial;
 	static const int max_level, max_images;
 
-	static int levels; // keeps track of the total number of grid cell levels
-	static int splitlevels; // specifies the number of initial splittings to perform (not counting extra splittings if critical curves present)
-	static int cc_splitlevels; // specifies the additional splittings to perform if critical curves are present
 	int galsubgrid_cc_splitlevels;
-	static double min_cell_area;
 
 	void clear_subcells(int clear_level);
 	void split_subcells_firstlevel(int cc_splitlevels, bool cc_neighbor_splitting);
@@ -168,30 +184,24 @@ class Grid : public Brent
 
 	static const int max_iterations, max_step_length;
 	static bool *newton_check;
-	// make these multithread-safe when you are ready to multithread the image searching
-	static bool finished_search;
-	static int nfound_max, nfound_pos, nfound_neg;
-	static image images[];
 
 public:
-	Grid(double r_min, double r_max, double xcenter_in, double ycenter_in, double grid_q_in, double zfactor_in); 
-	Grid(double xcenter_in, double ycenter_in, double xlength, double ylength, double zfactor_in);
+	Grid(Lens* lens_in, double r_min, double r_max, double xcenter_in, double ycenter_in, double grid_q_in, double zfactor_in);
+	Grid(Lens* lens_in, double xcenter_in, double ycenter_in, double xlength, double ylength, double zfactor_in);
 	void redraw_grid(double r_min, double r_max, double xcenter_in, double ycenter_in, double grid_q_in, double zfactor_in);
 	void redraw_grid(double xcenter_in, double ycenter_in, double xlength, double ylength, double zfactor_in);
 	void reassign_coordinates(lensvector** xij, const int& i, const int& j, const int& level_in, Grid* parent_ptr);
 
-	static void set_splitting(int rs0, int ts0, int sl, int ccsl, double max_cs, bool neighbor_split);
 	static void allocate_multithreaded_variables(const int& threads);
 	static void deallocate_multithreaded_variables();
-	static void reset_search_parameters();
+	void reset_search_parameters();
 	~Grid();
 
-	static int nfound;
+	int get_nfound() { return grid_data->nfound; }
 	static double image_pos_accuracy;
 	static double redundancy_separation_threshold;
 	static double warning_magnification_threshold;
 	image* tree_search();
-	static void set_lens(Lens* lensptr) { lens = lensptr; }
 	void subgrid_around_galaxies(lensvector* galaxy_centers, const int& ngal, double* subgrid_radius, double* min_galsubgrid_cellsize, const int& n_cc_splittings);
 	void subgrid_around_galaxies_iteration(lensvector* galaxy_centers, const int& ngal, double* subgrid_radius, double* min_galsubgrid_cellsize, const int& n_cc_split, bool cc_neighbor_splitting);
 
@@ -201,13 +211,12 @@ public:
 		image_pos_accuracy = setting;
 		redundancy_separation_threshold = 10*setting;
 	}
-	static void set_enforce_min_area(const bool& setting) { enforce_min_area = setting; }
 
 	// for plotting the grid to a file:
 	static ofstream xgrid;
 	void plot_corner_coordinates();
-	void get_usplit_initial(int &setting) { setting = u_split_initial; }
-	void get_wsplit_initial(int &setting) { setting = w_split_initial; }
+	void get_usplit_initial(int &setting) { setting = grid_data->u_split_initial; }
+	void get_wsplit_initial(int &setting) { setting = grid_data->w_split_initial; }
 };
 
 class Lens : public Cosmology, public Brent, public Sort, public Powell, public Simplex, public UCMC
@@ -221,6 +230,8 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	int chisq_it;
 	ofstream logfile;
 	bool show_wtime;
+	int lens_thread; // index of the dummy variables used by the single-threaded lensing functions; nonzero only for thread clones
+	bool thread_clone; // true if created by create_thread_clone; thread clones keep their own copy of the extra_bands array
 
 	protected:
 	int mpi_id, mpi_np, mpi_ngroups, group_id, group_num, group_np;
@@ -234,10 +245,16 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	int inversion_nthreads;
 	int simplex_nmax, simplex_nmax_anneal;
 	double simplex_temp_initial, simplex_temp_final, simplex_cooling_factor, simplex_minchisq;
+	int de_population_size; // for differential evolution (if zero, set automatically from the number of parameters)
+	int de_max_generations;
+	bool de_polish; // if on, the best point found by differential evolution is refined with the downhill simplex method
 	int n_mcpoints; // for nested sampling
 	int mcmc_threads;
 	double mcmc_tolerance; // for Metropolis-Hastings
 	bool mcmc_logfile;
+	int mcmc_checkpoint_interval; // iterations between checkpoints of the nested sampling or T-Walk state (0 = no checkpoints)
+	int twalk_threads; // number of T-Walk chains moved concurrently by each process, each evaluated on its own thread
+	int loglike_cache_size; // number of likelihood evaluations remembered during a fit, so repeated points are not re-evaluated (0 = off)
 	bool open_chisq_logfile;
 	bool psf_convolution_mpi;
 	bool use_mumps_subcomm;
@@ -253,6 +270,9 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 
 	int nlens;
 	LensProfile** lens_list;
+	bool use_lens_tree; // if on, distant compact lenses (e.g. subhalos) are summed using a tree of multipole expansions
+	double lens_tree_accuracy;
+	LensTree *lens_tree;
 
 	int n_sb;
 	SB_Profile** sb_list;
@@ -285,13 +305,14 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	int splitlevels, cc_splitlevels;
 
 	Lens *fitmodel;
+	LogLikeCache *loglike_cache;
 	dvector fitparams, upper_limits, lower_limits, upper_limits_initial, lower_limits_initial, bestfitparams;
 	dmatrix bestfit_fisher_inverse;
 	dmatrix fisher_inverse;
 	double bestfit_flux;
 	double chisq_bestfit;
 	SourceFitMode source_fit_mode;
-	int lensmodel_fit_parameters, n_fit_parameters, n_sourcepts_fit;
+	int lensmodel_fit_parameters, srcmodel_fit_parameters, n_fit_parameters, n_sourcepts_fit;
 	vector<string> fit_parameter_names, transformed_parameter_names;
 	vector<string> latex_parameter_names, transformed_latex_parameter_names;
 	lensvector *sourcepts_fit;
@@ -316,6 +337,7 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	bool use_image_plane_chisq;
 	bool use_image_plane_chisq2;
 	bool calculate_parameter_errors;
+	bool adaptive_fisher_steps;
 	bool adaptive_grid;
 	bool use_average_magnification_for_subgridding;
 	bool activate_unmapped_source_pixels;
@@ -353,9 +375,13 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	string fit_output_dir;
 	bool auto_fit_output_dir;
 	enum TerminalType { TEXT, POSTSCRIPT, PDF } terminal; // keeps track of the file format for plotting
-	enum FitMethod { POWELL, SIMPLEX, NESTED_SAMPLING, TWALK } fitmethod;
+	enum FitMethod { POWELL, SIMPLEX, NESTED_SAMPLING, TWALK, DIFFERENTIAL_EVOLUTION } fitmethod;
 	enum RegularizationMethod { None, Norm, Gradient, Curvature, Image_Plane_Curvature } regularization_method;
-	enum InversionMethod { CG_Method, MUMPS, UMFPACK } inversion_method;
+	enum InversionMethod { CG_Method, MUMPS, UMFPACK, Matrix_Free_CG } inversion_method;
+	int logdet_nprobes, logdet_lanczos_steps; // for the stochastic log-determinant estimate used by the matrix-free inversion
+	bool use_multigrid_preconditioner; // for the CG inversion; coarse levels are built from the source pixel grid
+	bool mpi_image_decomposition; // if on, each MPI process in a group builds the Lmatrix rows and Fmatrix terms for its own block of image pixels
+	bool lmatrix_single_precision; // if on, the Lmatrix values are read as floats when assembling the Fmatrix (or applying the lensing operator)
 	RayTracingMethod ray_tracing_method;
 	bool parallel_mumps, show_mumps_info;
 
@@ -366,6 +392,8 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	double pixel_fraction, pixel_fraction_lower_limit, pixel_fraction_upper_limit;
 	bool vary_pixel_fraction, vary_magnification_threshold;
 	double psf_width_x, psf_width_y, data_pixel_noise, sim_pixel_noise;
+	int source_supersampling; // number of splittings per image pixel side when ray tracing for a parameterized source
+	dvector traced_lens_params; // fit parameters for which the supersampled image pixels were last ray traced
 	double sb_threshold; // for creating centroid images from pixel maps
 	double noise_threshold; // for automatic source grid sizing
 
@@ -403,6 +431,15 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	void plot_lensinfo_maps(string file_root, const int x_n, const int y_N);
 	void plot_logkappa_map(const int x_N, const int y_N);
 	void plot_logmag_map(const int x_N, const int y_N);
+	static const int n_lensmap_planes;
+	static const char *lensmap_plane_names[6];
+	static const int lensmap_tile_size;
+	void evaluate_lens_maps(const int x_N, const int y_N, double **planes);
+	void find_lens_map_tile_limits(const int tile, const int tiles_x, const int x_N, const int y_N, int& imin, int& imax, int& jmin, int& jmax);
+	void evaluate_lens_map_tile(const int imin, const int imax, const int jmin, const int jmax, const int x_N, const int y_N, double **planes, const int i0, const int j0, const int row_length, const int thread);
+	void write_lens_map_text(string filename, double *plane, const int x_N, const int y_N, const bool log_scale, const bool log_abs);
+	void write_lens_map_pixel_edges(string file_root, const int x_N, const int y_N);
+	bool generate_lens_maps(string file_root, const int x_N, const int y_N, const bool *include_plane, const bool fits_output, const bool single_precision, const int preview_factor, const bool verbal);
 
 	struct critical_curve {
 		vector<lensvector> cc_pts;
@@ -418,6 +455,10 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	int n_critical_curves;
 	void sort_critical_curves();
 	bool sorted_critical_curves;
+	bool find_critical_curves_marching_squares(const bool verbal, const double zfac);
+	bool use_cc_marching_squares; // if on, critical curves are traced on a uniform mesh by marching squares rather than by the recursive grid
+	int cc_marching_nx, cc_marching_ny; // number of mesh cells along x and y used by the marching squares tracer
+	static const int cc_marching_newton_steps;
 	static bool auto_store_cc_points;
 	vector<lensvector> singular_pts;
 	int n_singular_points;
@@ -438,12 +479,18 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	bool auto_sourcegrid;
 	SourcePixelGrid *source_pixel_grid;
 	void plot_source_pixel_grid(const char filename[]);
+	bool use_delaunay_srcgrid; // if on, the source pixels are the ray-traced centers of image pixels, interpolated on a Delaunay triangulation
+	int delaunay_srcgrid_stride; // every n'th image pixel along each direction is used as a source point
+	DelaunaySourceGrid *delaunay_srcgrid; // kept after an inversion so the source can be displayed; source_pixel_grid is then only created for display
 
 	ImagePixelGrid *image_pixel_grid;
 	ImagePixelData *image_pixel_data;
+	int n_extra_bands;
+	ImagePixelBand *extra_bands; // additional bands of image data that share the lens mapping of image_pixel_data
 	int image_npixels, source_npixels;
 	int *active_image_pixel_i;
 	int *active_image_pixel_j;
+	int *active_image_row_start; // index of the first active image pixel in each row of the image pixel grid (and the total at the end)
 	double *image_surface_brightness;
 	double *source_surface_brightness;
 	double *source_pixel_n_images;
@@ -490,6 +537,7 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 
 	bool use_input_psf_matrix;
 	double **psf_matrix;
+	bool fit_uses_psf; // set by initialize_fitmodel for parameterized source fits, where the PSF matrix is only generated once
 	bool load_psf_fits(string fits_filename);
 	int psf_npixels_x, psf_npixels_y;
 	double psf_threshold;
@@ -499,16 +547,30 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	void clear_pixel_matrices();
 	void clear_lensing_matrices();
 	void assign_Lmatrix(bool verbal);
+	bool generate_psf_matrix();
 	void PSF_convolution_Lmatrix(bool verbal = false);
+	void PSF_convolution_image_pixels(bool verbal = false);
 	void create_regularization_matrix(void);
 	void generate_Rmatrix_from_gmatrices();
 	void generate_Rmatrix_from_hmatrices();
 	void generate_Rmatrix_norm();
 	void generate_Rmatrix_from_image_plane_curvature();
+	void generate_Rmatrix_delaunay(const bool curvature);
+	void build_delaunay_display_grid();
+	void update_source_pixel_surface_brightness();
 	void create_lensing_matrices_from_Lmatrix(bool verbal);
 	void invert_lens_mapping_MUMPS(bool verbal);
 	void invert_lens_mapping_UMFPACK(bool verbal);
+	bool use_image_pixel_decomposition();
+	bool image_pixels_decomposed();
+	void find_image_pixel_block(const int id, int& img_start, int& img_end, const bool include_halo = false);
+#ifdef USE_MPI
+	void reduce_Fmatrix_rows(vector<double>* Fmatrix_rows, vector<int>* Fmatrix_index_rows, int* Fmatrix_row_nn, double* Fmatrix_diags, MPI_Comm& sub_comm);
+#endif
 	void invert_lens_mapping_CG_method(bool verbal);
+	int find_multigrid_aggregates(int*& n_aggregates, int**& aggregate_index);
+	void find_Rmatrix_log_determinant(const bool verbal);
+	void invert_lens_mapping_matrix_free(bool verbal);
 	void indexx(int* arr, int* indx, int nn);
 
 	double set_required_data_pixel_window(bool verbal);
@@ -519,13 +581,20 @@ class Lens : public Cosmology, public Brent, public Sort, public Powell, public
 	void store_image_pixel_surface_brightness();
 	void plot_image_pixel_surface_brightness(string outfile_root);
 	double invert_image_surface_brightness_map(bool verbal);
+	double invert_extra_image_bands(bool verbal);
+	double calculate_parameterized_source_chisq(bool redo_ray_tracing, bool verbal);
 	void load_pixel_grid_from_data();
 	double invert_surface_brightness_map_from_data(bool verbal);
+	void check_lmatrix_single_precision(bool verbal);
+	void check_multigrid_preconditioner(bool verbal);
 
 	void find_optimal_sourcegrid_for_analytic_source();
 	bool create_source_surface_brightness_grid(bool verbal);
 	void load_source_surface_brightness_grid(string source_inputfile);
 	void load_image_surface_brightness_grid(string image_pixel_filename_root);
+	bool add_image_band(string image_pixel_filename_root);
+	void clear_image_bands();
+	void print_image_bands();
 	bool plot_lensed_surface_brightness(string imagefile, bool output_fits = false, bool plot_residual = false, bool verbose = true);
 
 	void plot_Lmatrix();
@@ -539,8 +608,11 @@ public:
 
 	friend class Grid;
 	friend class SourcePixelGrid;
+	friend class DelaunaySourceGrid;
 	friend class ImagePixelGrid;
 	friend class ImagePixelData;
+	friend class LensingOperatorCG;
+	friend class LensBenchmark;
 	Lens();
 	Lens(Lens *lens_in);
 	static void allocate_multithreaded_variables(const int& threads);
@@ -572,8 +644,8 @@ public:
 	// versions of the above functions that use lensvector for (x,y) coordinates
 	double kappa(const lensvector &x, const double zfactor) { return kappa(x[0], x[1], zfactor); }
 	double potential(const lensvector& x, const double zfactor) { return potential(x[0],x[1], zfactor); }
-	void deflection(const lensvector& x, lensvector& def, const double zfactor) { deflection(x[0], x[1], def, 0, zfactor); }
-	void hessian(const lensvector& x, lensmatrix& hess, const double zfactor) { hessian(x[0], x[1], hess, 0, zfactor); }
+	void deflection(const lensvector& x, lensvector& def, const double zfactor) { deflection(x[0], x[1], def, lens_thread, zfactor); }
+	void hessian(const lensvector& x, lensmatrix& hess, const double zfactor) { hessian(x[0], x[1], hess, lens_thread, zfactor); }
 
 	double inverse_magnification(const lensvector&, const int &thread, const double zfactor);
 	double magnification(const lensvector &x, const int &thread, const double zfactor);
@@ -593,10 +665,10 @@ public:
 	double kappa_exclude(const lensvector &x, const int& exclude_i, const double zfactor);
 
 	// non-multithreaded versions
-	void hessian_exclude(const double& x, const double& y, const int& exclude_i, lensmatrix& hess_tot, const double zfactor) { hessian_exclude(x,y,exclude_i,hess_tot,0,zfactor); }
-	double magnification_exclude(const lensvector &x, const int& exclude_i, const double zfactor) { return magnification_exclude(x,exclude_i,0,zfactor); }
-	double shear_exclude(const lensvector &x, const int& exclude_i, const double zfactor) { return shear_exclude(x,exclude_i,0,zfactor); }
-	void shear_exclude(const lensvector &x, double &shear, double &angle, const int& exclude_i, const double zfactor) { shear_exclude(x,shear,angle,exclude_i,0,zfactor); }
+	void hessian_exclude(const double& x, const double& y, const int& exclude_i, lensmatrix& hess_tot, const double zfactor) { hessian_exclude(x,y,exclude_i,hess_tot,lens_thread,zfactor); }
+	double magnification_exclude(const lensvector &x, const int& exclude_i, const double zfactor) { return magnification_exclude(x,exclude_i,lens_thread,zfactor); }
+	double shear_exclude(const lensvector &x, const int& exclude_i, const double zfactor) { return shear_exclude(x,exclude_i,lens_thread,zfactor); }
+	void shear_exclude(const lensvector &x, double &shear, double &angle, const int& exclude_i, const double zfactor) { shear_exclude(x,shear,angle,exclude_i,lens_thread,zfactor); }
 
 	bool test_for_elliptical_symmetry();
 	bool test_for_singularity();
@@ -616,6 +688,8 @@ public:
 	stringstream datastream;
 	bool read_from_file;
 	bool quit_after_reading_file;
+	bool batch_system; // true while running one of the systems of a batch, in which case an error ends that system's script
+	bool batch_system_failed;
 	void process_commands(bool read_file);
 	bool read_command(bool show_prompt);
 	void run_plotter(string plotcommand);
@@ -645,6 +719,8 @@ public:
 	image* get_images(const lensvector &source_in, int &n_images) { return get_images(source_in, n_images, true); }
 	image* get_images(const lensvector &source_in, int &n_images, bool verbal);
 	bool plot_images(const char *sourcefile, const char *imagefile, bool verbal);
+	bool find_images_batch(const char *sourcefile, const char *outfile, bool verbal);
+	bool convert_batch_images_to_text(const char *batchfile, const char *imagefile);
 	void lens_equation(const lensvector&, lensvector&, const int& thread, const double zfactor); // Used by Newton's method to find images
 
 	// the remaining functions in this class are all contained in lens.cpp
@@ -656,13 +732,14 @@ public:
 	void add_multipole_lens(int m, const double a_m, const double n, const double theta, const double xc, const double yc, bool kap, bool sine_term);
 	void add_lens(const char *splinefile, const double q, const double theta, const double qx, const double f, const double xc, const double yc);
 	void update_anchored_parameters();
+	void update_lens_tree();
 	void print_lens_list(bool show_vary_params);
 	void print_fit_model();
 
 	void add_source_object(SB_ProfileName name, double sb_norm, double scale, double logslope_param, double q, double theta, double xc, double yc);
 	void add_source_object(const char *splinefile, double q, double theta, double qx, double f, double xc, double yc);
 	void remove_source_object(int sb_number);
-	void print_source_list();
+	void print_source_list(bool show_vary_params = false);
 	void clear_source_objects();
 
 	bool create_grid(bool verbal, const double zfac);
@@ -683,12 +760,19 @@ public:
 	public:
 	double chi_square_fit_simplex();
 	double chi_square_fit_powell();
-	void chi_square_nested_sampling();
+	double chi_square_fit_de();
+	void chi_square_nested_sampling(const bool resume = false);
 	//void chi_square_metropolis_hastings();
-	void chi_square_twalk();
+	void chi_square_twalk(const bool resume = false);
 	void test_fitmodel_invert();
 	void plot_chisq_2d(const int param1, const int param2, const int n1, const double i1, const double f1, const int n2, const double i2, const double f2);
 	void plot_chisq_1d(const int param, const int n, const double i, const double f, string filename);
+	void chisq_scan(const int param1, const int n1, const double i1, const double f1, const int param2, const int n2, const double i2, const double f2, const bool profile, string filename);
+	double profile_scan_point(double *point, double (Lens::*loglikeptr)(double*), const int param1, const int param2);
+	double scan_profile_loglike(double *subparams);
+	double (Lens::*scan_loglikeptr)(double*); // these are used by scan_profile_loglike to hold the scanned parameters fixed
+	double *scan_point;
+	int scan_param1, scan_param2;
 	void chisq_single_evaluation();
 	bool setup_fit_parameters(bool include_limits);
 	void get_n_fit_parameters(int &nparams);
@@ -697,13 +781,22 @@ public:
 	void get_automatic_initial_stepsizes(dvector& stepsizes);
 	void set_default_plimits();
 	void initialize_fitmodel();
+	void clone_lens_models(Lens *lens_in);
+	void clone_source_models(Lens *lens_in);
+	Lens* create_thread_clone(const int thread);
+	Lens** create_image_search_clones();
+	bool thread_safe_likelihood();
 	bool update_fitmodel(const double* params);
+	bool loglike_cache_lookup(const double* params, double& loglike);
+	void loglike_cache_store(const double* params, const double loglike);
 	double fitmodel_loglike_point_source(double* params);
 	double fitmodel_loglike_pixellated_source(double* params);
 	double fitmodel_loglike_pixellated_source_test(double* params);
+	double fitmodel_loglike_parameterized_source(double* params);
 	double loglike_point_source(double* params);
 	bool calculate_fisher_matrix(const dvector &params, const dvector &stepsizes);
-	double loglike_deriv(const dvector &params, const int index, const double step);
+	void find_adaptive_fisher_steps(const dvector &params, double *h);
+	void evaluate_loglike_points(const int npoints, double **points, double *loglikes, Lens **thread_clones = NULL);
 	void output_bestfit_model();
 	void use_bestfit_model();
 
@@ -735,6 +828,7 @@ public:
 	bool make_random_sources(int nsources, const char *outfile);
 	bool total_cross_section(double&);
 	double total_cross_section_integrand(const double);
+	bool monte_carlo_cross_section(const double target_precision, const long int max_samples, const double lf_slope, const unsigned long long seed, bool verbal);
 
 	double chisq_pos_source_plane();
 	double chisq_pos_image_plane();
@@ -803,7 +897,7 @@ public:
 		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX)) {
 			for (int i=0; i < nlens; i++) lens_list[i]->set_include_limits(false);
 		}
-		if ((n_sourcepts_fit > 0) and ((fitmethod == NESTED_SAMPLING) or (fitmethod == TWALK))) {
+		if ((n_sourcepts_fit > 0) and ((fitmethod == NESTED_SAMPLING) or (fitmethod == TWALK) or (fitmethod == DIFFERENTIAL_EVOLUTION))) {
 			if (sourcepts_lower_limit==NULL) sourcepts_lower_limit = new lensvector[n_sourcepts_fit];
 			if (sourcepts_upper_limit==NULL) sourcepts_upper_limit = new lensvector[n_sourcepts_fit];
 			for (int i=0; i < nlens; i++) lens_list[i]->set_include_limits(true);
@@ -812,6 +906,8 @@ public:
 	}
 	void set_show_wtime(bool show_wt) { show_wtime = show_wt; }
 	bool open_command_file(char *filename);
+	bool run_batch(const string manifest_filename, const string batch_dir);
+	bool expand_batch_template(const string template_filename, map<string,string>& vars, const string script_filename, string& errmsg);
 	void set_verbal_mode(bool echo) { verbal_mode = echo; }
 	void set_quit_after_reading_file(bool setting) { quit_after_reading_file = setting; }
 
@@ -910,7 +1006,9 @@ struct ParamSettings
 		penalty_limits_lo = new double[nparams];
 		penalty_limits_hi = new double[nparams];
 		use_penalty_limits = new bool[nparams];
+		param_names = (nparams > 0) ? new string[nparams] : NULL;
 		for (int i=0; i < nparams; i++) {
+			param_names[i] = param_settings_in.param_names[i];
 			priors[i] = new ParamPrior(param_settings_in.priors[i]);
 			transforms[i] = new ParamTransform(param_settings_in.transforms[i]);
 			stepsizes[i] = param_settings_in.stepsizes[i];
@@ -1255,6 +1353,7 @@ public:
 
 inline double Lens::kappa(const double& x, const double& y, const double zfactor)
 {
+	if ((lens_tree != NULL) and (lens_tree->in_use())) return zfactor*lens_tree->kappa(x,y);
 	double kappa=0;
 	for (int i=0; i < nlens; i++)
 		kappa += lens_list[i]->kappa(x,y);
@@ -1263,6 +1362,7 @@ inline double Lens::kappa(const double& x, const double& y, const double zfactor
 
 inline double Lens::potential(const double& x, const double& y, const double zfactor)
 {
+	if ((lens_tree != NULL) and (lens_tree->in_use())) return zfactor*lens_tree->potential(x,y);
 	double pot = 0;
 	for (int i=0; i < nlens; i++)
 		pot += lens_list[i]->potential(x,y);
@@ -1274,12 +1374,15 @@ inline void Lens::deflection(const double& x, const double& y, lensvector& def_t
 	if (!defspline)
 	{
 		lensvector *def_i = &defs_i[thread];
-		lens_list[0]->deflection(x,y,def_tot);
-		int indx;
-		for (indx=1; indx < nlens; indx++) {
-			lens_list[indx]->deflection(x,y,(*def_i));
-			def_tot[0] += (*def_i)[0];
-			def_tot[1] += (*def_i)[1];
+		if ((lens_tree != NULL) and (lens_tree->in_use())) lens_tree->deflection(x,y,def_tot[0],def_tot[1],(*def_i));
+		else {
+			lens_list[0]->deflection(x,y,def_tot);
+			int indx;
+			for (indx=1; indx < nlens; indx++) {
+				lens_list[indx]->deflection(x,y,(*def_i));
+				def_tot[0] += (*def_i)[0];
+				def_tot[1] += (*def_i)[1];
+			}
 		}
 	}
 	else {
@@ -1294,14 +1397,17 @@ inline void Lens::deflection(const double& x, const double& y, double& def_tot_x
 	if (!defspline)
 	{
 		lensvector *def_i = &defs_i[thread];
-		lens_list[0]->deflection(x,y,(*def_i));
-		def_tot_x = (*def_i)[0];
-		def_tot_y = (*def_i)[1];
-		int indx;
-		for (indx=1; indx < nlens; indx++) {
-			lens_list[indx]->deflection(x,y,(*def_i));
-			def_tot_x += (*def_i)[0];
-			def_tot_y += (*def_i)[1];
+		if ((lens_tree != NULL) and (lens_tree->in_use())) lens_tree->deflection(x,y,def_tot_x,def_tot_y,(*def_i));
+		else {
+			lens_list[0]->deflection(x,y,(*def_i));
+			def_tot_x = (*def_i)[0];
+			def_tot_y = (*def_i)[1];
+			int indx;
+			for (indx=1; indx < nlens; indx++) {
+				lens_list[indx]->deflection(x,y,(*def_i));
+				def_tot_x += (*def_i)[0];
+				def_tot_y += (*def_i)[1];
+			}
 		}
 	}
 	else {
@@ -1319,14 +1425,17 @@ inline void Lens::hessian(const double& x, const double& y, lensmatrix& hess_tot
 	if (!defspline)
 	{
 		lensmatrix *hess_i = &hesses_i[thread];
-		lens_list[0]->hessian(x,y,hess_tot);
-		int indx;
-		for (indx=1; indx < nlens; indx++) {
-			lens_list[indx]->hessian(x,y,(*hess_i));
-			hess_tot[0][0] += (*hess_i)[0][0];
-			hess_tot[1][1] += (*hess_i)[1][1];
-			hess_tot[0][1] += (*hess_i)[0][1];
-			hess_tot[1][0] += (*hess_i)[1][0];
+		if ((lens_tree != NULL) and (lens_tree->in_use())) lens_tree->hessian(x,y,hess_tot,(*hess_i));
+		else {
+			lens_list[0]->hessian(x,y,hess_tot);
+			int indx;
+			for (indx=1; indx < nlens; indx++) {
+				lens_list[indx]->hessian(x,y,(*hess_i));
+				hess_tot[0][0] += (*hess_i)[0][0];
+				hess_tot[1][1] += (*hess_i)[1][1];
+				hess_tot[0][1] += (*hess_i)[0][1];
+				hess_tot[1][0] += (*hess_i)[1][0];
+			}
 		}
 	}
 	else {
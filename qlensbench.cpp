@@ -0,0 +1,392 @@
+// QLENSBENCH: Benchmark suite for QLens, which times fixed workloads of the main lensing, fitting and inversion calculations
+//             (built and run with 'make bench')
+
+#include "qlens.h"
+#include "pixelgrid.h"
+#include "profiler.h"
+#include "bench.h"
+#include "rand.h"
+#include "errors.h"
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace std;
+
+char *advance(char *p);
+void usage_error(const int mpi_id);
+
+// The workloads that need the internals of the Lens class; the models and data are set up by running commands through
+// the command interpreter, as a script would, and only the calculations themselves are timed.
+class LensBenchmark
+{
+	Lens *lens;
+	BenchLog *log;
+	int nreps;
+	string scratch_dir;
+
+	void run_script(const string commands);
+
+	public:
+	LensBenchmark(Lens *lens_in, BenchLog *log_in, const int nreps_in, const string scratch_dir_in) : lens(lens_in), log(log_in), nreps(nreps_in), scratch_dir(scratch_dir_in) {}
+	void deflection_and_hessian();
+	void image_finding();
+	void image_plane_chisq();
+	void pixel_inversion();
+};
+
+void LensBenchmark::run_script(const string commands)
+{
+	// the output of the commands is discarded so it does not interrupt the table; an error in the script quits the program
+	string script_filename = scratch_dir + "/bench_setup.in";
+	ofstream script(script_filename.c_str());
+	script << "warnings off\n" << commands;
+	script.close();
+	lens->infile.open(script_filename.c_str());
+	if (!lens->infile.is_open()) die("could not open benchmark setup script '%s'",script_filename.c_str());
+	streambuf *coutbuf = cout.rdbuf();
+	ostringstream discard;
+	cout.rdbuf(discard.rdbuf());
+	lens->process_commands(true);
+	cout.rdbuf(coutbuf);
+	cout.clear();
+}
+
+void LensBenchmark::deflection_and_hessian()
+{
+	// deflection and hessian of each lens profile on its own, evaluated at fixed random points in the image plane
+	const int npoints = 5000;
+	const int nprofiles = 13;
+	const char *profile_names[nprofiles] = { "sie", "alpha", "pjaffe", "nfw", "tnfw", "hern", "expdisk", "corecusp", "sersic", "ptmass", "sheet", "shear", "mpole" };
+	const char *profile_args[nprofiles] = { "alpha 1.5 1 0 0.8 30 0 0", "alpha 1.5 1.2 0.05 0.8 30 0 0", "pjaffe 1.5 5 0.1 0.8 30 0 0", "nfw 0.8 2 0.8 30 0 0",
+		"tnfw 0.8 2 10 0.8 30 0 0", "hern 0.8 2 0.8 30 0 0", "expdisk 0.8 1 0.8 30 0 0", "corecusp 0.8 2 4 1 0.1 0.8 30 0 0", "sersic 0.8 1 2 0.8 30 0 0",
+		"ptmass 1.5 0 0", "sheet 0.1 0 0", "shear 0.1 30 0 0", "mpole m=3 0.05 1 45 0 0" };
+
+	double *x = new double[npoints];
+	double *y = new double[npoints];
+	CounterRandom rng(12345ULL);
+	int i,n;
+	for (i=0; i < npoints; i++) {
+		x[i] = -2 + 4*rng.uniform(2*i);
+		y[i] = -2 + 4*rng.uniform(2*i+1);
+	}
+
+	double def_x, def_y, t0, checksum;
+	lensmatrix hess;
+	for (n=0; n < nprofiles; n++) {
+		run_script("lens clear\nlens " + string(profile_args[n]) + "\n");
+		vector<double> times;
+		checksum = 0;
+		for (int rep=-1; rep < nreps; rep++) {
+			t0 = Profiler::wtime();
+			for (i=0; i < npoints; i++) {
+				lens->deflection(x[i],y[i],def_x,def_y,0,lens->reference_zfactor);
+				if (rep==0) checksum += def_x + def_y;
+			}
+			if (rep >= 0) times.push_back(Profiler::wtime()-t0);
+		}
+		log->record("deflection_" + string(profile_names[n]),times,npoints,"evals",checksum);
+
+		times.clear();
+		checksum = 0;
+		for (int rep=-1; rep < nreps; rep++) {
+			t0 = Profiler::wtime();
+			for (i=0; i < npoints; i++) {
+				lens->hessian(x[i],y[i],hess,0,lens->reference_zfactor);
+				if (rep==0) checksum += hess[0][0] + hess[1][1] + hess[0][1];
+			}
+			if (rep >= 0) times.push_back(Profiler::wtime()-t0);
+		}
+		log->record("hessian_" + string(profile_names[n]),times,npoints,"evals",checksum);
+	}
+	run_script("lens clear\n");
+	delete[] x;
+	delete[] y;
+}
+
+void LensBenchmark::image_finding()
+{
+	// constructing the image-plane grid, and then finding the images of fixed random source points near the caustics
+	const int nsources = 100;
+	run_script("lens clear\ncentral_image on\nlens alpha 1.5 1 0 0.8 30 0 0 shear=0.05 10\n");
+	lensvector *sources = new lensvector[nsources];
+	CounterRandom rng(23456ULL);
+	int i, n_images;
+	for (i=0; i < nsources; i++) {
+		sources[i][0] = -0.15 + 0.3*rng.uniform(2*i);
+		sources[i][1] = -0.15 + 0.3*rng.uniform(2*i+1);
+	}
+
+	vector<double> grid_times, image_times;
+	double t0, grid_checksum = 0, image_checksum = 0;
+	image *img;
+	for (int rep=-1; rep < nreps; rep++) {
+		t0 = Profiler::wtime();
+		lens->create_grid(false,lens->reference_zfactor);
+		if (rep >= 0) grid_times.push_back(Profiler::wtime()-t0);
+		t0 = Profiler::wtime();
+		for (i=0; i < nsources; i++) {
+			img = lens->get_images(sources[i],n_images,false);
+			if (rep==0) {
+				image_checksum += n_images;
+				for (int j=0; j < n_images; j++) image_checksum += img[j].pos[0] + img[j].pos[1];
+			}
+		}
+		if (rep >= 0) image_times.push_back(Profiler::wtime()-t0);
+	}
+	grid_checksum = lens->grid_xlength + lens->grid_ylength;
+	log->record("grid_construction",grid_times,1,"grids",grid_checksum);
+	log->record("image_finding",image_times,nsources,"sources",image_checksum);
+	run_script("lens clear\n");
+	delete[] sources;
+}
+
+void LensBenchmark::image_plane_chisq()
+{
+	// image-plane chi-square of a lens model (slightly offset from the true model) for two sets of simulated point images
+	run_script("lens clear\nimgdata clear\ncentral_image off\nrandom_seed 10\nsim_err_pos 0.005\n"
+		"lens alpha 1.5 1 0 0.7 90 0.1 0.05 shear=0.1 40\nimgdata add 0.05 0.08\nimgdata add -0.06 0.03\nlens clear\n"
+		"fit method simplex\nfit lens alpha 1.48 1 0 0.72 88 0.09 0.06 shear=0.09 38\n1 0 0 1 1 1 1 1 1\nimgplane_chisq on\n");
+	if (lens->setup_fit_parameters(false)==false) die("could not set up fit parameters for image-plane chi-square benchmark");
+	lens->fit_set_optimizations();
+	lens->initialize_fitmodel();
+	lens->fitmodel_loglike_point_source(lens->fitparams.array()); // this also sets the source points of the fit model
+
+	vector<double> times;
+	double t0, chisq, checksum = 0;
+	for (int rep=-1; rep < nreps; rep++) {
+		t0 = Profiler::wtime();
+		chisq = lens->fitmodel->chisq_pos_image_plane();
+		if (rep >= 0) times.push_back(Profiler::wtime()-t0);
+		if (rep==0) checksum = chisq;
+	}
+	lens->fit_restore_defaults();
+	log->record("chisq_pos_image_plane",times,1,"evals",checksum);
+	run_script("lens clear\nimgdata clear\nimgplane_chisq off\n");
+}
+
+void LensBenchmark::pixel_inversion()
+{
+	// A simulated image (150x150 pixels, Gaussian PSF) of a lensed source made of five Gaussian blobs is inverted with each
+	// of the available inversion methods, first with a fixed regularization parameter and then with the regularization
+	// parameter treated as varied, in which case the log-determinant of the F-matrix is also found (for the CG methods, by
+	// stochastic Lanczos quadrature after the solve). The time spent in each stage is taken from the profiler timers.
+	string mock_src = scratch_dir + "/bench_src", mock_img = scratch_dir + "/bench_img";
+	run_script("lens clear\nterminal text\nshow_cc off\nfits_format off\nrandom_seed 10\n"
+		"lens alpha 1.5188 1 0 0.9 0 -0.09 -0.04\ngrid -2 2 -2 2\nimg_npixels 150 150\nsrc_npixels 40 40\n"
+		"auto_src_npixels off\nauto_srcgrid off\nsrcgrid -0.14 0.14 -0.14 0.14\nsim_pixel_noise 0.1\npsf_width 0.02\n"
+		"source gaussian 2 0.014 1 0 -0.07 0\nsource gaussian 2 0.014 1 0 0.086 -0.04\nsource gaussian 2 0.014 1 0 0 0.07\n"
+		"source gaussian 2 0.014 1 0 0 -0.07\nsource gaussian 2 0.014 1 0 0 0\n"
+		"sbmap makesrc\nsbmap plotimg " + mock_src + " " + mock_img + "\nsim_pixel_noise 0\ndata_pixel_noise 0.1\n"
+		"sbmap loadimg " + mock_img + "\nfit source_mode pixel\nfit regularization curvature\nregparam 9\n"
+		"raytrace_method interpolate\n");
+	bool vary_regparam_setting = lens->vary_regularization_parameter;
+	bool profiling_setting = Profiler::is_active();
+	Lens::InversionMethod inversion_method_setting = lens->inversion_method;
+	Profiler::set_active(true);
+
+	int n_methods = 0;
+	Lens::InversionMethod methods[4];
+	const char *method_names[4];
+	methods[n_methods] = Lens::CG_Method; method_names[n_methods++] = "cg";
+	methods[n_methods] = Lens::Matrix_Free_CG; method_names[n_methods++] = "matrix_free_cg";
+#ifdef USE_MUMPS
+	methods[n_methods] = Lens::MUMPS; method_names[n_methods++] = "mumps";
+#endif
+#ifdef USE_UMFPACK
+	methods[n_methods] = Lens::UMFPACK; method_names[n_methods++] = "umfpack";
+#endif
+	for (int m=0; m < n_methods; m++) {
+		lens->inversion_method = methods[m];
+		for (int find_logdet=0; find_logdet <= 1; find_logdet++) {
+			lens->vary_regularization_parameter = (find_logdet==1);
+			vector<double> total_times, raytrace_times, lmatrix_times, psf_times, fmatrix_times, inversion_times, logdet_times;
+			double t0, chisq, checksum = 0, logdet = 0;
+			long int n_rays = 0, n_lmatrix_elements = 0, n_source_pixels = 0;
+			for (int rep=-1; rep < nreps; rep++) {
+				Profiler::reset();
+				t0 = Profiler::wtime();
+				chisq = lens->invert_surface_brightness_map_from_data(false);
+				if (rep < 0) continue;
+				total_times.push_back(Profiler::wtime()-t0);
+				raytrace_times.push_back(Profiler::get_stage_time(PROF_RAY_TRACING));
+				lmatrix_times.push_back(Profiler::get_stage_time(PROF_LMATRIX));
+				psf_times.push_back(Profiler::get_stage_time(PROF_PSF_CONVOLUTION));
+				fmatrix_times.push_back(Profiler::get_stage_time(PROF_FMATRIX));
+				inversion_times.push_back(Profiler::get_stage_time(PROF_INVERSION) - Profiler::get_stage_time(PROF_LOG_DETERMINANT)); // the log-determinant is timed within the inversion
+				logdet_times.push_back(Profiler::get_stage_time(PROF_LOG_DETERMINANT));
+				if (rep==0) {
+					checksum = chisq;
+					logdet = lens->Fmatrix_log_determinant;
+					n_rays = Profiler::get_count(PROF_RAYS_TRACED);
+					n_lmatrix_elements = Profiler::get_count(PROF_LMATRIX_ELEMENTS);
+					n_source_pixels = Profiler::get_count(PROF_SOURCE_PIXELS);
+				}
+			}
+			if (find_logdet==0) {
+				if (m==0) {
+					// these stages do not depend on the inversion method (and the matrix-free method skips the last two)
+					log->record("ray_trace",raytrace_times,n_rays,"rays",n_rays);
+					log->record("lmatrix",lmatrix_times,n_lmatrix_elements,"elements",n_lmatrix_elements);
+					log->record("psf_convolution",psf_times,n_source_pixels,"src_pixels",n_source_pixels);
+					log->record("fmatrix",fmatrix_times,n_source_pixels,"src_pixels",n_source_pixels);
+				}
+				log->record("inversion_" + string(method_names[m]),inversion_times,n_source_pixels,"src_pixels",checksum);
+				log->record("pixel_likelihood_" + string(method_names[m]),total_times,1,"evals",checksum);
+			} else {
+				log->record("inversion_" + string(method_names[m]) + "_logdet_mode",inversion_times,n_source_pixels,"src_pixels",checksum);
+				log->record("log_determinant_" + string(method_names[m]),logdet_times,n_source_pixels,"src_pixels",logdet);
+			}
+		}
+	}
+	lens->inversion_method = inversion_method_setting;
+	lens->vary_regularization_parameter = vary_regparam_setting;
+	Profiler::set_active(profiling_setting);
+	Profiler::reset();
+	run_script("lens clear\nsource clear\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int mpi_id=0, mpi_np=1;
+
+#ifdef USE_MPI
+	MPI_Init(NULL, NULL);
+	MPI_Comm_size(MPI_COMM_WORLD, &mpi_np);
+	MPI_Comm_rank(MPI_COMM_WORLD, &mpi_id);
+#endif
+
+	int nthreads;
+#ifdef USE_OPENMP
+	#pragma omp parallel
+	{
+		#pragma omp master
+		nthreads = omp_get_num_threads();
+	}
+#else
+	nthreads = 1;
+#endif
+	Grid::allocate_multithreaded_variables(nthreads);
+	SourcePixelGrid::allocate_multithreaded_variables(nthreads);
+	Lens::allocate_multithreaded_variables(nthreads);
+	Profiler::allocate_multithreaded_variables(nthreads);
+	Profiler::set_mpi_params(mpi_id,mpi_np);
+
+	int nreps = 7;
+	char output_filename[100] = "bench.json";
+	char label[100] = "";
+	char scratch_dir[100] = "bench_scratch";
+	char workload_group[100] = "all";
+	for (int i = 1; i < argc; i++)   // Process command-line arguments
+	{
+		if ((*argv[i] == '-') and (isalpha(*(argv[i]+1)))) {
+			int c;
+			while (c = *++argv[i]) {
+				switch (c) {
+					case 'n':
+						if ((sscanf(argv[i], "n%i", &nreps)==0) or (nreps < 1)) usage_error(mpi_id);
+						argv[i] = advance(argv[i]);
+						break;
+					case 'o':
+						if (sscanf(argv[i], "o:%s", output_filename)==1) argv[i] += (1 + strlen(output_filename));
+						else usage_error(mpi_id);
+						argv[i] = advance(argv[i]);
+						break;
+					case 'l':
+						if (sscanf(argv[i], "l:%s", label)==1) argv[i] += (1 + strlen(label));
+						else usage_error(mpi_id);
+						argv[i] = advance(argv[i]);
+						break;
+					case 'd':
+						if (sscanf(argv[i], "d:%s", scratch_dir)==1) argv[i] += (1 + strlen(scratch_dir));
+						else usage_error(mpi_id);
+						argv[i] = advance(argv[i]);
+						break;
+					case 'w':
+						if (sscanf(argv[i], "w:%s", workload_group)==1) argv[i] += (1 + strlen(workload_group));
+						else usage_error(mpi_id);
+						argv[i] = advance(argv[i]);
+						break;
+					default: usage_error(mpi_id); break;
+				}
+			}
+		} else usage_error(mpi_id);
+	}
+	string group(workload_group);
+	if ((group != "all") and (group != "lens") and (group != "images") and (group != "chisq") and (group != "pixel") and (group != "mkdist")) usage_error(mpi_id);
+
+	struct stat sb;
+	if ((stat(scratch_dir,&sb) != 0) or (S_ISDIR(sb.st_mode)==false)) mkdir(scratch_dir,S_IRWXU | S_IRWXG);
+#ifdef USE_MPI
+	MPI_Barrier(MPI_COMM_WORLD);
+#endif
+
+	Lens lens;
+#ifdef USE_MPI
+	lens.set_mpi_params(mpi_id,mpi_np);
+	lens.Set_MCMC_MPI(mpi_np,mpi_id);
+#else
+	lens.set_mpi_params(0,1);
+#endif
+	lens.set_nthreads(nthreads);
+	lens.set_inversion_nthreads(nthreads);
+	lens.set_verbal_mode(false);
+	lens.set_quit_after_error(true);
+	lens.set_quit_after_reading_file(true);
+
+	BenchLog log(output_filename,label,nthreads,(mpi_id==0));
+	if (mpi_id==0) {
+		cout << "# QLens benchmark: " << nreps << " repetitions per workload, " << nthreads << " thread(s), " << mpi_np << " MPI process(es)";
+		if (log.is_open()) cout << "; results appended to '" << output_filename << "'";
+		cout << endl;
+	}
+	log.print_header();
+
+	LensBenchmark bench(&lens,&log,nreps,scratch_dir);
+	if ((group=="all") or (group=="lens")) bench.deflection_and_hessian();
+	if ((group=="all") or (group=="images")) bench.image_finding();
+	if ((group=="all") or (group=="chisq")) bench.image_plane_chisq();
+	if ((group=="all") or (group=="pixel")) bench.pixel_inversion();
+	if (((group=="all") or (group=="mkdist")) and (mpi_id==0)) bench_mkdist_histograms(log,scratch_dir,nreps);
+
+	Grid::deallocate_multithreaded_variables();
+	SourcePixelGrid::deallocate_multithreaded_variables();
+	Lens::deallocate_multithreaded_variables();
+	Profiler::deallocate_multithreaded_variables();
+
+#ifdef USE_MPI
+	MPI_Finalize();
+#endif
+
+	return 0;
+}
+
+char *advance(char *p)
+{
+	// This advances to the next flag (if there is one; 'e' is ignored because it might be part of a number in scientific notation)
+	while ((*++p) and ((!isalpha(*p)) or (*p=='e'))) ;
+	return --p;
+}
+
+void usage_error(const int mpi_id)
+{
+	if (mpi_id==0) {
+		cout << "Usage: qlensbench [args]    (all arguments are optional)\n\n"
+				"Argument options:\n"
+				"  -n##       Number of timed repetitions of each workload (default=7)\n"
+				"  -o:<file>  Append the results as lines of JSON to <file> (default: 'bench.json')\n"
+				"  -l:<label> Label included with each result, e.g. the commit being measured\n"
+				"  -d:<dir>   Directory for the scratch files made by the workloads (default: 'bench_scratch')\n"
+				"  -w:<group> Run only one group of workloads: lens (deflection and hessian of each lens profile),\n"
+				"             images (grid construction and image finding), chisq (image-plane chi-square),\n"
+				"             pixel (ray tracing, Lmatrix, PSF, Fmatrix, each inversion method and log-determinant),\n"
+				"             or mkdist (posterior histograms of a synthetic chain)\n";
+		cout << endl;
+	}
+#ifdef USE_MPI
+	MPI_Finalize();
+#endif
+	exit(0);
+}
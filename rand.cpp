@@ -83,6 +83,26 @@ double Random::RandomNumber2()
 	else return ans;
 }
 
+CounterRandom::CounterRandom(const unsigned long long key_in)
+{
+	// the key is scrambled so that nearby seeds give unrelated streams
+	unsigned long long z = key_in + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	key = z ^ (z >> 31);
+}
+
+double CounterRandom::uniform(const unsigned long long counter)
+{
+	// the (SplitMix64) finalizer is applied to a Weyl sequence indexed by the counter and offset by the key; the top 53 bits
+	// give the mantissa of the result
+	unsigned long long z = key + counter*0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= (z >> 31);
+	return (z >> 11) * (1.0/9007199254740992.0);
+}
+
 double Random::NormalDeviate()
 {
 	double fac,rsq,v1,v2;
@@ -19,4 +19,16 @@ class Random
 	double NormalDeviate();
 };
 
+// Counter-based generator: each number depends only on the key and a counter (rather than on the previous numbers drawn),
+// so independent streams can be drawn by different threads or processes in any order (e.g. by giving each sample its own
+// range of counters) and the results are reproducible regardless of how the work is divided
+class CounterRandom
+{
+	unsigned long long key;
+
+	public:
+	CounterRandom(const unsigned long long key_in);
+	double uniform(const unsigned long long counter); // uniform deviate in [0,1)
+};
+
 #endif // RAND_H
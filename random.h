@@ -338,6 +338,9 @@ class Ran
 		}
 		inline double Doub(){return 5.42101086242752217E-20 * int64();}
 		inline unsigned int int32(){return (unsigned int)int64();}
+		// the generator state (three words), so a sampler can be checkpointed and resumed with the same sequence of deviates
+		void GetState(unsigned long long int *state) {state[0] = u; state[1] = v; state[2] = w;}
+		void SetState(const unsigned long long int *state) {u = state[0]; v = state[1]; w = state[2];}
 };
 
 class ExponDev : public Ran
@@ -12,9 +12,15 @@ SB_Profile::SB_Profile(const char *splinefile, const double &q_in, const double
 			const double &xc_in, const double &yc_in, const double &qx_in, const double &f_in)
 {
 	sbtype = SB_SPLINE;
+	param = NULL;
+	set_geometric_parameters(q_in,theta_degrees,xc_in,yc_in);
 	qx_parameter = qx_in;
 	f_parameter = f_in;
 	sb_spline.input(splinefile);
+
+	set_n_params(6);
+	assign_param_pointers();
+	assign_paramnames();
 }
 
 SB_Profile::SB_Profile(const SB_Profile* sb_in)
@@ -26,6 +32,221 @@ SB_Profile::SB_Profile(const SB_Profile* sb_in)
 	qx_parameter = sb_in->qx_parameter;
 	f_parameter = sb_in->f_parameter;
 	sb_spline.input(sb_in->sb_spline);
+
+	param = NULL;
+	set_n_params(6);
+	assign_param_pointers();
+	assign_paramnames();
+	copy_fit_settings(sb_in);
+}
+
+void SB_Profile::set_n_params(const int &n_params_in)
+{
+	n_params = n_params_in;
+	n_vary_params = 0;
+	include_limits = false;
+	vary_params.input(n_params);
+	if (param != NULL) delete[] param;
+	param = new double*[n_params];
+	for (int i=0; i < n_params; i++) vary_params[i] = false;
+}
+
+void SB_Profile::copy_fit_settings(const SB_Profile* sb_in)
+{
+	// n_params *must* already be set before running this
+	boolvector vary_params_in(n_params);
+	for (int i=0; i < n_params; i++) vary_params_in[i] = sb_in->vary_params[i];
+	vary_parameters(vary_params_in);
+	include_limits = sb_in->include_limits;
+	if (include_limits) {
+		lower_limits = sb_in->lower_limits;
+		upper_limits = sb_in->upper_limits;
+		lower_limits_initial = sb_in->lower_limits_initial;
+		upper_limits_initial = sb_in->upper_limits_initial;
+	}
+}
+
+void SB_Profile::assign_paramnames()
+{
+	// the geometric parameters always come last; the derived classes assign the names for the remaining parameters
+	paramnames.resize(n_params);
+	latex_paramnames.resize(n_params);
+	latex_param_subscripts.resize(n_params);
+	if (sbtype==SB_SPLINE) {
+		paramnames[0] = "qx"; latex_paramnames[0] = "q"; latex_param_subscripts[0] = "x";
+		paramnames[1] = "f"; latex_paramnames[1] = "f"; latex_param_subscripts[1] = "";
+	}
+	paramnames[n_params-4] = "q_src"; latex_paramnames[n_params-4] = "q"; latex_param_subscripts[n_params-4] = "src";
+	paramnames[n_params-3] = "theta_src"; latex_paramnames[n_params-3] = "\\theta"; latex_param_subscripts[n_params-3] = "src";
+	paramnames[n_params-2] = "xc_src"; latex_paramnames[n_params-2] = "x"; latex_param_subscripts[n_params-2] = "c,src";
+	paramnames[n_params-1] = "yc_src"; latex_paramnames[n_params-1] = "y"; latex_param_subscripts[n_params-1] = "c,src";
+}
+
+void SB_Profile::assign_param_pointers()
+{
+	if (sbtype==SB_SPLINE) {
+		param[0] = &qx_parameter;
+		param[1] = &f_parameter;
+	}
+	param[n_params-4] = &q;
+	param[n_params-3] = &theta;
+	param[n_params-2] = &x_center;
+	param[n_params-1] = &y_center;
+}
+
+void SB_Profile::update_meta_parameters()
+{
+	costheta = cos(theta);
+	sintheta = sin(theta);
+}
+
+void SB_Profile::vary_parameters(const boolvector& vary_params_in)
+{
+	if (vary_params_in.size() != n_params) die("number of parameters to vary does not match total number of parameters");
+	n_vary_params=0;
+	for (int i=0; i < n_params; i++) {
+		vary_params[i] = vary_params_in[i];
+		if (vary_params_in[i]) n_vary_params++;
+	}
+}
+
+void SB_Profile::set_limits(const dvector& lower, const dvector& upper)
+{
+	set_limits(lower,upper,lower,upper);
+}
+
+void SB_Profile::set_limits(const dvector& lower, const dvector& upper, const dvector& lower_init, const dvector& upper_init)
+{
+	include_limits = true;
+	if (lower.size() != n_vary_params) die("number of parameters with lower limits does not match number of variable parameters");
+	if (upper.size() != n_vary_params) die("number of parameters with upper limits does not match number of variable parameters");
+	lower_limits = lower;
+	upper_limits = upper;
+	lower_limits_initial = lower_init;
+	upper_limits_initial = upper_init;
+}
+
+bool SB_Profile::get_limits(dvector& lower, dvector& upper, dvector& lower0, dvector& upper0, int &index)
+{
+	if ((include_limits==false) or (lower_limits.size() != n_vary_params)) return false;
+	for (int i=0; i < n_vary_params; i++) {
+		lower[index] = lower_limits[i];
+		upper[index] = upper_limits[i];
+		lower0[index] = lower_limits_initial[i];
+		upper0[index] = upper_limits_initial[i];
+		index++;
+	}
+	return true;
+}
+
+void SB_Profile::get_parameters(double* params)
+{
+	for (int i=0; i < n_params; i++) params[i] = (*param[i]);
+	params[n_params-3] = radians_to_degrees(theta);
+}
+
+void SB_Profile::update_parameters(const double* params)
+{
+	for (int i=0; i < n_params; i++) (*param[i]) = params[i];
+	theta = degrees_to_radians(params[n_params-3]);
+	update_meta_parameters();
+}
+
+void SB_Profile::get_fit_parameters(dvector& fitparams, int &index)
+{
+	for (int i=0; i < n_params; i++) {
+		if (vary_params[i]) {
+			if (i==n_params-3) fitparams[index++] = radians_to_degrees(theta);
+			else fitparams[index++] = (*param[i]);
+		}
+	}
+}
+
+void SB_Profile::update_fit_parameters(const double* fitparams, int &index, bool& status)
+{
+	if (n_vary_params > 0) {
+		for (int i=0; i < n_params; i++) {
+			if (vary_params[i]) {
+				if (i==n_params-3) theta = degrees_to_radians(fitparams[index++]);
+				else (*param[i]) = fitparams[index++];
+			}
+		}
+		if (vary_params[n_params-4]) {
+			if ((q <= 0) or (q > 1)) status = false; // q <= 0 or q > 1 is not a physically acceptable value, so report that we're out of bounds
+			if (q < 0) q = -q; // don't allow negative axis ratios
+			if (q > 1) q = 1.0; // don't allow q>1
+			if (q==0) q = 0.01;
+		}
+		update_meta_parameters();
+	}
+}
+
+void SB_Profile::get_fit_parameter_names(vector<string>& paramnames_vary, vector<string> *latex_paramnames_vary, vector<string> *latex_subscripts_vary)
+{
+	for (int i=0; i < n_params; i++) {
+		if (vary_params[i]) {
+			paramnames_vary.push_back(paramnames[i]);
+			if (latex_paramnames_vary != NULL) latex_paramnames_vary->push_back(latex_paramnames[i]);
+			if (latex_subscripts_vary != NULL) latex_subscripts_vary->push_back(latex_param_subscripts[i]);
+		}
+	}
+}
+
+void SB_Profile::get_auto_stepsizes(dvector& stepsizes, int &index)
+{
+	// the model-specific parameters are all amplitudes or scale lengths, so a fixed fraction of their current value is used
+	double scale = window_rmax();
+	for (int i=0; i < n_params-4; i++) {
+		if (vary_params[i]) stepsizes[index++] = ((*param[i]) != 0) ? 0.1*abs(*param[i]) : 0.1;
+	}
+	if (vary_params[n_params-4]) stepsizes[index++] = 0.1;
+	if (vary_params[n_params-3]) stepsizes[index++] = 20;
+	if (vary_params[n_params-2]) stepsizes[index++] = 0.02*scale;
+	if (vary_params[n_params-1]) stepsizes[index++] = 0.02*scale;
+}
+
+void SB_Profile::get_auto_ranges(boolvector& use_penalty_limits, dvector& lower, dvector& upper, int &index)
+{
+	for (int i=0; i < n_params-4; i++) {
+		if (vary_params[i]) {
+			if (use_penalty_limits[index]==false) { use_penalty_limits[index] = true; lower[index] = 0; upper[index] = 1e30; }
+			index++;
+		}
+	}
+	if (vary_params[n_params-4]) {
+		if (use_penalty_limits[index]==false) { use_penalty_limits[index] = true; lower[index] = 0; upper[index] = 1; }
+		index++;
+	}
+	for (int i=n_params-3; i < n_params; i++) {
+		if (vary_params[i]) index++;
+	}
+}
+
+void SB_Profile::print_vary_parameters()
+{
+	if (n_vary_params==0) {
+		cout << "   parameters: none\n";
+	} else {
+		vector<string> paramnames_vary;
+		get_fit_parameter_names(paramnames_vary);
+		if (include_limits) {
+			if (lower_limits_initial.size() != n_vary_params) cout << "   Warning: parameter limits not defined\n";
+			else {
+				cout << "   parameter limits:\n";
+				for (int i=0; i < n_vary_params; i++) {
+					if ((lower_limits_initial[i]==lower_limits[i]) and (upper_limits_initial[i]==upper_limits[i]))
+						cout << "   " << paramnames_vary[i] << ": [" << lower_limits[i] << ":" << upper_limits[i] << "]\n";
+					else
+						cout << "   " << paramnames_vary[i] << ": [" << lower_limits[i] << ":" << upper_limits[i] << "], initial range: [" << lower_limits_initial[i] << ":" << upper_limits_initial[i] << "]\n";
+				}
+			}
+		} else {
+			cout << "   parameters: ";
+			cout << paramnames_vary[0];
+			for (int i=1; i < n_vary_params; i++) cout << ", " << paramnames_vary[i];
+			cout << endl;
+		}
+	}
 }
 
 void SB_Profile::set_geometric_parameters(const double &q_in, const double &theta_degrees, const double &xc_in, const double &yc_in)
@@ -93,6 +314,22 @@ double SB_Profile::surface_brightness(double x, double y)
 	return sb_rsq(x*x + y*y/(q*q));
 }
 
+void SB_Profile::add_surface_brightness(const int npts, const double* xvals, const double* yvals, double* sb)
+{
+	// adds the surface brightness at each of the given points to sb; used when many points are evaluated for the same profile
+	double x, y, xp, qsq = q*q;
+	for (int i=0; i < npts; i++) {
+		x = xvals[i] - x_center;
+		y = yvals[i] - y_center;
+		if (theta != 0) {
+			xp = x*costheta + y*sintheta;
+			y = -x*sintheta + y*costheta;
+			x = xp;
+		}
+		sb[i] += sb_rsq(x*x + y*y/qsq);
+	}
+}
+
 double SB_Profile::surface_brightness_r(const double r)
 {
 	return sb_rsq(r*r);
@@ -141,6 +378,10 @@ Gaussian::Gaussian(const double &max_sb_in, const double &sig_x_in, const double
 	sbtype=GAUSSIAN;
 	set_geometric_parameters(q_in,theta_degrees,xc_in,yc_in);
 	max_sb = max_sb_in; sig_x = sig_x_in;
+
+	set_n_params(6);
+	assign_param_pointers();
+	assign_paramnames();
 }
 
 Gaussian::Gaussian(const Gaussian* sb_in)
@@ -151,6 +392,25 @@ Gaussian::Gaussian(const Gaussian* sb_in)
 	max_sb = sb_in->max_sb;
 	sig_x = sb_in->sig_x;
 	set_geometric_parameters_radians(sb_in->q,sb_in->theta,sb_in->x_center,sb_in->y_center);
+
+	set_n_params(6);
+	assign_param_pointers();
+	assign_paramnames();
+	copy_fit_settings(sb_in);
+}
+
+void Gaussian::assign_paramnames()
+{
+	SB_Profile::assign_paramnames();
+	paramnames[0] = "sbmax"; latex_paramnames[0] = "S"; latex_param_subscripts[0] = "max";
+	paramnames[1] = "sigma"; latex_paramnames[1] = "\\sigma"; latex_param_subscripts[1] = "";
+}
+
+void Gaussian::assign_param_pointers()
+{
+	SB_Profile::assign_param_pointers();
+	param[0] = &max_sb;
+	param[1] = &sig_x;
 }
 
 double Gaussian::sb_rsq(const double rsq)
@@ -178,6 +438,10 @@ Sersic::Sersic(const double &s0_in, const double &Re_in, const double &n_in, con
 	k = b*pow(sqrt(q)/Re_in,1.0/n);
 	s0 = s0_in;
 	//s0 = L0_in/(M_PI*re*re*2*n*Gamma(2*n)/pow(b,2*n));
+
+	set_n_params(7);
+	assign_param_pointers();
+	assign_paramnames();
 }
 
 Sersic::Sersic(const Sersic* sb_in)
@@ -187,8 +451,37 @@ Sersic::Sersic(const Sersic* sb_in)
 
 	s0 = sb_in->s0;
 	n = sb_in->n;
+	re = sb_in->re;
 	k = sb_in->k;
 	set_geometric_parameters_radians(sb_in->q,sb_in->theta,sb_in->x_center,sb_in->y_center);
+
+	set_n_params(7);
+	assign_param_pointers();
+	assign_paramnames();
+	copy_fit_settings(sb_in);
+}
+
+void Sersic::assign_paramnames()
+{
+	SB_Profile::assign_paramnames();
+	paramnames[0] = "s0"; latex_paramnames[0] = "S"; latex_param_subscripts[0] = "0";
+	paramnames[1] = "Reff"; latex_paramnames[1] = "R"; latex_param_subscripts[1] = "eff";
+	paramnames[2] = "n"; latex_paramnames[2] = "n"; latex_param_subscripts[2] = "";
+}
+
+void Sersic::assign_param_pointers()
+{
+	SB_Profile::assign_param_pointers();
+	param[0] = &s0;
+	param[1] = &re;
+	param[2] = &n;
+}
+
+void Sersic::update_meta_parameters()
+{
+	SB_Profile::update_meta_parameters();
+	double b = 2*n - 0.33333333333333 + 4.0/(405*n) + 46.0/(25515*n*n) + 131.0/(1148175*n*n*n);
+	k = b*pow(sqrt(q)/re,1.0/n);
 }
 
 double Sersic::sb_rsq(const double rsq)
@@ -211,6 +504,10 @@ TopHat::TopHat(const double &sb_in, const double &rad_in, const double &q_in, co
 	sbtype=TOPHAT;
 	set_geometric_parameters(q_in,theta_degrees,xc_in,yc_in);
 	sb = sb_in; rad = rad_in;
+
+	set_n_params(6);
+	assign_param_pointers();
+	assign_paramnames();
 }
 
 TopHat::TopHat(const TopHat* sb_in)
@@ -221,6 +518,25 @@ TopHat::TopHat(const TopHat* sb_in)
 	sb = sb_in->sb;
 	rad = sb_in->rad;
 	set_geometric_parameters_radians(sb_in->q,sb_in->theta,sb_in->x_center,sb_in->y_center);
+
+	set_n_params(6);
+	assign_param_pointers();
+	assign_paramnames();
+	copy_fit_settings(sb_in);
+}
+
+void TopHat::assign_paramnames()
+{
+	SB_Profile::assign_paramnames();
+	paramnames[0] = "sb"; latex_paramnames[0] = "S"; latex_param_subscripts[0] = "";
+	paramnames[1] = "rad"; latex_paramnames[1] = "r"; latex_param_subscripts[1] = "";
+}
+
+void TopHat::assign_param_pointers()
+{
+	SB_Profile::assign_param_pointers();
+	param[0] = &sb;
+	param[1] = &rad;
 }
 
 double TopHat::sb_rsq(const double rsq)
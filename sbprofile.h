@@ -5,6 +5,7 @@
 #include "spline.h"
 #include <cmath>
 #include <iostream>
+#include <string>
 #include <vector>
 using namespace std;
 
@@ -22,6 +23,21 @@ class SB_Profile
 	double q, theta, x_center, y_center; // four base parameters, which can be added to in derived surface brightness models
 	double costheta, sintheta;
 
+	double **param; // array of pointers to each parameter; the model-specific parameters come first, followed by q, theta, xc, yc
+	int n_params, n_vary_params;
+	boolvector vary_params;
+	vector<string> paramnames;
+	vector<string> latex_paramnames, latex_param_subscripts;
+	bool include_limits;
+	dvector lower_limits, upper_limits;
+	dvector lower_limits_initial, upper_limits_initial;
+
+	void set_n_params(const int &n_params_in);
+	void copy_fit_settings(const SB_Profile* sb_in);
+	virtual void assign_paramnames();
+	virtual void assign_param_pointers();
+	virtual void update_meta_parameters(); // recalculates quantities that are derived from the parameters (e.g. trig functions of theta)
+
 	// in all derived classes, each of the following function pointers MUST be set in the constructor.
 	// If the integrals are to be done numerically, they should point to the appropriate function using
 	// a static cast (see the constructor for any of the derived classes for examples)
@@ -34,10 +50,12 @@ class SB_Profile
 	public:
 	int sb_number;
 
-	SB_Profile() : qx_parameter(1) {}
+	SB_Profile() : qx_parameter(1), param(0), n_params(0), n_vary_params(0), include_limits(false) {}
 	SB_Profile(const char *splinefile, const double &q_in, const double &theta_degrees, const double &xc_in, const double &yc_in, const double &qx_in, const double &f_in);
 	SB_Profile(const SB_Profile* sb_in);
-	~SB_Profile() {}
+	virtual ~SB_Profile() {
+		if (param != NULL) delete[] param;
+	}
 
 	void set_geometric_parameters(const double &q_in, const double &theta_degrees, const double &xc_in, const double &yc_in);
 	void set_geometric_parameters_radians(const double &q_in, const double &theta_in, const double &xc_in, const double &yc_in);
@@ -51,9 +69,26 @@ class SB_Profile
 	// these functions can be redefined in the derived classes, but don't have to be
 	virtual double surface_brightness_r(const double r);
 	virtual double surface_brightness(double x, double y);
+	void add_surface_brightness(const int npts, const double* xvals, const double* yvals, double* sb);
 
 	SB_ProfileName get_sbtype() { return sbtype; }
 	void get_center_coords(double &xc, double &yc) { xc=x_center; yc=y_center; }
+
+	// fit parameters (used when the source is fit with a parameterized surface brightness model)
+	void vary_parameters(const boolvector& vary_params_in);
+	void set_limits(const dvector& lower, const dvector& upper);
+	void set_limits(const dvector& lower, const dvector& upper, const dvector& lower_init, const dvector& upper_init);
+	bool get_limits(dvector& lower, dvector& upper, dvector& lower0, dvector& upper0, int &index);
+	void get_parameters(double* params);
+	void update_parameters(const double* params);
+	void get_fit_parameters(dvector& fitparams, int &index);
+	void update_fit_parameters(const double* fitparams, int &index, bool& status);
+	void get_fit_parameter_names(vector<string>& paramnames_vary, vector<string> *latex_paramnames_vary = NULL, vector<string> *latex_subscripts_vary = NULL);
+	void get_auto_stepsizes(dvector& stepsizes, int &index);
+	void get_auto_ranges(boolvector& use_penalty_limits, dvector& lower, dvector& upper, int &index);
+	void print_vary_parameters();
+	int get_n_params() { return n_params; }
+	int get_n_vary_params() { return n_vary_params; }
 };
 
 class Gaussian : public SB_Profile
@@ -62,6 +97,8 @@ class Gaussian : public SB_Profile
 	double max_sb, sig_x; // sig_x is the dispersion along the major axis
 
 	double sb_rsq(const double);
+	void assign_paramnames();
+	void assign_param_pointers();
 
 	public:
 	Gaussian() : SB_Profile() {}
@@ -80,6 +117,9 @@ class Sersic : public SB_Profile
 	double re; // effective radius
 
 	double sb_rsq(const double);
+	void assign_paramnames();
+	void assign_param_pointers();
+	void update_meta_parameters();
 
 	public:
 	Sersic() : SB_Profile() {}
@@ -97,6 +137,8 @@ class TopHat : public SB_Profile
 	double sb, rad; // sig_x is the dispersion along the major axis
 
 	double sb_rsq(const double);
+	void assign_paramnames();
+	void assign_param_pointers();
 
 	public:
 	TopHat() : SB_Profile() {}
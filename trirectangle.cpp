@@ -1,5 +1,6 @@
 #include <iostream>
 #include <iomanip>
+#include <cmath>
 #include "errors.h"
 #include "trirectangle.h"
 using namespace std;
@@ -15,6 +16,9 @@ TriRectangleOverlap::TriRectangleOverlap()
 	r02 = new lensvector;
 	n_overlap_pts = 0;
 	for (int i=0; i < 7; i++) { overlap_pts[i][0] = 0; overlap_pts[i][1] = 0; }
+	batch_capacity = 0;
+	batch_index = NULL;
+	rect_xmin = rect_xmax = rect_ymin = rect_ymax = rect_area = NULL;
 }
 
 double TriRectangleOverlap::find_overlap_area(lensvector& a, lensvector& b, lensvector& c, const double& xmin, const double& xmax, const double& ymin, const double& ymax)
@@ -413,9 +417,124 @@ bool TriRectangleOverlap::determine_if_overlap_rough(lensvector& a, lensvector&
 	return false;
 }
 
+void TriRectangleOverlap::set_batch_capacity(const int n)
+{
+	if (n <= batch_capacity) return;
+	if (batch_capacity > 0) {
+		delete[] batch_index;
+		delete[] rect_xmin;
+		delete[] rect_xmax;
+		delete[] rect_ymin;
+		delete[] rect_ymax;
+		delete[] rect_area;
+	}
+	batch_capacity = 2*n; // leave some room, so the buffers don't have to be reallocated every time a slightly bigger batch comes along
+	batch_index = new int[batch_capacity];
+	rect_xmin = new double[batch_capacity];
+	rect_xmax = new double[batch_capacity];
+	rect_ymin = new double[batch_capacity];
+	rect_ymax = new double[batch_capacity];
+	rect_area = new double[batch_capacity];
+}
+
+int TriRectangleOverlap::find_rectangles_near_triangle(lensvector& a, lensvector& b, lensvector& c, const int n_rectangles, const double *xmin, const double *xmax, const double *ymin, const double *ymax, int *indx)
+{
+	// Conservative rejection pass: keeps only the rectangles that overlap the triangle's bounding box, storing their indices
+	// in indx and returning how many there are. The test and the compaction are done without branching.
+	double txmin, txmax, tymin, tymax;
+	txmin = txmax = a[0];
+	tymin = tymax = a[1];
+	if (b[0] < txmin) txmin = b[0];
+	if (b[0] > txmax) txmax = b[0];
+	if (c[0] < txmin) txmin = c[0];
+	if (c[0] > txmax) txmax = c[0];
+	if (b[1] < tymin) tymin = b[1];
+	if (b[1] > tymax) tymax = b[1];
+	if (c[1] < tymin) tymin = c[1];
+	if (c[1] > tymax) tymax = c[1];
+	int k, n_near=0;
+	for (k=0; k < n_rectangles; k++) {
+		indx[n_near] = k;
+		n_near += ((xmax[k] > txmin) & (xmin[k] < txmax) & (ymax[k] > tymin) & (ymin[k] < tymax));
+	}
+	return n_near;
+}
+
+void TriRectangleOverlap::find_overlap_areas(lensvector& a, lensvector& b, lensvector& c, const int n_rectangles, const double *xmin, const double *xmax, const double *ymin, const double *ymax, double *areas, const bool add_to_areas)
+{
+	// Rather than the case-by-case treatment in find_overlap_area, here the triangle is clipped against each side of the
+	// rectangle in turn (Sutherland-Hodgman), which gives the vertices of the overlap polygon in order so its area follows
+	// directly. The clipping has a fixed structure and few branches, and there is no heap allocation per rectangle.
+	// If add_to_areas is true, the overlap areas are added to the existing values in 'areas' (e.g. to combine two triangles).
+	// The buffers are never reallocated here, since the rectangle arrays passed in may be rect_xmin etc. themselves; the
+	// caller must call set_batch_capacity beforehand with at least n_rectangles.
+	if (n_rectangles > batch_capacity) die("batch capacity (%i) is smaller than the number of rectangles (%i); call set_batch_capacity first",batch_capacity,n_rectangles);
+	double tx[3], ty[3];
+	tx[0] = a[0]; tx[1] = b[0]; tx[2] = c[0];
+	ty[0] = a[1]; ty[1] = b[1]; ty[2] = c[1];
+	int k;
+	if (!add_to_areas) {
+		for (k=0; k < n_rectangles; k++) areas[k] = 0;
+	}
+	int n_near = find_rectangles_near_triangle(a,b,c,n_rectangles,xmin,xmax,ymin,ymax,batch_index);
+	for (int l=0; l < n_near; l++) {
+		k = batch_index[l];
+		areas[k] += clipped_triangle_area(tx,ty,xmin[k],xmax[k],ymin[k],ymax[k]);
+	}
+}
+
+double TriRectangleOverlap::clipped_triangle_area(const double *tx, const double *ty, const double& xmin, const double& xmax, const double& ymin, const double& ymax)
+{
+	// each clip can add at most one vertex to a convex polygon, so the overlap normally has at most 7 vertices; the buffers
+	// are sized for the worst case (doubling at each clip) in case roundoff makes a nearly degenerate polygon slightly nonconvex
+	double px[48], py[48], qx[48], qy[48];
+	int n;
+	n = clip_polygon(tx,ty,3,qx,qy,xmin,1,true);
+	n = clip_polygon(qx,qy,n,px,py,xmax,-1,true);
+	n = clip_polygon(px,py,n,qx,qy,ymin,1,false);
+	n = clip_polygon(qx,qy,n,px,py,ymax,-1,false);
+	double area = 0;
+	for (int i=0, j=n-1; i < n; j=i++) area += px[j]*py[i] - px[i]*py[j];
+	return 0.5*abs(area);
+}
+
+inline int TriRectangleOverlap::clip_polygon(const double *px, const double *py, const int n, double *qx, double *qy, const double edge, const double sign, const bool clip_in_x)
+{
+	// Keeps the part of the polygon (px,py) for which sign*(coordinate - edge) >= 0, where the coordinate is x if clip_in_x is
+	// true (otherwise y). Each vertex and edge crossing is always written, but the output count only advances if it is kept.
+	const double *p = (clip_in_x) ? px : py;
+	double di, dj, denom, t;
+	bool in_i, in_j;
+	int i, j, m=0;
+	for (i=0; i < n; i++) {
+		j = (i+1 < n) ? i+1 : 0;
+		di = sign*(p[i]-edge);
+		dj = sign*(p[j]-edge);
+		in_i = (di >= 0);
+		in_j = (dj >= 0);
+		qx[m] = px[i];
+		qy[m] = py[i];
+		m += in_i;
+		denom = di - dj;
+		t = (in_i != in_j) ? di/denom : 0;
+		qx[m] = px[i] + t*(px[j]-px[i]);
+		qy[m] = py[i] + t*(py[j]-py[i]);
+		m += (in_i != in_j);
+	}
+	return m;
+}
+
 TriRectangleOverlap::~TriRectangleOverlap()
 {
 	delete r01;
 	delete r02;
+	if (batch_capacity > 0) {
+		delete[] batch_index;
+		delete[] rect_xmin;
+		delete[] rect_xmax;
+		delete[] rect_ymin;
+		delete[] rect_ymax;
+		delete[] rect_area;
+	}
 }
 
@@ -32,7 +32,12 @@ class TriRectangleOverlap
 	bool swapped1, swapped2;
 	lensvector **newlist;
 
+	int batch_capacity;
+	int *batch_index; // indices of the rectangles that pass the bounding box test in the batched routine
+
 	double calculate_polygon_area();
+	inline int clip_polygon(const double *px, const double *py, const int n, double *qx, double *qy, const double edge, const double sign, const bool clip_in_x);
+	double clipped_triangle_area(const double *tx, const double *ty, const double& xmin, const double& xmax, const double& ymin, const double& ymax);
 	inline bool test_if_inside(const double& x, const double& y);
 	inline double dif_cross_product(const double& x, const double& y, const lensvector* A, const lensvector* B);
 	inline bool test_if_in_xrange(const double& x, const double& y, const int& i_xmin, const int& i_xmax);
@@ -45,6 +50,14 @@ class TriRectangleOverlap
 	bool determine_if_overlap(lensvector& a, lensvector& b, lensvector& c, const double& xmin, const double& xmax, const double& ymin, const double& ymax);
 	bool determine_if_overlap_rough(lensvector& a, lensvector& b, lensvector& c, const double& xmin, const double& xmax, const double& ymin, const double& ymax);
 	bool determine_if_in_neighborhood(lensvector& a, lensvector& b, lensvector& c, lensvector& d, const double& xmin, const double& xmax, const double& ymin, const double& ymax, bool &inside);
+
+	// Batched version of find_overlap_area: overlap of one triangle with each of an array of rectangles. The rectangles are
+	// stored as separate coordinate arrays (rect_xmin etc. can be used for this). set_batch_capacity must be called with at
+	// least the number of rectangles before find_overlap_areas, which does not resize the buffers itself.
+	double *rect_xmin, *rect_xmax, *rect_ymin, *rect_ymax, *rect_area;
+	void set_batch_capacity(const int n);
+	int find_rectangles_near_triangle(lensvector& a, lensvector& b, lensvector& c, const int n_rectangles, const double *xmin, const double *xmax, const double *ymin, const double *ymax, int *indx);
+	void find_overlap_areas(lensvector& a, lensvector& b, lensvector& c, const int n_rectangles, const double *xmin, const double *xmax, const double *ymin, const double *ymax, double *areas, const bool add_to_areas = false);
 };
 
 #endif // TRIRECTANGLE_H